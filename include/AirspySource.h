@@ -46,6 +46,21 @@ public:
     /** Return device current center frequency in Hz. */
     virtual std::uint32_t get_frequency();
 
+    /** Set device center frequency in Hz while streaming. */
+    virtual bool set_frequency(std::uint32_t frequency);
+
+    /** Set device gains while streaming (same keys as configure()). */
+    virtual bool set_gain(const std::string& gains);
+
+    /** Get gain settings for software gain control. */
+    virtual bool get_gain_steps(std::vector<GainStep>& steps, std::size_t& current);
+
+    /** Return number of bits per device sample. */
+    virtual unsigned int get_sample_bits()
+    {
+        return 12;
+    }
+
     /** Print current parameters specific to device type */
     virtual void print_specific_parms();
 
@@ -88,7 +103,7 @@ private:
 
     void callback(const short* buf, int len);
     static int rx_callback(airspy_transfer_t* transfer);
-    static void run(airspy_device* dev, std::atomic_bool *stop_flag);
+    void run();
 
     struct airspy_device* m_dev;
     uint32_t m_sampleRate;
@@ -101,7 +116,7 @@ private:
     bool m_mixAGC;
     bool m_running;
     std::thread *m_thread;
-    static AirspySource *m_this;
+    bool m_libInit;
     static const std::vector<int> m_lgains;
     static const std::vector<int> m_mgains;
     static const std::vector<int> m_vgains;
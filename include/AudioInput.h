@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_AUDIOINPUT_H_
+#define INCLUDE_AUDIOINPUT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+
+
+/** Read single channel sample data from a .WAV file. */
+class WavAudioInput
+{
+public:
+
+    /**
+     * Open .WAV file and parse its header.
+     *
+     * Supported encodings are 16-bit integer PCM and 32-bit IEEE float.
+     * Only the first channel of multi-channel files is read.
+     *
+     * filename :: file name (including path)
+     */
+    WavAudioInput(const std::string& filename);
+
+    ~WavAudioInput();
+
+    /** Return sample rate in Hz. */
+    unsigned int get_sample_rate() const
+    {
+        return m_sample_rate;
+    }
+
+    /**
+     * Read up to nsamples samples (scaled such that full scale is 1.0).
+     *
+     * Return true on success (samples is empty at end of file).
+     * Return false if an error occurs.
+     */
+    bool read(SampleVector& samples, std::size_t nsamples);
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if the stream is OK, return false if there is an error. */
+    operator bool() const
+    {
+        return (!m_zombie) && m_error.empty();
+    }
+
+private:
+    /** Parse RIFF header up to the start of the data chunk. */
+    bool read_header();
+
+    std::string m_error;
+    bool        m_zombie;
+    std::FILE   *m_stream;
+    unsigned int m_sample_rate;
+    unsigned int m_channels;
+    unsigned int m_bytes_per_sample;
+    bool        m_float32;
+    std::uint64_t m_remaining;
+    std::vector<std::uint8_t> m_bytebuf;
+
+    WavAudioInput(const WavAudioInput&);            // no copy constructor
+    WavAudioInput& operator=(const WavAudioInput&); // no assignment operator
+};
+
+#endif /* INCLUDE_AUDIOINPUT_H_ */
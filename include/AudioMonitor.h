@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_AUDIOMONITOR_H_
+#define INCLUDE_AUDIOMONITOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+
+
+/**
+ * Dead-air, clipping and channel balance monitor for decoded audio.
+ *
+ * The measurements are made in the same pass over the samples that
+ * applies the output gain, so monitoring costs no extra pass. State
+ * changes are reported as JSON event lines.
+ */
+class AudioMonitor
+{
+public:
+    static constexpr double default_silence_db   = -50;
+    static constexpr double default_silence_time =   5;
+    static constexpr double default_imbalance_db =   6;
+    static constexpr double imbalance_time       =   5;
+
+    /** Audio statistics. */
+    struct Stats
+    {
+        double          mean;           // mean of the last block before gain
+        double          rms;            // RMS of the last block before gain
+        double          peak;           // peak |sample| of the last block, 1.0 = full scale
+        std::uint64_t   clipped;        // samples at or beyond full scale since start
+        double          silence;        // duration of the current silence in seconds
+        double          imbalance_db;   // left over right level in dB (averaged)
+    };
+
+    /**
+     * Construct audio monitor.
+     *
+     * sample_rate  :: audio sample rate in Hz
+     * stereo       :: true for interleaved left/right samples
+     * silence_db   :: silence threshold in dB (as the audio level in the status line)
+     * silence_time :: report silence after this many seconds
+     * imbalance_db :: report a left/right level difference above this many dB
+     */
+    AudioMonitor(double sample_rate,
+                 bool stereo,
+                 double silence_db=default_silence_db,
+                 double silence_time=default_silence_time,
+                 double imbalance_db=default_imbalance_db);
+
+    /**
+     * Multiply samples in place by gain and measure them in the same pass.
+     * Peak and clipping refer to the samples after gain.
+     */
+    void process(SampleVector& samples, double gain);
+
+    /** Return statistics. */
+    const Stats& get_stats() const
+    {
+        return m_stats;
+    }
+
+    /** Return true while audio is silent for at least silence_time. */
+    bool silent() const
+    {
+        return m_silent;
+    }
+
+    /** Return JSON event lines raised by the most recent block. */
+    const std::vector<std::string>& get_events() const
+    {
+        return m_events;
+    }
+
+private:
+    const double    m_sample_rate;
+    const bool      m_stereo;
+    const double    m_silence_db;
+    const double    m_silence_time;
+    const double    m_imbalance_db;
+
+    Stats           m_stats;
+    bool            m_silent;
+    bool            m_imbalanced;
+    double          m_imbalance_duration;
+    double          m_clip_time;
+    std::uint64_t   m_clip_count;
+    double          m_clip_peak;
+    std::vector<std::string> m_events;
+};
+
+#endif /* INCLUDE_AUDIOMONITOR_H_ */
@@ -65,6 +65,10 @@ protected:
     static void samplesToInt16(const SampleVector& samples,
                                std::vector<std::uint8_t>& bytes);
 
+    /** Encode a list of samples as 32-bit little-endian floats. */
+    static void samplesToFloat32(const SampleVector& samples,
+                                 std::vector<std::uint8_t>& bytes);
+
     std::string m_error;
     bool        m_zombie;
 
@@ -74,7 +78,7 @@ private:
 };
 
 
-/** Write audio data as raw signed 16-bit little-endian data. */
+/** Write audio data as raw signed 16-bit or float little-endian data. */
 class RawAudioOutput : public AudioOutput
 {
 public:
@@ -83,13 +87,15 @@ public:
      * Construct raw audio writer.
      *
      * filename :: file name (including path) or "-" to write to stdout
+     * float32  :: true to write 32-bit floats instead of 16-bit integers
      */
-    RawAudioOutput(const std::string& filename);
+    RawAudioOutput(const std::string& filename, bool float32=false);
 
     ~RawAudioOutput();
     bool write(const SampleVector& samples);
 
 private:
+    const bool m_float32;
     int m_fd;
     std::vector<std::uint8_t> m_bytebuf;
 };
@@ -106,10 +112,12 @@ public:
      * filename     :: file name (including path) or "-" to write to stdout
      * samplerate   :: audio sample rate in Hz
      * stereo       :: true if the output stream contains stereo data
+     * float32      :: true to write 32-bit float instead of 16-bit samples
      */
     WavAudioOutput(const std::string& filename,
                    unsigned int samplerate,
-                   bool stereo);
+                   bool stereo,
+                   bool float32=false);
 
     ~WavAudioOutput();
     bool write(const SampleVector& samples);
@@ -126,6 +134,7 @@ private:
 
     const unsigned numberOfChannels;
     const unsigned sampleRate;
+    const bool     m_float32;
     std::FILE *m_stream;
     std::vector<std::uint8_t> m_bytebuf;
 };
@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_BANDSCANNER_H_
+#define INCLUDE_BANDSCANNER_H_
+
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+
+
+/**
+ * Station found by a band scan: carrier frequency in Hz, channel power
+ * in dB (full scale IQ signal is 0 dB), stereo pilot presence and RDS
+ * program identification (-1 if unknown).
+ */
+struct StationInfo
+{
+    double  frequency;
+    double  level;
+    bool    pilot;
+    int     pi;
+};
+
+
+/** Station index file written by a band scan. */
+class StationIndex
+{
+public:
+
+    /** Load station index from text file. Return false on error. */
+    bool load(const std::string& filename);
+
+    /** Save station index to text file. Return false on error. */
+    bool save(const std::string& filename);
+
+    /** Add station, keeping the index sorted by frequency. */
+    void add(const StationInfo& station);
+
+    /** Return all stations, sorted by frequency. */
+    const std::vector<StationInfo>& stations() const
+    {
+        return m_stations;
+    }
+
+    /** Return strongest station, or NULL if the index is empty. */
+    const StationInfo *strongest() const;
+
+    /**
+     * Return the center frequency of a window of the given width that
+     * covers the largest number of stations (0 if the index is empty).
+     */
+    double best_center(double width) const;
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+private:
+    std::vector<StationInfo> m_stations;
+    std::string              m_error;
+};
+
+
+/**
+ * FFT power spectrum estimator and carrier detector for one tuner window.
+ *
+ * Spectra of consecutive frames are averaged. The channel power is the
+ * sum of the bins within the FM channel, the noise floor is estimated
+ * from a low percentile of all bins in the usable bandwidth.
+ */
+class BandScanner
+{
+public:
+    static constexpr double channel_step       = 100000;
+    static constexpr double channel_halfwidth  =  80000;
+    static constexpr double default_threshold  =     10;
+
+    /**
+     * Construct band scanner.
+     *
+     * sample_rate      :: IQ sample rate in Hz
+     * threshold        :: Minimum channel power above noise floor in dB
+     */
+    BandScanner(double sample_rate, double threshold=default_threshold);
+
+    /** Clear averaged spectrum (after retuning). */
+    void reset();
+
+    /** Add IQ samples to the averaged spectrum. */
+    void process(const IQSampleVector& samples_in);
+
+    /**
+     * Detect carriers on the channel raster within the usable bandwidth.
+     *
+     * center_freq      :: Tuner center frequency in Hz
+     * min_freq         :: Lowest channel frequency in Hz
+     * max_freq         :: Highest channel frequency in Hz
+     *
+     * Return detected stations with pilot = false and pi = -1.
+     */
+    std::vector<StationInfo> find_carriers(double center_freq,
+                                           double min_freq,
+                                           double max_freq) const;
+
+    /** Return half the usable bandwidth in Hz for channel centers. */
+    double get_usable_span() const;
+
+    /** Return channel power in dB at the given offset from the tuner. */
+    double channel_level(double offset) const;
+
+private:
+    const double        m_sample_rate;
+    const double        m_threshold;
+    const unsigned int  m_fft_size;
+    std::vector<float>  m_window;
+    std::vector<double> m_power;
+    unsigned int        m_frames;
+    IQSampleVector      m_pending;
+    IQSampleVector      m_buf_fft;
+};
+
+#endif /* INCLUDE_BANDSCANNER_H_ */
@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_BATCHDECODER_H_
+#define INCLUDE_BATCHDECODER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+#include "FmDecode.h"
+#include "IQArchive.h"
+#include "IQConverter.h"
+
+
+/**
+ * Parallel offline decoder for IQ archive files.
+ *
+ * The recording is split into chunks that are decoded on several worker
+ * threads, each with its own FmDecoder and archive reader. Every chunk
+ * starts decoding a warm-up interval before its first sample, so filters,
+ * pilot PLL and RDS are settled when its output begins; the output of the
+ * warm-up is discarded. Chunk boundaries are aligned such that the audio
+ * resamplers are in the same phase as in a sequential decode, so the
+ * stitched output has exactly the same samples as the sequential output
+ * and differs only by the residue of the decoder start-up.
+ */
+class BatchDecoder
+{
+public:
+
+    /** Number of IF samples per call to FmDecoder::process(). */
+    static const unsigned int block_length = 65536;
+
+    /** Decoded output of one chunk. */
+    struct Chunk
+    {
+        unsigned int                index;
+        SampleVector                audio;
+        std::vector<std::string>    rds_events;
+    };
+
+    /** Create a new decoder, configured like the sequential decoder. */
+    typedef std::function<FmDecoder*()> DecoderFactory;
+
+    /** Receive decoded chunks in order; return false to abort. */
+    typedef std::function<bool(const Chunk&)> ChunkHandler;
+
+    /**
+     * Prepare batch decoding.
+     *
+     * filename       :: IQ archive file
+     * start, end     :: range of sample indices to decode
+     * chunk_length   :: IF samples per chunk
+     * warmup_length  :: IF samples decoded and discarded before each chunk
+     * align          :: chunk alignment in IF samples (see alignment());
+     *                   chunk and warm-up length are rounded up to multiples
+     * channels       :: audio channels per sample frame (1 or 2)
+     * factory        :: creates the FmDecoder for each chunk
+     */
+    BatchDecoder(const std::string& filename,
+                 std::uint64_t start,
+                 std::uint64_t end,
+                 std::uint64_t chunk_length,
+                 std::uint64_t warmup_length,
+                 std::uint64_t align,
+                 unsigned int channels,
+                 DecoderFactory factory);
+
+    /**
+     * Return the chunk alignment in IF samples: the shortest interval
+     * after which the baseband and audio resamplers of an FmDecoder are
+     * back in the same phase.
+     */
+    static std::uint64_t alignment(std::uint32_t sample_rate_if,
+                                   std::uint32_t sample_rate_pcm,
+                                   unsigned int downsample);
+
+    /** Return the number of chunks. */
+    unsigned int num_chunks() const
+    {
+        return (m_end - m_start + m_chunk_length - 1) / m_chunk_length;
+    }
+
+    /**
+     * Decode all chunks on nthreads worker threads. The handler is called
+     * for each chunk in order from the calling thread. Decoding stops when
+     * stop_flag is set. Return false on error, abort or stop.
+     */
+    bool run(unsigned int nthreads,
+             ChunkHandler handler,
+             const std::atomic_bool *stop_flag);
+
+    /**
+     * Decode the whole range sequentially with a single decoder, as a
+     * reference for run(). The output is passed to the handler in the
+     * same chunks. Return false on error, abort or stop.
+     */
+    bool run_sequential(ChunkHandler handler,
+                        const std::atomic_bool *stop_flag);
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if the decoder is OK, return false if there is an error. */
+    operator bool() const
+    {
+        return m_error.empty();
+    }
+
+private:
+    /**
+     * Decode samples [begin, end) of the archive and return the output
+     * of samples [keep, end) in chunk. Samples are corrected with iqconv
+     * as in live replay. Prime the decoder on its first block if prime
+     * is true. Return false on error.
+     */
+    bool decode_range(FmDecoder& fm,
+                      IQConverter& iqconv,
+                      IQArchiveReader& reader,
+                      std::uint64_t begin,
+                      std::uint64_t keep,
+                      std::uint64_t end,
+                      bool prime,
+                      const std::atomic_bool *stop_flag,
+                      Chunk& chunk,
+                      std::string& error);
+
+    std::string         m_error;
+    std::string         m_filename;
+    std::uint64_t       m_start;
+    std::uint64_t       m_end;
+    std::uint64_t       m_chunk_length;
+    std::uint64_t       m_warmup_length;
+    unsigned int        m_channels;
+    DecoderFactory      m_factory;
+};
+
+#endif /* INCLUDE_BATCHDECODER_H_ */
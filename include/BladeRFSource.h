@@ -45,6 +45,21 @@ public:
     /** Return device current center frequency in Hz. */
     virtual std::uint32_t get_frequency();
 
+    /** Set device center frequency in Hz while streaming. */
+    virtual bool set_frequency(std::uint32_t frequency);
+
+    /** Set device gains while streaming (same keys as configure()). */
+    virtual bool set_gain(const std::string& gains);
+
+    /** Get gain settings for software gain control. */
+    virtual bool get_gain_steps(std::vector<GainStep>& steps, std::size_t& current);
+
+    /** Return number of bits per device sample. */
+    virtual unsigned int get_sample_bits()
+    {
+        return 12;
+    }
+
     /** Print current parameters specific to device type */
     virtual void print_specific_parms();
 
@@ -86,9 +101,10 @@ private:
      * This function must be called regularly to maintain streaming.
      * Return true for success, false if an error occurred.
      */
-    static bool get_samples(IQSampleVector *samples);
+    bool get_samples(IQSampleVector *samples);
 
-    static void run();
+    /** Read samples from the device and push them to the buffer. */
+    void run();
 
     struct bladerf *m_dev;
     uint32_t m_sampleRate;
@@ -101,8 +117,8 @@ private:
     int m_vga1Gain;
     int m_vga2Gain;
     std::thread *m_thread;
+    uint64_t m_nextTimestamp;
     static const int m_blockSize = 1<<14;
-    static BladeRFSource *m_this;
     static const std::vector<int> m_lnaGains;
     static const std::vector<int> m_vga1Gains;
     static const std::vector<int> m_vga2Gains;
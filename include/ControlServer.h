@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_CONTROLSERVER_H_
+#define INCLUDE_CONTROLSERVER_H_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Runtime control interface on a local Unix stream socket.
+ *
+ * Clients send one command per line. A background thread accepts
+ * connections and collects complete lines; the main loop fetches them
+ * between blocks with pull_commands(), executes them and answers with
+ * reply(). Replies are written by the background thread without
+ * blocking, so neither loop waits for a slow client. A client that does
+ * not read its replies is disconnected once max_backlog bytes are pending.
+ */
+class ControlServer
+{
+public:
+    static const unsigned int max_clients = 8;
+    static const unsigned int max_line_length = 1024;
+    static const unsigned int max_backlog = 65536;
+    static const unsigned int all_clients = ~0u;
+
+    /** Command line received from a client. */
+    struct Command
+    {
+        unsigned int    client;
+        std::string     line;
+    };
+
+    /**
+     * Create socket and start server thread.
+     *
+     * path :: file system path of the Unix socket (replaced if it exists)
+     */
+    explicit ControlServer(const std::string& path);
+
+    /** Stop server thread, close connections and remove the socket. */
+    ~ControlServer();
+
+    /** Return commands received since the last call (never blocks). */
+    std::vector<Command> pull_commands();
+
+    /** Send a reply line to the client that sent the command. */
+    void reply(const Command& cmd, const std::string& text);
+
+    /** Send an event line to all connected clients. */
+    void notify(const std::string& text);
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if the server is OK, return false if there is an error. */
+    operator bool() const
+    {
+        return (!m_zombie) && m_error.empty();
+    }
+
+private:
+    /** Accept clients, read command lines and write replies. */
+    void run();
+
+    /** Queue replies for their clients and write as much as possible. */
+    void send_replies();
+
+    struct Client
+    {
+        int             fd;
+        std::string     inbuf;
+        std::string     outbuf;
+    };
+
+    const std::string   m_path;
+    std::string         m_error;
+    bool                m_zombie;
+    int                 m_listen_fd;
+    int                 m_wake_pipe[2];
+    unsigned int        m_next_client;
+    std::map<unsigned int, Client>  m_clients;
+
+    std::mutex          m_mutex;
+    std::vector<Command>    m_commands;
+    std::vector<Command>    m_replies;
+
+    std::atomic_bool    m_stop;
+    std::thread         m_thread;
+
+    ControlServer(const ControlServer&);            // no copy constructor
+    ControlServer& operator=(const ControlServer&); // no assignment operator
+};
+
+#endif /* INCLUDE_CONTROLSERVER_H_ */
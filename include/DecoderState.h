@@ -0,0 +1,137 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_DECODERSTATE_H_
+#define INCLUDE_DECODERSTATE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "SoftFM.h"
+
+
+/**
+ * Binary serialization of decoder state.
+ *
+ * Values are stored in native byte order and floating point format;
+ * a state can be restored on the same kind of machine only (another
+ * thread, process or a later run), which is what snapshots are for.
+ */
+class StateWriter
+{
+public:
+    /** Append a plain value. */
+    template <typename T>
+    void put(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "StateWriter::put needs a trivially copyable type");
+        const std::uint8_t *p = reinterpret_cast<const std::uint8_t*>(&value);
+        m_data.insert(m_data.end(), p, p + sizeof(T));
+    }
+
+    /** Append a vector of samples, preceded by its length. */
+    void put(const SampleVector& samples);
+
+    /** Append a vector of IQ samples, preceded by its length. */
+    void put(const IQSampleVector& samples);
+
+    /** Append a string, preceded by its length. */
+    void put(const std::string& str);
+
+    /** Return serialized state. */
+    const std::vector<std::uint8_t>& data() const
+    {
+        return m_data;
+    }
+
+private:
+    std::vector<std::uint8_t> m_data;
+};
+
+
+/**
+ * Read back state written by StateWriter.
+ *
+ * Reading past the end, or a vector with a length that does not match
+ * the receiving object, puts the reader in error state; later reads then
+ * leave their targets unchanged.
+ */
+class StateReader
+{
+public:
+    explicit StateReader(const std::vector<std::uint8_t>& data)
+        : m_data(data)
+        , m_pos(0)
+        , m_ok(true)
+    { }
+
+    /** Read a plain value. */
+    template <typename T>
+    void get(T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "StateReader::get needs a trivially copyable type");
+        if (!m_ok || m_data.size() - m_pos < sizeof(T)) {
+            m_ok = false;
+            return;
+        }
+        memcpy(&value, m_data.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+    }
+
+    /**
+     * Read a vector of samples.
+     *
+     * resize :: false if the stored length must equal samples.size()
+     *           (filter histories), true to accept any length.
+     */
+    void get(SampleVector& samples, bool resize=false);
+
+    /** Read a vector of IQ samples (see above). */
+    void get(IQSampleVector& samples, bool resize=false);
+
+    /** Read a string. */
+    void get(std::string& str);
+
+    /** Return true if all data was read without error. */
+    bool at_end() const
+    {
+        return m_ok && m_pos == m_data.size();
+    }
+
+    /** Return true if no error occurred. */
+    operator bool() const
+    {
+        return m_ok;
+    }
+
+private:
+    /** Read a vector length and check it, or resize the vector. */
+    template <typename V>
+    bool get_length(V& samples, bool resize);
+
+    const std::vector<std::uint8_t>& m_data;
+    std::size_t m_pos;
+    bool        m_ok;
+};
+
+#endif
@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_DEVICEGROUP_H_
+#define INCLUDE_DEVICEGROUP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+#include "DataBuffer.h"
+#include "Source.h"
+
+
+/**
+ * Several devices presented as one logical band.
+ *
+ * For example two RTL-SDR dongles tuned to adjacent slices of the FM
+ * band. Each device streams into its own buffer from its own thread,
+ * where its samples are also converted, and keeps its own count of
+ * dropped samples.
+ */
+class DeviceGroup
+{
+public:
+    DeviceGroup();
+
+    /** Stop all devices. */
+    ~DeviceGroup();
+
+    /** Add a configured device; the group takes ownership. */
+    void add(Source *source);
+
+    /** Return number of devices. */
+    std::size_t size() const
+    {
+        return m_devices.size();
+    }
+
+    /** Return device i. */
+    Source& get_source(std::size_t i)
+    {
+        return *m_devices[i]->source;
+    }
+
+    /** Return sample buffer of device i. */
+    DataBuffer<IQSample>& get_buffer(std::size_t i)
+    {
+        return m_devices[i]->buffer;
+    }
+
+    /** Start streaming on all devices. */
+    bool start(std::atomic_bool *stop_flag);
+
+    /** Stop streaming on all devices (set the stop flag first). */
+    void stop();
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+private:
+    struct Device
+    {
+        std::unique_ptr<Source> source;
+        DataBuffer<IQSample>    buffer;
+        bool                    started;
+    };
+
+    std::vector<std::unique_ptr<Device> > m_devices;
+    std::string         m_error;
+
+    DeviceGroup(const DeviceGroup&);            // no copy constructor
+    DeviceGroup& operator=(const DeviceGroup&); // no assignment operator
+};
+
+#endif /* INCLUDE_DEVICEGROUP_H_ */
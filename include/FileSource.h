@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_FILESOURCE_H_
+#define INCLUDE_FILESOURCE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+
+#include "Source.h"
+#include "IQArchive.h"
+
+/** Replay device IQ samples from an archive file (see IQArchiveCodec). */
+class FileSource : public Source
+{
+public:
+
+    static const int default_block_length = 65536;
+
+    /** Construct file source. The file is opened by configure(). */
+    FileSource();
+
+    virtual ~FileSource();
+
+    virtual bool configure(std::string configuration);
+
+    /** Return current sample frequency in Hz. */
+    virtual std::uint32_t get_sample_rate();
+
+    /** Return device center frequency of the recording in Hz. */
+    virtual std::uint32_t get_frequency();
+
+    /** Return number of bits per device sample of the recording. */
+    virtual unsigned int get_sample_bits();
+
+    /** Return file name of the recording. */
+    const std::string& get_filename() const
+    {
+        return m_filename;
+    }
+
+    /** Return index of the first sample to replay (start= option). */
+    std::uint64_t get_start_index() const
+    {
+        return m_reader ? m_reader->position() : 0;
+    }
+
+    /** Return total number of samples in the recording. */
+    std::uint64_t get_num_samples() const
+    {
+        return m_reader ? m_reader->num_samples() : 0;
+    }
+
+    /** Print current parameters specific to device type */
+    virtual void print_specific_parms();
+
+    virtual bool start(DataBuffer<IQSample> *buf, std::atomic_bool *stop_flag);
+    virtual bool stop();
+
+    /** Return true if the device is OK, return false if there is an error. */
+    virtual operator bool() const
+    {
+        return m_error.empty();
+    }
+
+    /** Return a list of supported devices. */
+    static void get_device_names(std::vector<std::string>& devices);
+
+private:
+    /** Read samples from file and push them to the buffer. */
+    void run();
+
+    std::unique_ptr<IQArchiveReader> m_reader;
+    std::string         m_filename;
+    double              m_start;
+    bool                m_realtime;
+    unsigned int        m_block_length;
+    std::thread         *m_thread;
+};
+
+#endif /* INCLUDE_FILESOURCE_H_ */
@@ -22,6 +22,9 @@
 #include <vector>
 #include "SoftFM.h"
 
+class StateWriter;
+class StateReader;
+
 
 /** Fine tuner which shifts the frequency of an IQ signal by a fixed offset. */
 class FineTuner
@@ -40,7 +43,20 @@ public:
     FineTuner(unsigned int table_size, int freq_shift);
 
     /** Process samples. */
-    void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+    void process(const IQSampleVector& samples_in, IQSampleVector& samples_out)
+    {
+        process(samples_in.data(), samples_in.size(), samples_out);
+    }
+
+    /** Process n samples from caller memory. */
+    void process(const IQSample *samples_in, unsigned int n,
+                 IQSampleVector& samples_out);
+
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
 
 private:
     unsigned int    m_index;
@@ -65,12 +81,67 @@ public:
     /** Process samples. */
     void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
 
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
 private:
     std::vector<IQSample::value_type> m_coeff;
     IQSampleVector  m_state;
 };
 
 
+/**
+ *  Downsampler with low-pass FIR filter for IQ samples.
+ *
+ *  Step 1: Low-pass filter based on Lanczos FIR filter
+ *  Step 2: Decimation by an integer factor
+ *
+ *  Only the retained output samples are computed.
+ */
+class DownsampleFilterIQ
+{
+public:
+
+    /**
+     * Construct low-pass filter with integer downsampling.
+     *
+     * filter_order :: FIR filter order.
+     * cutoff       :: Cutoff frequency relative to the full input sample rate
+     *                 (valid range 0.0 .. 0.5)
+     * downsample   :: Integer decimation factor (>= 1)
+     *
+     * The output sample rate is (input_sample_rate / downsample)
+     */
+    DownsampleFilterIQ(unsigned int filter_order, double cutoff,
+                       unsigned int downsample);
+
+    /** Process samples. */
+    void process(const IQSampleVector& samples_in, IQSampleVector& samples_out)
+    {
+        process(samples_in.data(), samples_in.size(), samples_out);
+    }
+
+    /** Process n samples from caller memory. */
+    void process(const IQSample *samples_in, unsigned int n,
+                 IQSampleVector& samples_out);
+
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
+private:
+    unsigned int    m_downsample;
+    unsigned int    m_pos;
+    std::vector<IQSample::value_type> m_coeff;
+    IQSampleVector  m_state;
+};
+
+
 /**
  *  Downsampler with low-pass FIR filter for real-valued signals.
  *
@@ -99,7 +170,34 @@ public:
     /** Process samples. */
     void process(const SampleVector& samples_in, SampleVector& samples_out);
 
+    /**
+     * Advance the filter as process() would, without computing output.
+     *
+     * Afterwards the filter is in exactly the state that process() leaves,
+     * so output continues seamlessly. Only the last filter_order() input
+     * samples are read; the others need not be valid.
+     */
+    void skip(const SampleVector& samples_in);
+
+    /** Clear the filter history, keeping the output sample position. */
+    void clear_history();
+
+    /** Return the number of input samples kept as filter history. */
+    unsigned int filter_order() const
+    {
+        return m_state.size();
+    }
+
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
 private:
+    /** Keep the last input samples as filter history. */
+    void update_state(const SampleVector& samples_in);
+
     double          m_downsample;
     unsigned int    m_downsample_int;
     unsigned int    m_pos_int;
@@ -133,6 +231,12 @@ public:
     /** Process interleaved samples in-place. */
     void process_interleaved_inplace(SampleVector& samples);
 
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
 private:
     double  m_timeconst;
     Sample  m_a1;
@@ -158,6 +262,12 @@ public:
     /** Process samples. */
     void process(const SampleVector& samples_in, SampleVector& samples_out);
 
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
 private:
     Sample  b0, a1, a2, a3, a4;
     Sample  y1, y2, y3, y4;
@@ -183,9 +293,51 @@ public:
     /** Process samples in-place. */
     void process_inplace(SampleVector& samples);
 
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
 private:
     Sample b0, b1, b2, a1, a2;
     Sample x1, x2, y1, y2;
 };
 
+/**
+ * Power of a real-valued signal at a few fixed frequencies.
+ *
+ * Each block is weighted with a Hann window and run through one Goertzel
+ * resonator per frequency, in a single pass over the samples. This costs
+ * a few multiplications per sample and frequency, much less than a full
+ * spectrum when only some bins are of interest.
+ */
+class GoertzelProbe
+{
+public:
+
+    /**
+     * Construct probe.
+     *
+     * freqs    :: Frequencies relative to the sample frequency
+     *             (valid range 0.0 .. 0.5)
+     */
+    explicit GoertzelProbe(const std::vector<double>& freqs);
+
+    /**
+     * Measure one block of samples.
+     *
+     * Return in power[k] the power at freqs[k], normalized to the window
+     * energy: white noise of variance v gives v in every bin, a tone of
+     * amplitude a gives about a*a*n/6 for a block of n samples.
+     */
+    void process(const SampleVector& samples, std::vector<double>& power);
+
+private:
+    std::vector<double> m_coeff;
+    std::vector<double> m_state;
+    SampleVector        m_window;
+    double              m_window_energy;
+};
+
 #endif
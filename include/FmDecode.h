@@ -22,8 +22,11 @@
 #include <cstdint>
 #include <vector>
 
+#include <memory>
+
 #include "SoftFM.h"
 #include "Filter.h"
+#include "RdsDecoder.h"
 
 
 /* Detect frequency by phase discrimination between successive samples. */
@@ -44,7 +47,20 @@ public:
      * Output is a sequence of frequency estimates, scaled such that
      * output value +/- 1.0 represents the maximum frequency deviation.
      */
-    void process(const IQSampleVector& samples_in, SampleVector& samples_out);
+    void process(const IQSampleVector& samples_in, SampleVector& samples_out)
+    {
+        process(samples_in.data(), samples_in.size(), samples_out);
+    }
+
+    /** Process n samples from caller memory. */
+    void process(const IQSample *samples_in, unsigned int n,
+                 SampleVector& samples_out);
+
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
 
 private:
     const Sample m_freq_scale_factor;
@@ -69,6 +85,14 @@ public:
         double          block_position;
     };
 
+    /** Counters of the PPS generator. */
+    struct PpsCounters
+    {
+        int             pilot_periods;
+        std::uint64_t   pps_cnt;
+        std::uint64_t   sample_cnt;
+    };
+
     /**
      * Construct phase-locked loop.
      *
@@ -82,8 +106,11 @@ public:
     /**
      * Process samples and extract 19 kHz pilot tone.
      * Generate phase-locked 38 kHz tone with unit amplitude.
+     * If samples_57k is not NULL, also generate a phase-locked
+     * 57 kHz unit phasor (for the RDS subcarrier).
      */
-    void process(const SampleVector& samples_in, SampleVector& samples_out);
+    void process(const SampleVector& samples_in, SampleVector& samples_out,
+                 IQSampleVector *samples_57k=NULL);
 
     /** Return true if the phase-locked loop is locked. */
     bool locked() const
@@ -103,6 +130,27 @@ public:
         return m_pps_events;
     }
 
+    /** Return the counters of the PPS generator. */
+    PpsCounters get_pps_counters() const
+    {
+        return PpsCounters{m_pilot_periods, m_pps_cnt, m_sample_cnt};
+    }
+
+    /** Restore PPS counters and drop pending PPS events. */
+    void set_pps_counters(const PpsCounters& counters)
+    {
+        m_pilot_periods = counters.pilot_periods;
+        m_pps_cnt       = counters.pps_cnt;
+        m_sample_cnt    = counters.sample_cnt;
+        m_pps_events.clear();
+    }
+
+    /** Save internal state. */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
 private:
     Sample  m_minfreq, m_maxfreq;
     Sample  m_phasor_b0, m_phasor_a1, m_phasor_a2;
@@ -130,6 +178,29 @@ public:
     static constexpr double default_freq_dev      =  75000;
     static constexpr double default_bandwidth_pcm =  15000;
     static constexpr double pilot_freq            =  19000;
+    static constexpr double default_squelch_noise =    -25;
+    static constexpr double squelch_hysteresis    =      3;
+    static constexpr double squelch_hang_time     =    0.2;
+
+    /** Signal quality measured on the composite baseband signal. */
+    struct Quality
+    {
+        double  pilot_db;       // stereo pilot amplitude in dB (nominal -20 dB)
+        double  guard_db;       // noise density in the 16 - 18 kHz guard band in dB/Hz
+        double  pilot_snr;      // pilot power over guard band noise in dB-Hz
+        double  rds_db;         // density at 57 +- 1 kHz (RDS subcarrier) in dB/Hz
+        double  ultrasonic_db;  // noise density above the RDS band in dB/Hz
+    };
+
+    /**
+     * Return the largest distance in Hz between a station and the tuner
+     * frequency at which the channel still fits the usable IF band.
+     * Band scans, RDS monitoring, tuning and srate=auto all use this rule.
+     */
+    static double max_tuning_offset(double sample_rate_if)
+    {
+        return 0.45 * sample_rate_if - default_bandwidth_if;
+    }
 
     /**
      * Construct FM decoder.
@@ -139,7 +210,9 @@ public:
      *                     to receiver LO frequency (positive value means
      *                     station is at higher frequency than LO).
      * sample_rate_pcm  :: Audio sample rate.
-     * stereo           :: True to enable stereo decoding.
+     * stereo           :: True to enable stereo decoding. Without stereo
+     *                     the mono audio is decimated in two cheaper
+     *                     stages instead of one filter at baseband rate.
      * deemphasis       :: Time constant of de-emphasis filter in microseconds
      *                     (50 us for broadcast FM, 0 to disable de-emphasis).
      * bandwidth_if     :: Half bandwidth of IF signal in Hz
@@ -170,8 +243,106 @@ public:
      * vector only contains samples for one channel.
      */
     void process(const IQSampleVector& samples_in,
+                 SampleVector& audio)
+    {
+        process(samples_in.data(), samples_in.size(), audio);
+    }
+
+    /** Process n IQ samples read directly from caller memory. */
+    void process(const IQSample *samples_in, unsigned int n,
                  SampleVector& audio);
 
+    /**
+     * Prepare the decoder for the first block of IQ samples.
+     *
+     * Filter histories, the pilot PLL and the level estimators are warmed
+     * up with a time-mirrored copy of the start of the block, so the first
+     * call to process() does not produce a start-up transient.
+     * Call this once with the first block, then process it as usual.
+     *
+     * Return the number of audio samples (per channel) at the start of
+     * the next output that cover the filter group delay and should be
+     * dropped to align the output with the input.
+     */
+    unsigned int prime(const IQSampleVector& samples_in)
+    {
+        return prime(samples_in.data(), samples_in.size());
+    }
+
+    /** Prepare the decoder from n IQ samples in caller memory. */
+    unsigned int prime(const IQSample *samples_in, unsigned int n);
+
+    /**
+     * Process composite baseband (MPX) samples and return audio samples.
+     *
+     * This runs only the stages after FM demodulation (pilot PLL, stereo
+     * demodulation, audio resampling and de-emphasis). The input must be
+     * sampled at the baseband rate (sample_rate_if / downsample) and
+     * scaled such that 1.0 represents the full frequency deviation.
+     * Output is the same as for process().
+     */
+    void process_baseband(const SampleVector& samples_baseband,
+                          SampleVector& audio);
+
+    /**
+     * Enable carrier squelch.
+     *
+     * level_db         :: Minimum IF level in dB (as get_if_level())
+     * noise_db         :: Maximum baseband noise above 60 kHz in dB
+     *                     relative to full deviation
+     *
+     * The IF level is checked right after the IF filter. While the
+     * squelch is closed all later stages are bypassed and process()
+     * returns silence with the normal number of audio samples.
+     * The squelch opens on the first block that passes both checks and
+     * closes after squelch_hang_time seconds below the thresholds minus
+     * squelch_hysteresis dB. If the squelch is already enabled, only the
+     * thresholds change and the open/hang state is kept.
+     */
+    void set_squelch(double level_db, double noise_db=default_squelch_noise);
+
+    /** Disable carrier squelch. */
+    void disable_squelch();
+
+    /**
+     * Change the tuning offset (in Hz, as in the constructor) while
+     * keeping all filter states.
+     */
+    void set_tuning_offset(double tuning_offset);
+
+    /**
+     * Enable or disable stereo decoding at runtime. The output keeps its
+     * channel layout; with stereo disabled both channels carry the mono
+     * signal. Return false if stereo is requested from a mono decoder.
+     */
+    bool set_stereo(bool stereo);
+
+    /**
+     * Skip stereo demodulation while the pilot is not locked.
+     *
+     * The pilot PLL keeps running, but the stereo demodulator, resampler
+     * and DC blocker are bypassed on mono stations. The stereo resampler
+     * is advanced in step with the mono resampler and fed the tail of
+     * the demodulated signal, so when the pilot appears it continues
+     * exactly as if it had run all along; the DC blocker starts at rest.
+     */
+    void set_stereo_bypass(bool bypass)
+    {
+        m_stereo_bypass = bypass;
+    }
+
+    /** Return true unless the squelch is enabled and closed. */
+    bool squelch_open() const
+    {
+        return m_squelch_open;
+    }
+
+    /** Return baseband noise level above 60 kHz in dB (only with squelch). */
+    double get_squelch_noise() const
+    {
+        return m_squelch_noise_level;
+    }
+
     /** Return true if a stereo signal is detected. */
     bool stereo_detected() const
     {
@@ -210,10 +381,104 @@ public:
         return m_pilotpll.get_pps_events();
     }
 
+    /**
+     * Return IF samples of the most recently processed block, after fine
+     * tuning and channel filtering (still at the full IF sample rate).
+     */
+    const IQSampleVector& get_if_samples() const
+    {
+        return m_buf_iffiltered;
+    }
+
+    /**
+     * Return composite baseband (MPX) samples of the most recently
+     * processed block, after downsampling (where 1.0 is full deviation).
+     */
+    const SampleVector& get_baseband_samples() const
+    {
+        return m_buf_baseband;
+    }
+
+    /** Enable RDS decoding (runs the pilot PLL even in mono mode). */
+    void enable_rds()
+    {
+        if (!m_rds)
+            m_rds.reset(new RdsDecoder(m_sample_rate_baseband));
+    }
+
+    /** Disable RDS decoding. */
+    void disable_rds()
+    {
+        m_rds.reset();
+    }
+
+    /** Return RDS decoder, or NULL if RDS decoding is not enabled. */
+    const RdsDecoder *get_rds() const
+    {
+        return m_rds.get();
+    }
+
+    /**
+     * Enable signal quality measurements.
+     *
+     * Each baseband block is probed with Goertzel filters in the guard
+     * band, at the pilot, next to the RDS subcarrier and above the RDS
+     * band. Levels are relative to full deviation and averaged like the
+     * other levels.
+     */
+    void enable_quality();
+
+    /** Return signal quality (only after enable_quality()). */
+    Quality get_quality() const;
+
+    /** Return sample rate of the composite baseband signal in Hz. */
+    double get_baseband_sample_rate() const
+    {
+        return m_sample_rate_baseband;
+    }
+
+    /**
+     * Return a snapshot of the complete decoder state: filter histories,
+     * fine tuner phase, pilot PLL, RDS decoder, squelch, level averages
+     * and PPS counters.
+     *
+     * The snapshot can be restored with load_state() into a decoder with
+     * the same constructor parameters, in this or another process on the
+     * same machine. Processing then continues exactly as if it had not
+     * been interrupted.
+     */
+    std::vector<std::uint8_t> save_state() const;
+
+    /**
+     * Restore decoder state from a snapshot made by save_state().
+     *
+     * RDS decoding is enabled or disabled as in the snapshot.
+     * Return false, leaving the decoder unchanged, if the snapshot was
+     * made by a decoder with different parameters or tuning offset,
+     * or is corrupt.
+     */
+    bool load_state(const std::vector<std::uint8_t>& data);
+
 private:
     /** Demodulate stereo L-R signal. */
     void demod_stereo(const SampleVector& samples_baseband,
-                      SampleVector& samples_stereo);
+                      SampleVector& samples_stereo,
+                      unsigned int start=0);
+
+    /** Measure baseband noise above 60 kHz in dB. */
+    double measure_squelch_noise();
+
+    /** Update quality averages from a block of baseband samples. */
+    void measure_quality(const SampleVector& samples_baseband);
+
+    /** Update squelch state and return true if it is open. */
+    bool update_squelch(bool signal, unsigned int n);
+
+    /** Restore state without rollback; return false on error. */
+    bool restore_state(const std::vector<std::uint8_t>& data);
+
+    /** Return silence for n IF samples while the squelch is closed. */
+    void squelch_output(unsigned int n, SampleVector& audio);
 
     /** Duplicate mono signal in left/right channels. */
     void mono_to_left_right(const SampleVector& samples_mono,
@@ -227,34 +492,60 @@ private:
     // Data members.
     const double    m_sample_rate_if;
     const double    m_sample_rate_baseband;
+    const double    m_sample_rate_pcm;
     const int       m_tuning_table_size;
-    const int       m_tuning_shift;
+    int             m_tuning_shift;
     const double    m_freq_dev;
     const unsigned int m_downsample;
-    const bool      m_stereo_enabled;
+    const bool      m_stereo_output;
+    const unsigned int m_mono_downsample;
+    const double    m_sample_rate_mono;
+    double          m_group_delay;
+    bool            m_stereo_enabled;
+    bool            m_stereo_bypass;
     bool            m_stereo_detected;
     double          m_if_level;
     double          m_baseband_mean;
     double          m_baseband_level;
+    bool            m_squelch_enabled;
+    bool            m_squelch_open;
+    double          m_squelch_level;
+    double          m_squelch_noise;
+    double          m_squelch_noise_level;
+    unsigned int    m_squelch_hang;
+    double          m_squelch_baseband_frac;
+    double          m_squelch_pcm_frac;
 
     IQSampleVector  m_buf_iftuned;
     IQSampleVector  m_buf_iffiltered;
     SampleVector    m_buf_baseband;
     SampleVector    m_buf_mono;
+    SampleVector    m_buf_mono_decim;
     SampleVector    m_buf_rawstereo;
     SampleVector    m_buf_stereo;
+    IQSampleVector  m_buf_rds57k;
+    SampleVector    m_buf_squelch;
 
     FineTuner           m_finetuner;
     LowPassFilterFirIQ  m_iffilter;
     PhaseDiscriminator  m_phasedisc;
     DownsampleFilter    m_resample_baseband;
+    DownsampleFilter    m_squelch_lowpass;
     PilotPhaseLock      m_pilotpll;
+    DownsampleFilter    m_decimate_mono;
     DownsampleFilter    m_resample_mono;
     DownsampleFilter    m_resample_stereo;
     HighPassFilterIir   m_dcblock_mono;
     HighPassFilterIir   m_dcblock_stereo;
     LowPassFilterRC     m_deemph_mono;
     LowPassFilterRC     m_deemph_stereo;
+    std::unique_ptr<RdsDecoder> m_rds;
+
+    std::unique_ptr<GoertzelProbe> m_quality_probe;
+    std::vector<unsigned int>   m_quality_group;
+    std::vector<double>         m_quality_power;
+    double                      m_quality_avg[4];
+    bool                        m_quality_valid;
 };
 
 #endif
@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_GAINCONTROL_H_
+#define INCLUDE_GAINCONTROL_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "IQConverter.h"
+#include "Source.h"
+
+
+/**
+ * Software gain control of the device front end.
+ *
+ * Steps through the gain settings of the device to hold the RMS level of
+ * the raw ADC samples at a target headroom below full scale, measured
+ * over intervals of a quarter second. Clipping forces the gain down at
+ * once; the gain goes up only as far as the peak level leaves room.
+ * The interval after a change is skipped while the device settles.
+ */
+class GainControl
+{
+public:
+    /** Measurement interval in seconds. */
+    static constexpr double interval = 0.25;
+
+    /** Tolerated deviation from the target level in dB. */
+    static constexpr double hysteresis = 3.0;
+
+    /** Fraction of clipped samples that counts as overload. */
+    static constexpr double max_clip_ratio = 1.0e-4;
+
+    /**
+     * Prepare gain control.
+     *
+     * source       :: device, must outlive this object
+     * sample_rate  :: device sample rate in Hz
+     * headroom     :: target RMS level below ADC full scale in dB
+     */
+    GainControl(Source *source, double sample_rate, double headroom);
+
+    /**
+     * Add level statistics from the source and adjust the gain at the
+     * end of each interval. Return true if the gain was changed.
+     */
+    bool update(const IQConverter::LevelStats& stats);
+
+    /**
+     * Re-read the current setting from the device after its gain was
+     * changed elsewhere (e.g. with the gain control command), so that
+     * the next step starts from there. The interval in progress and the
+     * next one are skipped while the device settles.
+     */
+    void sync_gain();
+
+    /** Return the current gain setting. */
+    const GainStep& get_gain() const
+    {
+        return m_steps[m_current];
+    }
+
+    /** Return RMS level of the last interval in dB relative to full scale. */
+    double get_level() const
+    {
+        return m_level;
+    }
+
+    /** Return fraction of clipped samples in the last interval. */
+    double get_clip_ratio() const
+    {
+        return m_clip_ratio;
+    }
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if gain control is possible, false if there is an error. */
+    operator bool() const
+    {
+        return m_error.empty();
+    }
+
+private:
+    Source              *m_source;
+    double              m_headroom;
+    std::uint64_t       m_interval_samples;
+    std::vector<GainStep> m_steps;
+    std::size_t         m_current;
+    bool                m_settling;
+    std::string         m_error;
+
+    std::uint64_t       m_samples;
+    std::uint64_t       m_clipped;
+    double              m_peak;
+    double              m_sumsq;
+
+    double              m_level;
+    double              m_clip_ratio;
+};
+
+#endif /* INCLUDE_GAINCONTROL_H_ */
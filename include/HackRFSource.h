@@ -46,6 +46,21 @@ public:
     /** Return device current center frequency in Hz. */
     virtual std::uint32_t get_frequency();
 
+    /** Set device center frequency in Hz while streaming. */
+    virtual bool set_frequency(std::uint32_t frequency);
+
+    /** Set device gains while streaming (same keys as configure()). */
+    virtual bool set_gain(const std::string& gains);
+
+    /** Get gain settings for software gain control. */
+    virtual bool get_gain_steps(std::vector<GainStep>& steps, std::size_t& current);
+
+    /** Return number of bits per device sample. */
+    virtual unsigned int get_sample_bits()
+    {
+        return 8;
+    }
+
     /** Print current parameters specific to device type */
     virtual void print_specific_parms();
 
@@ -85,7 +100,7 @@ private:
 
     void callback(const char* buf, int len);
     static int rx_callback(hackrf_transfer* transfer);
-    static void run(hackrf_device* dev, std::atomic_bool *stop_flag);
+    void run();
 
     struct hackrf_device* m_dev;
     uint32_t m_sampleRate;
@@ -97,7 +112,7 @@ private:
     bool m_biasAnt;
     bool m_running;
     std::thread *m_thread;
-    static HackRFSource *m_this;
+    bool m_libInit;
     static const std::vector<int> m_lgains;
     static const std::vector<int> m_vgains;
     static const std::vector<int> m_bwfilt;
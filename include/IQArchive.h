@@ -0,0 +1,222 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_IQARCHIVE_H_
+#define INCLUDE_IQARCHIVE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+
+
+/**
+ * Lossless block codec for integer device IQ samples.
+ *
+ * IQ samples are quantized back to the integer codes delivered by the
+ * device (sample value * 2**(bits-1)), so no information is lost for
+ * 8-bit or 12-bit devices. Each block is coded independently:
+ *
+ *  - a fixed linear predictor of order 0, 1 or 2 is selected per channel
+ *    (the one that minimizes the sum of absolute residuals),
+ *  - residuals are mapped to unsigned integers (zigzag) and entropy coded
+ *    with a Rice code whose parameter is adapted per block and channel.
+ *
+ * Archive file layout (all integers little endian):
+ *
+ *   file header (48 bytes):
+ *     "SFMIQARC", u32 version, u32 bits, u32 block_size, u32 reserved,
+ *     f64 sample_rate, u64 center frequency, u64 configured frequency
+ *   blocks:
+ *     u32 nsamples, u8 predictor orders (I | Q << 4), u8 rice_k I,
+ *     u8 rice_k Q, u8 reserved, u32 payload bytes, payload
+ *   seek index (written on close):
+ *     u64 file offset of each block, u64 nblocks, u64 nsamples, "SFMIQIDX"
+ *
+ * All blocks except the last one contain exactly block_size samples,
+ * so the block containing any sample index is found directly from the
+ * seek index. If the index is missing (interrupted recording), readers
+ * rebuild it by scanning the block headers.
+ */
+class IQArchiveCodec
+{
+public:
+
+    static constexpr std::size_t header_size = 48;
+    static constexpr std::size_t block_header_size = 12;
+    static constexpr std::size_t trailer_size = 24;
+    static constexpr std::uint32_t version = 1;
+    static constexpr std::uint32_t default_block_size = 65536;
+
+    /** Archive file header fields. */
+    struct Header
+    {
+        std::uint32_t   bits;
+        std::uint32_t   block_size;
+        double          sample_rate;
+        std::uint64_t   frequency;
+        std::uint64_t   conf_frequency;
+    };
+
+    /** Serialize file header. */
+    static void encode_header(const Header& header,
+                              std::vector<std::uint8_t>& bytes);
+
+    /**
+     * Parse file header.
+     * Return false if the data is not a valid archive header.
+     */
+    static bool decode_header(const std::uint8_t *bytes, Header& header);
+
+    /**
+     * Encode a block of IQ samples including its block header.
+     *
+     * samples  :: IQ samples scaled such that device full scale is 1.0
+     * bits     :: number of bits per device sample
+     * bytes    :: encoded block (replaced)
+     */
+    static void encode_block(const IQSampleVector& samples,
+                             unsigned int bits,
+                             std::vector<std::uint8_t>& bytes);
+
+    /**
+     * Parse block header.
+     * Return total size of the encoded block (header + payload).
+     */
+    static std::size_t decode_block_size(const std::uint8_t *bytes,
+                                         std::uint32_t& nsamples);
+
+    /**
+     * Decode a complete block (header + payload).
+     * Return false if the block is corrupt.
+     */
+    static bool decode_block(const std::uint8_t *bytes,
+                             std::size_t nbytes,
+                             unsigned int bits,
+                             IQSampleVector& samples);
+
+    /** Store little-endian integer. */
+    template <typename T>
+    static void put_value(std::uint8_t *ptr, T value)
+    {
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            ptr[i] = value & 0xff;
+            value >>= 8;
+        }
+    }
+
+    /** Load little-endian integer. */
+    template <typename T>
+    static T get_value(const std::uint8_t *ptr)
+    {
+        T value = 0;
+        for (std::size_t i = sizeof(T); i > 0; --i) {
+            value = (value << 8) | ptr[i-1];
+        }
+        return value;
+    }
+};
+
+
+
+/** Read IQ samples from an archive file with random access. */
+class IQArchiveReader
+{
+public:
+
+    /**
+     * Open archive file and load (or rebuild) its seek index.
+     *
+     * filename :: file name (including path)
+     */
+    IQArchiveReader(const std::string& filename);
+
+    ~IQArchiveReader();
+
+    /** Return archive file header. */
+    const IQArchiveCodec::Header& header() const
+    {
+        return m_header;
+    }
+
+    /** Return total number of samples in the archive. */
+    std::uint64_t num_samples() const
+    {
+        return m_nsamples;
+    }
+
+    /** Return index of the next sample to be read. */
+    std::uint64_t position() const
+    {
+        return m_position;
+    }
+
+    /**
+     * Position the reader at the specified sample index.
+     * Return false if the index is beyond the end of the archive.
+     */
+    bool seek(std::uint64_t sample_index);
+
+    /**
+     * Read next block of samples.
+     *
+     * Return true on success (samples is empty at end of archive).
+     * Return false if an error occurs.
+     */
+    bool read(IQSampleVector& samples);
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if the archive is OK, return false if there is an error. */
+    operator bool() const
+    {
+        return (!m_zombie) && m_error.empty();
+    }
+
+private:
+    /** Load seek index from the file trailer. */
+    bool load_index(std::uint64_t file_size);
+
+    /** Rebuild seek index by scanning block headers. */
+    bool scan_index(std::uint64_t file_size);
+
+    std::string                 m_error;
+    bool                        m_zombie;
+    FILE                        *m_file;
+    IQArchiveCodec::Header      m_header;
+    std::vector<std::uint64_t>  m_offsets;
+    std::uint64_t               m_data_end;
+    std::uint64_t               m_nsamples;
+    std::uint64_t               m_position;
+    std::size_t                 m_block;
+    std::size_t                 m_skip;
+    std::vector<std::uint8_t>   m_bytebuf;
+
+    IQArchiveReader(const IQArchiveReader&);            // no copy constructor
+    IQArchiveReader& operator=(const IQArchiveReader&); // no assignment operator
+};
+
+#endif /* INCLUDE_IQARCHIVE_H_ */
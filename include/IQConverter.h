@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_IQCONVERTER_H_
+#define INCLUDE_IQCONVERTER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+#include "SoftFM.h"
+
+/**
+ * Convert device samples to IQ samples with adaptive DC offset and
+ * I/Q imbalance correction.
+ *
+ * Correction runs in the same pass as the sample conversion: the DC
+ * estimate is subtracted and Q is orthogonalized against I and scaled
+ * to the power of I (Gram-Schmidt). The estimates are updated once per
+ * block from moments accumulated in that pass, averaged with a time
+ * constant of half a second. This makes zero-IF tuning usable, where
+ * DC offset and the image of the station itself land in the channel.
+ *
+ * The same pass also counts samples at the ADC limits and measures peak
+ * and RMS level of the raw samples, for overload display and gain
+ * control. These statistics may be read from another thread.
+ */
+class IQConverter
+{
+public:
+
+    /** ADC level statistics of the raw device samples. */
+    struct LevelStats
+    {
+        std::uint64_t   samples;        // number of IQ samples
+        std::uint64_t   clipped;        // samples with I or Q at the ADC limits
+        double          peak;           // peak |I| or |Q|, 1.0 = full scale
+        double          rms;            // RMS magnitude, 1.0 = full scale
+    };
+
+    /** Averaging time constant of the estimates in seconds. */
+    static constexpr double default_time_constant = 0.5;
+
+    /** Construct converter with correction enabled. */
+    IQConverter();
+
+    /** Set sample rate in Hz and restart the estimation. */
+    void set_sample_rate(double sample_rate);
+
+    /** Enable or disable correction (conversion only). */
+    void set_enabled(bool enabled)
+    {
+        m_enabled = enabled;
+    }
+
+    /** Return true if correction is enabled. */
+    bool enabled() const
+    {
+        return m_enabled;
+    }
+
+    /** Convert unsigned 8-bit offset binary samples (RTL-SDR). */
+    void convert(const std::uint8_t *buf, std::size_t n, IQSampleVector& samples_out);
+
+    /** Convert signed 8-bit samples (HackRF). */
+    void convert(const std::int8_t *buf, std::size_t n, IQSampleVector& samples_out);
+
+    /**
+     * Convert signed 16-bit samples.
+     *
+     * buf          :: n interleaved I/Q pairs
+     * bits         :: ADC resolution (full scale is 2**(bits-1))
+     */
+    void convert(const std::int16_t *buf, std::size_t n, unsigned int bits,
+                 IQSampleVector& samples_out);
+
+    /** Correct IQ samples in place. */
+    void process(IQSampleVector& samples);
+
+    /** Return current DC offset estimate. */
+    IQSample get_dc_offset() const
+    {
+        return IQSample(m_dc_i, m_dc_q);
+    }
+
+    /** Return estimated gain of Q relative to I in dB. */
+    double get_gain_imbalance() const;
+
+    /** Return estimated phase error of Q relative to I in degrees. */
+    double get_phase_imbalance() const;
+
+    /** Return level statistics since the previous call and restart them. */
+    void get_level_stats(LevelStats& stats);
+
+private:
+    /**
+     * Convert (and correct) n interleaved I/Q values: (v - offset) * scale.
+     * Values at or beyond clip_lo or clip_hi count as clipped.
+     */
+    template <typename T>
+    void convert_block(const T *buf, std::size_t n, float offset, float scale,
+                       T clip_lo, T clip_hi, IQSampleVector& samples_out);
+
+    /** Count samples with I or Q at the ADC limits, given the block extremes. */
+    template <typename T>
+    static std::size_t count_clipped(const T *buf, std::size_t n,
+                                     T clip_lo, T clip_hi, T raw_min, T raw_max);
+
+    /** Add the level statistics of one block. */
+    void add_level_stats(std::size_t n, std::size_t clipped, double peak, double sumsq);
+
+    /** Update estimates from the moments of one block. */
+    void update(std::size_t n, double si, double sq,
+                double sii, double sqq, double siq);
+
+    bool            m_enabled;
+    double          m_time_constant;
+    double          m_nsamples;
+    float           m_dc_i;
+    float           m_dc_q;
+    double          m_pii;
+    double          m_pqq;
+    double          m_piq;
+    float           m_corr_qq;
+    float           m_corr_qi;
+
+    std::mutex      m_stats_mutex;
+    LevelStats      m_stats;
+    double          m_stats_sumsq;
+};
+
+#endif /* INCLUDE_IQCONVERTER_H_ */
@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_IQOUTPUT_H_
+#define INCLUDE_IQOUTPUT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+#include "IQArchive.h"
+
+
+/** Base class for writing IQ sample data to file. */
+class IQOutput
+{
+public:
+
+    /** Sample encoding of IQ files. */
+    enum SampleFormat
+    {
+        FORMAT_CF32,    // interleaved 32-bit float I/Q (little endian)
+        FORMAT_CS16     // interleaved signed 16-bit I/Q (little endian)
+    };
+
+    /** Destructor. */
+    virtual ~IQOutput() { }
+
+    /**
+     * Write IQ data.
+     *
+     * Return true on success.
+     * Return false if an error occurs.
+     */
+    virtual bool write(const IQSampleVector& samples) = 0;
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if the stream is OK, return false if there is an error. */
+    operator bool() const
+    {
+        return (!m_zombie) && m_error.empty();
+    }
+
+    /**
+     * Parse sample format name ("cf32" or "cs16").
+     * Return true if the name is valid.
+     */
+    static bool parse_format(const std::string& name, SampleFormat& format);
+
+protected:
+    /** Constructor. */
+    IQOutput() : m_zombie(false) { }
+
+    /**
+     * Write all bytes to file descriptor.
+     * Set m_error and return false if an error occurs.
+     */
+    bool write_bytes(int fd, const std::vector<std::uint8_t>& bytes);
+
+    std::string m_error;
+    bool        m_zombie;
+
+private:
+    IQOutput(const IQOutput&);            // no copy constructor
+    IQOutput& operator=(const IQOutput&); // no assignment operator
+};
+
+
+/**
+ * Write IQ data as raw interleaved samples.
+ *
+ * Unless writing to stdout, capture metadata is written to a SigMF
+ * compatible sidecar file (filename + ".sigmf-meta").
+ */
+class RawIQOutput : public IQOutput
+{
+public:
+
+    /**
+     * Construct raw IQ writer.
+     *
+     * filename     :: file name (including path) or "-" to write to stdout
+     * format       :: sample encoding
+     * sample_rate  :: IQ sample rate in Hz
+     * frequency    :: center frequency of the IQ signal in Hz
+     */
+    RawIQOutput(const std::string& filename,
+                SampleFormat format,
+                double sample_rate,
+                double frequency);
+
+    ~RawIQOutput();
+    bool write(const IQSampleVector& samples);
+
+private:
+
+    /** Write SigMF metadata file. */
+    bool write_metadata(const std::string& filename,
+                        double sample_rate,
+                        double frequency);
+
+    const SampleFormat m_format;
+    int m_fd;
+    std::vector<std::uint8_t> m_bytebuf;
+};
+
+
+
+/**
+ * Write device IQ samples to a compact lossless archive.
+ *
+ * See IQArchiveCodec for the file format. The seek index is written
+ * when the writer is destroyed.
+ */
+class ArchiveIQOutput : public IQOutput
+{
+public:
+
+    /**
+     * Construct archive writer.
+     *
+     * filename         :: file name (including path)
+     * bits             :: number of bits per device sample (1 to 16)
+     * sample_rate      :: IQ sample rate in Hz
+     * frequency        :: device center frequency in Hz
+     * conf_frequency   :: configured (station) frequency in Hz
+     * block_size       :: number of samples per coded block
+     */
+    ArchiveIQOutput(const std::string& filename,
+                    unsigned int bits,
+                    double sample_rate,
+                    double frequency,
+                    double conf_frequency,
+                    unsigned int block_size=IQArchiveCodec::default_block_size);
+
+    ~ArchiveIQOutput();
+    bool write(const IQSampleVector& samples);
+
+    /** Return total number of bytes written so far. */
+    std::uint64_t bytes_written() const
+    {
+        return m_offset;
+    }
+
+private:
+
+    /** Encode and write one block. */
+    bool write_block(const IQSampleVector& samples);
+
+    /** Write final partial block and seek index. */
+    bool finish();
+
+    const unsigned int m_bits;
+    const unsigned int m_block_size;
+    int m_fd;
+    std::uint64_t m_offset;
+    std::uint64_t m_nsamples;
+    std::vector<std::uint64_t> m_index;
+    IQSampleVector m_pending;
+    std::vector<std::uint8_t> m_bytebuf;
+};
+
+#endif /* INCLUDE_IQOUTPUT_H_ */
@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_RDSDECODER_H_
+#define INCLUDE_RDSDECODER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+#include "Filter.h"
+
+
+/**
+ * Decoder for RDS data on the 57 kHz subcarrier.
+ *
+ * The composite baseband signal is mixed down with a 57 kHz phasor that
+ * is locked to the stereo pilot, decimated to ~ 20 kS/s in two stages
+ * and passed through a biphase matched filter. Bits are recovered by
+ * differential decoding with an early / late bit clock tracker (after
+ * pyfm.py rdsDemodulate). Block synchronization, syndrome check and
+ * burst error correction are table driven.
+ */
+class RdsDecoder
+{
+public:
+
+    /** RDS bit rate in bit/s. */
+    static constexpr double bit_rate = 1187.5;
+
+    /** Decoded RDS group (blocks A, B, C or C', D). */
+    struct Group
+    {
+        std::uint16_t   blocks[4];
+        unsigned int    corrected;      // number of corrected blocks
+    };
+
+    /**
+     * Construct RDS decoder.
+     *
+     * sample_rate :: sample rate of the composite baseband signal in Hz
+     */
+    RdsDecoder(double sample_rate);
+
+    /**
+     * Process a block of baseband samples.
+     *
+     * samples_baseband :: composite baseband signal
+     * subcarrier       :: 57 kHz unit phasor locked to the pilot,
+     *                     same length as samples_baseband
+     */
+    void process(const SampleVector& samples_baseband,
+                 const IQSampleVector& subcarrier);
+
+    /** Return true if the decoder is synchronized on RDS blocks. */
+    bool synced() const
+    {
+        return m_synced;
+    }
+
+    /** Return program identification code (or -1 if not yet known). */
+    int get_pi() const
+    {
+        return m_pi;
+    }
+
+    /** Return program service name (complete once all segments are in). */
+    const std::string& get_ps() const
+    {
+        return m_ps;
+    }
+
+    /** Return most recent complete radio text. */
+    const std::string& get_rt() const
+    {
+        return m_rt;
+    }
+
+    /** Return number of valid groups since start. */
+    std::uint64_t get_group_count() const
+    {
+        return m_group_cnt;
+    }
+
+    /** Return block error rate over recent blocks (0.0 .. 1.0). */
+    double get_block_error_rate() const
+    {
+        return m_bler;
+    }
+
+    /** Return RDS subcarrier level (matched filter output amplitude). */
+    double get_level() const
+    {
+        return m_level;
+    }
+
+    /** Return groups decoded from the most recently processed block. */
+    const std::vector<Group>& get_groups() const
+    {
+        return m_groups;
+    }
+
+    /**
+     * Return JSON lines produced from the most recently processed block.
+     *
+     * A line is produced when PI changes, when a new program service
+     * name or radio text is complete and for each clock-time group.
+     */
+    const std::vector<std::string>& get_events() const
+    {
+        return m_events;
+    }
+
+    /** Save internal state (without the output of the last block). */
+    void save_state(StateWriter& state) const;
+
+    /** Restore internal state saved by save_state(). */
+    void load_state(StateReader& state);
+
+private:
+    /** Recover bits from the decimated subcarrier signal. */
+    void demodulate();
+
+    /** Process one received bit. */
+    void receive_bit(unsigned int bit);
+
+    /** Process a complete group. */
+    void decode_group(const Group& group);
+
+    /** Return syndrome (remainder modulo generator) of a 26-bit word. */
+    std::uint32_t syndrome(std::uint32_t word) const;
+
+    /** Emit a JSON event line. */
+    void add_event(const std::string& key, const std::string& value);
+
+    // Demodulator.
+    const double        m_sample_rate;
+    IQSampleVector      m_buf_mixed;
+    IQSampleVector      m_buf_stage1;
+    IQSampleVector      m_buf_symbols;
+    DownsampleFilterIQ  m_resample1;
+    DownsampleFilterIQ  m_resample2;
+    std::vector<float>  m_matched;
+    double              m_bitsteps;
+    double              m_pos;
+    IQSample            m_prev_a1;
+    double              m_level;
+
+    // Block synchronization.
+    std::uint32_t       m_syndrome_hi[256];
+    std::uint32_t       m_syndrome_lo[256];
+    std::uint32_t       m_error_table[1024];
+    std::uint32_t       m_shift;
+    std::uint64_t       m_bit_cnt;
+    bool                m_synced;
+    std::uint64_t       m_last_match_bit;
+    int                 m_last_match_block;
+    unsigned int        m_block_bits;
+    int                 m_block_index;
+    unsigned int        m_bad_blocks;
+    double              m_bler;
+    Group               m_group;
+    bool                m_group_valid;
+
+    // Decoded data.
+    int                 m_pi;
+    std::string         m_ps;
+    std::string         m_rt;
+    char                m_ps_buf[8];
+    unsigned int        m_ps_segments;
+    char                m_rt_buf[64];
+    std::uint32_t       m_rt_segments;
+    int                 m_rt_ab;
+    std::uint64_t       m_group_cnt;
+    std::vector<Group>  m_groups;
+    std::vector<std::string> m_events;
+};
+
+#endif /* INCLUDE_RDSDECODER_H_ */
@@ -46,6 +46,21 @@ public:
     /** Return device current center frequency in Hz. */
     virtual std::uint32_t get_frequency();
 
+    /** Set device center frequency in Hz while streaming. */
+    virtual bool set_frequency(std::uint32_t frequency);
+
+    /** Set device gains while streaming (same keys as configure()). */
+    virtual bool set_gain(const std::string& gains);
+
+    /** Get gain settings for software gain control. */
+    virtual bool get_gain_steps(std::vector<GainStep>& steps, std::size_t& current);
+
+    /** Return number of bits per device sample. */
+    virtual unsigned int get_sample_bits()
+    {
+        return 8;
+    }
+
     /** Print current parameters specific to device type */
     virtual void print_specific_parms();
 
@@ -90,9 +105,10 @@ private:
      * This function must be called regularly to maintain streaming.
      * Return true for success, false if an error occurred.
      */
-    static bool get_samples(IQSampleVector *samples);
+    bool get_samples(IQSampleVector *samples);
 
-    static void run();
+    /** Read samples from the device and push them to the buffer. */
+    void run();
 
     struct rtlsdr_dev * m_dev;
     int                 m_block_length;
@@ -100,7 +116,6 @@ private:
     std::string         m_gainsStr;
     bool                m_confAgc;
     std::thread         *m_thread;
-    static RtlSdrSource *m_this;
 };
 
 #endif
@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_SIMSOURCE_H_
+#define INCLUDE_SIMSOURCE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+
+#include "Source.h"
+
+/**
+ * Virtual device that synthesizes stereo FM stations in real time.
+ *
+ * Front-end impairments (DC offset, I/Q imbalance, clock error, ADC
+ * clipping and quantization, dropped transfers and delivery jitter) are
+ * applied with a seeded random generator, so a run is repeatable. Used
+ * to soak test the buffering and decoding stack without hardware.
+ */
+class SimSource : public Source
+{
+public:
+
+    static const int default_block_length = 65536;
+
+    /** Range of the simulated front-end gain in dB. */
+    static const int min_gain = -20;
+    static const int max_gain = 40;
+
+    /** Construct simulated source. Parameters are set by configure(). */
+    SimSource();
+
+    virtual ~SimSource();
+
+    virtual bool configure(std::string configuration);
+
+    /** Return current sample frequency in Hz. */
+    virtual std::uint32_t get_sample_rate();
+
+    /** Return simulated tuner center frequency in Hz. */
+    virtual std::uint32_t get_frequency();
+
+    /** Retune the simulated tuner while streaming. */
+    virtual bool set_frequency(std::uint32_t frequency);
+
+    /** Set the simulated front-end gain while streaming (gain=<dB>). */
+    virtual bool set_gain(const std::string& gains);
+
+    /** Get gain settings for software gain control. */
+    virtual bool get_gain_steps(std::vector<GainStep>& steps, std::size_t& current);
+
+    /** Return number of bits of the simulated ADC. */
+    virtual unsigned int get_sample_bits();
+
+    /** Print current parameters specific to device type */
+    virtual void print_specific_parms();
+
+    virtual bool start(DataBuffer<IQSample> *buf, std::atomic_bool *stop_flag);
+    virtual bool stop();
+
+    /** Return true if the device is OK, return false if there is an error. */
+    virtual operator bool() const
+    {
+        return m_error.empty();
+    }
+
+    /** Return a list of supported devices. */
+    static void get_device_names(std::vector<std::string>& devices);
+
+private:
+    /** Oscillator phases of one simulated station. */
+    struct Station
+    {
+        double          frequency;      // absolute carrier frequency in Hz
+        std::uint32_t   carrier_phase;
+        std::uint32_t   pilot_phase;
+        std::uint32_t   left_phase;
+        std::uint32_t   right_phase;
+        std::uint32_t   left_step;
+        std::uint32_t   right_step;
+    };
+
+    /**
+     * Generate one block of device samples as signed ADC codes.
+     *
+     * work         :: work buffer, resized to n samples
+     * codes_out    :: n interleaved I/Q codes
+     */
+    void generate(std::size_t n, IQSampleVector& work, std::vector<std::int16_t>& codes_out);
+
+    /** Generate samples and push them to the buffer. */
+    void run();
+
+    std::vector<Station> m_stations;
+    std::vector<float>  m_sintab;
+    std::mt19937        m_rng;
+    std::atomic<std::uint32_t> m_frequency;
+    std::atomic<int>    m_gain;
+    std::uint32_t       m_srate;
+    unsigned int        m_block_length;
+    unsigned int        m_bits;
+    double              m_level;
+    double              m_noise;
+    double              m_dc;
+    double              m_iq_gain;
+    double              m_iq_phase;
+    double              m_ppm;
+    double              m_drop;
+    double              m_jitter;
+    double              m_duration;
+    unsigned int        m_seed;
+    bool                m_realtime;
+    std::uint64_t       m_dropped;
+    std::thread         *m_thread;
+};
+
+#endif /* INCLUDE_SIMSOURCE_H_ */
@@ -22,14 +22,23 @@
 #include <string>
 #include <atomic>
 #include <memory>
+#include <vector>
 
 #include "SoftFM.h"
 #include "DataBuffer.h"
+#include "IQConverter.h"
+
+/** Device gain setting for the software gain control. */
+struct GainStep
+{
+    double      gain;       // total gain in dB
+    std::string setting;    // gain keys as for Source::set_gain()
+};
 
 class Source
 {
 public:
-    Source() : m_confFreq(0), m_buf(0) {}
+    Source() : m_confFreq(0), m_buf(0), m_dropped_samples(0) {}
     virtual ~Source() {}
 
     /**
@@ -43,6 +52,91 @@ public:
     /** Return device current center frequency in Hz. */
     virtual std::uint32_t get_frequency() = 0;
 
+    /**
+     * Set device center frequency in Hz while streaming.
+     * Return false if the device does not support retuning.
+     */
+    virtual bool set_frequency(std::uint32_t)
+    {
+        m_error = "Device does not support retuning";
+        return false;
+    }
+
+    /**
+     * Set device gains while streaming.
+     * The gain keys are the same as for configure() (e.g. "lgain=16").
+     * Return false if a gain is invalid or the device does not support it.
+     */
+    virtual bool set_gain(const std::string&)
+    {
+        m_error = "Device does not support runtime gain changes";
+        return false;
+    }
+
+    /**
+     * Get the device gain settings for software gain control, ordered by
+     * increasing total gain, and the index of the current setting.
+     * Return false if the device gains can not be controlled.
+     */
+    virtual bool get_gain_steps(std::vector<GainStep>&, std::size_t&)
+    {
+        m_error = "Device does not support gain control";
+        return false;
+    }
+
+    /**
+     * Return ADC level statistics of the samples delivered since the
+     * previous call. May be called from another thread while streaming.
+     */
+    void get_level_stats(IQConverter::LevelStats& stats)
+    {
+        m_iqconv.get_level_stats(stats);
+    }
+
+    /**
+     * Enable or disable DC offset and I/Q imbalance correction of the
+     * delivered samples. configure() enables it only in zero-IF mode.
+     * Call before start().
+     */
+    void set_iq_correction(bool enable)
+    {
+        m_iqconv.set_enabled(enable);
+    }
+
+    /** Return true if DC offset and I/Q imbalance are corrected. */
+    bool get_iq_correction() const
+    {
+        return m_iqconv.enabled();
+    }
+
+    /**
+     * Return true if a tuner at tuner_freq receives the station at
+     * conf_freq in zero-IF position (see tuner_offset_ratio()).
+     */
+    static bool zeroif_tuning(double tuner_freq, double conf_freq, double sample_rate);
+
+    /**
+     * Set station frequencies in Hz that must lie within the usable IF band,
+     * besides the configured frequency, when the sample rate is chosen
+     * automatically (srate=auto). Call before configure().
+     */
+    void set_required_stations(const std::vector<double>& stations)
+    {
+        m_reqStations = stations;
+    }
+
+    /** Return number of bits per device sample (ADC resolution). */
+    virtual unsigned int get_sample_bits() = 0;
+
+    /**
+     * Return number of device samples lost since streaming started
+     * (short reads or transfers dropped by the driver).
+     */
+    std::uint64_t get_dropped_samples() const
+    {
+        return m_dropped_samples;
+    }
+
     /** Return current configured center frequency in Hz. */
     std::uint32_t get_configured_frequency() const
     {
@@ -77,11 +171,58 @@ public:
     }
 
 protected:
+    /**
+     * Return the offset of the tuner from the station, relative to the
+     * sample rate: 1/4 normally, 1/64 in zero-IF mode. Only zero-IF mode
+     * needs DC offset and I/Q imbalance correction.
+     */
+    static double tuner_offset_ratio(bool zeroif);
+
+    /**
+     * Choose the sample rate for srate=auto.
+     *
+     * rates        :: supported sample rates in Hz
+     * frequency    :: configured station frequency in Hz
+     * tuner_offset :: tuner offset from the station relative to the sample rate
+     *
+     * Return the rate with the lowest decoding cost that keeps the station
+     * and all required stations within the usable IF band, or the highest
+     * rate if none does.
+     */
+    std::uint32_t choose_sample_rate(const std::vector<std::uint32_t>& rates,
+                                     std::uint32_t frequency,
+                                     double tuner_offset);
+
+    /**
+     * Return a block length for srate=auto: about 65 ms of samples at
+     * sample_rate, rounded up to a multiple of granularity.
+     */
+    static int choose_block_length(std::uint32_t sample_rate, int granularity);
+
+    /**
+     * Build gain steps from the gain values of several amplifier stages.
+     *
+     * keys         :: gain key of each stage as for set_gain()
+     * values       :: supported gains in dB of each stage
+     * current      :: current gain of each stage
+     *
+     * Each total gain uses the setting that spreads it most evenly over
+     * the stages, relative to their ranges. Return the index of the step
+     * closest to the current total gain.
+     */
+    static std::size_t make_gain_steps(const std::vector<std::string>& keys,
+                                       const std::vector<std::vector<int> >& values,
+                                       const std::vector<int>& current,
+                                       std::vector<GainStep>& steps);
+
     std::string          m_devname;
     std::string          m_error;
     uint32_t             m_confFreq;
     DataBuffer<IQSample> *m_buf;
     std::atomic_bool     *m_stop_flag;
+    IQConverter          m_iqconv;
+    std::vector<double>  m_reqStations;
+    std::atomic<std::uint64_t> m_dropped_samples;
 };
 
 #endif /* INCLUDE_SOURCE_H_ */
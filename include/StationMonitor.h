@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_STATIONMONITOR_H_
+#define INCLUDE_STATIONMONITOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SoftFM.h"
+#include "Filter.h"
+#include "FmDecode.h"
+#include "RdsDecoder.h"
+
+
+/**
+ * Headless RDS monitor for one station within the tuned bandwidth.
+ *
+ * Runs only the IF front end (fine tuning, channel filter with
+ * decimation), the phase discriminator, the pilot PLL and the RDS
+ * decoder. No audio is produced.
+ */
+class StationMonitor
+{
+public:
+
+    /**
+     * Construct station monitor.
+     *
+     * sample_rate_if   :: IQ sample rate in Hz
+     * tuning_offset    :: Frequency offset in Hz of the station with
+     *                     respect to the receiver LO frequency
+     * frequency        :: Station frequency in Hz (for reports)
+     */
+    StationMonitor(double sample_rate_if,
+                   double tuning_offset,
+                   double frequency);
+
+    /**
+     * Enable carrier squelch: blocks with an IF level below level_db
+     * (minus FmDecoder::squelch_hysteresis while open) skip demodulation
+     * and RDS decoding.
+     */
+    void set_squelch(double level_db)
+    {
+        m_squelch_enabled = true;
+        m_squelch_level = level_db;
+    }
+
+    /** Process a block of IQ samples. */
+    void process(const IQSampleVector& samples_in);
+
+    /** Return station frequency in Hz. */
+    double get_frequency() const
+    {
+        return m_frequency;
+    }
+
+    /** Return RDS decoder. */
+    const RdsDecoder& get_rds() const
+    {
+        return m_rds;
+    }
+
+    /** Return RMS IF level (where full scale IQ signal is 1.0). */
+    double get_if_level() const
+    {
+        return m_if_level;
+    }
+
+    /** Return RMS IF level of the most recently processed block. */
+    double get_block_level() const
+    {
+        return m_block_level;
+    }
+
+    /**
+     * Return pilot power over guard band noise density in dB-Hz, measured
+     * over the most recently processed block with the same probe as
+     * FmDecoder::get_quality(). Unlike pilot_locked() this needs no PLL
+     * acquisition time.
+     */
+    double get_pilot_snr() const
+    {
+        return m_pilot_snr;
+    }
+
+    /**
+     * Return baseband noise above 60 kHz in dB relative to full
+     * deviation, measured over the most recently processed block.
+     */
+    double get_noise_level() const
+    {
+        return m_noise_level;
+    }
+
+    /** Return true if the stereo pilot is locked. */
+    bool pilot_locked() const
+    {
+        return m_pilotpll.locked();
+    }
+
+    /**
+     * Return JSON lines for the most recently processed block:
+     * one line per decoded RDS group and per RDS event.
+     */
+    std::vector<std::string> get_group_lines() const;
+
+    /** Return JSON line with lock and quality metrics. */
+    std::string get_status_line() const;
+
+private:
+    const double        m_frequency;
+    const double        m_sample_rate_channel;
+    double              m_if_level;
+    double              m_block_level;
+    double              m_pilot_snr;
+    double              m_noise_level;
+    bool                m_squelch_enabled;
+    bool                m_squelch_open;
+    double              m_squelch_level;
+
+    IQSampleVector      m_buf_iftuned;
+    IQSampleVector      m_buf_channel;
+    SampleVector        m_buf_baseband;
+    SampleVector        m_buf_pilot;
+    SampleVector        m_buf_noise;
+    IQSampleVector      m_buf_rds57k;
+    std::vector<double> m_probe_power;
+
+    FineTuner           m_finetuner;
+    DownsampleFilterIQ  m_chanfilter;
+    PhaseDiscriminator  m_phasedisc;
+    DownsampleFilter    m_noise_lowpass;
+    PilotPhaseLock      m_pilotpll;
+    RdsDecoder          m_rds;
+    GoertzelProbe       m_pilot_probe;
+};
+
+#endif /* INCLUDE_STATIONMONITOR_H_ */
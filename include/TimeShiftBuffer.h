@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_TIMESHIFTBUFFER_H_
+#define INCLUDE_TIMESHIFTBUFFER_H_
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <thread>
+
+#include "SoftFM.h"
+
+
+/**
+ * Disk-backed circular buffer of IQ samples with triggered dumps.
+ *
+ * The most recent samples are kept in a memory-mapped ring file. When
+ * a dump is triggered, a background thread copies the ring contents
+ * (plus an optional number of samples after the trigger) to a new raw
+ * IQ file with SigMF metadata.
+ *
+ * The writer side is lock-free and never waits for the dump thread.
+ * The writer publishes a reservation before each copy into the ring,
+ * so the dump thread can detect and skip data that was overwritten
+ * while it was being copied.
+ */
+class TimeShiftBuffer
+{
+public:
+
+    /**
+     * Create ring file and start dump thread.
+     *
+     * ringfile     :: path of memory-mapped ring file (created / truncated)
+     * capacity     :: number of samples kept in the ring
+     * post_samples :: number of samples recorded after a trigger
+     * sample_rate  :: IQ sample rate in Hz
+     * frequency    :: center frequency of the IQ signal in Hz
+     * dump_prefix  :: path prefix of dump files
+     */
+    TimeShiftBuffer(const std::string& ringfile,
+                    std::size_t capacity,
+                    std::size_t post_samples,
+                    double sample_rate,
+                    double frequency,
+                    const std::string& dump_prefix);
+
+    /** Stop dump thread (finishing a running dump) and unmap ring. */
+    ~TimeShiftBuffer();
+
+    /** Append samples to the ring. Must be called from a single thread. */
+    void write(const IQSampleVector& samples);
+
+    /**
+     * Request a dump of the ring contents.
+     *
+     * This function only stores the reason and is safe to call from a
+     * signal handler. Triggers during a running dump are ignored.
+     *
+     * reason :: static string describing the trigger (used in file name)
+     */
+    void trigger(const char *reason);
+
+    /** Return the last error, or return an empty string if there is no error. */
+    std::string error()
+    {
+        std::string ret(m_error);
+        m_error.clear();
+        return ret;
+    }
+
+    /** Return true if the buffer is OK, return false if there is an error. */
+    operator bool() const
+    {
+        return (!m_zombie) && m_error.empty();
+    }
+
+private:
+    /** Wait for triggers and write dumps. */
+    void run();
+
+    /** Copy ring contents [begin, end) to a new dump file. */
+    void dump(std::uint64_t begin, std::uint64_t end, const char *reason);
+
+    std::string     m_error;
+    bool            m_zombie;
+    int             m_fd;
+    IQSample        *m_ring;
+    const std::size_t   m_capacity;
+    const std::size_t   m_post_samples;
+    const double    m_sample_rate;
+    const double    m_frequency;
+    const std::string   m_dump_prefix;
+
+    std::atomic<std::uint64_t>  m_write_reserved;
+    std::atomic<std::uint64_t>  m_write_pos;
+    std::atomic<std::uint64_t>  m_trigger_pos;
+    std::atomic<const char *>   m_trigger;
+    std::atomic_bool            m_stop;
+    std::thread                 m_thread;
+
+    TimeShiftBuffer(const TimeShiftBuffer&);            // no copy constructor
+    TimeShiftBuffer& operator=(const TimeShiftBuffer&); // no assignment operator
+};
+
+#endif /* INCLUDE_TIMESHIFTBUFFER_H_ */
@@ -0,0 +1,224 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDE_SOFTFM_C_H_
+#define INCLUDE_SOFTFM_C_H_
+
+/*
+ * C API of the SoftFM decoder (libsoftfm).
+ *
+ * A decoder turns IQ samples of an FM broadcast channel into audio, with
+ * optional RDS decoding and carrier squelch. All data is passed in caller
+ * provided buffers; a decoder has no shared or global state, so separate
+ * decoders may be used from separate threads. A single decoder must not
+ * be used from several threads at the same time.
+ *
+ * Functions that can fail return SFM_OK (0) or a negative error code.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Version of this API; incremented on incompatible changes. */
+#define SFM_API_VERSION 1
+
+/* Error codes. */
+#define SFM_OK              0
+#define SFM_ERR_INVALID     (-1)    /* invalid argument or configuration */
+#define SFM_ERR_BUFFER      (-2)    /* caller buffer too small */
+#define SFM_ERR_STATE       (-3)    /* state does not match this decoder */
+#define SFM_ERR_NOMEM       (-4)    /* out of memory */
+
+/** Opaque decoder handle. */
+typedef struct sfm_decoder sfm_decoder;
+
+/** Decoder configuration; initialize with sfm_config_init(). */
+typedef struct sfm_config
+{
+    double          sample_rate_if;     /* IQ sample rate in Hz */
+    double          tuning_offset;      /* station minus IQ center frequency in Hz */
+    double          sample_rate_pcm;    /* audio sample rate in Hz */
+    int             stereo;             /* 1 for stereo output (interleaved L/R), 0 for mono */
+    double          deemphasis;         /* de-emphasis time constant in us, 0 to disable */
+    double          bandwidth_if;       /* half bandwidth of the IF filter in Hz */
+    double          freq_dev;           /* full scale frequency deviation in Hz */
+    double          bandwidth_pcm;      /* audio bandwidth in Hz */
+    unsigned int    downsample;         /* baseband downsampling, 0 for automatic */
+    int             rds;                /* 1 to enable RDS decoding */
+} sfm_config;
+
+/** Signal metrics after the most recent call to sfm_process(). */
+typedef struct sfm_metrics
+{
+    double          if_level;           /* IF level (RMS, 1.0 = full scale) */
+    double          baseband_level;     /* baseband level (RMS, 1.0 = full deviation) */
+    double          pilot_level;        /* stereo pilot amplitude */
+    double          tuning_offset;      /* effective tuning offset in Hz */
+    int             stereo_detected;    /* 1 if the pilot PLL is locked */
+    int             squelch_open;       /* 1 unless the squelch is enabled and closed */
+    int             rds_synced;         /* 1 if RDS block sync is established */
+    int             rds_pi;             /* RDS program identification, -1 if unknown */
+    double          rds_bler;           /* RDS block error rate (0.0 .. 1.0) */
+    uint64_t        rds_groups;         /* number of valid RDS groups */
+    char            rds_ps[9];          /* RDS program service name */
+    char            rds_rt[65];         /* RDS radiotext */
+} sfm_metrics;
+
+/** Fill configuration with broadcast FM defaults for the given rates. */
+void sfm_config_init(sfm_config *config, double sample_rate_if, double sample_rate_pcm);
+
+/** Create decoder; return NULL if the configuration is invalid. */
+sfm_decoder *sfm_create(const sfm_config *config);
+
+/** Destroy decoder (NULL is allowed). */
+void sfm_destroy(sfm_decoder *dec);
+
+/**
+ * Return the audio buffer size (number of float values) that is always
+ * large enough for the output of n IQ samples.
+ */
+size_t sfm_max_audio_samples(const sfm_decoder *dec, size_t n);
+
+/**
+ * Decode n IQ samples (2*n floats, interleaved I and Q) and write the
+ * audio samples (interleaved L/R in stereo mode) to audio, which has
+ * room for audio_size floats.
+ *
+ * The first call warms up the decoder state from its input, so no
+ * start-up transient is produced.
+ * Return the number of floats written, or SFM_ERR_BUFFER if audio_size
+ * is less than sfm_max_audio_samples(n); nothing is consumed then.
+ */
+long sfm_process(sfm_decoder *dec, const float *iq, size_t n,
+                 float *audio, size_t audio_size);
+
+/**
+ * Decode n composite baseband (MPX) samples, sampled at the baseband
+ * rate (sfm_baseband_rate()) with 1.0 as full deviation. Runs only the
+ * stages after the FM discriminator. The decoder works in double
+ * precision, so the samples are converted once into an internal buffer.
+ * audio_size must be at least sfm_max_audio_samples(n * downsample);
+ * return value as sfm_process().
+ */
+long sfm_process_baseband(sfm_decoder *dec, const float *mpx, size_t n,
+                          float *audio, size_t audio_size);
+
+/** Return the composite baseband sample rate in Hz. */
+double sfm_baseband_rate(const sfm_decoder *dec);
+
+/** Get signal metrics. */
+int sfm_get_metrics(const sfm_decoder *dec, sfm_metrics *metrics);
+
+/**
+ * Copy the RDS events of the most recent call to sfm_process() as JSON
+ * lines, each terminated by a newline, with a terminating null byte.
+ * Return the length in bytes (without the null byte), or SFM_ERR_BUFFER
+ * if buf with size bytes is too small.
+ */
+long sfm_get_rds_events(const sfm_decoder *dec, char *buf, size_t size);
+
+/** Change the tuning offset in Hz, keeping all filter states. */
+int sfm_set_tuning_offset(sfm_decoder *dec, double tuning_offset);
+
+/** Enable (1) or disable (0) stereo decoding; output layout is unchanged. */
+int sfm_set_stereo(sfm_decoder *dec, int stereo);
+
+/**
+ * Enable (1) or disable (0) carrier squelch with minimum IF level in dB.
+ * While closed, silence is returned with the normal number of samples.
+ */
+int sfm_set_squelch(sfm_decoder *dec, int enable, double level_db);
+
+/**
+ * Save the complete decoder state to buf with size bytes. Return the
+ * state size in bytes; if it is larger than size, nothing is written
+ * (call with size 0 to query the size).
+ */
+long sfm_save_state(const sfm_decoder *dec, void *buf, size_t size);
+
+/** Restore decoder state saved by sfm_save_state() from a decoder with the same configuration. */
+int sfm_load_state(sfm_decoder *dec, const void *buf, size_t size);
+
+/*
+ * Signal processing stages.
+ *
+ * The building blocks of the decoder, for use on their own. A stage
+ * takes a block of n input samples and writes its output to a caller
+ * buffer. Complex (IQ) samples are passed as interleaved float pairs,
+ * real samples as floats. Each stage keeps its filter state between
+ * calls.
+ */
+
+/** Opaque stage handle. */
+typedef struct sfm_stage sfm_stage;
+
+/** Frequency shift of IQ samples by freq_shift (relative to the sample rate). */
+sfm_stage *sfm_stage_finetuner(double freq_shift);
+
+/** Low-pass FIR filter (Lanczos) for IQ samples, with integer decimation. */
+sfm_stage *sfm_stage_lowpass_iq(unsigned int order, double cutoff, unsigned int downsample);
+
+/** FM discriminator: IQ samples to frequency, 1.0 = max_freq_dev (relative). */
+sfm_stage *sfm_stage_discriminator(double max_freq_dev);
+
+/** Low-pass FIR filter for real samples, with integer or fractional decimation. */
+sfm_stage *sfm_stage_lowpass(unsigned int order, double cutoff, double downsample);
+
+/** Stereo pilot PLL: real baseband to phase-locked 38 kHz tone (relative frequencies). */
+sfm_stage *sfm_stage_pilot_pll(double freq, double bandwidth, double minsignal);
+
+/** First order low-pass (de-emphasis) with time constant in samples. */
+sfm_stage *sfm_stage_deemphasis(double timeconst);
+
+/** Second order Butterworth high-pass (relative cutoff). */
+sfm_stage *sfm_stage_highpass(double cutoff);
+
+/** Destroy stage (NULL is allowed). */
+void sfm_stage_destroy(sfm_stage *stage);
+
+/** Return 1 if the stage takes IQ input, 0 for real input. */
+int sfm_stage_input_iq(const sfm_stage *stage);
+
+/** Return 1 if the stage produces IQ output, 0 for real output. */
+int sfm_stage_output_iq(const sfm_stage *stage);
+
+/** Return the output buffer size (floats) that is always large enough for n input samples. */
+size_t sfm_stage_max_output(const sfm_stage *stage, size_t n);
+
+/**
+ * Process n input samples and write the output to out, which has room
+ * for out_size floats. Return the number of output samples (complex
+ * samples count once), or SFM_ERR_BUFFER if out_size is less than
+ * sfm_stage_max_output(n); nothing is consumed then. IQ input is read
+ * in place; real input is converted once to double precision.
+ */
+long sfm_stage_process(sfm_stage *stage, const float *in, size_t n,
+                       float *out, size_t out_size);
+
+/** Return a description of an error code. */
+const char *sfm_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_SOFTFM_C_H_ */
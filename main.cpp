@@ -25,6 +25,7 @@
 #include <algorithm>
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <unistd.h>
 #include <getopt.h>
@@ -35,16 +36,78 @@
 #include "DataBuffer.h"
 #include "FmDecode.h"
 #include "AudioOutput.h"
+#include "AudioInput.h"
+#include "IQConverter.h"
+#include "GainControl.h"
+#include "AudioMonitor.h"
+#include "IQOutput.h"
+#include "TimeShiftBuffer.h"
+#include "StationMonitor.h"
+#include "BandScanner.h"
+#include "ControlServer.h"
+#include "BatchDecoder.h"
+#include "parsekv.h"
 #include "MovingAverage.h"
 
 #include "RtlSdrSource.h"
 #include "HackRFSource.h"
 #include "AirspySource.h"
 #include "BladeRFSource.h"
+#include "FileSource.h"
+#include "SimSource.h"
+#include "DeviceGroup.h"
 
 /** Flag is set on SIGINT / SIGTERM. */
 static std::atomic_bool stop_flag(false);
 
+/** Flag is set on SIGUSR1 to request a time-shift buffer dump. */
+static std::atomic_bool dump_flag(false);
+
+
+/** Return Unix time stamp in seconds. */
+double get_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+
+/** Time-shift buffer settings (-Z option). */
+struct TimeShiftConfig
+{
+    std::string ringfile;
+    std::string prefix;
+    double      length;
+    double      post;
+    bool        on_pilot_loss;
+    double      silence;
+
+    TimeShiftConfig()
+        : ringfile("softfm-timeshift.ring")
+        , prefix("timeshift")
+        , length(120)
+        , post(5)
+        , on_pilot_loss(false)
+        , silence(0)
+    { }
+};
+
+
+/** Audio monitor settings (-E option). */
+struct AudioMonitorConfig
+{
+    double      silence_db;
+    double      silence_time;
+    double      imbalance_db;
+
+    AudioMonitorConfig()
+        : silence_db(AudioMonitor::default_silence_db)
+        , silence_time(AudioMonitor::default_silence_time)
+        , imbalance_db(AudioMonitor::default_imbalance_db)
+    { }
+};
+
 
 /** Simple linear gain adjustment. */
 void adjust_gain(SampleVector& samples, double gain)
@@ -87,186 +150,1308 @@ void write_output_data(AudioOutput *output, DataBuffer<Sample> *buf,
 }
 
 
-/** Handle Ctrl-C and SIGTERM. */
-static void handle_sigterm(int sig)
+/**
+ * Decode composite baseband (MPX) samples from a .WAV file.
+ *
+ * Only the stages after FM demodulation are run. Return exit status.
+ */
+static int decode_mpx_file(const std::string& filename,
+                           AudioOutput *output,
+                           unsigned int pcmrate,
+                           bool stereo,
+                           double bandwidth_pcm)
 {
-    stop_flag.store(true);
+    WavAudioInput input(filename);
 
-    std::string msg = "\nGot signal ";
-    msg += strsignal(sig);
-    msg += ", stopping ...\n";
+    if (!input)
+    {
+        fprintf(stderr, "ERROR: MPX input: %s\n", input.error().c_str());
+        return 1;
+    }
 
-    const char *s = msg.c_str();
-    write(STDERR_FILENO, s, strlen(s));
-}
+    double mpxrate = input.get_sample_rate();
+    fprintf(stderr, "decoding MPX file '%s' (%.0f S/s)\n", filename.c_str(), mpxrate);
 
+    // Decoder front end runs at the MPX rate and is not used.
+    FmDecoder fm(mpxrate,                           // sample_rate_if
+                 0,                                 // tuning_offset
+                 pcmrate,                           // sample_rate_pcm
+                 stereo,                            // stereo
+                 FmDecoder::default_deemphasis,     // deemphasis,
+                 FmDecoder::default_bandwidth_if,   // bandwidth_if
+                 FmDecoder::default_freq_dev,       // freq_dev
+                 bandwidth_pcm,                     // bandwidth_pcm
+                 1);                                // downsample
 
-void usage()
-{
-    fprintf(stderr,
-    "Usage: softfm [options]\n"
-            "  -t devtype     Device type:\n"
-            "                   - rtlsdr: RTL-SDR devices\n"
-            "                   - hackrf: HackRF One or Jawbreaker\n"
-            "                   - airspy: Airspy\n"
-            "                   - bladerf: BladeRF\n"
-            "  -c config      Comma separated key=value configuration pairs or just key for switches\n"
-            "                 See below for valid values per device type\n"
-            "  -d devidx      Device index, 'list' to show device list (default 0)\n"
-            "  -r pcmrate     Audio sample rate in Hz (default 48000 Hz)\n"
-            "  -M             Disable stereo decoding\n"
-            "  -R filename    Write audio data as raw S16_LE samples\n"
-            "                 use filename '-' to write to stdout\n"
-            "  -W filename    Write audio data to .WAV file\n"
-            "  -P [device]    Play audio via ALSA device (default 'default')\n"
-            "  -T filename    Write pulse-per-second timestamps\n"
-            "                 use filename '-' to write to stdout\n"
-            "  -b seconds     Set audio buffer size in seconds\n"
-            "\n"
-            "Configuration options for RTL-SDR devices\n"
-            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
-    		"                 valid values: 10M to 2.2G (working range depends on device)\n"
-            "  srate=<int>    IF sample rate in Hz (default 1000000)\n"
-            "                 (valid ranges: [225001, 300000], [900001, 3200000]))\n"
-            "  gain=<float>   Set LNA gain in dB, or 'auto',\n"
-            "                 or 'list' to just get a list of valid values (default auto)\n"
-            "  blklen=<int>   Set audio buffer size in seconds (default RTL-SDR default)\n"
-            "  agc            Enable RTL AGC mode (default disabled)\n"
-            "\n"
-            "Configuration options for HackRF devices\n"
-            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
-    		"                 valid values: 1M to 6G\n"
-            "  srate=<int>    IF sample rate in Hz (default 5000000)\n"
-            "                 (valid ranges: [2500000,20000000]))\n"
-            "  lgain=<int>    LNA gain in dB. 'list' to just get a list of valid values: (default 16)\n"
-            "  vgain=<int>    VGA gain in dB. 'list' to just get a list of valid values: (default 22)\n"
-            "  bwfilter=<int> Filter bandwidth in MHz. 'list' to just get a list of valid values: (default 2.5)\n"
-            "  extamp         Enable extra RF amplifier (default disabled)\n"
-            "  antbias        Enable antemma bias (default disabled)\n"
-            "\n"
-            "Configuration options for Airspy devices\n"
-            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
-    		"                 valid values: 24M to 1.8G\n"
-            "  srate=<int>    IF sample rate in Hz. Depends on Airspy firmware and libairspy support\n"
-    		"                 Airspy firmware and library must support dynamic sample rate query. (default 10000000)\n"
-            "  lgain=<int>    LNA gain in dB. 'list' to just get a list of valid values: (default 8)\n"
-            "  mgain=<int>    Mixer gain in dB. 'list' to just get a list of valid values: (default 8)\n"
-            "  vgain=<int>    VGA gain in dB. 'list' to just get a list of valid values: (default 8)\n"
-            "  antbias        Enable antemma bias (default disabled)\n"
-            "  lagc           Enable LNA AGC (default disabled)\n"
-            "  magc           Enable mixer AGC (default disabled)\n"
-            "\n"
-            "Configuration options for BladeRF devices\n"
-            "  freq=<int>     Frequency of radio station in Hz (default 300000000)\n"
-    		"                 valid values (with XB200): 100k to 3.8G\n"
-    		"                 valid values (without XB200): 300M to 3.8G\n"
-            "  srate=<int>    IF sample rate in Hz. Valid values: 48k to 40M (default 1000000)\n"
-            "  bw=<int>       Bandwidth in Hz. 'list' to just get a list of valid values: (default 1500000)\n"
-            "  lgain=<int>    LNA gain in dB. 'list' to just get a list of valid values: (default 3)\n"
-            "  v1gain=<int>   VGA1 gain in dB. 'list' to just get a list of valid values: (default 20)\n"
-            "  v2gain=<int>   VGA2 gain in dB. 'list' to just get a list of valid values: (default 9)\n"
-            "\n");
-}
+    SampleVector mpxsamples;
+    SampleVector audiosamples;
+    bool got_stereo = false;
 
+    for (unsigned int block = 0; !stop_flag.load(); block++)
+    {
+        if (!input.read(mpxsamples, 65536))
+        {
+            fprintf(stderr, "\nERROR: MPX input: %s\n", input.error().c_str());
+            return 1;
+        }
 
-void badarg(const char *label)
-{
-    usage();
-    fprintf(stderr, "ERROR: Invalid argument for %s\n", label);
-    exit(1);
-}
+        if (mpxsamples.empty())
+        {
+            break;
+        }
 
+        fm.process_baseband(mpxsamples, audiosamples);
 
-bool parse_int(const char *s, int& v, bool allow_unit=false)
-{
-    char *endp;
-    long t = strtol(s, &endp, 10);
-    if (endp == s)
-        return false;
-    if ( allow_unit && *endp == 'k' &&
-         t > INT_MIN / 1000 && t < INT_MAX / 1000 ) {
-        t *= 1000;
-        endp++;
+        // Set nominal audio volume.
+        adjust_gain(audiosamples, 0.5);
+
+        fprintf(stderr, "\rblk=%6d  BB=%+5.1fdB  pilot=%5.3f ",
+                block,
+                20*log10(fm.get_baseband_level()) + 3.01,
+                fm.get_pilot_level());
+        fflush(stderr);
+
+        if (fm.stereo_detected() != got_stereo)
+        {
+            got_stereo = fm.stereo_detected();
+            fprintf(stderr, got_stereo ? "\ngot stereo signal\n" : "\nlost stereo signal\n");
+        }
+
+        if (!output->write(audiosamples))
+        {
+            fprintf(stderr, "\nERROR: AudioOutput: %s\n", output->error().c_str());
+            return 1;
+        }
     }
-    if (*endp != '\0' || t < INT_MIN || t > INT_MAX)
-        return false;
-    v = t;
-    return true;
+
+    fprintf(stderr, "\n");
+    return 0;
 }
 
 
-/** Return Unix time stamp in seconds. */
-double get_time()
+/**
+ * Parse list of stations to monitor (-L option).
+ *
+ * Either a comma separated list of frequencies in Hz (with optional
+ * k, M, G suffix), "all" for every 100 kHz channel within the usable
+ * IF bandwidth around the tuner frequency, or "index" for all stations
+ * of the loaded station index. With check_band, listed frequencies
+ * outside the usable IF bandwidth are rejected.
+ */
+static bool parse_station_list(const std::string& list,
+                               double tuner_freq,
+                               double ifrate,
+                               const StationIndex& index,
+                               std::vector<double>& stations,
+                               bool check_band=false)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + 1.0e-6 * tv.tv_usec;
-}
+    stations.clear();
 
-static bool get_device(std::vector<std::string> &devnames, std::string& devtype, Source **srcsdr, int devidx)
-{
-    if (strcasecmp(devtype.c_str(), "rtlsdr") == 0)
-    {
-        RtlSdrSource::get_device_names(devnames);
-    }
-    else if (strcasecmp(devtype.c_str(), "hackrf") == 0)
+    if (list == "index")
     {
-        HackRFSource::get_device_names(devnames);
+        for (const StationInfo& st : index.stations())
+        {
+            stations.push_back(st.frequency);
+        }
+
+        return !stations.empty();
     }
-    else if (strcasecmp(devtype.c_str(), "airspy") == 0)
+
+    if (list == "all")
     {
-        AirspySource::get_device_names(devnames);
+        // Keep channel filter clear of the IF band edges.
+        double span = FmDecoder::max_tuning_offset(ifrate);
+        double step = 100.0e3;
+        double f = ceil((tuner_freq - span) / step) * step;
+
+        for (; f <= tuner_freq + span; f += step)
+        {
+            stations.push_back(f);
+        }
+
+        return !stations.empty();
     }
-    else if (strcasecmp(devtype.c_str(), "bladerf") == 0)
+
+    std::string::size_type p = 0;
+
+    while (p <= list.size())
     {
-        BladeRFSource::get_device_names(devnames);
+        std::string::size_type q = list.find(',', p);
+        if (q == std::string::npos)
+            q = list.size();
+
+        double f;
+        std::string item = list.substr(p, q - p);
+
+        if (!parse_dbl(item.c_str(), f) || f <= 0)
+            return false;
+
+        if (check_band && fabs(f - tuner_freq) > FmDecoder::max_tuning_offset(ifrate))
+        {
+            fprintf(stderr, "ERROR: station %.3f MHz is outside the IF bandwidth\n",
+                    f * 1.0e-6);
+            return false;
+        }
+
+        stations.push_back(f);
+        p = q + 1;
     }
-    else
+
+    return !stations.empty();
+}
+
+
+/** Device feeding the RDS monitor and the stations routed to it. */
+struct MonitorDevice
+{
+    Source                  *source;
+    DataBuffer<IQSample>    *buffer;
+    double                  tuner_freq;
+    double                  ifrate;
+    unsigned int            nthreads;
+    std::vector<std::unique_ptr<StationMonitor>> monitors;
+    std::atomic<unsigned int> blocks;
+    std::atomic<unsigned int> nsync;
+
+    MonitorDevice(Source *src, DataBuffer<IQSample> *buf)
+      : source(src), buffer(buf),
+        tuner_freq(src->get_frequency()), ifrate(src->get_sample_rate()),
+        nthreads(1), blocks(0), nsync(0)
+    { }
+};
+
+
+/**
+ * Process the stations of one device until its stream ends.
+ * Output lines are written under the lock of rdsfile.
+ */
+static void monitor_device(MonitorDevice& dev, FILE *rdsfile, std::mutex& rdsfile_mutex)
+{
+    std::vector<std::unique_ptr<StationMonitor>>& monitors = dev.monitors;
+    unsigned int nthreads = dev.nthreads;
+    bool inbuf_length_warning = false;
+    double status_samples = 0;
+
+    // Start persistent workers; worker t handles every nthreads-th
+    // station starting at t. Each block is passed by pointer, and the
+    // device thread waits for all workers before it pulls the next block.
+    std::vector<std::unique_ptr<DataBuffer<const IQSampleVector*>>> work_buffers;
+    DataBuffer<unsigned int> done_buffer;
+    std::vector<std::thread> workers;
+
+    for (unsigned int t = 1; t < nthreads; t++)
     {
-        fprintf(stderr, "ERROR: wrong device type (-t option) must be one of the following:\n");
-        fprintf(stderr, "       rtlsdr, hackrf, airspy, bladerf\n");
-        return false;
+        work_buffers.emplace_back(new DataBuffer<const IQSampleVector*>());
+        DataBuffer<const IQSampleVector*> *work = work_buffers.back().get();
+
+        workers.emplace_back([&monitors, &done_buffer, work, t, nthreads]() {
+            while (true)
+            {
+                std::vector<const IQSampleVector*> block = work->pull();
+
+                if (block.empty())
+                    break;
+
+                for (unsigned int i = t; i < monitors.size(); i += nthreads)
+                    monitors[i]->process(*block[0]);
+
+                done_buffer.push(std::vector<unsigned int>(1, t));
+            }
+        });
     }
 
-    if (devidx < 0 || (unsigned int)devidx >= devnames.size())
+    while (!stop_flag.load())
     {
-        if (devidx != -1)
+        // Check for overflow of source buffer.
+        if (!inbuf_length_warning && dev.buffer->queued_samples() > 10 * dev.ifrate)
         {
-            fprintf(stderr, "ERROR: invalid device index %d\n", devidx);
+            fprintf(stderr, "\nWARNING: Input buffer of %s is growing (system too slow)\n",
+                    dev.source->get_device_name().c_str());
+            inbuf_length_warning = true;
         }
 
-        fprintf(stderr, "Found %u devices:\n", (unsigned int)devnames.size());
+        // Pull next block from source buffer.
+        IQSampleVector iqsamples = dev.buffer->pull();
 
-        for (unsigned int i = 0; i < devnames.size(); i++)
+        if (iqsamples.empty())
         {
-            fprintf(stderr, "%2u: %s\n", i, devnames[i].c_str());
+            break;
         }
 
-        return false;
-    }
+        // Hand the block to the workers and process the first share here.
+        for (std::unique_ptr<DataBuffer<const IQSampleVector*>>& work : work_buffers)
+        {
+            work->push(std::vector<const IQSampleVector*>(1, &iqsamples));
+        }
 
-    fprintf(stderr, "using device %d: %s\n", devidx, devnames[devidx].c_str());
+        for (unsigned int i = 0; i < monitors.size(); i += nthreads)
+        {
+            monitors[i]->process(iqsamples);
+        }
 
-    if (strcasecmp(devtype.c_str(), "rtlsdr") == 0)
-    {
-        // Open RTL-SDR device.
-        *srcsdr = new RtlSdrSource(devidx);
+        for (unsigned int t = 1; t < nthreads; t++)
+        {
+            done_buffer.pull();
+        }
+
+        std::lock_guard<std::mutex> lock(rdsfile_mutex);
+
+        // Write group data and events.
+        for (const std::unique_ptr<StationMonitor>& m : monitors)
+        {
+            for (const std::string& line : m->get_group_lines())
+            {
+                fprintf(rdsfile, "%s\n", line.c_str());
+            }
+        }
+
+        // Write lock and quality metrics once per second.
+        status_samples += iqsamples.size();
+
+        if (status_samples >= dev.ifrate)
+        {
+            status_samples -= dev.ifrate;
+            unsigned int nsync = 0;
+
+            for (const std::unique_ptr<StationMonitor>& m : monitors)
+            {
+                fprintf(rdsfile, "%s\n", m->get_status_line().c_str());
+                nsync += m->get_rds().synced() ? 1 : 0;
+            }
+
+            dev.nsync.store(nsync);
+        }
+
+        fflush(rdsfile);
+        dev.blocks++;
     }
-    else if (strcasecmp(devtype.c_str(), "hackrf") == 0)
+
+    // Stop the workers.
+    for (std::unique_ptr<DataBuffer<const IQSampleVector*>>& work : work_buffers)
     {
-        // Open HackRF device.
-        *srcsdr = new HackRFSource(devidx);
+        work->push_end();
     }
-    else if (strcasecmp(devtype.c_str(), "airspy") == 0)
+
+    for (std::thread& w : workers)
     {
-        // Open Airspy device.
-        *srcsdr = new AirspySource(devidx);
+        w.join();
     }
-    else if (strcasecmp(devtype.c_str(), "bladerf") == 0)
-    {
-        // Open BladeRF device.
+}
+
+
+/**
+ * Monitor RDS of several stations within the tuned bandwidth of one
+ * or more devices.
+ *
+ * No audio is decoded. Group data, decoded events and once per second
+ * lock and quality metrics are written as JSON lines. Each station is
+ * routed to the device that covers it with the widest margin. Each
+ * device is processed by its own thread, and its stations in parallel
+ * by worker threads, one per group of stations. Return exit status.
+ */
+static int run_rds_monitor(const std::vector<double>& stations,
+                           std::vector<std::unique_ptr<MonitorDevice>>& devices,
+                           bool squelch,
+                           double squelch_level,
+                           FILE *rdsfile)
+{
+    unsigned int nstations = 0;
+
+    for (double f : stations)
+    {
+        MonitorDevice *best = NULL;
+        double best_margin = 0;
+
+        for (std::unique_ptr<MonitorDevice>& dev : devices)
+        {
+            double margin = FmDecoder::max_tuning_offset(dev->ifrate) -
+                            fabs(f - dev->tuner_freq);
+
+            if (margin >= 0 && (best == NULL || margin > best_margin))
+            {
+                best = dev.get();
+                best_margin = margin;
+            }
+        }
+
+        if (best == NULL)
+        {
+            fprintf(stderr, "WARNING: station %.3f MHz is outside the IF bandwidth, skipped\n",
+                    f * 1.0e-6);
+            continue;
+        }
+
+        best->monitors.emplace_back(new StationMonitor(best->ifrate, f - best->tuner_freq, f));
+        nstations++;
+
+        if (squelch)
+        {
+            best->monitors.back()->set_squelch(squelch_level);
+        }
+    }
+
+    if (nstations == 0)
+    {
+        fprintf(stderr, "ERROR: no stations to monitor\n");
+        return 1;
+    }
+
+    // Share the worker threads among devices by number of stations.
+    unsigned int nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (std::unique_ptr<MonitorDevice>& dev : devices)
+    {
+        unsigned int n = dev->monitors.size();
+        dev->nthreads = std::max(1u, std::min(n, nthreads * n / nstations));
+
+        if (devices.size() > 1)
+        {
+            fprintf(stderr, "%s: %u stations\n",
+                    dev->source->get_device_name().c_str(), n);
+        }
+    }
+
+    fprintf(stderr, "monitoring RDS of %u stations on %u devices\n",
+            nstations, (unsigned int)devices.size());
+
+    std::mutex rdsfile_mutex;
+    std::vector<std::thread> device_threads;
+
+    for (std::unique_ptr<MonitorDevice>& dev : devices)
+    {
+        device_threads.emplace_back(monitor_device, std::ref(*dev),
+                                    rdsfile, std::ref(rdsfile_mutex));
+    }
+
+    // Report progress until all device streams have ended.
+    unsigned int nactive = devices.size();
+
+    for (unsigned int tick = 1; nactive > 0 && !stop_flag.load(); tick++)
+    {
+        usleep(100000);
+
+        nactive = 0;
+
+        for (std::unique_ptr<MonitorDevice>& dev : devices)
+        {
+            nactive += dev->buffer->pull_end_reached() ? 0 : 1;
+        }
+
+        if (tick % 10 != 0 && nactive > 0)
+        {
+            continue;
+        }
+
+        unsigned int nsync = 0;
+        std::string dropped;
+
+        for (std::unique_ptr<MonitorDevice>& dev : devices)
+        {
+            nsync += dev->nsync.load();
+            dropped += (dropped.empty() ? "" : "/") +
+                       std::to_string(dev->source->get_dropped_samples());
+        }
+
+        fprintf(stderr, "\rblk=%6u  stations=%u  rds_sync=%u  dropped=%s ",
+                devices[0]->blocks.load(), nstations, nsync, dropped.c_str());
+        fflush(stderr);
+    }
+
+    for (std::thread& t : device_threads)
+    {
+        t.join();
+    }
+
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+
+/**
+ * Discard queued samples after retuning and wait until the tuner
+ * has settled. Return false at end of stream.
+ */
+static bool discard_after_retune(DataBuffer<IQSample>& source_buffer,
+                                 std::size_t settle_samples)
+{
+    while (source_buffer.queued_samples() > 0)
+    {
+        source_buffer.pull();
+    }
+
+    std::size_t discarded = 0;
+
+    while (discarded < settle_samples && !stop_flag.load())
+    {
+        IQSampleVector iqsamples = source_buffer.pull();
+
+        if (iqsamples.empty())
+        {
+            return false;
+        }
+
+        discarded += iqsamples.size();
+    }
+
+    return true;
+}
+
+
+/**
+ * Measure tuner settling at the start of a visit.
+ *
+ * The channel level of the station is measured in short windows. Samples
+ * still coming from the previous tuner frequency show a different level;
+ * the settling time ends after the last window that is more than 3 dB
+ * off the final level. Return the number of settling samples, or -1 if
+ * the first window is within 6 dB of the final level, so that the old
+ * and new frequency can not be told apart.
+ */
+static long measure_settle(const IQSampleVector& samples,
+                           double ifrate,
+                           double tuning_offset)
+{
+    const unsigned int wlen = 1024;
+    unsigned int nwin = samples.size() / wlen;
+
+    if (nwin < 8)
+    {
+        return -1;
+    }
+
+    StationMonitor mon(ifrate, tuning_offset, 0);
+    std::vector<double> levels(nwin);
+
+    for (unsigned int i = 0; i < nwin; i++)
+    {
+        IQSampleVector w(samples.begin() + i * wlen, samples.begin() + (i + 1) * wlen);
+        mon.process(w);
+        levels[i] = 20 * log10(std::max(mon.get_block_level(), 1.0e-10));
+    }
+
+    // Final level is the median of the second half.
+    std::vector<double> tail(levels.begin() + nwin / 2, levels.end());
+    std::nth_element(tail.begin(), tail.begin() + tail.size() / 2, tail.end());
+    double final_db = tail[tail.size() / 2];
+
+    if (fabs(levels[0] - final_db) < 6)
+    {
+        return -1;
+    }
+
+    unsigned int last = 0;
+    for (unsigned int i = 0; i < nwin / 2; i++)
+    {
+        if (fabs(levels[i] - final_db) > 3)
+            last = i + 1;
+    }
+
+    return long(last) * wlen;
+}
+
+
+/**
+ * Monitor stations in turn with a single tuner (-H option).
+ *
+ * The tuner visits each station for dwell seconds. After retuning, the
+ * queued samples of the previous frequency and the measured tuner
+ * settling samples are discarded; the settling time is measured during
+ * the first cycle. Each visit reports level, pilot, audio quality and
+ * RDS PI as one JSON line. Return exit status.
+ */
+static int run_round_robin(const std::vector<double>& stations,
+                           Source *srcsdr,
+                           double ifrate,
+                           double lo_offset,
+                           double dwell,
+                           DataBuffer<IQSample>& source_buffer,
+                           FILE *outfile)
+{
+    const double probe = 0.25;
+    std::vector<std::unique_ptr<StationMonitor>> monitors;
+
+    for (double f : stations)
+    {
+        monitors.emplace_back(new StationMonitor(ifrate, -lo_offset, f));
+    }
+
+    std::size_t dwell_samples = dwell * ifrate;
+    std::size_t settle = 0;
+    long settle_measured = -1;
+    std::uint64_t visits = 0;
+    double start_time = get_time();
+
+    fprintf(stderr, "round-robin over %u stations, dwell %.3f s\n",
+            (unsigned int)stations.size(), dwell);
+
+    for (unsigned int cycle = 0; !stop_flag.load(); cycle++)
+    {
+        bool calibrating = (cycle == 0);
+
+        for (unsigned int i = 0; i < monitors.size() && !stop_flag.load(); i++)
+        {
+            double f = monitors[i]->get_frequency();
+
+            if (!srcsdr->set_frequency(lrint(f + lo_offset)))
+            {
+                fprintf(stderr, "\nERROR: source: %s\n", srcsdr->error().c_str());
+                return 1;
+            }
+
+            // Samples queued before the retune are from the old frequency.
+            std::size_t discarded = 0;
+
+            while (source_buffer.queued_samples() > 0)
+            {
+                discarded += source_buffer.pull().size();
+            }
+
+            // Collect settling samples (or a probe to measure them) and the dwell.
+            std::size_t skip = calibrating ? 0 : settle;
+            std::size_t need = skip + dwell_samples + (calibrating ? probe * ifrate : 0);
+            IQSampleVector visit;
+
+            while (visit.size() < need && !stop_flag.load())
+            {
+                IQSampleVector iqsamples = source_buffer.pull();
+
+                if (iqsamples.empty())
+                {
+                    return 0;
+                }
+
+                visit.insert(visit.end(), iqsamples.begin(), iqsamples.end());
+            }
+
+            if (visit.size() < need)
+            {
+                break;
+            }
+
+            if (calibrating)
+            {
+                long t = measure_settle(visit, ifrate, -lo_offset);
+                settle_measured = std::max(settle_measured, t);
+                skip = probe * ifrate;
+            }
+
+            // Measure this visit.
+            IQSampleVector dwellsamples(visit.begin() + skip,
+                                        visit.begin() + skip + dwell_samples);
+            StationMonitor& mon = *monitors[i];
+            mon.process(dwellsamples);
+            visits++;
+
+            char pi[8] = "null";
+            if (mon.get_rds().get_pi() >= 0)
+                snprintf(pi, sizeof(pi), "\"%04X\"", mon.get_rds().get_pi() & 0xffff);
+
+            fprintf(outfile,
+                    "{\"freq\":%.0f,\"cycle\":%u,\"discarded\":%lu,\"settle\":%lu,"
+                    "\"if_db\":%.1f,\"pilot_snr\":%.1f,\"noise_db\":%.1f,"
+                    "\"rds_sync\":%s,\"pi\":%s}\n",
+                    f, cycle, (unsigned long)discarded, (unsigned long)skip,
+                    20 * log10(std::max(mon.get_block_level(), 1.0e-10)),
+                    mon.get_pilot_snr(), mon.get_noise_level(),
+                    mon.get_rds().synced() ? "true" : "false", pi);
+        }
+
+        fflush(outfile);
+
+        if (calibrating)
+        {
+            if (settle_measured >= 0)
+            {
+                settle = settle_measured;
+                fprintf(stderr, "measured tuner settling: %lu samples (%.1f ms)\n",
+                        (unsigned long)settle, 1.0e3 * settle / ifrate);
+            }
+            else
+            {
+                settle = 0.05 * ifrate;
+                fprintf(stderr, "WARNING: can not measure tuner settling, "
+                                "discarding %.0f ms\n", 1.0e3 * settle / ifrate);
+            }
+        }
+
+        fprintf(stderr, "\rcycle=%u  visits/s=%.1f ", cycle,
+                visits / std::max(get_time() - start_time, 1.0e-3));
+        fflush(stderr);
+    }
+
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+
+/**
+ * Scan the FM broadcast band and write a station index (--scan option).
+ *
+ * The tuner is stepped across the band. For each tuner window the FFT
+ * power spectrum gives the carriers, then each carrier is checked for
+ * stereo pilot and RDS PI. Return exit status.
+ */
+static int run_band_scan(Source *srcsdr,
+                         double ifrate,
+                         DataBuffer<IQSample>& source_buffer,
+                         const std::string& filename)
+{
+    const double band_min = 87.5e6;
+    const double band_max = 108.0e6;
+    const double dwell    = 1.5;
+    const double settle   = 0.1;
+    const double step     = BandScanner::channel_step;
+
+    BandScanner scanner(ifrate);
+    StationIndex index;
+
+    // Tune between channels to keep the DC spike off the carriers.
+    // Each window covers nch channels symmetrically around its center.
+    double span = scanner.get_usable_span();
+
+    if (span < 0.5 * step)
+    {
+        fprintf(stderr, "ERROR: sample rate too low for scanning\n");
+        return 1;
+    }
+
+    int nch = 2 * (int((span - 0.5 * step) / step) + 1);
+    double center = band_min - 0.5 * step + 0.5 * nch * step;
+
+    fprintf(stderr, "scanning %.1f - %.1f MHz, %d channels per window\n",
+            band_min * 1.0e-6, band_max * 1.0e-6, nch);
+
+    for (; center - 0.5 * nch * step < band_max && !stop_flag.load();
+         center += nch * step)
+    {
+        if (!srcsdr->set_frequency(lrint(center)))
+        {
+            fprintf(stderr, "\nERROR: source: %s\n", srcsdr->error().c_str());
+            return 1;
+        }
+
+        if (!discard_after_retune(source_buffer, settle * ifrate))
+        {
+            break;
+        }
+
+        // Collect samples for this window.
+        IQSampleVector window;
+
+        while (window.size() < dwell * ifrate && !stop_flag.load())
+        {
+            IQSampleVector iqsamples = source_buffer.pull();
+
+            if (iqsamples.empty())
+            {
+                break;
+            }
+
+            window.insert(window.end(), iqsamples.begin(), iqsamples.end());
+        }
+
+        scanner.reset();
+        scanner.process(window);
+
+        fprintf(stderr, "\rwindow %.3f MHz ", center * 1.0e-6);
+        fflush(stderr);
+
+        // Check pilot and RDS of each carrier.
+        for (StationInfo& st : scanner.find_carriers(center, band_min, band_max))
+        {
+            StationMonitor mon(ifrate, st.frequency - center, st.frequency);
+
+            for (std::size_t p = 0; p < window.size(); p += 65536)
+            {
+                IQSampleVector blk(window.begin() + p,
+                                   window.begin() + std::min(window.size(), p + 65536));
+                mon.process(blk);
+            }
+
+            st.pilot = mon.pilot_locked();
+            st.pi = mon.get_rds().get_pi();
+            index.add(st);
+
+            char pi[8] = "-";
+            if (st.pi >= 0)
+                snprintf(pi, sizeof(pi), "%04X", st.pi & 0xffff);
+
+            fprintf(stderr, "\r%8.1f MHz  %+6.1f dB  %-6s  PI=%s\n",
+                    st.frequency * 1.0e-6, st.level,
+                    st.pilot ? "stereo" : "mono", pi);
+        }
+    }
+
+    fprintf(stderr, "\nfound %u stations, writing index to '%s'\n",
+            (unsigned int)index.stations().size(), filename.c_str());
+
+    if (!index.save(filename))
+    {
+        fprintf(stderr, "ERROR: station index: %s\n", index.error().c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Decode an IQ archive in parallel chunks (-B option).
+ *
+ * Chunks are decoded on all cores and written in order to the audio
+ * output (and RDS events to rdsfile). With verify set, a sequential
+ * decode runs alongside and the stitched output is compared with it.
+ * Return exit status.
+ */
+static int run_batch_decode(FileSource *filesrc,
+                            BatchDecoder::DecoderFactory factory,
+                            double ifrate,
+                            unsigned int pcmrate,
+                            unsigned int downsample,
+                            bool stereo,
+                            double chunk_secs,
+                            bool verify,
+                            AudioOutput *audio_output,
+                            FILE *rdsfile)
+{
+    // Warm-up covers filter start-up and pilot PLL lock.
+    const double warmup_secs = 2.0;
+    const double verify_tolerance = 1.0e-3;
+
+    unsigned int nchannel = stereo ? 2 : 1;
+    std::uint64_t align = BatchDecoder::alignment(lrint(ifrate), pcmrate, downsample);
+    unsigned int nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+    auto make_batch = [&]()
+    {
+        return new BatchDecoder(filesrc->get_filename(),
+                                filesrc->get_start_index(),
+                                filesrc->get_num_samples(),
+                                llrint(chunk_secs * ifrate),
+                                llrint(warmup_secs * ifrate),
+                                align, nchannel, factory);
+    };
+
+    std::unique_ptr<BatchDecoder> batch(make_batch());
+    fprintf(stderr, "batch decoding %u chunks of %.1f s on %u threads\n",
+            batch->num_chunks(), chunk_secs, nthreads);
+
+    // Run the sequential reference decode in the background.
+    std::unique_ptr<BatchDecoder> reference;
+    DataBuffer<Sample> reference_buffer;
+    std::thread reference_thread;
+    SampleVector refsamples;
+    double maxdiff = 0, sumdiff2 = 0;
+    std::uint64_t ncompared = 0;
+    bool length_mismatch = false;
+
+    if (verify)
+    {
+        reference.reset(make_batch());
+        reference_thread = std::thread([&]()
+        {
+            reference->run_sequential([&](const BatchDecoder::Chunk& chunk)
+            {
+                reference_buffer.push(SampleVector(chunk.audio));
+                return true;
+            }, &stop_flag);
+            reference_buffer.push_end();
+        });
+    }
+
+    double t0 = get_time();
+
+    bool ok = batch->run(nthreads, [&](const BatchDecoder::Chunk& chunk)
+    {
+        if (verify)
+        {
+            while (refsamples.size() < chunk.audio.size())
+            {
+                SampleVector buf = reference_buffer.pull();
+                if (buf.empty())
+                    break;
+                refsamples.insert(refsamples.end(), buf.begin(), buf.end());
+            }
+
+            std::size_t n = std::min(refsamples.size(), chunk.audio.size());
+            length_mismatch |= (n < chunk.audio.size());
+
+            for (std::size_t i = 0; i < n; i++)
+            {
+                double d = fabs(chunk.audio[i] - refsamples[i]);
+                maxdiff = std::max(maxdiff, d);
+                sumdiff2 += d * d;
+            }
+
+            ncompared += n;
+            refsamples.erase(refsamples.begin(), refsamples.begin() + n);
+        }
+
+        SampleVector audiosamples(chunk.audio);
+        adjust_gain(audiosamples, 0.5);
+
+        if (!audio_output->write(audiosamples))
+        {
+            fprintf(stderr, "\nERROR: AudioOutput: %s\n", audio_output->error().c_str());
+            return false;
+        }
+
+        if (rdsfile != NULL)
+        {
+            for (const std::string& line : chunk.rds_events)
+            {
+                fprintf(rdsfile, "%s\n", line.c_str());
+            }
+
+            fflush(rdsfile);
+        }
+
+        fprintf(stderr, "\rchunk %u / %u", chunk.index + 1, batch->num_chunks());
+        fflush(stderr);
+        return true;
+    }, &stop_flag);
+
+    fprintf(stderr, "\n");
+
+    if (!ok)
+    {
+        fprintf(stderr, "ERROR: batch decode: %s\n", batch->error().c_str());
+    }
+    else
+    {
+        fprintf(stderr, "decoded in %.1f s\n", get_time() - t0);
+    }
+
+    if (verify)
+    {
+        if (!ok)
+            stop_flag.store(true);
+
+        reference_thread.join();
+
+        // Any reference samples left over mean the lengths differ.
+        length_mismatch |= !refsamples.empty() || !reference_buffer.pull().empty();
+
+        if (ok && !(*reference))
+        {
+            fprintf(stderr, "ERROR: sequential decode: %s\n", reference->error().c_str());
+            return 1;
+        }
+
+        if (ok)
+        {
+            double rmsdiff = sqrt(sumdiff2 / std::max<std::uint64_t>(ncompared, 1));
+            fprintf(stderr, "verify: %lu samples, max difference %.2e, rms difference %.2e%s\n",
+                    (unsigned long)ncompared, maxdiff, rmsdiff,
+                    length_mismatch ? ", LENGTH MISMATCH" : "");
+
+            if (length_mismatch || maxdiff > verify_tolerance)
+            {
+                fprintf(stderr, "ERROR: batch output differs from sequential decode\n");
+                return 1;
+            }
+        }
+    }
+
+    return ok ? 0 : 1;
+}
+
+
+/** Handle SIGUSR1. */
+static void handle_sigusr1(int)
+{
+    dump_flag.store(true);
+}
+
+
+/** Handle Ctrl-C and SIGTERM. */
+static void handle_sigterm(int sig)
+{
+    stop_flag.store(true);
+
+    std::string msg = "\nGot signal ";
+    msg += strsignal(sig);
+    msg += ", stopping ...\n";
+
+    const char *s = msg.c_str();
+    write(STDERR_FILENO, s, strlen(s));
+}
+
+
+void usage()
+{
+    fprintf(stderr,
+    "Usage: softfm [options]\n"
+            "  -t devtype     Device type:\n"
+            "                   - rtlsdr: RTL-SDR devices\n"
+            "                   - hackrf: HackRF One or Jawbreaker\n"
+            "                   - airspy: Airspy\n"
+            "                   - bladerf: BladeRF\n"
+            "                   - file: replay IQ archive file (see -A)\n"
+            "                   - sim: simulated device with impairments (no hardware)\n"
+            "  -c config      Comma separated key=value configuration pairs or just key for switches\n"
+            "                 See below for valid values per device type\n"
+            "                 repeat once per device when several devices are given\n"
+            "  -d devidx      Device index, 'list' to show device list (default 0)\n"
+            "                 comma separated indexes to monitor several devices with -L\n"
+            "  -r pcmrate     Audio sample rate in Hz (default 48000 Hz)\n"
+            "  -M             Disable stereo decoding\n"
+            "  -R filename    Write audio data as raw S16_LE samples\n"
+            "                 use filename '-' to write to stdout\n"
+            "  -W filename    Write audio data to .WAV file\n"
+            "  -P [device]    Play audio via ALSA device (default 'default')\n"
+            "  -T filename    Write pulse-per-second timestamps\n"
+            "                 use filename '-' to write to stdout\n"
+            "  -Q filename    Measure guard band noise, pilot SNR, RDS and ultrasonic levels\n"
+            "                 and write them once per second as JSON lines ('-' for stdout)\n"
+            "  -b seconds     Set audio buffer size in seconds\n"
+            "  -I filename    Write channel filtered and decimated IQ samples\n"
+            "                 (~ 250 kS/s) with SigMF metadata in filename.sigmf-meta\n"
+            "  -F format      Sample format for -I: cf32 or cs16 (default cf32)\n"
+            "  -A filename    Write device IQ samples to lossless compressed archive\n"
+            "  -X filename    Write composite baseband (MPX) signal as 32-bit float .WAV file\n"
+            "                 (~ 200 kS/s), use extension .raw or '-' for raw float samples\n"
+            "  -m filename    Decode MPX .WAV file (as written with -X) instead of a device\n"
+            "  -j filename    Decode RDS and write PI/PS/RT/CT as JSON lines\n"
+            "                 use filename '-' to write to stdout\n"
+            "  -S filename    Scan 87.5 - 108 MHz and write station index file (no audio)\n"
+            "  -k filename    Load station index file (written with -S): without freq=\n"
+            "                 in -c tune to the strongest station, use -L index to monitor all\n"
+            "  -C path        Accept runtime control commands on Unix socket path (see below)\n"
+            "  -B seconds     Decode an IQ archive (-t file) in parallel chunks of this length\n"
+            "                 on all cores and stitch the output\n"
+            "  -V             With -B, also decode sequentially and verify the output\n"
+            "  -K filename    Restore decoder state from file at start (if it exists) and save\n"
+            "                 it there at exit, to resume a decode without re-acquisition\n"
+            "  -H stations    Visit stations in turn with one tuner (list as for -L) and write\n"
+            "                 level, pilot, noise and RDS PI per visit as JSON lines to -j\n"
+            "  -w seconds     Dwell time per station for -H (default 0.2)\n"
+            "  -G headroom    Software gain control: step the device gains to hold the ADC\n"
+            "                 RMS level this many dB below full scale (e.g. 15)\n"
+            "  -q level       Carrier squelch: mute and skip demodulation while the IF level\n"
+            "                 is below level in dB (e.g. -40) or the channel carries only noise\n"
+            "  -L stations    Monitor RDS only (no audio) of stations within the tuned bandwidth\n"
+            "                 comma separated frequencies in Hz or 'all' for every 100 kHz channel,\n"
+            "                 write group data and quality metrics as JSON lines to -j (default stdout)\n"
+            "  -E config      Audio monitor thresholds for dead air and channel imbalance\n"
+            "                 (see below); events go to stderr, -Q and control clients\n"
+            "  -Z config      Keep channel IQ samples in a disk-backed time-shift buffer and\n"
+            "                 dump it on SIGUSR1 or on configured events (see below)\n"
+            "\n"
+            "Configuration options for RTL-SDR devices\n"
+            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
+    		"                 valid values: 10M to 2.2G (working range depends on device)\n"
+            "  srate=<int>    IF sample rate in Hz (default 1000000)\n"
+            "                 (valid ranges: [225001, 300000], [900001, 3200000]))\n"
+            "                 'auto' for the cheapest rate and block length for the stations\n"
+            "  gain=<float>   Set LNA gain in dB, or 'auto',\n"
+            "                 or 'list' to just get a list of valid values (default auto)\n"
+            "  blklen=<int>   Set audio buffer size in seconds (default RTL-SDR default)\n"
+            "  agc            Enable RTL AGC mode (default disabled)\n"
+            "  zeroif         Tune the station near the centre (DC and I/Q corrected)\n"
+            "\n"
+            "Configuration options for HackRF devices\n"
+            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
+    		"                 valid values: 1M to 6G\n"
+            "  srate=<int>    IF sample rate in Hz (default 5000000)\n"
+            "                 (valid ranges: [2500000,20000000]))\n"
+            "                 'auto' for the cheapest rate for the stations\n"
+            "  lgain=<int>    LNA gain in dB. 'list' to just get a list of valid values: (default 16)\n"
+            "  vgain=<int>    VGA gain in dB. 'list' to just get a list of valid values: (default 22)\n"
+            "  bwfilter=<int> Filter bandwidth in MHz. 'list' to just get a list of valid values: (default 2.5)\n"
+            "  extamp         Enable extra RF amplifier (default disabled)\n"
+            "  antbias        Enable antemma bias (default disabled)\n"
+            "  zeroif         Tune the station near the centre (DC and I/Q corrected)\n"
+            "\n"
+            "Configuration options for Airspy devices\n"
+            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
+    		"                 valid values: 24M to 1.8G\n"
+            "  srate=<int>    IF sample rate in Hz. Depends on Airspy firmware and libairspy support\n"
+    		"                 Airspy firmware and library must support dynamic sample rate query. (default 10000000)\n"
+            "                 'auto' for the cheapest rate for the stations\n"
+            "  lgain=<int>    LNA gain in dB. 'list' to just get a list of valid values: (default 8)\n"
+            "  mgain=<int>    Mixer gain in dB. 'list' to just get a list of valid values: (default 8)\n"
+            "  vgain=<int>    VGA gain in dB. 'list' to just get a list of valid values: (default 8)\n"
+            "  antbias        Enable antemma bias (default disabled)\n"
+            "  lagc           Enable LNA AGC (default disabled)\n"
+            "  magc           Enable mixer AGC (default disabled)\n"
+            "  zeroif         Tune the station near the centre (DC and I/Q corrected)\n"
+            "\n"
+            "Configuration options for BladeRF devices\n"
+            "  freq=<int>     Frequency of radio station in Hz (default 300000000)\n"
+    		"                 valid values (with XB200): 100k to 3.8G\n"
+    		"                 valid values (without XB200): 300M to 3.8G\n"
+            "  srate=<int>    IF sample rate in Hz. Valid values: 48k to 40M (default 1000000)\n"
+            "                 'auto' for the cheapest rate for the stations\n"
+            "  bw=<int>       Bandwidth in Hz. 'list' to just get a list of valid values: (default 1500000)\n"
+            "  lgain=<int>    LNA gain in dB. 'list' to just get a list of valid values: (default 3)\n"
+            "  v1gain=<int>   VGA1 gain in dB. 'list' to just get a list of valid values: (default 20)\n"
+            "  v2gain=<int>   VGA2 gain in dB. 'list' to just get a list of valid values: (default 9)\n"
+            "  zeroif         Tune the station near the centre (DC and I/Q corrected)\n"
+            "\n"
+            "Configuration options for IQ archive files\n"
+            "  file=<path>    IQ archive file written with -A\n"
+            "  start=<float>  Start replay at this time offset in seconds (default 0)\n"
+            "  blklen=<int>   Number of samples per block (default 65536)\n"
+            "  realtime       Replay at the recorded sample rate (default as fast as possible)\n"
+            "\n"
+            "Configuration options for the simulated device\n"
+            "  freq=<int>     Frequency of radio station in Hz (default 100000000)\n"
+            "  srate=<int>    IF sample rate in Hz, 48k to 40M (default 1000000)\n"
+            "                 'auto' for the cheapest rate and block length for the stations\n"
+            "  blklen=<int>   Number of samples per block (default 65536)\n"
+            "  stations=<list> Colon separated station frequencies in Hz (default freq)\n"
+            "  level=<float>  Level of each station in dBFS (default -20)\n"
+            "  gain=<int>     Front-end gain in dB, -20 to 40 (default 0)\n"
+            "  noise=<float>  Noise level per I/Q component in dBFS, or 'off' (default -50)\n"
+            "  bits=<int>     ADC resolution; clips at full scale (default 8)\n"
+            "  dc=<float>     DC offset, fraction of full scale (default 0)\n"
+            "  iqgain=<float> I/Q gain imbalance in dB (default 0)\n"
+            "  iqphase=<float> I/Q phase imbalance in degrees (default 0)\n"
+            "  ppm=<float>    Sample clock and LO error in ppm (default 0)\n"
+            "  drop=<float>   Probability of dropping a block (default 0)\n"
+            "  jitter=<float> Maximum random block delivery delay in ms (default 0)\n"
+            "  duration=<float> Stop after this many seconds (default run forever)\n"
+            "  seed=<int>     Random generator seed (default 1)\n"
+            "  fast           Generate as fast as the decoder runs (default real time)\n"
+            "  zeroif         Tune the station near the centre (DC and I/Q corrected)\n"
+            "\n"
+            "Control commands (-C), one per line, answered with OK or ERR\n"
+            "  freq <Hz>      Tune to frequency (retunes the device if outside the IF band)\n"
+            "  gain <keys>    Set device gains, same keys as -c (e.g. gain=30 or lgain=16)\n"
+            "  stereo on|off  Enable or disable stereo decoding\n"
+            "  squelch <dB>|off  Set or disable carrier squelch\n"
+            "  record <file>|off  Start or stop an additional .WAV recording of the audio\n"
+            "  mpx <file>|off Start or stop writing MPX samples as with -X\n"
+            "  status         Show frequency, levels and decoder state\n"
+            "  audio          Show audio level, peak, clipped samples, silence and balance\n"
+            "  quit           Stop softfm\n"
+            "\n"
+            "Configuration options for the time-shift buffer (-Z)\n"
+            "  file=<path>    Memory-mapped ring file (default softfm-timeshift.ring)\n"
+            "  len=<float>    Buffer length in seconds (default 120)\n"
+            "  post=<float>   Seconds recorded after the trigger (default 5)\n"
+            "  prefix=<path>  Dump file prefix (default timeshift)\n"
+            "  pilot          Dump on loss of stereo pilot lock\n"
+            "  silence=<float> Dump when audio is silent for this many seconds\n"
+            "                 (threshold as set with -E silencedb)\n"
+            "\n"
+            "Configuration options for the audio monitor (-E)\n"
+            "  silence=<float> Report dead air after this many seconds (default 5)\n"
+            "  silencedb=<float> Silence threshold in dB (default -50)\n"
+            "  imbalance=<float> Report a left/right level difference above this many dB\n"
+            "                 lasting 5 seconds (default 6)\n"
+            "\n");
+}
+
+
+void badarg(const char *label)
+{
+    usage();
+    fprintf(stderr, "ERROR: Invalid argument for %s\n", label);
+    exit(1);
+}
+
+
+bool parse_int(const char *s, int& v, bool allow_unit=false)
+{
+    char *endp;
+    long t = strtol(s, &endp, 10);
+    if (endp == s)
+        return false;
+    if ( allow_unit && *endp == 'k' &&
+         t > INT_MIN / 1000 && t < INT_MAX / 1000 ) {
+        t *= 1000;
+        endp++;
+    }
+    if (*endp != '\0' || t < INT_MIN || t > INT_MAX)
+        return false;
+    v = t;
+    return true;
+}
+
+
+/** Parse time-shift buffer configuration. */
+static bool parse_timeshift_config(std::string config, TimeShiftConfig& ts)
+{
+    namespace qi = boost::spirit::qi;
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end)
+        return false;
+
+    if (m.find("file") != m.end())
+        ts.ringfile = m["file"];
+
+    if (m.find("prefix") != m.end())
+        ts.prefix = m["prefix"];
+
+    if (m.find("len") != m.end() &&
+        (!parse_dbl(m["len"].c_str(), ts.length) || ts.length <= 0))
+        return false;
+
+    if (m.find("post") != m.end() &&
+        (!parse_dbl(m["post"].c_str(), ts.post) || ts.post < 0))
+        return false;
+
+    if (m.find("silence") != m.end() &&
+        (!parse_dbl(m["silence"].c_str(), ts.silence) || ts.silence < 0))
+        return false;
+
+    ts.on_pilot_loss = (m.find("pilot") != m.end());
+
+    return true;
+}
+
+
+/** Parse audio monitor configuration (-E option). */
+static bool parse_audiomon_config(std::string config, AudioMonitorConfig& am)
+{
+    namespace qi = boost::spirit::qi;
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end)
+        return false;
+
+    if (m.find("silence") != m.end() &&
+        (!parse_dbl(m["silence"].c_str(), am.silence_time) || am.silence_time < 0))
+        return false;
+
+    if (m.find("silencedb") != m.end() &&
+        !parse_dbl(m["silencedb"].c_str(), am.silence_db))
+        return false;
+
+    if (m.find("imbalance") != m.end() &&
+        (!parse_dbl(m["imbalance"].c_str(), am.imbalance_db) || am.imbalance_db <= 0))
+        return false;
+
+    return true;
+}
+
+/** Read decoder state file (-K option). Return false if it can not be read. */
+static bool read_state_file(const std::string& filename, std::vector<std::uint8_t>& data)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (f == NULL)
+        return false;
+
+    data.clear();
+    std::uint8_t buf[65536];
+    std::size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+/** Write decoder state file (-K option). Return false on error. */
+static bool write_state_file(const std::string& filename, const std::vector<std::uint8_t>& data)
+{
+    // Write to a temporary file first, so an interrupted write does
+    // not destroy the previous state.
+    std::string tmpname = filename + ".tmp";
+    FILE *f = fopen(tmpname.c_str(), "wb");
+    if (f == NULL)
+        return false;
+
+    bool ok = (fwrite(data.data(), 1, data.size(), f) == data.size());
+    ok = (fclose(f) == 0) && ok;
+
+    return ok && rename(tmpname.c_str(), filename.c_str()) == 0;
+}
+
+static bool get_device(std::vector<std::string> &devnames, std::string& devtype, Source **srcsdr, int devidx)
+{
+    if (strcasecmp(devtype.c_str(), "rtlsdr") == 0)
+    {
+        RtlSdrSource::get_device_names(devnames);
+    }
+    else if (strcasecmp(devtype.c_str(), "hackrf") == 0)
+    {
+        HackRFSource::get_device_names(devnames);
+    }
+    else if (strcasecmp(devtype.c_str(), "airspy") == 0)
+    {
+        AirspySource::get_device_names(devnames);
+    }
+    else if (strcasecmp(devtype.c_str(), "bladerf") == 0)
+    {
+        BladeRFSource::get_device_names(devnames);
+    }
+    else if (strcasecmp(devtype.c_str(), "file") == 0)
+    {
+        FileSource::get_device_names(devnames);
+    }
+    else if (strcasecmp(devtype.c_str(), "sim") == 0)
+    {
+        SimSource::get_device_names(devnames);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: wrong device type (-t option) must be one of the following:\n");
+        fprintf(stderr, "       rtlsdr, hackrf, airspy, bladerf, file, sim\n");
+        return false;
+    }
+
+    if (devidx < 0 || (unsigned int)devidx >= devnames.size())
+    {
+        if (devidx != -1)
+        {
+            fprintf(stderr, "ERROR: invalid device index %d\n", devidx);
+        }
+
+        fprintf(stderr, "Found %u devices:\n", (unsigned int)devnames.size());
+
+        for (unsigned int i = 0; i < devnames.size(); i++)
+        {
+            fprintf(stderr, "%2u: %s\n", i, devnames[i].c_str());
+        }
+
+        return false;
+    }
+
+    fprintf(stderr, "using device %d: %s\n", devidx, devnames[devidx].c_str());
+
+    if (strcasecmp(devtype.c_str(), "rtlsdr") == 0)
+    {
+        // Open RTL-SDR device.
+        *srcsdr = new RtlSdrSource(devidx);
+    }
+    else if (strcasecmp(devtype.c_str(), "hackrf") == 0)
+    {
+        // Open HackRF device.
+        *srcsdr = new HackRFSource(devidx);
+    }
+    else if (strcasecmp(devtype.c_str(), "airspy") == 0)
+    {
+        // Open Airspy device.
+        *srcsdr = new AirspySource(devidx);
+    }
+    else if (strcasecmp(devtype.c_str(), "bladerf") == 0)
+    {
+        // Open BladeRF device.
         *srcsdr = new BladeRFSource(devnames[devidx].c_str());
     }
+    else if (strcasecmp(devtype.c_str(), "file") == 0)
+    {
+        // Open IQ archive file (at configuration).
+        *srcsdr = new FileSource();
+    }
+    else if (strcasecmp(devtype.c_str(), "sim") == 0)
+    {
+        // Simulated device (configured at configuration).
+        *srcsdr = new SimSource();
+    }
 
     return true;
 }
@@ -276,14 +1461,41 @@ int main(int argc, char **argv)
     int     devidx  = 0;
     int     pcmrate = 48000;
     bool    stereo  = true;
-    enum OutputMode { MODE_RAW, MODE_WAV, MODE_ALSA };
+    enum OutputMode { MODE_RAW, MODE_WAV, MODE_ALSA, MODE_NONE };
     OutputMode outmode = MODE_ALSA;
     std::string  filename;
     std::string  alsadev("default");
     std::string  ppsfilename;
     FILE *  ppsfile = NULL;
+    std::string  metricsfilename;
+    FILE *  metricsfile = NULL;
     double  bufsecs = -1;
+    std::string  chaniqfilename;
+    IQOutput::SampleFormat chaniqformat = IQOutput::FORMAT_CF32;
+    std::string  archivefilename;
+    std::string  mpxfilename;
+    std::string  mpxinfilename;
+    std::string  rdsfilename;
+    FILE *  rdsfile = NULL;
+    std::string  monitorlist;
+    std::string  scanfilename;
+    std::string  indexfilename;
+    std::string  controlpath;
+    std::string  hoplist;
+    std::string  statefilename;
+    double  batch_chunk = 0;
+    bool    batch_verify = false;
+    double  dwell = 0.2;
+    StationIndex station_index;
+    bool    squelch = false;
+    double  squelch_level = 0;
+    double  agc_headroom = 0;
+    bool    timeshift = false;
+    TimeShiftConfig timeshift_conf;
+    AudioMonitorConfig audiomon_conf;
     std::string config_str;
+    std::vector<std::string> config_strs;
+    std::vector<int> devindices;
     std::string devtype_str;
     std::vector<std::string> devnames;
     Source *srcsdr = 0;
@@ -302,11 +1514,31 @@ int main(int argc, char **argv)
         { "play",       2, NULL, 'P' },
         { "pps",        1, NULL, 'T' },
         { "buffer",     1, NULL, 'b' },
+        { "chaniq",     1, NULL, 'I' },
+        { "iqformat",   1, NULL, 'F' },
+        { "archive",    1, NULL, 'A' },
+        { "mpx",        1, NULL, 'X' },
+        { "mpxin",      1, NULL, 'm' },
+        { "timeshift",  1, NULL, 'Z' },
+        { "rds",        1, NULL, 'j' },
+        { "monitor",    1, NULL, 'L' },
+        { "squelch",    1, NULL, 'q' },
+        { "scan",       1, NULL, 'S' },
+        { "stations",   1, NULL, 'k' },
+        { "control",    1, NULL, 'C' },
+        { "hop",        1, NULL, 'H' },
+        { "state",      1, NULL, 'K' },
+        { "batch",      1, NULL, 'B' },
+        { "batch-verify", 0, NULL, 'V' },
+        { "dwell",      1, NULL, 'w' },
+        { "agc",        1, NULL, 'G' },
+        { "metrics",    1, NULL, 'Q' },
+        { "audiomon",   1, NULL, 'E' },
         { NULL,         0, NULL, 0 } };
 
     int c, longindex;
     while ((c = getopt_long(argc, argv,
-                            "t:c:d:r:MR:W:P::T:b:",
+                            "t:c:d:r:MR:W:P::T:b:I:F:A:X:m:Z:j:L:q:S:k:C:H:w:K:B:VG:Q:E:",
                             longopts, &longindex)) >= 0) {
         switch (c) {
             case 't':
@@ -314,10 +1546,35 @@ int main(int argc, char **argv)
                 break;
             case 'c':
                 config_str.assign(optarg);
+                config_strs.push_back(config_str);
                 break;
             case 'd':
-                if (!parse_int(optarg, devidx))
-                    devidx = -1;
+                {
+                    // Comma separated list of device indexes.
+                    std::string list(optarg);
+                    std::string::size_type p = 0;
+                    devindices.clear();
+
+                    while (p <= list.size())
+                    {
+                        std::string::size_type q = list.find(',', p);
+                        if (q == std::string::npos)
+                            q = list.size();
+
+                        if (!parse_int(list.substr(p, q - p).c_str(), devidx))
+                        {
+                            devindices.clear();
+                            devidx = -1;
+                            break;
+                        }
+
+                        devindices.push_back(devidx);
+                        p = q + 1;
+                    }
+
+                    if (!devindices.empty())
+                        devidx = devindices[0];
+                }
                 break;
             case 'r':
                 if (!parse_int(optarg, pcmrate, true) || pcmrate < 1) {
@@ -340,12 +1597,88 @@ int main(int argc, char **argv)
                 if (optarg != NULL)
                     alsadev = optarg;
                 break;
-            case 'T':
-                ppsfilename = optarg;
+            case 'Q':
+                metricsfilename = optarg;
+                break;
+            case 'T':
+                ppsfilename = optarg;
+                break;
+            case 'b':
+                if (!parse_dbl(optarg, bufsecs) || bufsecs < 0) {
+                    badarg("-b");
+                }
+                break;
+            case 'I':
+                chaniqfilename = optarg;
+                break;
+            case 'F':
+                if (!IQOutput::parse_format(optarg, chaniqformat)) {
+                    badarg("-F");
+                }
+                break;
+            case 'A':
+                archivefilename = optarg;
+                break;
+            case 'X':
+                mpxfilename = optarg;
+                break;
+            case 'm':
+                mpxinfilename = optarg;
+                break;
+            case 'j':
+                rdsfilename = optarg;
+                break;
+            case 'L':
+                monitorlist = optarg;
+                break;
+            case 'B':
+                if (!parse_dbl(optarg, batch_chunk) || batch_chunk <= 0) {
+                    badarg("-B");
+                }
+                break;
+            case 'V':
+                batch_verify = true;
+                break;
+            case 'K':
+                statefilename = optarg;
+                break;
+            case 'H':
+                hoplist = optarg;
+                break;
+            case 'w':
+                if (!parse_dbl(optarg, dwell) || dwell <= 0) {
+                    badarg("-w");
+                }
+                break;
+            case 'C':
+                controlpath = optarg;
+                break;
+            case 'S':
+                scanfilename = optarg;
+                break;
+            case 'k':
+                indexfilename = optarg;
+                break;
+            case 'q':
+                if (!parse_dbl(optarg, squelch_level)) {
+                    badarg("-q");
+                }
+                squelch = true;
+                break;
+            case 'G':
+                if (!parse_dbl(optarg, agc_headroom) || agc_headroom <= 0) {
+                    badarg("-G");
+                }
+                break;
+            case 'Z':
+                if (!parse_timeshift_config(optarg, timeshift_conf)) {
+                    badarg("-Z");
+                }
+                timeshift = true;
                 break;
-            case 'b':
-                if (!parse_dbl(optarg, bufsecs) || bufsecs < 0) {
-                    badarg("-b");
+            case 'E':
+                if (!parse_audiomon_config(optarg, audiomon_conf)) {
+                    badarg("-E");
                 }
                 break;
             default:
@@ -378,6 +1711,20 @@ int main(int argc, char **argv)
         fprintf(stderr, "WARNING: can not install SIGTERM handler (%s)\n", strerror(errno));
     }
 
+    // SIGUSR1 requests a time-shift buffer dump.
+    if (timeshift)
+    {
+        struct sigaction usr1act;
+        usr1act.sa_handler = handle_sigusr1;
+        sigemptyset(&usr1act.sa_mask);
+        usr1act.sa_flags = SA_RESTART;
+
+        if (sigaction(SIGUSR1, &usr1act, NULL) < 0)
+        {
+            fprintf(stderr, "WARNING: can not install SIGUSR1 handler (%s)\n", strerror(errno));
+        }
+    }
+
     // Open PPS file.
     if (!ppsfilename.empty())
     {
@@ -402,6 +1749,88 @@ int main(int argc, char **argv)
         fflush(ppsfile);
     }
 
+    // Open signal quality metrics file.
+    if (!metricsfilename.empty())
+    {
+        if (metricsfilename == "-")
+        {
+            fprintf(stderr, "writing signal quality metrics to stdout\n");
+            metricsfile = stdout;
+        }
+        else
+        {
+            fprintf(stderr, "writing signal quality metrics to '%s'\n", metricsfilename.c_str());
+            metricsfile = fopen(metricsfilename.c_str(), "w");
+
+            if (metricsfile == NULL)
+            {
+                fprintf(stderr, "ERROR: can not open '%s' (%s)\n", metricsfilename.c_str(), strerror(errno));
+                exit(1);
+            }
+        }
+    }
+
+    // Load station index.
+    bool freq_configured = (config_str.find("freq=") != std::string::npos);
+
+    if (!indexfilename.empty())
+    {
+        if (!station_index.load(indexfilename))
+        {
+            fprintf(stderr, "ERROR: station index: %s\n", station_index.error().c_str());
+            exit(1);
+        }
+
+        fprintf(stderr, "loaded %u stations from '%s'\n",
+                (unsigned int)station_index.stations().size(), indexfilename.c_str());
+
+        // Start on the strongest station unless a frequency is given.
+        const StationInfo *st = station_index.strongest();
+
+        if (!freq_configured && st != NULL)
+        {
+            if (!config_str.empty())
+                config_str += ",";
+            config_str += "freq=" + std::to_string(lrint(st->frequency));
+        }
+    }
+
+    // Band scan and RDS monitor have no audio output.
+    if (!scanfilename.empty())
+    {
+        outmode = MODE_NONE;
+    }
+
+    // RDS monitor has no audio output and writes to stdout by default.
+    if (!monitorlist.empty() || !hoplist.empty())
+    {
+        outmode = MODE_NONE;
+
+        if (rdsfilename.empty())
+            rdsfilename = "-";
+    }
+
+    // Open RDS output file.
+    if (!rdsfilename.empty())
+    {
+        if (rdsfilename == "-")
+        {
+            fprintf(stderr, "writing RDS data to stdout\n");
+            rdsfile = stdout;
+        }
+        else
+        {
+            fprintf(stderr, "writing RDS data to '%s'\n", rdsfilename.c_str());
+            rdsfile = fopen(rdsfilename.c_str(), "w");
+
+            if (rdsfile == NULL)
+            {
+                fprintf(stderr, "ERROR: can not open '%s' (%s)\n", rdsfilename.c_str(), strerror(errno));
+                exit(1);
+            }
+        }
+    }
+
     // Calculate number of samples in audio buffer.
     unsigned int outputbuf_samples = 0;
 
@@ -412,112 +1841,516 @@ int main(int argc, char **argv)
     }
     else if (bufsecs > 0)
     {
-        // Calculate nr of samples for configured buffer length.
-        outputbuf_samples = (unsigned int)(bufsecs * pcmrate);
+        // Calculate nr of samples for configured buffer length.
+        outputbuf_samples = (unsigned int)(bufsecs * pcmrate);
+    }
+
+    if (outputbuf_samples > 0)
+    {
+       fprintf(stderr, "output buffer:     %.1f seconds\n", outputbuf_samples / double(pcmrate));
+    }
+
+    // Prepare output writer (not needed for RDS monitoring).
+    std::unique_ptr<AudioOutput> audio_output;
+
+    switch (outmode)
+    {
+        case MODE_RAW:
+            fprintf(stderr, "writing raw 16-bit audio samples to '%s'\n", filename.c_str());
+            audio_output.reset(new RawAudioOutput(filename));
+            break;
+        case MODE_WAV:
+            fprintf(stderr, "writing audio samples to '%s'\n", filename.c_str());
+            audio_output.reset(new WavAudioOutput(filename, pcmrate, stereo));
+            break;
+        case MODE_ALSA:
+            fprintf(stderr, "playing audio to ALSA device '%s'\n", alsadev.c_str());
+            audio_output.reset(new AlsaAudioOutput(alsadev, pcmrate, stereo));
+            break;
+        case MODE_NONE:
+            break;
+    }
+
+    if (audio_output && !(*audio_output))
+    {
+        fprintf(stderr, "ERROR: AudioOutput: %s\n", audio_output->error().c_str());
+        exit(1);
+    }
+
+    // Decode MPX file without device and IF front end.
+    if (!mpxinfilename.empty())
+    {
+        double bandwidth_pcm = std::min(FmDecoder::default_bandwidth_pcm, 0.45 * pcmrate);
+        return decode_mpx_file(mpxinfilename, audio_output.get(),
+                               pcmrate, stereo, bandwidth_pcm);
+    }
+
+    // Monitor RDS with several devices as one band.
+    if (devindices.size() > 1)
+    {
+        if (monitorlist.empty())
+        {
+            fprintf(stderr, "ERROR: several devices (-d) are only supported with -L\n");
+            exit(1);
+        }
+
+        if (config_strs.size() != devindices.size())
+        {
+            fprintf(stderr, "ERROR: give one configuration (-c) per device (-d)\n");
+            exit(1);
+        }
+
+        DeviceGroup group;
+
+        for (unsigned int i = 0; i < devindices.size(); i++)
+        {
+            std::vector<std::string> names;
+            Source *src = NULL;
+
+            if (!get_device(names, devtype_str, &src, devindices[i]))
+            {
+                exit(1);
+            }
+
+            group.add(src);
+
+            if (!(*src) || !src->configure(config_strs[i]))
+            {
+                fprintf(stderr, "ERROR: device %d: %s\n", devindices[i], src->error().c_str());
+                exit(1);
+            }
+
+            fprintf(stderr, "device %d tuned for: %.6f MHz, IF sample rate: %.0f Hz\n",
+                    devindices[i], src->get_frequency() * 1.0e-6,
+                    (double)src->get_sample_rate());
+            src->print_specific_parms();
+        }
+
+        // Every device converts its samples in its own thread.
+        if (!group.start(&stop_flag))
+        {
+            fprintf(stderr, "ERROR: source: %s\n", group.error().c_str());
+            stop_flag.store(true);
+            exit(1);
+        }
+
+        // Collect the stations of all devices, without duplicates
+        // where bands overlap.
+        std::vector<double> stations;
+
+        for (unsigned int i = 0; i < group.size(); i++)
+        {
+            std::vector<double> dev_stations;
+
+            if (!parse_station_list(monitorlist,
+                                    group.get_source(i).get_frequency(),
+                                    group.get_source(i).get_sample_rate(),
+                                    station_index, dev_stations))
+            {
+                if (monitorlist != "all")
+                    badarg("-L");
+            }
+
+            stations.insert(stations.end(), dev_stations.begin(), dev_stations.end());
+        }
+
+        std::sort(stations.begin(), stations.end());
+        stations.erase(std::unique(stations.begin(), stations.end()), stations.end());
+
+        std::vector<std::unique_ptr<MonitorDevice>> devices;
+
+        for (unsigned int i = 0; i < group.size(); i++)
+        {
+            devices.emplace_back(new MonitorDevice(&group.get_source(i), &group.get_buffer(i)));
+        }
+
+        int ret = run_rds_monitor(stations, devices,
+                                  squelch, squelch_level, rdsfile);
+        stop_flag.store(true);
+        group.stop();
+        return ret;
+    }
+
+    if (!get_device(devnames, devtype_str, &srcsdr, devidx))
+    {
+        exit(1);
+    }
+
+    if (!(*srcsdr))
+    {
+        fprintf(stderr, "ERROR source: %s\n", srcsdr->error().c_str());
+        delete srcsdr;
+        exit(1);
+    }
+
+
+    // Stations monitored with -L must all fit the IF band if the sample
+    // rate is chosen automatically.
+    if (!monitorlist.empty() && monitorlist != "all")
+    {
+        std::vector<double> stations;
+
+        if (!parse_station_list(monitorlist, 0, 0, station_index, stations))
+        {
+            badarg("-L");
+        }
+
+        srcsdr->set_required_stations(stations);
+    }
+
+    // Configure device and start streaming.
+    if (!srcsdr->configure(config_str))
+    {
+        fprintf(stderr, "ERROR: configuration: %s\n", srcsdr->error().c_str());
+        delete srcsdr;
+        exit(1);
+    }
+
+    double freq = srcsdr->get_configured_frequency();
+    fprintf(stderr, "tuned for:         %.6f MHz\n", freq * 1.0e-6);
+
+    double tuner_freq = srcsdr->get_frequency();
+    fprintf(stderr, "device tuned for:  %.6f MHz\n", tuner_freq * 1.0e-6);
+
+    double ifrate = srcsdr->get_sample_rate();
+    fprintf(stderr, "IF sample rate:    %.0f Hz\n", ifrate);
+
+    double delta_if = tuner_freq - freq;
+    MovingAverage<float> ppm_average(40, 0.0f);
+
+    srcsdr->print_specific_parms();
+
+    // Create source data queue.
+    DataBuffer<IQSample> source_buffer;
+
+    // ownership will be transferred to thread therefore the unique_ptr with move is convenient
+    // if the pointer is to be shared with the main thread use shared_ptr (and no move) instead
+    std::unique_ptr<Source> up_srcsdr(srcsdr);
+
+    // The archive keeps the device samples as received, so DC offset and
+    // I/Q imbalance (zero-IF mode only) are then corrected here instead
+    // of in the source.
+    IQConverter iqcorr;
+    iqcorr.set_sample_rate(ifrate);
+    iqcorr.set_enabled(!archivefilename.empty() && up_srcsdr->get_iq_correction());
+
+    if (!archivefilename.empty())
+    {
+        up_srcsdr->set_iq_correction(false);
+    }
+
+    // Start reading from device in separate thread.
+    // Batch mode reads the archive itself.
+    //std::thread source_thread(read_source_data, std::move(up_srcsdr), &source_buffer);
+    if (batch_chunk == 0)
+    {
+        up_srcsdr->start(&source_buffer, &stop_flag);
+    }
+
+    if (!up_srcsdr) {
+    	fprintf(stderr, "ERROR: source: %s\n", up_srcsdr->error().c_str());
+    	exit(1);
+    }
+
+    // Scan band and write station index.
+    if (!scanfilename.empty())
+    {
+        int ret = run_band_scan(up_srcsdr.get(), ifrate, source_buffer, scanfilename);
+        stop_flag.store(true);
+        up_srcsdr->stop();
+        return ret;
+    }
+
+    // Visit stations in turn.
+    if (!hoplist.empty())
+    {
+        std::vector<double> stations;
+
+        if (!parse_station_list(hoplist, tuner_freq, ifrate,
+                                station_index, stations))
+        {
+            stop_flag.store(true);
+            up_srcsdr->stop();
+            badarg("-H");
+        }
+
+        int ret = run_round_robin(stations, up_srcsdr.get(), ifrate,
+                                  tuner_freq - freq, dwell,
+                                  source_buffer, rdsfile);
+        stop_flag.store(true);
+        up_srcsdr->stop();
+        return ret;
+    }
+
+    // Monitor RDS only, without audio decoding.
+    if (!monitorlist.empty())
+    {
+        std::vector<double> stations;
+
+        // Center the tuner on the largest set of indexed stations.
+        if (monitorlist == "index" && !freq_configured)
+        {
+            double width = 2 * FmDecoder::max_tuning_offset(ifrate);
+            double center = station_index.best_center(width);
+
+            if (center > 0 && up_srcsdr->set_frequency(lrint(center)))
+            {
+                tuner_freq = up_srcsdr->get_frequency();
+                discard_after_retune(source_buffer, 0.1 * ifrate);
+                fprintf(stderr, "device tuned for:  %.6f MHz\n", tuner_freq * 1.0e-6);
+            }
+        }
+
+        if (!parse_station_list(monitorlist, tuner_freq, ifrate,
+                                station_index, stations, true))
+        {
+            stop_flag.store(true);
+            up_srcsdr->stop();
+            badarg("-L");
+        }
+
+        std::vector<std::unique_ptr<MonitorDevice>> devices;
+        devices.emplace_back(new MonitorDevice(up_srcsdr.get(), &source_buffer));
+
+        int ret = run_rds_monitor(stations, devices,
+                                  squelch, squelch_level, rdsfile);
+        stop_flag.store(true);
+        up_srcsdr->stop();
+        return ret;
+    }
+
+    // The baseband signal is empty above 100 kHz, so we can
+    // downsample to ~ 200 kS/s without loss of information.
+    // This will speed up later processing stages.
+    unsigned int downsample = std::max(1, int(ifrate / 215.0e3));
+    fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+
+    // Prevent aliasing at very low output sample rates.
+    double bandwidth_pcm = std::min(FmDecoder::default_bandwidth_pcm, 0.45 * pcmrate);
+    fprintf(stderr, "audio sample rate: %u Hz\n", pcmrate);
+    fprintf(stderr, "audio bandwidth:   %.3f kHz\n", bandwidth_pcm * 1.0e-3);
+
+    // Prepare decoder.
+    FmDecoder fm(ifrate,                            // sample_rate_if
+                 freq - tuner_freq,                 // tuning_offset
+                 pcmrate,                           // sample_rate_pcm
+                 stereo,                            // stereo
+                 FmDecoder::default_deemphasis,     // deemphasis,
+                 FmDecoder::default_bandwidth_if,   // bandwidth_if
+                 FmDecoder::default_freq_dev,       // freq_dev
+                 bandwidth_pcm,                     // bandwidth_pcm
+                 downsample);                       // downsample
+
+    // Resume from saved decoder state. Squelch and RDS follow the
+    // command line, everything else comes from the state file. A state
+    // saved with a different tuning offset is rejected.
+    bool state_loaded = false;
+
+    if (!statefilename.empty())
+    {
+        std::vector<std::uint8_t> state;
+
+        if (read_state_file(statefilename, state))
+        {
+            state_loaded = fm.load_state(state);
+
+            if (state_loaded)
+            {
+                fprintf(stderr, "restored decoder state from '%s'\n", statefilename.c_str());
+            }
+            else
+            {
+                fprintf(stderr, "WARNING: decoder state in '%s' does not match, starting cold\n",
+                        statefilename.c_str());
+            }
+        }
+    }
+
+    if (rdsfile != NULL)
+    {
+        fm.enable_rds();
+    }
+    else
+    {
+        fm.disable_rds();
     }
 
-    if (outputbuf_samples > 0)
+    if (metricsfile != NULL)
     {
-       fprintf(stderr, "output buffer:     %.1f seconds\n", outputbuf_samples / double(pcmrate));
+        fm.enable_quality();
     }
 
-    // Prepare output writer.
-    std::unique_ptr<AudioOutput> audio_output;
+    // Mono stations do not need the stereo path until a pilot appears.
+    fm.set_stereo_bypass(true);
 
-    switch (outmode)
+    // A restored squelch keeps its open/hang state; only the level
+    // comes from the command line.
+    if (squelch)
     {
-        case MODE_RAW:
-            fprintf(stderr, "writing raw 16-bit audio samples to '%s'\n", filename.c_str());
-            audio_output.reset(new RawAudioOutput(filename));
-            break;
-        case MODE_WAV:
-            fprintf(stderr, "writing audio samples to '%s'\n", filename.c_str());
-            audio_output.reset(new WavAudioOutput(filename, pcmrate, stereo));
-            break;
-        case MODE_ALSA:
-            fprintf(stderr, "playing audio to ALSA device '%s'\n", alsadev.c_str());
-            audio_output.reset(new AlsaAudioOutput(alsadev, pcmrate, stereo));
-            break;
+        fprintf(stderr, "squelch level:     %.1f dB\n", squelch_level);
+        fm.set_squelch(squelch_level);
+    }
+    else
+    {
+        fm.disable_squelch();
     }
 
-    if (!(*audio_output))
+    // Decode archive in parallel chunks.
+    if (batch_chunk > 0)
     {
-        fprintf(stderr, "ERROR: AudioOutput: %s\n", audio_output->error().c_str());
-        exit(1);
+        FileSource *filesrc = dynamic_cast<FileSource*>(up_srcsdr.get());
+
+        if (filesrc == NULL)
+        {
+            fprintf(stderr, "ERROR: batch decoding (-B) needs an IQ archive (-t file)\n");
+            exit(1);
+        }
+
+        if (outmode != MODE_RAW && outmode != MODE_WAV)
+        {
+            fprintf(stderr, "ERROR: batch decoding (-B) needs an output file (-R or -W)\n");
+            exit(1);
+        }
+
+        auto factory = [&]()
+        {
+            FmDecoder *dec = new FmDecoder(ifrate, freq - tuner_freq, pcmrate, stereo,
+                                           FmDecoder::default_deemphasis,
+                                           FmDecoder::default_bandwidth_if,
+                                           FmDecoder::default_freq_dev,
+                                           bandwidth_pcm, downsample);
+            if (rdsfile != NULL)
+                dec->enable_rds();
+            dec->set_stereo_bypass(true);
+            if (squelch)
+                dec->set_squelch(squelch_level);
+            return dec;
+        };
+
+        return run_batch_decode(filesrc, factory, ifrate, pcmrate, downsample,
+                                stereo, batch_chunk, batch_verify,
+                                audio_output.get(), rdsfile);
     }
 
-    if (!get_device(devnames, devtype_str, &srcsdr, devidx))
+    // Prepare channel-rate IQ filter for the IQ recorder and time-shift buffer.
+    // The IF filtered signal is decimated by the baseband downsampling
+    // factor, which keeps the full FM channel at ~ 250 kS/s.
+    std::unique_ptr<IQOutput> chaniq_output;
+    std::unique_ptr<DownsampleFilterIQ> chaniq_filter;
+    IQSampleVector chaniqsamples;
+    double chanrate = ifrate / downsample;
+
+    if (!chaniqfilename.empty() || timeshift)
     {
-        exit(1);
+        chaniq_filter.reset(new DownsampleFilterIQ(8 * downsample,
+                                                   0.45 / downsample,
+                                                   downsample));
     }
 
-    if (!(*srcsdr))
+    if (!chaniqfilename.empty())
     {
-        fprintf(stderr, "ERROR source: %s\n", srcsdr->error().c_str());
-        delete srcsdr;
-        exit(1);
+        fprintf(stderr, "writing channel IQ samples (%.0f S/s) to '%s'\n",
+                chanrate, chaniqfilename.c_str());
+        chaniq_output.reset(new RawIQOutput(chaniqfilename, chaniqformat,
+                                            chanrate, freq));
+
+        if (!(*chaniq_output))
+        {
+            fprintf(stderr, "ERROR: IQOutput: %s\n", chaniq_output->error().c_str());
+            exit(1);
+        }
     }
 
+    // Prepare time-shift buffer.
+    std::unique_ptr<TimeShiftBuffer> timeshift_buffer;
 
-    // Configure device and start streaming.
-    if (!srcsdr->configure(config_str))
+    if (timeshift)
     {
-        fprintf(stderr, "ERROR: configuration: %s\n", srcsdr->error().c_str());
-        delete srcsdr;
-        exit(1);
+        fprintf(stderr, "time-shift buffer: %.0f s of channel IQ in '%s'\n",
+                timeshift_conf.length, timeshift_conf.ringfile.c_str());
+        timeshift_buffer.reset(new TimeShiftBuffer(timeshift_conf.ringfile,
+                                                   timeshift_conf.length * chanrate,
+                                                   timeshift_conf.post * chanrate,
+                                                   chanrate, freq,
+                                                   timeshift_conf.prefix));
+
+        if (!(*timeshift_buffer))
+        {
+            fprintf(stderr, "ERROR: time-shift buffer: %s\n", timeshift_buffer->error().c_str());
+            exit(1);
+        }
     }
 
-    double freq = srcsdr->get_configured_frequency();
-    fprintf(stderr, "tuned for:         %.6f MHz\n", freq * 1.0e-6);
+    // Prepare device IQ archive writer.
+    std::unique_ptr<IQOutput> archive_output;
 
-    double tuner_freq = srcsdr->get_frequency();
-    fprintf(stderr, "device tuned for:  %.6f MHz\n", tuner_freq * 1.0e-6);
+    if (!archivefilename.empty())
+    {
+        fprintf(stderr, "writing %u-bit device IQ samples to archive '%s'\n",
+                up_srcsdr->get_sample_bits(), archivefilename.c_str());
+        archive_output.reset(new ArchiveIQOutput(archivefilename,
+                                                 up_srcsdr->get_sample_bits(),
+                                                 ifrate, tuner_freq, freq));
 
-    double ifrate = srcsdr->get_sample_rate();
-    fprintf(stderr, "IF sample rate:    %.0f Hz\n", ifrate);
+        if (!(*archive_output))
+        {
+            fprintf(stderr, "ERROR: IQOutput: %s\n", archive_output->error().c_str());
+            exit(1);
+        }
+    }
 
-    double delta_if = tuner_freq - freq;
-    MovingAverage<float> ppm_average(40, 0.0f);
+    // Prepare composite baseband (MPX) writer.
+    std::unique_ptr<AudioOutput> mpx_output;
 
-    srcsdr->print_specific_parms();
+    if (!mpxfilename.empty())
+    {
+        double mpxrate = fm.get_baseband_sample_rate();
+        bool mpxraw = mpxfilename == "-" ||
+                      (mpxfilename.size() > 4 &&
+                       mpxfilename.compare(mpxfilename.size() - 4, 4, ".raw") == 0);
 
-    // Create source data queue.
-    DataBuffer<IQSample> source_buffer;
+        fprintf(stderr, "writing MPX samples (%.0f S/s) to '%s'\n",
+                mpxrate, mpxfilename.c_str());
 
-    // ownership will be transferred to thread therefore the unique_ptr with move is convenient
-    // if the pointer is to be shared with the main thread use shared_ptr (and no move) instead
-    std::unique_ptr<Source> up_srcsdr(srcsdr);
+        if (mpxrate != rint(mpxrate))
+        {
+            fprintf(stderr, "WARNING: MPX sample rate %.3f Hz is not an integer, "
+                            "header states %.0f Hz\n", mpxrate, rint(mpxrate));
+        }
 
-    // Start reading from device in separate thread.
-    //std::thread source_thread(read_source_data, std::move(up_srcsdr), &source_buffer);
-    up_srcsdr->start(&source_buffer, &stop_flag);
+        if (mpxraw)
+        {
+            mpx_output.reset(new RawAudioOutput(mpxfilename, true));
+        }
+        else
+        {
+            mpx_output.reset(new WavAudioOutput(mpxfilename, lrint(mpxrate),
+                                                false, true));
+        }
 
-    if (!up_srcsdr) {
-    	fprintf(stderr, "ERROR: source: %s\n", up_srcsdr->error().c_str());
-    	exit(1);
+        if (!(*mpx_output))
+        {
+            fprintf(stderr, "ERROR: MPX output: %s\n", mpx_output->error().c_str());
+            exit(1);
+        }
     }
 
-    // The baseband signal is empty above 100 kHz, so we can
-    // downsample to ~ 200 kS/s without loss of information.
-    // This will speed up later processing stages.
-    unsigned int downsample = std::max(1, int(ifrate / 215.0e3));
-    fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+    // Prepare software gain control.
+    std::unique_ptr<GainControl> gain_control;
 
-    // Prevent aliasing at very low output sample rates.
-    double bandwidth_pcm = std::min(FmDecoder::default_bandwidth_pcm, 0.45 * pcmrate);
-    fprintf(stderr, "audio sample rate: %u Hz\n", pcmrate);
-    fprintf(stderr, "audio bandwidth:   %.3f kHz\n", bandwidth_pcm * 1.0e-3);
+    if (agc_headroom > 0)
+    {
+        gain_control.reset(new GainControl(up_srcsdr.get(), ifrate, agc_headroom));
 
-    // Prepare decoder.
-    FmDecoder fm(ifrate,                            // sample_rate_if
-                 freq - tuner_freq,                 // tuning_offset
-                 pcmrate,                           // sample_rate_pcm
-                 stereo,                            // stereo
-                 FmDecoder::default_deemphasis,     // deemphasis,
-                 FmDecoder::default_bandwidth_if,   // bandwidth_if
-                 FmDecoder::default_freq_dev,       // freq_dev
-                 bandwidth_pcm,                     // bandwidth_pcm
-                 downsample);                       // downsample
+        if (!(*gain_control))
+        {
+            fprintf(stderr, "ERROR: gain control: %s\n", gain_control->error().c_str());
+            exit(1);
+        }
+
+        fprintf(stderr, "gain control:      %.1f dB headroom, starting at %s\n",
+                agc_headroom, gain_control->get_gain().setting.c_str());
+    }
 
     // If buffering enabled, start background output thread.
     DataBuffer<Sample> output_buffer;
@@ -532,10 +2365,171 @@ int main(int argc, char **argv)
                                outputbuf_samples * nchannel);
     }
 
+    // Start control server.
+    std::unique_ptr<ControlServer> control;
+    std::unique_ptr<AudioOutput> record_output;
+
+    if (!controlpath.empty())
+    {
+        fprintf(stderr, "accepting control commands on '%s'\n", controlpath.c_str());
+        control.reset(new ControlServer(controlpath));
+
+        if (!(*control))
+        {
+            fprintf(stderr, "ERROR: control: %s\n", control->error().c_str());
+            exit(1);
+        }
+    }
+
+    // Audio dead-air, clipping and balance monitor.
+    AudioMonitor audio_monitor(pcmrate, stereo,
+                               audiomon_conf.silence_db,
+                               audiomon_conf.silence_time,
+                               audiomon_conf.imbalance_db);
+
+    // Execute one control command and return the reply.
+    auto execute_command = [&](const std::string& line) -> std::string
+    {
+        std::string cmd = line.substr(0, line.find(' '));
+        std::string arg = (cmd.size() < line.size()) ? line.substr(cmd.size() + 1) : "";
+
+        if (cmd == "freq")
+        {
+            double f;
+            if (!parse_dbl(arg.c_str(), f) || f <= 0)
+                return "ERR invalid frequency";
+
+            if (fabs(f - tuner_freq) <= FmDecoder::max_tuning_offset(ifrate))
+            {
+                // Station is within the IF band: just move the fine tuner.
+                fm.set_tuning_offset(f - tuner_freq);
+            }
+            else
+            {
+                // Retune the device, keeping the decoder tuning offset.
+                if (!up_srcsdr->set_frequency(lrint(f + tuner_freq - freq)))
+                    return "ERR " + up_srcsdr->error();
+                tuner_freq = up_srcsdr->get_frequency();
+                fm.set_tuning_offset(f - tuner_freq);
+            }
+
+            freq = f;
+            delta_if = tuner_freq - freq;
+            return "OK";
+        }
+        else if (cmd == "gain")
+        {
+            if (!up_srcsdr->set_gain(arg))
+                return "ERR " + up_srcsdr->error();
+            // Software gain control continues from the new setting.
+            if (gain_control)
+                gain_control->sync_gain();
+            return "OK";
+        }
+        else if (cmd == "stereo")
+        {
+            if (arg != "on" && arg != "off")
+                return "ERR expected on or off";
+            if (!fm.set_stereo(arg == "on"))
+                return "ERR output is mono (-M)";
+            return "OK";
+        }
+        else if (cmd == "squelch")
+        {
+            double level;
+            if (arg == "off")
+                fm.disable_squelch();
+            else if (parse_dbl(arg.c_str(), level))
+                fm.set_squelch(level);
+            else
+                return "ERR invalid squelch level";
+            return "OK";
+        }
+        else if (cmd == "record")
+        {
+            record_output.reset();
+            if (arg == "off")
+                return "OK";
+            record_output.reset(new WavAudioOutput(arg, pcmrate, stereo));
+            if (!(*record_output))
+            {
+                std::string err = record_output->error();
+                record_output.reset();
+                return "ERR " + err;
+            }
+            return "OK";
+        }
+        else if (cmd == "mpx")
+        {
+            mpx_output.reset();
+            if (arg == "off")
+                return "OK";
+            mpx_output.reset(new WavAudioOutput(arg, lrint(fm.get_baseband_sample_rate()),
+                                                false, true));
+            if (!(*mpx_output))
+            {
+                std::string err = mpx_output->error();
+                mpx_output.reset();
+                return "ERR " + err;
+            }
+            return "OK";
+        }
+        else if (cmd == "status")
+        {
+            char buf[256];
+            snprintf(buf, sizeof(buf),
+                     "OK freq=%.0f tuner=%.0f if=%.1fdB stereo=%s squelch=%s",
+                     freq, tuner_freq, 20*log10(fm.get_if_level()),
+                     fm.stereo_detected() ? "yes" : "no",
+                     fm.squelch_open() ? "open" : "closed");
+            std::string reply(buf);
+
+            if (metricsfile != NULL)
+            {
+                FmDecoder::Quality q = fm.get_quality();
+                snprintf(buf, sizeof(buf),
+                         " pilot_snr=%.1fdBHz guard=%.1fdB/Hz",
+                         q.pilot_snr, q.guard_db);
+                reply += buf;
+            }
+
+            return reply;
+        }
+        else if (cmd == "audio")
+        {
+            const AudioMonitor::Stats& st = audio_monitor.get_stats();
+            char buf[256];
+            snprintf(buf, sizeof(buf),
+                     "OK level=%.1fdB peak=%.3f clipped=%llu silence=%.1fs imbalance=%.1fdB",
+                     20*log10(std::max(st.rms, 1.0e-10)) + 3.01, st.peak,
+                     (unsigned long long)st.clipped, st.silence, st.imbalance_db);
+            return buf;
+        }
+        else if (cmd == "dump")
+        {
+            if (!timeshift_buffer)
+                return "ERR no time-shift buffer (-Z)";
+            timeshift_buffer->trigger("command");
+            return "OK";
+        }
+        else if (cmd == "quit")
+        {
+            stop_flag.store(true);
+            return "OK";
+        }
+
+        return "ERR unknown command '" + cmd + "'";
+    };
+
     SampleVector audiosamples;
     bool inbuf_length_warning = false;
     double audio_level = 0;
     bool got_stereo = false;
+    bool silence_triggered = false;
+    std::size_t audio_drop = 0;
+    double adc_level = -INFINITY;
+    double adc_clip = 0;
+    double metrics_samples = 0;
 
     double block_time = get_time();
 
@@ -561,30 +2555,176 @@ int main(int argc, char **argv)
         double prev_block_time = block_time;
         block_time = get_time();
 
+        // Apply control commands between blocks.
+        if (control)
+        {
+            for (const ControlServer::Command& cmd : control->pull_commands())
+            {
+                std::string reply = execute_command(cmd.line);
+                fprintf(stderr, "\ncontrol: %s: %s\n", cmd.line.c_str(), reply.c_str());
+                control->reply(cmd, reply);
+            }
+        }
+
+        // Track ADC level and adjust the device gain.
+        IQConverter::LevelStats adc_stats;
+        up_srcsdr->get_level_stats(adc_stats);
+
+        if (adc_stats.samples > 0)
+        {
+            adc_level = 20 * log10(std::max(adc_stats.rms, 1.0e-10));
+            adc_clip = double(adc_stats.clipped) / adc_stats.samples;
+        }
+
+        if (gain_control && gain_control->update(adc_stats))
+        {
+            fprintf(stderr, "\ngain control: %s (ADC %.1f dBFS, %.3f %% clipped)\n",
+                    gain_control->get_gain().setting.c_str(),
+                    gain_control->get_level(), 100 * gain_control->get_clip_ratio());
+        }
+
+        if (gain_control && !(*gain_control))
+        {
+            fprintf(stderr, "\nERROR: gain control: %s\n", gain_control->error().c_str());
+            gain_control.reset();
+        }
+
+        // Archive device IQ samples.
+        if (archive_output && !archive_output->write(iqsamples))
+        {
+            fprintf(stderr, "\nERROR: IQOutput: %s\n", archive_output->error().c_str());
+        }
+
+        iqcorr.process(iqsamples);
+
+        // Warm up the decoder on the first block instead of throwing
+        // away its noisy start-up output.
+        if (block == 0 && !state_loaded)
+        {
+            unsigned int nchannel = stereo ? 2 : 1;
+            audio_drop = fm.prime(iqsamples) * nchannel;
+        }
+
         // Decode FM signal.
         fm.process(iqsamples, audiosamples);
 
-        // Measure audio level.
-        double audio_mean, audio_rms;
-        samples_mean_rms(audiosamples, audio_mean, audio_rms);
+        // Drop output that only covers the filter group delay.
+        if (audio_drop > 0)
+        {
+            std::size_t ndrop = std::min(audio_drop, audiosamples.size());
+            audiosamples.erase(audiosamples.begin(), audiosamples.begin() + ndrop);
+            audio_drop -= ndrop;
+        }
+
+        // Write composite baseband samples.
+        if (mpx_output && !mpx_output->write(fm.get_baseband_samples()))
+        {
+            fprintf(stderr, "\nERROR: MPX output: %s\n", mpx_output->error().c_str());
+        }
+
+        // Write channel-rate IQ samples.
+        if (chaniq_filter)
+        {
+            chaniq_filter->process(fm.get_if_samples(), chaniqsamples);
+        }
+
+        if (chaniq_output && !chaniq_output->write(chaniqsamples))
+        {
+            fprintf(stderr, "\nERROR: IQOutput: %s\n", chaniq_output->error().c_str());
+        }
+
+        if (timeshift_buffer)
+        {
+            timeshift_buffer->write(chaniqsamples);
+        }
+
+        // Set nominal audio volume and measure audio in the same pass.
+        audio_monitor.process(audiosamples, 0.5);
+        double audio_rms = audio_monitor.get_stats().rms;
         audio_level = 0.95 * audio_level + 0.05 * audio_rms;
 
-        // Set nominal audio volume.
-        adjust_gain(audiosamples, 0.5);
+        // Report dead air, clipping and channel imbalance.
+        for (const std::string& ev : audio_monitor.get_events())
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "{\"time\":%.3f,", block_time);
+            std::string line = buf + ev.substr(1);
+
+            fprintf(stderr, "\naudio: %s\n", line.c_str());
+
+            if (metricsfile != NULL)
+            {
+                fprintf(metricsfile, "%s\n", line.c_str());
+                fflush(metricsfile);
+            }
+
+            if (control)
+            {
+                control->notify(line);
+            }
+        }
+
+        // Check time-shift dump triggers.
+        if (timeshift_buffer)
+        {
+            if (dump_flag.exchange(false))
+            {
+                timeshift_buffer->trigger("signal");
+            }
+
+            if (timeshift_conf.on_pilot_loss && got_stereo && !fm.stereo_detected())
+            {
+                timeshift_buffer->trigger("pilotloss");
+            }
+
+            // The audio monitor measures the silence duration.
+            if (timeshift_conf.silence > 0)
+            {
+                bool was_silent = silence_triggered;
+                silence_triggered = audio_monitor.get_stats().silence >= timeshift_conf.silence;
+
+                if (!was_silent && silence_triggered)
+                {
+                    timeshift_buffer->trigger("silence");
+                }
+            }
+        }
 
         ppm_average.feed(((fm.get_tuning_offset() + delta_if) / tuner_freq) * -1.0e6); // the minus factor is to show the ppm correction to make and not the one made
 
         // Show statistics.
         fprintf(stderr,
-                "\rblk=%6d  freq=%10.6fMHz  ppm=%+6.2f  IF=%+5.1fdB  BB=%+5.1fdB  audio=%+5.1fdB ",
+                "\rblk=%6d  freq=%10.6fMHz  ppm=%+6.2f  ADC=%+5.1fdB  IF=%+5.1fdB  BB=%+5.1fdB  audio=%+5.1fdB ",
                 block,
                 (tuner_freq + fm.get_tuning_offset()) * 1.0e-6,
                 ppm_average.average(),
                 //((fm.get_tuning_offset() + delta_if) / tuner_freq) * 1.0e6,
+                adc_level,
                 20*log10(fm.get_if_level()),
                 20*log10(fm.get_baseband_level()) + 3.01,
                 20*log10(audio_level) + 3.01);
 
+        if (!fm.squelch_open())
+        {
+            fprintf(stderr, " SQL ");
+        }
+
+        if (audio_monitor.silent())
+        {
+            fprintf(stderr, " SIL ");
+        }
+
+        if (adc_clip > 0)
+        {
+            fprintf(stderr, " CLIP=%.2f%% ", 100 * adc_clip);
+        }
+
+        if (up_srcsdr->get_dropped_samples() > 0)
+        {
+            fprintf(stderr, " DROP=%llu ",
+                    (unsigned long long)up_srcsdr->get_dropped_samples());
+        }
+
         if (outputbuf_samples > 0)
         {
             unsigned int nchannel = stereo ? 2 : 1;
@@ -609,6 +2749,44 @@ int main(int argc, char **argv)
             }
         }
 
+        // Write RDS data.
+        if (rdsfile != NULL)
+        {
+            for (const std::string& line : fm.get_rds()->get_events())
+            {
+                fprintf(rdsfile, "%s\n", line.c_str());
+            }
+
+            fflush(rdsfile);
+        }
+
+        // Write signal quality metrics once per second.
+        metrics_samples += iqsamples.size();
+
+        if (metricsfile != NULL && metrics_samples >= ifrate)
+        {
+            metrics_samples -= ifrate;
+            FmDecoder::Quality q = fm.get_quality();
+            fprintf(metricsfile,
+                    "{\"time\":%.3f,\"freq\":%.0f,\"if_db\":%.1f,\"bb_db\":%.1f,"
+                    "\"stereo\":%s,\"squelch\":%s,\"pilot_db\":%.1f,\"pilot_snr\":%.1f,"
+                    "\"guard_db\":%.1f,\"rds_db\":%.1f,\"ultrasonic_db\":%.1f,"
+                    "\"audio_db\":%.1f,\"audio_peak\":%.3f,\"clipped\":%llu,"
+                    "\"silence\":%.1f,\"imbalance_db\":%.1f}\n",
+                    block_time, freq,
+                    20*log10(fm.get_if_level()),
+                    20*log10(fm.get_baseband_level()) + 3.01,
+                    fm.stereo_detected() ? "true" : "false",
+                    fm.squelch_open() ? "false" : "true",
+                    q.pilot_db, q.pilot_snr, q.guard_db, q.rds_db, q.ultrasonic_db,
+                    20*log10(std::max(audio_level, 1.0e-10)) + 3.01,
+                    audio_monitor.get_stats().peak,
+                    (unsigned long long)audio_monitor.get_stats().clipped,
+                    audio_monitor.get_stats().silence,
+                    audio_monitor.get_stats().imbalance_db);
+            fflush(metricsfile);
+        }
+
         // Write PPS markers.
         if (ppsfile != NULL)
         {
@@ -624,26 +2802,41 @@ int main(int argc, char **argv)
             }
         }
 
-        // Throw away first block. It is noisy because IF filters
-        // are still starting up.
-        if (block > 0)
+        // Write samples to runtime recording.
+        if (record_output && !record_output->write(audiosamples))
         {
-            // Write samples to output.
-            if (outputbuf_samples > 0)
-            {
-                // Buffered write.
-                output_buffer.push(move(audiosamples));
-            }
-            else
-            {
-                // Direct write.
-                audio_output->write(audiosamples);
-            }
+            fprintf(stderr, "\nERROR: record: %s\n", record_output->error().c_str());
+            record_output.reset();
+        }
+
+        // Write samples to output.
+        if (outputbuf_samples > 0)
+        {
+            // Buffered write.
+            output_buffer.push(move(audiosamples));
+        }
+        else
+        {
+            // Direct write.
+            audio_output->write(audiosamples);
         }
     }
 
     fprintf(stderr, "\n");
 
+    // Save decoder state for the next run.
+    if (!statefilename.empty())
+    {
+        if (write_state_file(statefilename, fm.save_state()))
+        {
+            fprintf(stderr, "saved decoder state to '%s'\n", statefilename.c_str());
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: can not write '%s' (%s)\n", statefilename.c_str(), strerror(errno));
+        }
+    }
+
     // Join background threads.
     //source_thread.join();
     up_srcsdr->stop();
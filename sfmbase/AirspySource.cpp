@@ -16,10 +16,12 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.          //
 ///////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cstring>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <mutex>
 #include <thread>
 #include <cstdlib>
 
@@ -27,11 +29,41 @@
 #include "parsekv.h"
 #include "AirspySource.h"
 
-AirspySource *AirspySource::m_this = 0;
 const std::vector<int> AirspySource::m_lgains({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14});
 const std::vector<int> AirspySource::m_mgains({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15});
 const std::vector<int> AirspySource::m_vgains({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15});
 
+// Number of users of the Airspy library, shared by all devices.
+static std::mutex airspy_lib_mutex;
+static int airspy_lib_users = 0;
+
+// Initialize the Airspy library for one more user.
+static airspy_error airspy_lib_init()
+{
+    std::lock_guard<std::mutex> lock(airspy_lib_mutex);
+
+    if (airspy_lib_users == 0)
+    {
+        airspy_error rc = (airspy_error) airspy_init();
+        if (rc != AIRSPY_SUCCESS)
+            return rc;
+    }
+
+    airspy_lib_users++;
+    return AIRSPY_SUCCESS;
+}
+
+// Release the Airspy library; the last user shuts it down.
+static airspy_error airspy_lib_exit()
+{
+    std::lock_guard<std::mutex> lock(airspy_lib_mutex);
+
+    if (--airspy_lib_users > 0)
+        return AIRSPY_SUCCESS;
+
+    return (airspy_error) airspy_exit();
+}
+
 // Open Airspy device.
 AirspySource::AirspySource(int dev_index) :
     m_dev(0),
@@ -44,9 +76,10 @@ AirspySource::AirspySource(int dev_index) :
     m_lnaAGC(false),
     m_mixAGC(false),
     m_running(false),
-    m_thread(0)
+    m_thread(0),
+    m_libInit(false)
 {
-    airspy_error rc = (airspy_error) airspy_init();
+    airspy_error rc = airspy_lib_init();
 
     if (rc != AIRSPY_SUCCESS)
     {
@@ -57,6 +90,7 @@ AirspySource::AirspySource(int dev_index) :
     }
     else
     {
+        m_libInit = true;
         for (int i = 0; i < AIRSPY_MAX_DEVICE; i++)
         {
             rc = (airspy_error) airspy_open(&m_dev);
@@ -147,8 +181,6 @@ AirspySource::AirspySource(int dev_index) :
 
     std::ostringstream bwfilt_ostr;
     bwfilt_ostr << std::fixed << std::setprecision(2);
-
-    m_this = this;
 }
 
 AirspySource::~AirspySource()
@@ -157,10 +189,10 @@ AirspySource::~AirspySource()
         airspy_close(m_dev);
     }
     
-    airspy_error rc = (airspy_error) airspy_exit();
-    std::cerr << "AirspySource::~AirspySource: Airspy library exit: " << rc << ": " << airspy_error_name(rc) << std::endl;
-
-    m_this = 0;
+    if (m_libInit) {
+        airspy_error rc = airspy_lib_exit();
+        std::cerr << "AirspySource::~AirspySource: Airspy library exit: " << rc << ": " << airspy_error_name(rc) << std::endl;
+    }
 }
 
 void AirspySource::get_device_names(std::vector<std::string>& devices)
@@ -172,7 +204,7 @@ void AirspySource::get_device_names(std::vector<std::string>& devices)
     airspy_error rc;
     int i;
 
-    rc = (airspy_error) airspy_init();
+    rc = airspy_lib_init();
 
     if (rc != AIRSPY_SUCCESS)
     {
@@ -213,7 +245,7 @@ void AirspySource::get_device_names(std::vector<std::string>& devices)
         }
     }
 
-    rc = (airspy_error) airspy_exit();
+    rc = airspy_lib_exit();
     std::cerr << "AirspySource::get_device_names: Airspy library exit: " << rc << ": " << airspy_error_name(rc) << std::endl;
 }
 
@@ -227,6 +259,98 @@ std::uint32_t AirspySource::get_frequency()
     return m_frequency;
 }
 
+bool AirspySource::set_frequency(std::uint32_t frequency)
+{
+    if (!m_dev || airspy_set_freq(m_dev, frequency) != AIRSPY_SUCCESS)
+    {
+        std::ostringstream err_ostr;
+        err_ostr << "Could not set center frequency to " << frequency << " Hz";
+        m_error = err_ostr.str();
+        return false;
+    }
+
+    m_frequency = frequency;
+    return true;
+}
+
+bool AirspySource::set_gain(const std::string& gains)
+{
+    namespace qi = boost::spirit::qi;
+    std::string config(gains);
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end)
+    {
+        m_error = "Gain parsing failed";
+        return false;
+    }
+
+    int lnaGain = m_lnaGain;
+    int mixGain = m_mixGain;
+    int vgaGain = m_vgaGain;
+
+    if (m.find("lgain") != m.end())
+    {
+        lnaGain = atoi(m["lgain"].c_str());
+
+        if (find(m_lgains.begin(), m_lgains.end(), lnaGain) == m_lgains.end())
+        {
+            m_error = "LNA gain not supported. Available gains (dB): " + m_lgainsStr;
+            return false;
+        }
+    }
+
+    if (m.find("mgain") != m.end())
+    {
+        mixGain = atoi(m["mgain"].c_str());
+
+        if (find(m_mgains.begin(), m_mgains.end(), mixGain) == m_mgains.end())
+        {
+            m_error = "Mixer gain not supported. Available gains (dB): " + m_mgainsStr;
+            return false;
+        }
+    }
+
+    if (m.find("vgain") != m.end())
+    {
+        vgaGain = atoi(m["vgain"].c_str());
+
+        if (find(m_vgains.begin(), m_vgains.end(), vgaGain) == m_vgains.end())
+        {
+            m_error = "VGA gain not supported. Available gains (dB): " + m_vgainsStr;
+            return false;
+        }
+    }
+
+    if (!m_dev ||
+        airspy_set_lna_gain(m_dev, lnaGain) != AIRSPY_SUCCESS ||
+        airspy_set_mixer_gain(m_dev, mixGain) != AIRSPY_SUCCESS ||
+        airspy_set_vga_gain(m_dev, vgaGain) != AIRSPY_SUCCESS)
+    {
+        m_error = "Could not set gains";
+        return false;
+    }
+
+    m_lnaGain = lnaGain;
+    m_mixGain = mixGain;
+    m_vgaGain = vgaGain;
+    return true;
+}
+
+// Get gain settings for software gain control.
+bool AirspySource::get_gain_steps(std::vector<GainStep>& steps, std::size_t& current)
+{
+    current = make_gain_steps({ "lgain", "mgain", "vgain" },
+                              { m_lgains, m_mgains, m_vgains },
+                              { m_lnaGain, m_mixGain, m_vgaGain },
+                              steps);
+    return true;
+}
+
 void AirspySource::print_specific_parms()
 {
     fprintf(stderr, "LNA gain:          %d\n", m_lnaGain);
@@ -362,6 +486,8 @@ bool AirspySource::configure(std::string configurationStr)
     bool antBias = false;
     bool lnaAGC = false;
     bool mixAGC = false;
+    bool zeroif = false;
+    bool autorate = false;
 
     parsekv::key_value_sequence<std::string::iterator> p;
     parsekv::pairs_type m;
@@ -383,6 +509,7 @@ bool AirspySource::configure(std::string configurationStr)
                 return false;
             }
 
+            autorate = (strcasecmp(m["srate"].c_str(), "auto") == 0);
             m_sampleRate = atoi(m["srate"].c_str());
             uint32_t i;
 
@@ -395,7 +522,7 @@ bool AirspySource::configure(std::string configurationStr)
                 }
             }
 
-            if (i == m_srates.size())
+            if (!autorate && (i == m_srates.size()))
             {
                 m_error = "Invalid sample rate";
                 m_sampleRate = 0;
@@ -488,10 +615,25 @@ bool AirspySource::configure(std::string configurationStr)
             std::cerr << "AirspySource::configure: magc" << std::endl;
             mixAGC = true;
         }
+
+        if (m.find("zeroif") != m.end())
+        {
+            std::cerr << "AirspySource::configure: zeroif" << std::endl;
+            zeroif = true;
+        }
+    }
+
+    if (autorate)
+    {
+        std::vector<std::uint32_t> rates(m_srates.begin(), m_srates.end());
+        std::uint32_t rate = choose_sample_rate(rates, frequency, tuner_offset_ratio(zeroif));
+        sampleRateIndex = std::find(rates.begin(), rates.end(), rate) - rates.begin();
     }
 
     m_confFreq = frequency;
-    double tuner_freq = frequency + 0.25 * m_srates[sampleRateIndex];
+    double tuner_freq = frequency + tuner_offset_ratio(zeroif) * m_srates[sampleRateIndex];
+    m_iqconv.set_sample_rate(m_srates[sampleRateIndex]);
+    m_iqconv.set_enabled(zeroif);
     return configure(sampleRateIndex, tuner_freq, antBias, lnaGain, mixGain, vgaGain, lnaAGC, mixAGC);
 }
 
@@ -504,7 +646,7 @@ bool AirspySource::start(DataBuffer<IQSample> *buf, std::atomic_bool *stop_flag)
     {
         std::cerr << "AirspySource::start: starting" << std::endl;
         m_running = true;
-        m_thread = new std::thread(run, m_dev, stop_flag);
+        m_thread = new std::thread(&AirspySource::run, this);
         sleep(1);
         return *this;
     }
@@ -516,20 +658,21 @@ bool AirspySource::start(DataBuffer<IQSample> *buf, std::atomic_bool *stop_flag)
     }
 }
 
-void AirspySource::run(airspy_device* dev, std::atomic_bool *stop_flag)
+void AirspySource::run()
 {
     std::cerr << "AirspySource::run" << std::endl;
 
-    airspy_error rc = (airspy_error) airspy_start_rx(dev, rx_callback, 0);
+    // The callback finds its source through the transfer context.
+    airspy_error rc = (airspy_error) airspy_start_rx(m_dev, rx_callback, this);
 
     if (rc == AIRSPY_SUCCESS)
     {
-        while (!stop_flag->load() && (airspy_is_streaming(dev) == AIRSPY_TRUE))
+        while (!m_stop_flag->load() && (airspy_is_streaming(m_dev) == AIRSPY_TRUE))
         {
             sleep(1);
         }
         
-        rc = (airspy_error) airspy_stop_rx(dev);
+        rc = (airspy_error) airspy_stop_rx(m_dev);
         
         if (rc != AIRSPY_SUCCESS)
         {
@@ -555,9 +698,12 @@ int AirspySource::rx_callback(airspy_transfer_t* transfer)
 {
     int len = transfer->sample_count * 2; // interleaved I/Q samples
 
-    if (m_this)
+    AirspySource *source = static_cast<AirspySource*>(transfer->ctx);
+
+    if (source)
     {
-        m_this->callback((short *) transfer->samples, len);
+        source->m_dropped_samples += transfer->dropped_samples;
+        source->callback((short *) transfer->samples, len);
     }
 
     return 0;
@@ -567,15 +713,8 @@ void AirspySource::callback(const short* buf, int len)
 {
     IQSampleVector iqsamples;
 
-    iqsamples.resize(len/2);
-
-    for (int i = 0, j = 0; i < len; i+=2, j++)
-    {
-        int32_t re = buf[i];
-        int32_t im = buf[i+1];
-        iqsamples[j] = IQSample( re / IQSample::value_type(1<<11),   // 12 bits samples
-                                 im / IQSample::value_type(1<<11) );
-    }
+    // 12 bits samples
+    m_iqconv.convert(reinterpret_cast<const std::int16_t*>(buf), len/2, 12, iqsamples);
 
     m_buf->push(move(iqsamples));
 }
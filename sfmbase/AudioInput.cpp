@@ -0,0 +1,200 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include "AudioInput.h"
+
+
+/** Load little-endian integer. */
+template <typename T>
+static T get_value(const std::uint8_t *ptr)
+{
+    T value = 0;
+    for (std::size_t i = sizeof(T); i > 0; --i) {
+        value = (value << 8) | ptr[i-1];
+    }
+    return value;
+}
+
+
+/* ****************  class WavAudioInput  **************** */
+
+// Open .WAV file and parse its header.
+WavAudioInput::WavAudioInput(const std::string& filename)
+    : m_zombie(false)
+    , m_sample_rate(0)
+    , m_channels(0)
+    , m_bytes_per_sample(0)
+    , m_float32(false)
+    , m_remaining(0)
+{
+    m_stream = fopen(filename.c_str(), "rb");
+    if (m_stream == NULL) {
+        m_error  = "can not open '" + filename + "' (" +
+                   strerror(errno) + ")";
+        m_zombie = true;
+        return;
+    }
+
+    if (!read_header()) {
+        m_error  = "'" + filename + "': " + m_error;
+        m_zombie = true;
+    }
+}
+
+
+// Destructor.
+WavAudioInput::~WavAudioInput()
+{
+    if (m_stream) {
+        fclose(m_stream);
+    }
+}
+
+
+// Parse RIFF header up to the start of the data chunk.
+bool WavAudioInput::read_header()
+{
+    enum wFormatTagId
+    {
+        WAVE_FORMAT_PCM        = 0x0001,
+        WAVE_FORMAT_IEEE_FLOAT = 0x0003,
+        WAVE_FORMAT_EXTENSIBLE = 0xFFFE
+    };
+
+    std::uint8_t hdr[12];
+    if (fread(hdr, 1, 12, m_stream) != 12 ||
+        memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0) {
+        m_error = "not a .WAV file";
+        return false;
+    }
+
+    bool got_fmt = false;
+
+    while (true) {
+
+        std::uint8_t chunk[8];
+        if (fread(chunk, 1, 8, m_stream) != 8) {
+            m_error = "no data chunk";
+            return false;
+        }
+
+        std::uint32_t size = get_value<std::uint32_t>(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+
+            std::vector<std::uint8_t> fmt(size + (size & 1));
+            if (size < 16 || fread(fmt.data(), 1, fmt.size(), m_stream) != fmt.size()) {
+                m_error = "invalid fmt chunk";
+                return false;
+            }
+
+            unsigned int tag  = get_value<std::uint16_t>(fmt.data());
+            m_channels        = get_value<std::uint16_t>(fmt.data() + 2);
+            m_sample_rate     = get_value<std::uint32_t>(fmt.data() + 4);
+            unsigned int bits = get_value<std::uint16_t>(fmt.data() + 14);
+
+            // Sub format GUID starts with the format tag.
+            if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 26)
+                tag = get_value<std::uint16_t>(fmt.data() + 24);
+
+            if (tag == WAVE_FORMAT_PCM && bits == 16) {
+                m_float32 = false;
+            } else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+                m_float32 = true;
+            } else {
+                m_error = "unsupported sample format (need 16-bit PCM or 32-bit float)";
+                return false;
+            }
+
+            if (m_channels == 0 || m_sample_rate == 0) {
+                m_error = "invalid fmt chunk";
+                return false;
+            }
+
+            m_bytes_per_sample = bits / 8;
+            got_fmt = true;
+
+        } else if (memcmp(chunk, "data", 4) == 0) {
+
+            if (!got_fmt) {
+                m_error = "data chunk before fmt chunk";
+                return false;
+            }
+
+            // A writer that was interrupted leaves a dummy size;
+            // in that case read until end of file.
+            m_remaining = size;
+            return true;
+
+        } else {
+
+            if (fseek(m_stream, size + (size & 1), SEEK_CUR) != 0) {
+                m_error = "truncated file";
+                return false;
+            }
+        }
+    }
+}
+
+
+// Read samples from the first channel.
+bool WavAudioInput::read(SampleVector& samples, std::size_t nsamples)
+{
+    samples.clear();
+
+    if (m_zombie)
+        return false;
+
+    std::size_t framesize = m_channels * m_bytes_per_sample;
+    std::size_t nframes = std::min<std::uint64_t>(nsamples, m_remaining / framesize);
+
+    m_bytebuf.resize(nframes * framesize);
+    std::size_t k = fread(m_bytebuf.data(), 1, m_bytebuf.size(), m_stream);
+
+    if (k < m_bytebuf.size() && ferror(m_stream)) {
+        m_error = "read failed (";
+        m_error += strerror(errno);
+        m_error += ")";
+        return false;
+    }
+
+    nframes = k / framesize;
+    m_remaining = (k < m_bytebuf.size()) ? 0 : m_remaining - k;
+
+    samples.resize(nframes);
+    const std::uint8_t *p = m_bytebuf.data();
+
+    for (std::size_t i = 0; i < nframes; i++, p += framesize) {
+        if (m_float32) {
+            std::uint32_t u = get_value<std::uint32_t>(p);
+            float v;
+            memcpy(&v, &u, sizeof(v));
+            samples[i] = v;
+        } else {
+            samples[i] = std::int16_t(get_value<std::uint16_t>(p)) / 32768.0;
+        }
+    }
+
+    return true;
+}
+
+/* end */
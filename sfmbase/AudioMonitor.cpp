@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "AudioMonitor.h"
+
+
+/* ****************  class AudioMonitor  **************** */
+
+// Construct audio monitor.
+AudioMonitor::AudioMonitor(double sample_rate,
+                           bool stereo,
+                           double silence_db,
+                           double silence_time,
+                           double imbalance_db)
+    : m_sample_rate(sample_rate)
+    , m_stereo(stereo)
+    , m_silence_db(silence_db)
+    , m_silence_time(silence_time)
+    , m_imbalance_db(imbalance_db)
+    , m_stats{0, 0, 0, 0, 0, 0}
+    , m_silent(false)
+    , m_imbalanced(false)
+    , m_imbalance_duration(0)
+    , m_clip_time(0)
+    , m_clip_count(0)
+    , m_clip_peak(0)
+{ }
+
+
+// Apply gain and measure samples in one pass.
+void AudioMonitor::process(SampleVector& samples, double gain)
+{
+    m_events.clear();
+
+    unsigned int n = samples.size();
+    if (n == 0)
+        return;
+
+    Sample vsum = 0, vsumsq_left = 0, vsumsq_right = 0;
+    Sample peak = 0;
+    unsigned int clipped = 0;
+
+    if (m_stereo) {
+        for (unsigned int i = 0; i + 1 < n; i += 2) {
+            Sample l = samples[i], r = samples[i+1];
+            vsum         += l + r;
+            vsumsq_left  += l * l;
+            vsumsq_right += r * r;
+            l *= gain;
+            r *= gain;
+            samples[i]   = l;
+            samples[i+1] = r;
+            Sample a = std::max(std::fabs(l), std::fabs(r));
+            peak = std::max(peak, a);
+            clipped += (std::fabs(l) >= 1.0) + (std::fabs(r) >= 1.0);
+        }
+    } else {
+        for (unsigned int i = 0; i < n; i++) {
+            Sample v = samples[i];
+            vsum        += v;
+            vsumsq_left += v * v;
+            v *= gain;
+            samples[i] = v;
+            peak = std::max(peak, Sample(std::fabs(v)));
+            clipped += (std::fabs(v) >= 1.0);
+        }
+        vsumsq_right = vsumsq_left;
+    }
+
+    unsigned int nframes = m_stereo ? n / 2 : n;
+    double duration = nframes / m_sample_rate;
+
+    m_stats.mean    = vsum / n;
+    m_stats.rms     = sqrt((vsumsq_left + (m_stereo ? vsumsq_right : 0)) / n);
+    m_stats.peak    = peak;
+    m_stats.clipped += clipped;
+
+    char buf[160];
+
+    // Dead air.
+    if (20 * log10(std::max(m_stats.rms, 1.0e-10)) + 3.01 < m_silence_db) {
+        m_stats.silence += duration;
+        if (!m_silent && m_stats.silence >= m_silence_time) {
+            m_silent = true;
+            snprintf(buf, sizeof(buf), "{\"event\":\"silence\",\"state\":\"start\",\"duration\":%.1f}",
+                     m_stats.silence);
+            m_events.push_back(buf);
+        }
+    } else {
+        if (m_silent) {
+            m_silent = false;
+            snprintf(buf, sizeof(buf), "{\"event\":\"silence\",\"state\":\"end\",\"duration\":%.1f}",
+                     m_stats.silence);
+            m_events.push_back(buf);
+        }
+        m_stats.silence = 0;
+    }
+
+    // Clipping, reported at most once per second.
+    m_clip_count += clipped;
+    m_clip_peak = std::max(m_clip_peak, double(peak));
+    m_clip_time += duration;
+
+    if (m_clip_time >= 1.0) {
+        if (m_clip_count > 0) {
+            snprintf(buf, sizeof(buf), "{\"event\":\"clipping\",\"samples\":%llu,\"peak\":%.3f}",
+                     (unsigned long long)m_clip_count, m_clip_peak);
+            m_events.push_back(buf);
+        }
+        m_clip_time = 0;
+        m_clip_count = 0;
+        m_clip_peak = 0;
+    }
+
+    // Channel imbalance, not measured during silence.
+    if (m_stereo && !m_silent) {
+        // Average the level ratio, over about one second.
+        double ratio_db = 10 * log10(std::max(vsumsq_left, 1.0e-20) /
+                                     std::max(vsumsq_right, 1.0e-20));
+        double alpha = std::min(1.0, duration);
+        m_stats.imbalance_db += alpha * (ratio_db - m_stats.imbalance_db);
+
+        bool over = std::fabs(m_stats.imbalance_db) > m_imbalance_db;
+        m_imbalance_duration = over ? m_imbalance_duration + duration : 0;
+
+        if (over != m_imbalanced && (!over || m_imbalance_duration >= imbalance_time)) {
+            m_imbalanced = over;
+            snprintf(buf, sizeof(buf), "{\"event\":\"imbalance\",\"state\":\"%s\",\"db\":%.1f}",
+                     over ? "start" : "end", m_stats.imbalance_db);
+            m_events.push_back(buf);
+        }
+    }
+}
+
+/* end */
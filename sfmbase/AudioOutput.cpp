@@ -55,10 +55,33 @@ void AudioOutput::samplesToInt16(const SampleVector& samples,
 }
 
 
+// Encode a list of samples as 32-bit little-endian floats.
+void AudioOutput::samplesToFloat32(const SampleVector& samples,
+        std::vector<uint8_t>& bytes)
+{
+    bytes.resize(4 * samples.size());
+
+    SampleVector::const_iterator i = samples.begin();
+    SampleVector::const_iterator n = samples.end();
+    std::vector<uint8_t>::iterator k = bytes.begin();
+
+    while (i != n) {
+        float s = *(i++);
+        uint32_t u;
+        memcpy(&u, &s, sizeof(u));
+        *(k++) = u & 0xff;
+        *(k++) = (u >> 8) & 0xff;
+        *(k++) = (u >> 16) & 0xff;
+        *(k++) = (u >> 24) & 0xff;
+    }
+}
+
+
 /* ****************  class RawAudioOutput  **************** */
 
 // Construct raw audio writer.
-RawAudioOutput::RawAudioOutput(const std::string& filename)
+RawAudioOutput::RawAudioOutput(const std::string& filename, bool float32)
+  : m_float32(float32)
 {
     if (filename == "-") {
 
@@ -95,7 +118,10 @@ bool RawAudioOutput::write(const SampleVector& samples)
         return false;
 
     // Convert samples to bytes.
-    samplesToInt16(samples, m_bytebuf);
+    if (m_float32)
+        samplesToFloat32(samples, m_bytebuf);
+    else
+        samplesToInt16(samples, m_bytebuf);
 
     // Write data.
     std::size_t p = 0;
@@ -124,9 +150,11 @@ bool RawAudioOutput::write(const SampleVector& samples)
 // Construct .WAV writer.
 WavAudioOutput::WavAudioOutput(const std::string& filename,
                                unsigned int samplerate,
-                               bool stereo)
+                               bool stereo,
+                               bool float32)
   : numberOfChannels(stereo ? 2 : 1)
   , sampleRate(samplerate)
+  , m_float32(float32)
 {
     m_stream = fopen(filename.c_str(), "wb");
     if (m_stream == NULL) {
@@ -153,7 +181,7 @@ WavAudioOutput::~WavAudioOutput()
 
     if (!m_zombie) {
 
-        const unsigned bytesPerSample = 2;
+        const unsigned bytesPerSample = m_float32 ? 4 : 2;
 
         const long currentPosition = ftell(m_stream);
 
@@ -185,7 +213,10 @@ bool WavAudioOutput::write(const SampleVector& samples)
         return false;
 
     // Convert samples to bytes.
-    samplesToInt16(samples, m_bytebuf);
+    if (m_float32)
+        samplesToFloat32(samples, m_bytebuf);
+    else
+        samplesToInt16(samples, m_bytebuf);
 
     // Write samples to file.
     std::size_t k = fwrite(m_bytebuf.data(), 1, m_bytebuf.size(), m_stream);
@@ -203,8 +234,8 @@ bool WavAudioOutput::write(const SampleVector& samples)
 // (Re)write .WAV header.
 bool WavAudioOutput::write_header(unsigned int nsamples)
 {
-    const unsigned bytesPerSample = 2;
-    const unsigned bitsPerSample  = 16;
+    const unsigned bytesPerSample = m_float32 ? 4 : 2;
+    const unsigned bitsPerSample  = 8 * bytesPerSample;
 
     enum wFormatTagId
     {
@@ -223,7 +254,7 @@ bool WavAudioOutput::write_header(unsigned int nsamples)
     encode_chunk_id    (wavHeader +  8, "WAVE");
     encode_chunk_id    (wavHeader + 12, "fmt ");
     set_value<uint32_t>(wavHeader + 16, 16);
-    set_value<uint16_t>(wavHeader + 20, WAVE_FORMAT_PCM);
+    set_value<uint16_t>(wavHeader + 20, m_float32 ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM);
     set_value<uint16_t>(wavHeader + 22, numberOfChannels);
     set_value<uint32_t>(wavHeader + 24, sampleRate                                    ); // sample rate
     set_value<uint32_t>(wavHeader + 28, sampleRate * numberOfChannels * bytesPerSample); // byte rate
@@ -0,0 +1,331 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include "BandScanner.h"
+
+
+/* ****************  class StationIndex  **************** */
+
+// Load station index from text file.
+bool StationIndex::load(const std::string& filename)
+{
+    FILE *f = fopen(filename.c_str(), "r");
+    if (f == NULL) {
+        m_error = "can not open '" + filename + "' (" + strerror(errno) + ")";
+        return false;
+    }
+
+    m_stations.clear();
+
+    char line[256];
+    unsigned int lineno = 0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        StationInfo st;
+        int pilot;
+        char pi[16];
+
+        if (sscanf(line, "%lf %lf %d %15s", &st.frequency, &st.level, &pilot, pi) != 4) {
+            m_error = "invalid station index line " + std::to_string(lineno) +
+                      " in '" + filename + "'";
+            fclose(f);
+            return false;
+        }
+
+        st.pilot = (pilot != 0);
+        st.pi = (pi[0] == '-') ? -1 : int(strtol(pi, NULL, 16));
+        add(st);
+    }
+
+    fclose(f);
+    return true;
+}
+
+
+// Save station index to text file.
+bool StationIndex::save(const std::string& filename)
+{
+    FILE *f = fopen(filename.c_str(), "w");
+    if (f == NULL) {
+        m_error = "can not open '" + filename + "' (" + strerror(errno) + ")";
+        return false;
+    }
+
+    fprintf(f, "#  frequency  level_db pilot   pi\n");
+
+    for (const StationInfo& st : m_stations) {
+        char pi[8] = "-";
+        if (st.pi >= 0)
+            snprintf(pi, sizeof(pi), "%04X", st.pi & 0xffff);
+        fprintf(f, "%12.0f  %8.1f  %4d  %4s\n",
+                st.frequency, st.level, st.pilot ? 1 : 0, pi);
+    }
+
+    if (fclose(f) != 0) {
+        m_error = "write error on '" + filename + "' (" + strerror(errno) + ")";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Add station, keeping the index sorted by frequency.
+void StationIndex::add(const StationInfo& station)
+{
+    auto it = std::lower_bound(m_stations.begin(), m_stations.end(), station,
+                               [](const StationInfo& a, const StationInfo& b) {
+                                   return a.frequency < b.frequency;
+                               });
+    m_stations.insert(it, station);
+}
+
+
+// Return strongest station.
+const StationInfo *StationIndex::strongest() const
+{
+    const StationInfo *best = NULL;
+
+    for (const StationInfo& st : m_stations) {
+        if (best == NULL || st.level > best->level)
+            best = &st;
+    }
+
+    return best;
+}
+
+
+// Return center of the window covering the largest number of stations.
+double StationIndex::best_center(double width) const
+{
+    unsigned int n = m_stations.size();
+    unsigned int best_count = 0;
+    double center = 0;
+
+    // Stations are sorted; slide the window start over each station.
+    for (unsigned int i = 0, j = 0; i < n; i++) {
+        while (j < n && m_stations[j].frequency - m_stations[i].frequency <= width)
+            j++;
+        if (j - i > best_count) {
+            best_count = j - i;
+            center = 0.5 * (m_stations[i].frequency + m_stations[j-1].frequency);
+        }
+    }
+
+    return center;
+}
+
+
+/* ****************  class BandScanner  **************** */
+
+/** Return smallest power of two >= n. */
+static unsigned int next_pow2(unsigned int n)
+{
+    unsigned int p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+
+/** In-place radix-2 complex FFT (size must be a power of two). */
+static void fft_inplace(IQSampleVector& x)
+{
+    unsigned int n = x.size();
+
+    // Bit reversal permutation.
+    for (unsigned int i = 1, j = 0; i < n; i++) {
+        unsigned int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(x[i], x[j]);
+    }
+
+    // Butterflies.
+    for (unsigned int len = 2; len <= n; len <<= 1) {
+        double ang = -2.0 * M_PI / len;
+        IQSample wlen(cos(ang), sin(ang));
+        for (unsigned int i = 0; i < n; i += len) {
+            IQSample w(1, 0);
+            for (unsigned int k = 0; k < len / 2; k++) {
+                IQSample u = x[i+k];
+                IQSample v = x[i+k+len/2] * w;
+                x[i+k]       = u + v;
+                x[i+k+len/2] = u - v;
+                w *= wlen;
+            }
+        }
+    }
+}
+
+
+// Construct band scanner.
+BandScanner::BandScanner(double sample_rate, double threshold)
+    : m_sample_rate(sample_rate)
+    , m_threshold(threshold)
+    , m_fft_size(std::max(256u, next_pow2((unsigned int)(sample_rate / 1000.0))))
+    , m_window(m_fft_size)
+    , m_power(m_fft_size, 0.0)
+    , m_frames(0)
+{
+    // Hann window, scaled so that the summed bin power equals the
+    // mean signal power.
+    double wpower = 0;
+    for (unsigned int i = 0; i < m_fft_size; i++) {
+        m_window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / m_fft_size);
+        wpower += m_window[i] * m_window[i];
+    }
+
+    float scale = 1.0 / sqrt(wpower * m_fft_size);
+    for (unsigned int i = 0; i < m_fft_size; i++) {
+        m_window[i] *= scale;
+    }
+}
+
+
+// Clear averaged spectrum.
+void BandScanner::reset()
+{
+    std::fill(m_power.begin(), m_power.end(), 0.0);
+    m_frames = 0;
+    m_pending.clear();
+}
+
+
+// Add IQ samples to the averaged spectrum.
+void BandScanner::process(const IQSampleVector& samples_in)
+{
+    m_pending.insert(m_pending.end(), samples_in.begin(), samples_in.end());
+
+    unsigned int pos = 0;
+    m_buf_fft.resize(m_fft_size);
+
+    for (; pos + m_fft_size <= m_pending.size(); pos += m_fft_size) {
+        for (unsigned int i = 0; i < m_fft_size; i++) {
+            m_buf_fft[i] = m_pending[pos+i] * m_window[i];
+        }
+
+        fft_inplace(m_buf_fft);
+
+        for (unsigned int i = 0; i < m_fft_size; i++) {
+            m_power[i] += std::norm(m_buf_fft[i]);
+        }
+
+        m_frames++;
+    }
+
+    m_pending.erase(m_pending.begin(), m_pending.begin() + pos);
+}
+
+
+// Return half the usable bandwidth in Hz for channel centers.
+double BandScanner::get_usable_span() const
+{
+    return 0.4 * m_sample_rate - channel_halfwidth;
+}
+
+
+// Return channel power in dB at the given offset from the tuner.
+double BandScanner::channel_level(double offset) const
+{
+    double binwidth = m_sample_rate / m_fft_size;
+    int half = m_fft_size / 2;
+    int k0 = std::max(-half, int(ceil((offset - channel_halfwidth) / binwidth)));
+    int k1 = std::min(half - 1, int(floor((offset + channel_halfwidth) / binwidth)));
+    double p = 0;
+
+    for (int k = k0; k <= k1; k++) {
+        // Skip the DC spike of the receiver.
+        if (k >= -2 && k <= 2)
+            continue;
+        p += m_power[(k + m_fft_size) % m_fft_size];
+    }
+
+    p /= std::max(1u, m_frames);
+    return 10 * log10(std::max(p, 1.0e-20));
+}
+
+
+// Detect carriers on the channel raster within the usable bandwidth.
+std::vector<StationInfo> BandScanner::find_carriers(double center_freq,
+                                                    double min_freq,
+                                                    double max_freq) const
+{
+    std::vector<StationInfo> found;
+    double span = get_usable_span();
+    double binwidth = m_sample_rate / m_fft_size;
+
+    // Estimate noise floor per channel from the 20th percentile bin.
+    std::vector<double> bins;
+    int kmax = int((span + channel_halfwidth) / binwidth);
+    for (int k = -kmax; k <= kmax; k++) {
+        if (k < -2 || k > 2)
+            bins.push_back(m_power[(k + m_fft_size) % m_fft_size]);
+    }
+
+    if (bins.empty() || m_frames == 0)
+        return found;
+
+    std::nth_element(bins.begin(), bins.begin() + bins.size() / 5, bins.end());
+    double floor_bin = bins[bins.size() / 5] / m_frames;
+    double floor_db = 10 * log10(std::max(floor_bin * 2 * channel_halfwidth / binwidth,
+                                          1.0e-20));
+
+    // Walk the channel raster.
+    long nmin = lrint(ceil((std::max(min_freq, center_freq - span) - min_freq) / channel_step));
+    long nmax = lrint(floor((std::min(max_freq, center_freq + span) - min_freq) / channel_step));
+
+    for (long n = nmin; n <= nmax; n++) {
+        double f = min_freq + n * channel_step;
+        double offset = f - center_freq;
+        double level = channel_level(offset);
+
+        if (level < floor_db + m_threshold)
+            continue;
+
+        // Require a local maximum to reject the skirts of strong
+        // stations on adjacent channels.
+        if (level < channel_level(offset - channel_step) ||
+            level < channel_level(offset + channel_step))
+            continue;
+
+        StationInfo st;
+        st.frequency = f;
+        st.level     = level;
+        st.pilot     = false;
+        st.pi        = -1;
+        found.push_back(st);
+    }
+
+    return found;
+}
+
+/* end */
@@ -0,0 +1,342 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "BatchDecoder.h"
+#include "Source.h"
+
+
+/**
+ * Prepare sample correction for an archive. Archives keep the uncorrected
+ * device samples; only zero-IF recordings need DC and I/Q correction.
+ */
+static void init_iqconv(IQConverter& iqconv, const IQArchiveCodec::Header& header)
+{
+    iqconv.set_sample_rate(header.sample_rate);
+    iqconv.set_enabled(Source::zeroif_tuning(header.frequency, header.conf_frequency,
+                                             header.sample_rate));
+}
+
+
+/** Return greatest common divisor. */
+static std::uint64_t gcd(std::uint64_t a, std::uint64_t b)
+{
+    while (b != 0) {
+        std::uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+/** Round up to a multiple of align. */
+static std::uint64_t round_up(std::uint64_t n, std::uint64_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+
+/* ****************  class BatchDecoder  **************** */
+
+// Prepare batch decoding.
+BatchDecoder::BatchDecoder(const std::string& filename,
+                           std::uint64_t start,
+                           std::uint64_t end,
+                           std::uint64_t chunk_length,
+                           std::uint64_t warmup_length,
+                           std::uint64_t align,
+                           unsigned int channels,
+                           DecoderFactory factory)
+    : m_filename(filename)
+    , m_start(start)
+    , m_end(std::max(start, end))
+    , m_chunk_length(round_up(std::max<std::uint64_t>(chunk_length, 1), align))
+    , m_warmup_length(round_up(warmup_length, align))
+    , m_channels(channels)
+    , m_factory(factory)
+{
+}
+
+
+// Return the resampler phase period in IF samples.
+std::uint64_t BatchDecoder::alignment(std::uint32_t sample_rate_if,
+                                      std::uint32_t sample_rate_pcm,
+                                      unsigned int downsample)
+{
+    // The audio resampler repeats after this many IF samples, which
+    // must also be a whole number of baseband samples.
+    std::uint64_t period = sample_rate_if / gcd(sample_rate_if, sample_rate_pcm);
+    return period / gcd(period, downsample) * downsample;
+}
+
+
+// Decode chunks in parallel.
+bool BatchDecoder::run(unsigned int nthreads,
+                       ChunkHandler handler,
+                       const std::atomic_bool *stop_flag)
+{
+    const unsigned int nchunks = num_chunks();
+    const unsigned int max_ahead = 2 * std::max(1u, nthreads);
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::unique_ptr<Chunk>> done(nchunks);
+    unsigned int next_chunk = 0;
+    unsigned int next_output = 0;
+    std::atomic_bool failed(false);
+
+    auto worker = [&]()
+    {
+        IQArchiveReader reader(m_filename);
+        std::string error;
+
+        if (!reader) {
+            std::unique_lock<std::mutex> lock(mutex);
+            m_error = reader.error();
+            failed.store(true);
+            cond.notify_all();
+            return;
+        }
+
+        while (true) {
+
+            // Take the next chunk, but do not run too far ahead of the output.
+            unsigned int k;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]{ return failed.load() ||
+                                            next_chunk >= nchunks ||
+                                            next_chunk < next_output + max_ahead; });
+                if (failed.load() || next_chunk >= nchunks)
+                    return;
+                k = next_chunk++;
+            }
+
+            std::uint64_t chunk_start = m_start + k * m_chunk_length;
+            std::uint64_t chunk_end = std::min(m_end, chunk_start + m_chunk_length);
+            std::uint64_t begin = chunk_start - std::min(chunk_start - m_start, m_warmup_length);
+
+            std::unique_ptr<Chunk> chunk(new Chunk);
+            chunk->index = k;
+            std::unique_ptr<FmDecoder> fm(m_factory());
+            IQConverter iqconv;
+            init_iqconv(iqconv, reader.header());
+
+            bool ok = decode_range(*fm, iqconv, reader, begin, chunk_start, chunk_end,
+                                   true, &failed, *chunk, error);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (ok) {
+                done[k] = move(chunk);
+            } else if (!failed.load()) {
+                m_error = error;
+                failed.store(true);
+            }
+            lock.unlock();
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < std::max(1u, nthreads); i++)
+        threads.push_back(std::thread(worker));
+
+    // Pass chunks to the handler in order.
+    while (next_output < nchunks) {
+
+        std::unique_ptr<Chunk> chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!failed.load() && !done[next_output]) {
+                cond.wait_for(lock, std::chrono::milliseconds(100));
+                if (stop_flag != NULL && stop_flag->load() && !failed.load()) {
+                    m_error = "Interrupted";
+                    failed.store(true);
+                }
+            }
+            if (failed.load())
+                break;
+            chunk = move(done[next_output]);
+            next_output++;
+        }
+        cond.notify_all();
+
+        if (!handler(*chunk)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (m_error.empty())
+                m_error = "Aborted";
+            failed.store(true);
+            break;
+        }
+    }
+
+    // Release and join workers.
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        failed.store(true);
+    }
+    cond.notify_all();
+
+    for (std::thread& t : threads)
+        t.join();
+
+    return m_error.empty();
+}
+
+
+// Decode the whole range with a single decoder.
+bool BatchDecoder::run_sequential(ChunkHandler handler,
+                                  const std::atomic_bool *stop_flag)
+{
+    IQArchiveReader reader(m_filename);
+
+    if (!reader) {
+        m_error = reader.error();
+        return false;
+    }
+
+    std::unique_ptr<FmDecoder> fm(m_factory());
+    IQConverter iqconv;
+    init_iqconv(iqconv, reader.header());
+
+    for (unsigned int k = 0; k < num_chunks(); k++) {
+
+        std::uint64_t chunk_start = m_start + k * m_chunk_length;
+        std::uint64_t chunk_end = std::min(m_end, chunk_start + m_chunk_length);
+
+        Chunk chunk;
+        chunk.index = k;
+
+        if (!decode_range(*fm, iqconv, reader, chunk_start, chunk_start, chunk_end,
+                          k == 0, stop_flag, chunk, m_error)) {
+            return false;
+        }
+
+        if (!handler(chunk)) {
+            m_error = "Aborted";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Decode a range of samples.
+bool BatchDecoder::decode_range(FmDecoder& fm,
+                                IQConverter& iqconv,
+                                IQArchiveReader& reader,
+                                std::uint64_t begin,
+                                std::uint64_t keep,
+                                std::uint64_t end,
+                                bool prime,
+                                const std::atomic_bool *stop_flag,
+                                Chunk& chunk,
+                                std::string& error)
+{
+    if (reader.position() != begin && !reader.seek(begin)) {
+        error = "Chunk start beyond end of recording";
+        return false;
+    }
+
+    IQSampleVector filebuf;
+    std::size_t filepos = 0;
+    std::uint64_t pos = begin;
+    std::size_t drop = 0;
+    SampleVector audio;
+
+    while (pos < end) {
+
+        if (stop_flag != NULL && stop_flag->load()) {
+            error = "Interrupted";
+            return false;
+        }
+
+        // Collect the next block; warm-up and kept samples go into
+        // separate blocks.
+        std::uint64_t block_end = (pos < keep) ? keep : end;
+        std::size_t n = std::min<std::uint64_t>(block_end - pos, block_length);
+        IQSampleVector samples;
+        samples.reserve(n);
+
+        while (samples.size() < n) {
+            if (filepos == filebuf.size()) {
+                if (!reader.read(filebuf)) {
+                    error = reader.error();
+                    return false;
+                }
+                filepos = 0;
+                if (filebuf.empty())
+                    break;
+            }
+            std::size_t m = std::min(n - samples.size(), filebuf.size() - filepos);
+            samples.insert(samples.end(), filebuf.begin() + filepos,
+                           filebuf.begin() + filepos + m);
+            filepos += m;
+        }
+
+        if (samples.empty())
+            break;
+
+        iqconv.process(samples);
+
+        if (prime) {
+            drop = fm.prime(samples) * m_channels;
+            prime = false;
+        }
+
+        fm.process(samples, audio);
+
+        bool warmup = (pos < keep);
+        pos += samples.size();
+
+        if (drop > 0) {
+            std::size_t ndrop = std::min(drop, audio.size());
+            audio.erase(audio.begin(), audio.begin() + ndrop);
+            drop -= ndrop;
+        }
+
+        if (warmup)
+            continue;
+
+        chunk.audio.insert(chunk.audio.end(), audio.begin(), audio.end());
+
+        if (fm.get_rds() != NULL) {
+            const std::vector<std::string>& events = fm.get_rds()->get_events();
+            chunk.rds_events.insert(chunk.rds_events.end(), events.begin(), events.end());
+        }
+    }
+
+    // Leave the reader at the end of the range, so that the next
+    // sequential chunk continues without seeking.
+    if (filepos < filebuf.size() && !reader.seek(pos)) {
+        error = "Seek failed";
+        return false;
+    }
+
+    return true;
+}
+
+/* end */
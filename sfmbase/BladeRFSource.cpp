@@ -28,7 +28,6 @@
 #include "parsekv.h"
 #include "BladeRFSource.h"
 
-BladeRFSource *BladeRFSource::m_this = 0;
 const std::vector<int> BladeRFSource::m_lnaGains({0, 3, 6});
 const std::vector<int> BladeRFSource::m_vga1Gains({5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30});
 const std::vector<int> BladeRFSource::m_vga2Gains({0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30});
@@ -46,7 +45,8 @@ BladeRFSource::BladeRFSource(const char *serial) :
     m_lnaGain(3),
     m_vga1Gain(6),
     m_vga2Gain(5),
-    m_thread(0)
+    m_thread(0),
+    m_nextTimestamp(0)
 {
     int status;
     struct bladerf_devinfo info;
@@ -93,7 +93,7 @@ BladeRFSource::BladeRFSource(const char *serial) :
         }
         else
         {
-            if ((status = bladerf_sync_config(m_dev, BLADERF_MODULE_RX, BLADERF_FORMAT_SC16_Q11, 64, 8192, 32, 10000)) < 0)
+            if ((status = bladerf_sync_config(m_dev, BLADERF_MODULE_RX, BLADERF_FORMAT_SC16_Q11_META, 64, 8192, 32, 10000)) < 0)
             {
                 std::ostringstream err_ostr;
                 err_ostr << "bladerf_sync_config failed with return code " << status;
@@ -168,8 +168,6 @@ BladeRFSource::BladeRFSource(const char *serial) :
     }
 
     m_bwfiltStr = bw_ostr.str();
-
-    m_this = this;
 }
 
 
@@ -179,8 +177,6 @@ BladeRFSource::~BladeRFSource()
     if (m_dev) {
         bladerf_close(m_dev);
     }
-        
-    m_this = 0;
 }
 
 bool BladeRFSource::configure(std::string configurationStr)
@@ -195,6 +191,8 @@ bool BladeRFSource::configure(std::string configurationStr)
     int lnaGainIndex = 2; // 3 dB
     int vga1Gain = 20;
     int vga2Gain = 9;
+    bool zeroif = false;
+    bool autorate = false;
 
     parsekv::key_value_sequence<std::string::iterator> p;
     parsekv::pairs_type m;
@@ -209,9 +207,10 @@ bool BladeRFSource::configure(std::string configurationStr)
         if (m.find("srate") != m.end())
         {
             std::cerr << "BladeRFSource::configure: srate: " << m["srate"] << std::endl;
+            autorate = (strcasecmp(m["srate"].c_str(), "auto") == 0);
             sample_rate = atoi(m["srate"].c_str());
 
-            if ((sample_rate < 48000) || (sample_rate > 40000000))
+            if (!autorate && ((sample_rate < 48000) || (sample_rate > 40000000)))
             {
                 m_error = "Invalid sample rate";
                 return false;
@@ -316,9 +315,34 @@ bool BladeRFSource::configure(std::string configurationStr)
             }
         }
 
-        // Intentionally tune at a higher frequency to avoid DC offset.
+        if (m.find("zeroif") != m.end())
+        {
+            std::cerr << "BladeRFSource::configure: zeroif" << std::endl;
+            zeroif = true;
+        }
+
+        if (autorate)
+        {
+            // Rates below the RX filter bandwidth would alias adjacent
+            // stations into the IF band.
+            static const std::uint32_t candidates[] = {
+                1536000, 1920000, 2000000, 2400000, 3072000, 4000000, 5000000,
+                8000000, 10000000, 20000000, 40000000 };
+            std::vector<std::uint32_t> rates;
+
+            for (std::uint32_t rate : candidates)
+            {
+                if (rate >= bandwidth)
+                    rates.push_back(rate);
+            }
+
+            sample_rate = choose_sample_rate(rates, frequency, tuner_offset_ratio(zeroif));
+        }
+
         m_confFreq = frequency;
-        double tuner_freq = frequency + 0.25 * sample_rate;
+        double tuner_freq = frequency + tuner_offset_ratio(zeroif) * sample_rate;
+        m_iqconv.set_sample_rate(sample_rate);
+        m_iqconv.set_enabled(zeroif);
 
         return configure(sample_rate, tuner_freq, bandwidth, lnaGainIndex, vga1Gain, vga2Gain);
     }
@@ -389,6 +413,114 @@ uint32_t BladeRFSource::get_frequency()
     return static_cast<uint32_t>(m_frequency);
 }
 
+// Set device center frequency in Hz while streaming.
+bool BladeRFSource::set_frequency(uint32_t frequency)
+{
+    if (!m_dev || bladerf_set_frequency(m_dev, BLADERF_MODULE_RX, frequency) != 0)
+    {
+        m_error = "Cannot set Rx frequency";
+        return false;
+    }
+
+    m_frequency = frequency;
+    return true;
+}
+
+// Set device gains while streaming.
+bool BladeRFSource::set_gain(const std::string& gains)
+{
+    namespace qi = boost::spirit::qi;
+    std::string config(gains);
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end)
+    {
+        m_error = "Gain parsing failed";
+        return false;
+    }
+
+    if (!m_dev)
+    {
+        return false;
+    }
+
+    if (m.find("lgain") != m.end())
+    {
+        int lnaGain = atoi(m["lgain"].c_str());
+        std::vector<int>::const_iterator it = find(m_lnaGains.begin(), m_lnaGains.end(), lnaGain);
+
+        if (it == m_lnaGains.end())
+        {
+            m_error = "Invalid LNA gain";
+            return false;
+        }
+
+        int lnaGainIndex = (it - m_lnaGains.begin()) + 1;
+
+        if (bladerf_set_lna_gain(m_dev, static_cast<bladerf_lna_gain>(lnaGainIndex)) != 0)
+        {
+            m_error = "Cannot set LNA gain";
+            return false;
+        }
+
+        m_lnaGain = lnaGain;
+    }
+
+    if (m.find("v1gain") != m.end())
+    {
+        int vga1Gain = atoi(m["v1gain"].c_str());
+
+        if (find(m_vga1Gains.begin(), m_vga1Gains.end(), vga1Gain) == m_vga1Gains.end())
+        {
+            m_error = "VGA1 gain not supported. Available gains (dB): " + m_vga1GainsStr;
+            return false;
+        }
+
+        if (bladerf_set_rxvga1(m_dev, vga1Gain) != 0)
+        {
+            m_error = "Cannot set VGA1 gain";
+            return false;
+        }
+
+        m_vga1Gain = vga1Gain;
+    }
+
+    if (m.find("v2gain") != m.end())
+    {
+        int vga2Gain = atoi(m["v2gain"].c_str());
+
+        if (find(m_vga2Gains.begin(), m_vga2Gains.end(), vga2Gain) == m_vga2Gains.end())
+        {
+            m_error = "VGA2 gain not supported. Available gains (dB): " + m_vga2GainsStr;
+            return false;
+        }
+
+        if (bladerf_set_rxvga2(m_dev, vga2Gain) != 0)
+        {
+            m_error = "Cannot set VGA2 gain";
+            return false;
+        }
+
+        m_vga2Gain = vga2Gain;
+    }
+
+    return true;
+}
+
+// Get gain settings for software gain control.
+bool BladeRFSource::get_gain_steps(std::vector<GainStep>& steps, std::size_t& current)
+{
+    current = make_gain_steps({ "lgain", "v1gain", "v2gain" },
+                              { m_lnaGains, m_vga1Gains, m_vga2Gains },
+                              { m_lnaGain, m_vga1Gain, m_vga2Gain },
+                              steps);
+    return true;
+}
+
 void BladeRFSource::print_specific_parms()
 {
     fprintf(stderr, "Bandwidth:         %d\n", m_actualBandwidth);
@@ -404,7 +536,7 @@ bool BladeRFSource::start(DataBuffer<IQSample>* buf, std::atomic_bool *stop_flag
     
     if (m_thread == 0)
     {
-        m_thread = new std::thread(run);
+        m_thread = new std::thread(&BladeRFSource::run, this);
         return true;
     }
     else
@@ -430,9 +562,9 @@ void BladeRFSource::run()
 {
     IQSampleVector iqsamples;
 
-    while (!m_this->m_stop_flag->load() && get_samples(&iqsamples))
+    while (!m_stop_flag->load() && get_samples(&iqsamples))
     {
-        m_this->m_buf->push(move(iqsamples));
+        m_buf->push(move(iqsamples));
     }
 }
 
@@ -441,23 +573,27 @@ bool BladeRFSource::get_samples(IQSampleVector *samples)
 {
     int res;
     std::vector<int16_t> buf(2*m_blockSize);
+    struct bladerf_metadata meta;
 
-    if ((res = bladerf_sync_rx(m_this->m_dev, buf.data(), m_blockSize, 0, 10000)) < 0)
+    memset(&meta, 0, sizeof(meta));
+    meta.flags = BLADERF_META_FLAG_RX_NOW;
+
+    if ((res = bladerf_sync_rx(m_dev, buf.data(), m_blockSize, &meta, 10000)) < 0)
     {
-        m_this->m_error = "bladerf_sync_rx failed";
+        m_error = "bladerf_sync_rx failed";
         return false;
     }
 
-    samples->resize(m_blockSize);
-
-    for (int i = 0; i < m_blockSize; i++)
+    // Samples lost in an overrun show up as a gap in the timestamps.
+    if (m_nextTimestamp != 0 && meta.timestamp > m_nextTimestamp)
     {
-        int32_t re = buf[2*i];
-        int32_t im = buf[2*i+1];
-        (*samples)[i] = IQSample( re / IQSample::value_type(1<<11),
-                                  im / IQSample::value_type(1<<11) );
+        m_dropped_samples += meta.timestamp - m_nextTimestamp;
     }
 
+    m_nextTimestamp = meta.timestamp + meta.actual_count;
+
+    m_iqconv.convert(buf.data(), meta.actual_count, 12, *samples);
+
     return true;
 }
 
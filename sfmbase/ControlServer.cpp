@@ -0,0 +1,284 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ControlServer.h"
+
+
+/* ****************  class ControlServer  **************** */
+
+// Create socket and start server thread.
+ControlServer::ControlServer(const std::string& path)
+    : m_path(path)
+    , m_zombie(true)
+    , m_listen_fd(-1)
+    , m_next_client(0)
+    , m_stop(false)
+{
+    m_wake_pipe[0] = m_wake_pipe[1] = -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        m_error = "socket path too long";
+        return;
+    }
+
+    strcpy(addr.sun_path, path.c_str());
+
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen_fd < 0) {
+        m_error = std::string("can not create socket (") + strerror(errno) + ")";
+        return;
+    }
+
+    // Replace stale socket of a previous run.
+    unlink(path.c_str());
+
+    if (bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(m_listen_fd, max_clients) < 0) {
+        m_error = "can not bind '" + path + "' (" + strerror(errno) + ")";
+        close(m_listen_fd);
+        m_listen_fd = -1;
+        return;
+    }
+
+    if (pipe(m_wake_pipe) < 0) {
+        m_error = std::string("can not create pipe (") + strerror(errno) + ")";
+        return;
+    }
+
+    fcntl(m_wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+    m_zombie = false;
+    m_thread = std::thread(&ControlServer::run, this);
+}
+
+
+// Stop server thread, close connections and remove the socket.
+ControlServer::~ControlServer()
+{
+    if (m_thread.joinable()) {
+        m_stop.store(true);
+        char c = 0;
+        (void)!write(m_wake_pipe[1], &c, 1);
+        m_thread.join();
+    }
+
+    for (auto& c : m_clients) {
+        close(c.second.fd);
+    }
+
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+        unlink(m_path.c_str());
+    }
+
+    if (m_wake_pipe[0] >= 0) {
+        close(m_wake_pipe[0]);
+        close(m_wake_pipe[1]);
+    }
+}
+
+
+// Return commands received since the last call.
+std::vector<ControlServer::Command> ControlServer::pull_commands()
+{
+    std::vector<Command> ret;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ret.swap(m_commands);
+    return ret;
+}
+
+
+// Send a reply line to the client that sent the command.
+void ControlServer::reply(const Command& cmd, const std::string& text)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Command r;
+        r.client = cmd.client;
+        r.line   = text + "\n";
+        m_replies.push_back(r);
+    }
+
+    // Wake up server thread.
+    char c = 0;
+    (void)!write(m_wake_pipe[1], &c, 1);
+}
+
+
+// Send an event line to all connected clients.
+void ControlServer::notify(const std::string& text)
+{
+    Command cmd;
+    cmd.client = all_clients;
+    reply(cmd, text);
+}
+
+
+// Queue replies for their clients and write as much as possible.
+void ControlServer::send_replies()
+{
+    std::vector<Command> replies;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        replies.swap(m_replies);
+    }
+
+    for (const Command& r : replies) {
+        for (auto& c : m_clients) {
+            if (r.client == all_clients || r.client == c.first)
+                c.second.outbuf += r.line;
+        }
+    }
+
+    for (auto it = m_clients.begin(); it != m_clients.end(); ) {
+        Client& c = it->second;
+        bool drop = false;
+
+        if (!c.outbuf.empty()) {
+            ssize_t n = send(c.fd, c.outbuf.data(), c.outbuf.size(),
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0)
+                c.outbuf.erase(0, n);
+            else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                drop = true;
+        }
+
+        // Drop clients that do not read their replies.
+        if (drop || c.outbuf.size() > max_backlog) {
+            close(c.fd);
+            it = m_clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+// Accept clients, read command lines and write replies.
+void ControlServer::run()
+{
+    std::vector<struct pollfd> fds;
+    std::vector<unsigned int> ids;
+
+    while (!m_stop.load()) {
+
+        fds.clear();
+        ids.clear();
+
+        struct pollfd pfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        pfd.fd = m_wake_pipe[0];
+        fds.push_back(pfd);
+        pfd.fd = m_listen_fd;
+        fds.push_back(pfd);
+
+        for (const auto& c : m_clients) {
+            pfd.fd = c.second.fd;
+            pfd.events = c.second.outbuf.empty() ? POLLIN : (POLLIN | POLLOUT);
+            fds.push_back(pfd);
+            ids.push_back(c.first);
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        // Drain wake-up pipe and send replies, also to clients that
+        // became writable again.
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(m_wake_pipe[0], buf, sizeof(buf)) > 0) { }
+        }
+
+        send_replies();
+
+        // Accept new client.
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(m_listen_fd, NULL, NULL);
+            if (fd >= 0 && m_clients.size() >= max_clients) {
+                close(fd);
+            } else if (fd >= 0) {
+                Client c;
+                c.fd = fd;
+                m_clients[m_next_client++] = c;
+            }
+        }
+
+        // Read command lines from clients.
+        for (unsigned int i = 0; i < ids.size(); i++) {
+            if (!(fds[i+2].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            auto it = m_clients.find(ids[i]);
+            if (it == m_clients.end())
+                continue;
+
+            Client& c = it->second;
+            char buf[512];
+            ssize_t n = read(c.fd, buf, sizeof(buf));
+
+            if (n <= 0) {
+                close(c.fd);
+                m_clients.erase(it);
+                continue;
+            }
+
+            c.inbuf.append(buf, n);
+
+            std::string::size_type p;
+            while ((p = c.inbuf.find('\n')) != std::string::npos) {
+                Command cmd;
+                cmd.client = ids[i];
+                cmd.line = c.inbuf.substr(0, p);
+                if (!cmd.line.empty() && cmd.line.back() == '\r')
+                    cmd.line.erase(cmd.line.size() - 1);
+                c.inbuf.erase(0, p + 1);
+
+                if (!cmd.line.empty()) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_commands.push_back(cmd);
+                }
+            }
+
+            // Drop clients sending overlong lines.
+            if (c.inbuf.size() > max_line_length) {
+                close(c.fd);
+                m_clients.erase(it);
+            }
+        }
+    }
+}
+
+/* end */
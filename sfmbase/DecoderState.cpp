@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "DecoderState.h"
+
+
+/* ****************  class StateWriter  **************** */
+
+// Append a vector of samples.
+void StateWriter::put(const SampleVector& samples)
+{
+    put(std::uint64_t(samples.size()));
+    const std::uint8_t *p = reinterpret_cast<const std::uint8_t*>(samples.data());
+    m_data.insert(m_data.end(), p, p + samples.size() * sizeof(Sample));
+}
+
+
+// Append a vector of IQ samples.
+void StateWriter::put(const IQSampleVector& samples)
+{
+    put(std::uint64_t(samples.size()));
+    const std::uint8_t *p = reinterpret_cast<const std::uint8_t*>(samples.data());
+    m_data.insert(m_data.end(), p, p + samples.size() * sizeof(IQSample));
+}
+
+
+// Append a string.
+void StateWriter::put(const std::string& str)
+{
+    put(std::uint64_t(str.size()));
+    m_data.insert(m_data.end(), str.begin(), str.end());
+}
+
+
+/* ****************  class StateReader  **************** */
+
+// Read a vector length and check it, or resize the vector.
+template <typename V>
+bool StateReader::get_length(V& samples, bool resize)
+{
+    std::uint64_t len = 0;
+    get(len);
+
+    if (m_ok && resize && len <= (m_data.size() - m_pos) / sizeof(samples[0]))
+        samples.resize(len);
+
+    if (!m_ok || len != samples.size()) {
+        m_ok = false;
+        return false;
+    }
+
+    return true;
+}
+
+
+// Read a vector of samples.
+void StateReader::get(SampleVector& samples, bool resize)
+{
+    if (!get_length(samples, resize)) {
+        return;
+    }
+
+    std::size_t nbytes = samples.size() * sizeof(Sample);
+
+    if (m_data.size() - m_pos < nbytes) {
+        m_ok = false;
+        return;
+    }
+
+    memcpy(samples.data(), m_data.data() + m_pos, nbytes);
+    m_pos += nbytes;
+}
+
+
+// Read a vector of IQ samples.
+void StateReader::get(IQSampleVector& samples, bool resize)
+{
+    if (!get_length(samples, resize)) {
+        return;
+    }
+
+    std::size_t nbytes = samples.size() * sizeof(IQSample);
+
+    if (m_data.size() - m_pos < nbytes) {
+        m_ok = false;
+        return;
+    }
+
+    memcpy(reinterpret_cast<void*>(samples.data()), m_data.data() + m_pos, nbytes);
+    m_pos += nbytes;
+}
+
+
+// Read a string.
+void StateReader::get(std::string& str)
+{
+    std::uint64_t len = 0;
+    get(len);
+
+    if (!m_ok || m_data.size() - m_pos < len) {
+        m_ok = false;
+        return;
+    }
+
+    str.assign(m_data.begin() + m_pos, m_data.begin() + m_pos + len);
+    m_pos += len;
+}
+
+/* end */
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "DeviceGroup.h"
+
+
+/* ****************  class DeviceGroup  **************** */
+
+// Construct empty group.
+DeviceGroup::DeviceGroup()
+{ }
+
+
+// Stop all devices.
+DeviceGroup::~DeviceGroup()
+{
+    stop();
+}
+
+
+// Add a configured device.
+void DeviceGroup::add(Source *source)
+{
+    m_devices.emplace_back(new Device);
+    m_devices.back()->source.reset(source);
+    m_devices.back()->started = false;
+}
+
+
+// Start streaming on all devices.
+bool DeviceGroup::start(std::atomic_bool *stop_flag)
+{
+    for (std::unique_ptr<Device>& dev : m_devices)
+    {
+        if (!dev->source->start(&dev->buffer, stop_flag))
+        {
+            m_error = dev->source->get_device_name() + ": " + dev->source->error();
+            return false;
+        }
+
+        dev->started = true;
+    }
+
+    return true;
+}
+
+
+// Stop streaming on all devices.
+void DeviceGroup::stop()
+{
+    for (std::unique_ptr<Device>& dev : m_devices)
+    {
+        if (dev->started)
+        {
+            dev->source->stop();
+            dev->started = false;
+        }
+    }
+}
+
+/* end */
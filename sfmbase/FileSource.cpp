@@ -0,0 +1,254 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "util.h"
+#include "parsekv.h"
+#include "FileSource.h"
+
+// Construct file source.
+FileSource::FileSource() :
+    m_start(0),
+    m_realtime(false),
+    m_block_length(default_block_length),
+    m_thread(0)
+{
+    m_devname = "IQ archive file";
+}
+
+FileSource::~FileSource()
+{
+    stop();
+}
+
+bool FileSource::configure(std::string configurationStr)
+{
+    namespace qi = boost::spirit::qi;
+    std::string::iterator begin = configurationStr.begin();
+    std::string::iterator end = configurationStr.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m))
+    {
+        m_error = "Configuration parsing failed\n";
+        return false;
+    }
+
+    if (m.find("file") == m.end())
+    {
+        m_error = "Missing file name (file=<path>)";
+        return false;
+    }
+
+    m_filename = m["file"];
+    std::cerr << "FileSource::configure: file: " << m_filename << std::endl;
+
+    if (m.find("start") != m.end())
+    {
+        std::cerr << "FileSource::configure: start: " << m["start"] << std::endl;
+
+        if (!parse_dbl(m["start"].c_str(), m_start) || m_start < 0)
+        {
+            m_error = "Invalid start time";
+            return false;
+        }
+    }
+
+    if (m.find("blklen") != m.end())
+    {
+        std::cerr << "FileSource::configure: blklen: " << m["blklen"] << std::endl;
+        int block_length = atoi(m["blklen"].c_str());
+
+        if (block_length < 1024)
+        {
+            m_error = "Invalid block length";
+            return false;
+        }
+
+        m_block_length = block_length;
+    }
+
+    if (m.find("realtime") != m.end())
+    {
+        std::cerr << "FileSource::configure: realtime" << std::endl;
+        m_realtime = true;
+    }
+
+    m_reader.reset(new IQArchiveReader(m_filename));
+
+    if (!(*m_reader))
+    {
+        m_error = m_reader->error();
+        m_reader.reset();
+        return false;
+    }
+
+    m_confFreq = m_reader->header().conf_frequency;
+    m_iqconv.set_sample_rate(m_reader->header().sample_rate);
+
+    // Archives keep the uncorrected device samples; only zero-IF
+    // recordings need DC and I/Q correction.
+    m_iqconv.set_enabled(zeroif_tuning(m_reader->header().frequency,
+                                       m_confFreq,
+                                       m_reader->header().sample_rate));
+
+    // Seek directly to the block containing the start time.
+    std::uint64_t start_index = llrint(m_start * m_reader->header().sample_rate);
+
+    if (!m_reader->seek(start_index))
+    {
+        m_error = "Start time beyond end of recording";
+        return false;
+    }
+
+    return true;
+}
+
+// Return current sample frequency in Hz.
+std::uint32_t FileSource::get_sample_rate()
+{
+    return m_reader ? lrint(m_reader->header().sample_rate) : 0;
+}
+
+// Return device center frequency of the recording in Hz.
+std::uint32_t FileSource::get_frequency()
+{
+    return m_reader ? m_reader->header().frequency : 0;
+}
+
+// Return number of bits per device sample of the recording.
+unsigned int FileSource::get_sample_bits()
+{
+    return m_reader ? m_reader->header().bits : 16;
+}
+
+void FileSource::print_specific_parms()
+{
+    if (!m_reader)
+        return;
+
+    double srate = m_reader->header().sample_rate;
+
+    fprintf(stderr, "file:              %s\n", m_filename.c_str());
+    fprintf(stderr, "sample bits:       %u\n", m_reader->header().bits);
+    fprintf(stderr, "duration:          %.1f s\n", m_reader->num_samples() / srate);
+    fprintf(stderr, "start time:        %.1f s\n", m_reader->position() / srate);
+    fprintf(stderr, "replay:            %s\n", m_realtime ? "real time" : "as fast as possible");
+}
+
+bool FileSource::start(DataBuffer<IQSample>* buf, std::atomic_bool *stop_flag)
+{
+    m_buf = buf;
+    m_stop_flag = stop_flag;
+
+    if (!m_reader)
+    {
+        m_error = "File not configured";
+        return false;
+    }
+
+    if (m_thread == 0)
+    {
+        m_thread = new std::thread(&FileSource::run, this);
+        return true;
+    }
+    else
+    {
+        m_error = "Source thread already started";
+        return false;
+    }
+}
+
+bool FileSource::stop()
+{
+    if (m_thread)
+    {
+        m_thread->join();
+        delete m_thread;
+        m_thread = 0;
+    }
+
+    return true;
+}
+
+void FileSource::run()
+{
+    typedef std::chrono::steady_clock clock;
+
+    double srate = m_reader->header().sample_rate;
+    std::uint64_t nsent = 0;
+    clock::time_point t0 = clock::now();
+    IQSampleVector filebuf;
+    std::size_t filepos = 0;
+
+    while (!m_stop_flag->load())
+    {
+        if (m_realtime)
+        {
+            // Pace output at the recorded sample rate.
+            std::this_thread::sleep_until(t0 +
+                std::chrono::microseconds(llrint(nsent * 1.0e6 / srate)));
+        }
+        else
+        {
+            // Do not run ahead of the decoder by more than a second.
+            while (!m_stop_flag->load() && m_buf->queued_samples() > srate)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // Refill from archive blocks and cut to the requested block length.
+        if (filepos == filebuf.size())
+        {
+            if (!m_reader->read(filebuf))
+            {
+                std::cerr << "FileSource::run: " << m_reader->error() << std::endl;
+                break;
+            }
+
+            filepos = 0;
+
+            if (filebuf.empty())
+                break;
+        }
+
+        std::size_t n = std::min<std::size_t>(m_block_length, filebuf.size() - filepos);
+        IQSampleVector iqsamples(filebuf.begin() + filepos, filebuf.begin() + filepos + n);
+        filepos += n;
+        nsent += n;
+
+        // Archives hold uncorrected device samples.
+        m_iqconv.process(iqsamples);
+        m_buf->push(move(iqsamples));
+    }
+
+    m_buf->push_end();
+}
+
+void FileSource::get_device_names(std::vector<std::string>& devices)
+{
+    devices.push_back("IQ archive file");
+}
+
+/* end */
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <complex>
 
+#include "DecoderState.h"
 #include "Filter.h"
 
 
@@ -83,12 +84,11 @@ FineTuner::FineTuner(unsigned int table_size, int freq_shift)
 
 
 // Process samples.
-void FineTuner::process(const IQSampleVector& samples_in,
+void FineTuner::process(const IQSample *samples_in, unsigned int n,
                         IQSampleVector& samples_out)
 {
     unsigned int tblidx = m_index;
     unsigned int tblsiz = m_table.size();
-    unsigned int n = samples_in.size();
 
     samples_out.resize(n);
 
@@ -103,6 +103,21 @@ void FineTuner::process(const IQSampleVector& samples_in,
 }
 
 
+// Save internal state.
+void FineTuner::save_state(StateWriter& state) const
+{
+    state.put(m_index);
+}
+
+
+// Restore internal state.
+void FineTuner::load_state(StateReader& state)
+{
+    state.get(m_index);
+    m_index %= m_table.size();
+}
+
+
 /* ****************  class LowPassFilterFirIQ  **************** */
 
 // Construct low-pass filter.
@@ -159,6 +174,107 @@ void LowPassFilterFirIQ::process(const IQSampleVector& samples_in,
 }
 
 
+// Save internal state.
+void LowPassFilterFirIQ::save_state(StateWriter& state) const
+{
+    state.put(m_state);
+}
+
+
+// Restore internal state.
+void LowPassFilterFirIQ::load_state(StateReader& state)
+{
+    state.get(m_state);
+}
+
+
+/* ****************  class DownsampleFilterIQ  **************** */
+
+// Construct low-pass filter with integer downsampling.
+DownsampleFilterIQ::DownsampleFilterIQ(unsigned int filter_order,
+                                       double cutoff,
+                                       unsigned int downsample)
+    : m_downsample(downsample)
+    , m_pos(0)
+    , m_state(filter_order)
+{
+    assert(downsample >= 1);
+    make_lanczos_coeff(filter_order, cutoff, m_coeff);
+}
+
+
+// Process samples.
+void DownsampleFilterIQ::process(const IQSample *samples_in, unsigned int n,
+                                 IQSampleVector& samples_out)
+{
+    unsigned int order = m_state.size();
+    unsigned int p = m_pos;
+    unsigned int pstep = m_downsample;
+
+    samples_out.resize((n + pstep - 1 - std::min(n, p)) / pstep);
+
+    // The first few samples need data from m_state.
+    unsigned int i = 0;
+    for (; p < n && p < order; p += pstep, i++) {
+        IQSample y = 0;
+        for (unsigned int j = 0; j < order - p; j++)
+            y += m_state[p+j] * m_coeff[j];
+        for (unsigned int j = order - p; j <= order; j++)
+            y += samples_in[p-order+j] * m_coeff[j];
+        samples_out[i] = y;
+    }
+
+    // Remaining samples only need data from samples_in.
+    // The Lanczos kernel is symmetric, so opposite taps share one
+    // multiplication; two partial sums keep the adder pipeline busy.
+    unsigned int half = (order + 1) / 2;
+    for (; p < n; p += pstep, i++) {
+        const IQSample *inp = samples_in + p - order;
+        const IQSample::value_type *coeff = m_coeff.data();
+        IQSample y0 = 0, y1 = 0;
+        unsigned int j = 0;
+        for (; j + 2 <= half; j += 2) {
+            y0 += (inp[j] + inp[order-j]) * coeff[j];
+            y1 += (inp[j+1] + inp[order-j-1]) * coeff[j+1];
+        }
+        for (; j < half; j++)
+            y0 += (inp[j] + inp[order-j]) * coeff[j];
+        if (order % 2 == 0)
+            y1 += inp[half] * coeff[half];
+        samples_out[i] = y0 + y1;
+    }
+
+    assert(i == samples_out.size());
+
+    // Update index of start position in next sample block.
+    m_pos = p - n;
+
+    // Update m_state.
+    if (n < order) {
+        copy(m_state.begin() + n, m_state.end(), m_state.begin());
+        copy(samples_in, samples_in + n, m_state.end() - n);
+    } else {
+        copy(samples_in + n - order, samples_in + n, m_state.begin());
+    }
+}
+
+
+// Save internal state.
+void DownsampleFilterIQ::save_state(StateWriter& state) const
+{
+    state.put(m_pos);
+    state.put(m_state);
+}
+
+
+// Restore internal state.
+void DownsampleFilterIQ::load_state(StateReader& state)
+{
+    state.get(m_pos);
+    state.get(m_state);
+}
+
+
 /* ****************  class DownsampleFilter  **************** */
 
 // Construct low-pass filter with optional downsampling.
@@ -267,14 +383,77 @@ void DownsampleFilter::process(const SampleVector& samples_in,
             m_pos_frac = 0;
     }
 
-    // Update m_state.
+    update_state(samples_in);
+}
+
+
+// Advance as process() would, without computing output.
+void DownsampleFilter::skip(const SampleVector& samples_in)
+{
+    unsigned int n = samples_in.size();
+
+    // Same position arithmetic as process(), so both stay bit-exact.
+    if (m_downsample_int != 0) {
+        unsigned int p = m_pos_int;
+        for (; p < n; p += m_downsample_int)
+            ;
+        m_pos_int = p - n;
+    } else {
+        Sample p = m_pos_frac;
+        Sample pf = p;
+        unsigned int pi = int(pf);
+        unsigned int i = 0;
+        while (pi < n) {
+            i++;
+            pf = p + i * m_downsample;
+            pi = int(pf);
+        }
+        m_pos_frac = pf - n;
+        if (m_pos_frac < 0)
+            m_pos_frac = 0;
+    }
+
+    update_state(samples_in);
+}
+
+
+// Clear the filter history, keeping the output sample position.
+void DownsampleFilter::clear_history()
+{
+    std::fill(m_state.begin(), m_state.end(), 0);
+}
+
+
+// Keep the last input samples as filter history.
+void DownsampleFilter::update_state(const SampleVector& samples_in)
+{
+    unsigned int order = m_state.size();
+    unsigned int n = samples_in.size();
+
     if (n < order) {
         copy(m_state.begin() + n, m_state.end(), m_state.begin());
         copy(samples_in.begin(), samples_in.end(), m_state.end() - n);
     } else {
         copy(samples_in.end() - order, samples_in.end(), m_state.begin());
     }
+}
 
+
+// Save internal state.
+void DownsampleFilter::save_state(StateWriter& state) const
+{
+    state.put(m_pos_int);
+    state.put(m_pos_frac);
+    state.put(m_state);
+}
+
+
+// Restore internal state.
+void DownsampleFilter::load_state(StateReader& state)
+{
+    state.get(m_pos_int);
+    state.get(m_pos_frac);
+    state.get(m_state);
 }
 
 
@@ -388,6 +567,23 @@ void LowPassFilterRC::process_interleaved_inplace(SampleVector& samples)
     m_y1_1 = y1;
 }
 
+
+// Save internal state.
+void LowPassFilterRC::save_state(StateWriter& state) const
+{
+    state.put(m_y0_1);
+    state.put(m_y1_1);
+}
+
+
+// Restore internal state.
+void LowPassFilterRC::load_state(StateReader& state)
+{
+    state.get(m_y0_1);
+    state.get(m_y1_1);
+}
+
+
 /* ****************  class LowPassFilterIir  **************** */
 
 // Construct 4th order low-pass IIR filter.
@@ -448,6 +644,26 @@ void LowPassFilterIir::process(const SampleVector& samples_in,
 }
 
 
+// Save internal state.
+void LowPassFilterIir::save_state(StateWriter& state) const
+{
+    state.put(y1);
+    state.put(y2);
+    state.put(y3);
+    state.put(y4);
+}
+
+
+// Restore internal state.
+void LowPassFilterIir::load_state(StateReader& state)
+{
+    state.get(y1);
+    state.get(y2);
+    state.get(y3);
+    state.get(y4);
+}
+
+
 /* ****************  class HighPassFilterIir  **************** */
 
 // Construct 2nd order high-pass IIR filter.
@@ -522,4 +738,74 @@ void HighPassFilterIir::process_inplace(SampleVector& samples)
     }
 }
 
+
+// Save internal state.
+void HighPassFilterIir::save_state(StateWriter& state) const
+{
+    state.put(x1);
+    state.put(x2);
+    state.put(y1);
+    state.put(y2);
+}
+
+
+// Restore internal state.
+void HighPassFilterIir::load_state(StateReader& state)
+{
+    state.get(x1);
+    state.get(x2);
+    state.get(y1);
+    state.get(y2);
+}
+
+
+/* ****************  class GoertzelProbe  **************** */
+
+// Construct probe.
+GoertzelProbe::GoertzelProbe(const std::vector<double>& freqs)
+    : m_state(2 * freqs.size())
+    , m_window_energy(0)
+{
+    for (double f : freqs) {
+        m_coeff.push_back(2 * cos(2 * M_PI * f));
+    }
+}
+
+
+// Measure one block of samples.
+void GoertzelProbe::process(const SampleVector& samples, std::vector<double>& power)
+{
+    unsigned int n = samples.size();
+    unsigned int nfreq = m_coeff.size();
+
+    // Hann window for this block length.
+    if (m_window.size() != n) {
+        m_window.resize(n);
+        m_window_energy = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            m_window[i] = 0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / n);
+            m_window_energy += m_window[i] * m_window[i];
+        }
+    }
+
+    std::fill(m_state.begin(), m_state.end(), 0);
+
+    for (unsigned int i = 0; i < n; i++) {
+        double x = samples[i] * m_window[i];
+        for (unsigned int k = 0; k < nfreq; k++) {
+            double s0 = x + m_coeff[k] * m_state[2*k] - m_state[2*k+1];
+            m_state[2*k+1] = m_state[2*k];
+            m_state[2*k] = s0;
+        }
+    }
+
+    power.resize(nfreq);
+
+    for (unsigned int k = 0; k < nfreq; k++) {
+        double s1 = m_state[2*k], s2 = m_state[2*k+1];
+        double p = s1 * s1 + s2 * s2 - m_coeff[k] * s1 * s2;
+        power[k] = (n > 0) ? p / m_window_energy : 0;
+    }
+}
+
 /* end */
@@ -16,10 +16,12 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.          //
 /////////////////////////////////////////////////////////////////////////////////// 
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
 #include "fastatan2.h"
+#include "DecoderState.h"
 #include "FmDecode.h"
 
 
@@ -67,6 +69,16 @@ static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
 }
 
 
+/**
+ * Return fine tuner table size for a resolution of about 1 kHz.
+ * A multiple of 64 keeps offsets of 1/64 and 1/4 of the sample rate exact.
+ */
+static int tuning_table_size(double sample_rate_if)
+{
+    return 64 * std::max(1, int(sample_rate_if / 64000.0));
+}
+
+
 /* ****************  class PhaseDiscriminator  **************** */
 
 // Construct phase discriminator.
@@ -76,10 +88,9 @@ PhaseDiscriminator::PhaseDiscriminator(double max_freq_dev)
 
 
 // Process samples.
-void PhaseDiscriminator::process(const IQSampleVector& samples_in,
+void PhaseDiscriminator::process(const IQSample *samples_in, unsigned int n,
                                  SampleVector& samples_out)
 {
-    unsigned int n = samples_in.size();
     IQSample s0 = m_last1_sample;
 
     samples_out.resize(n);
@@ -98,6 +109,22 @@ void PhaseDiscriminator::process(const IQSampleVector& samples_in,
 }
 
 
+// Save internal state.
+void PhaseDiscriminator::save_state(StateWriter& state) const
+{
+    state.put(m_last1_sample);
+    state.put(m_last2_sample);
+}
+
+
+// Restore internal state.
+void PhaseDiscriminator::load_state(StateReader& state)
+{
+    state.get(m_last1_sample);
+    state.get(m_last2_sample);
+}
+
+
 /* ****************  class PilotPhaseLock  **************** */
 
 // Construct phase-locked loop.
@@ -162,11 +189,14 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 
 // Process samples.
 void PilotPhaseLock::process(const SampleVector& samples_in,
-                             SampleVector& samples_out)
+                             SampleVector& samples_out,
+                             IQSampleVector *samples_57k)
 {
     unsigned int n = samples_in.size();
 
     samples_out.resize(n);
+    if (samples_57k)
+        samples_57k->resize(n);
 
     bool was_locked = (m_lock_cnt >= m_lock_delay);
     m_pps_events.clear();
@@ -184,6 +214,14 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
         // sin(2*x) = 2 * sin(x) * cos(x)
         samples_out[i] = 2 * psin * pcos;
 
+        // Generate triple-frequency phasor.
+        // cos(3*x) = cos(x) * (4 * cos(x)**2 - 3)
+        // sin(3*x) = sin(x) * (3 - 4 * sin(x)**2)
+        if (samples_57k) {
+            (*samples_57k)[i] = IQSample(pcos * (4 * pcos * pcos - 3),
+                                         psin * (3 - 4 * psin * psin));
+        }
+
         // Multiply locked tone with input.
         Sample x = samples_in[i];
         Sample phasor_i = psin * x;
@@ -267,6 +305,42 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 }
 
 
+// Save internal state.
+void PilotPhaseLock::save_state(StateWriter& state) const
+{
+    state.put(m_phasor_i1);
+    state.put(m_phasor_i2);
+    state.put(m_phasor_q1);
+    state.put(m_phasor_q2);
+    state.put(m_loopfilter_x1);
+    state.put(m_freq);
+    state.put(m_phase);
+    state.put(m_pilot_level);
+    state.put(m_lock_cnt);
+    state.put(m_pilot_periods);
+    state.put(m_pps_cnt);
+    state.put(m_sample_cnt);
+}
+
+
+// Restore internal state.
+void PilotPhaseLock::load_state(StateReader& state)
+{
+    state.get(m_phasor_i1);
+    state.get(m_phasor_i2);
+    state.get(m_phasor_q1);
+    state.get(m_phasor_q2);
+    state.get(m_loopfilter_x1);
+    state.get(m_freq);
+    state.get(m_phase);
+    state.get(m_pilot_level);
+    state.get(m_lock_cnt);
+    state.get(m_pilot_periods);
+    state.get(m_pps_cnt);
+    state.get(m_sample_cnt);
+}
+
+
 /* ****************  class FmDecoder  **************** */
 
 FmDecoder::FmDecoder(double sample_rate_if,
@@ -282,15 +356,29 @@ FmDecoder::FmDecoder(double sample_rate_if,
     // Initialize member fields
     : m_sample_rate_if(sample_rate_if)
     , m_sample_rate_baseband(sample_rate_if / downsample)
-    , m_tuning_table_size(64)
-    , m_tuning_shift(lrint(-64.0 * tuning_offset / sample_rate_if))
+    , m_sample_rate_pcm(sample_rate_pcm)
+    , m_tuning_table_size(tuning_table_size(sample_rate_if))
+    , m_tuning_shift(lrint(-m_tuning_table_size * tuning_offset / sample_rate_if))
     , m_freq_dev(freq_dev)
     , m_downsample(downsample)
+    , m_stereo_output(stereo)
+    , m_mono_downsample(stereo ? 1 :
+        std::max(1, int(m_sample_rate_baseband / (2 * sample_rate_pcm))))
+    , m_sample_rate_mono(m_sample_rate_baseband / m_mono_downsample)
     , m_stereo_enabled(stereo)
+    , m_stereo_bypass(false)
     , m_stereo_detected(false)
     , m_if_level(0)
     , m_baseband_mean(0)
     , m_baseband_level(0)
+    , m_squelch_enabled(false)
+    , m_squelch_open(true)
+    , m_squelch_level(0)
+    , m_squelch_noise(0)
+    , m_squelch_noise_level(0)
+    , m_squelch_hang(0)
+    , m_squelch_baseband_frac(0)
+    , m_squelch_pcm_frac(0)
 
     // Construct FineTuner
     , m_finetuner(m_tuning_table_size, m_tuning_shift)
@@ -304,16 +392,27 @@ FmDecoder::FmDecoder(double sample_rate_if,
     // Construct DownsampleFilter for baseband
     , m_resample_baseband(8 * downsample, 0.4 / downsample, downsample, true)
 
+    // Construct low-pass filter below the squelch noise band
+    , m_squelch_lowpass(std::max(16, int(m_sample_rate_baseband / 10000.0)),
+                        std::min(0.45, 62000.0 / m_sample_rate_baseband),
+                        1, true)
+
     // Construct PilotPhaseLock
     , m_pilotpll(pilot_freq / m_sample_rate_baseband,       // freq
                  50 / m_sample_rate_baseband,               // bandwidth
                  0.01)                                      // minsignal (was 0.04)
 
+    // Construct integer pre-decimator for mono-only output.
+    // It only needs to keep aliases out of the audio band, so it is short;
+    // the pilot and subcarriers are removed by the mono resampler below.
+    , m_decimate_mono(8 * m_mono_downsample, 0.4 / m_mono_downsample,
+                      m_mono_downsample, true)
+
     // Construct DownsampleFilter for mono channel
     , m_resample_mono(
-        int(m_sample_rate_baseband / 1000.0),               // filter_order
-        bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-        m_sample_rate_baseband / sample_rate_pcm,           // downsample
+        int(m_sample_rate_mono / 1000.0),                   // filter_order
+        bandwidth_pcm / m_sample_rate_mono,                 // cutoff
+        m_sample_rate_mono / sample_rate_pcm,               // downsample
         false)                                              // integer_factor
 
     // Construct DownsampleFilter for stereo channel
@@ -333,16 +432,63 @@ FmDecoder::FmDecoder(double sample_rate_if,
     , m_deemph_stereo(
         (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
 
+    // Signal quality is measured only on request
+    , m_quality_avg{0, 0, 0, 0}
+    , m_quality_valid(false)
+
+{
+    // Group delay of the FIR filters from IF input to audio output,
+    // in IF samples.
+    double mono_delay = 0.5 * int(m_sample_rate_mono / 1000.0);
+    if (m_mono_downsample > 1)
+        mono_delay += 0.5 * 8;
+    m_group_delay = 0.5 * 10
+                    + downsample * (0.5 * 8 + m_mono_downsample * mono_delay);
+}
+
+
+// Warm up decoder state before the first block.
+unsigned int FmDecoder::prime(const IQSample *samples_in, unsigned int n)
 {
-    // nothing more to do
+    if (n < 2)
+        return 0;
+
+    unsigned int nprime = std::max(256, 2 * int(ceil(m_group_delay)));
+    nprime = std::min(nprime, n - 1);
+
+    // Mirror the start of the block around its first sample. The complex
+    // conjugate keeps the sign of the demodulated signal; the rotation by
+    // x0^2/|x0|^2 makes the phase run continuously into the first sample.
+    IQSample x0 = samples_in[0];
+    IQSample::value_type p0 = std::norm(x0);
+    IQSample rot = (p0 > 0) ? x0 * x0 / p0 : IQSample(1);
+    IQSampleVector samples_prime(nprime);
+    for (unsigned int i = 0; i < nprime; i++)
+        samples_prime[i] = std::conj(samples_in[nprime - i]) * rot;
+
+    // Run the primer through the decoder, but keep it away from RDS
+    // and from the PPS sample count.
+    std::unique_ptr<RdsDecoder> rds(move(m_rds));
+    PilotPhaseLock::PpsCounters pps = m_pilotpll.get_pps_counters();
+    SampleVector audio;
+    process(samples_prime, audio);
+    m_pilotpll.set_pps_counters(pps);
+    m_rds = move(rds);
+
+    // Start level estimators at the measured level instead of zero.
+    m_if_level = rms_level_approx(m_buf_iffiltered);
+    if (m_squelch_open)
+        samples_mean_rms(m_buf_baseband, m_baseband_mean, m_baseband_level);
+
+    return lrint(m_group_delay * m_sample_rate_pcm / m_sample_rate_if);
 }
 
 
-void FmDecoder::process(const IQSampleVector& samples_in,
+void FmDecoder::process(const IQSample *samples_in, unsigned int n,
                         SampleVector& audio)
 {
     // Fine tuning.
-    m_finetuner.process(samples_in, m_buf_iftuned);
+    m_finetuner.process(samples_in, n, m_buf_iftuned);
 
     // Low pass filter to isolate station.
     m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
@@ -351,6 +497,19 @@ void FmDecoder::process(const IQSampleVector& samples_in,
     double if_rms = rms_level_approx(m_buf_iffiltered);
     m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
 
+    // Check carrier level before demodulation, so that an empty
+    // channel costs no more than the IF filter.
+    bool carrier = true;
+
+    if (m_squelch_enabled) {
+        double hyst = m_squelch_open ? squelch_hysteresis : 0;
+        carrier = 20*log10(std::max(if_rms, 1.0e-10)) >= m_squelch_level - hyst;
+        if (!carrier && !update_squelch(false, n)) {
+            squelch_output(n, audio);
+            return;
+        }
+    }
+
     // Extract carrier frequency.
     m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
 
@@ -360,35 +519,91 @@ void FmDecoder::process(const IQSampleVector& samples_in,
         m_resample_baseband.process(tmp, m_buf_baseband);
     }
 
+    // Check ultrasonic noise; a carrier without FM modulation on top of
+    // noise (or noise only) has a flat discriminator output.
+    if (m_squelch_enabled && carrier) {
+        double hyst = m_squelch_open ? squelch_hysteresis : 0;
+        bool quiet = measure_squelch_noise() <= m_squelch_noise + hyst;
+        if (!update_squelch(quiet, n)) {
+            squelch_output(n, audio);
+            return;
+        }
+    }
+
+    // Decode composite baseband signal.
+    process_baseband(m_buf_baseband, audio);
+}
+
+
+void FmDecoder::process_baseband(const SampleVector& samples_baseband,
+                                 SampleVector& audio)
+{
     // Measure baseband level.
     double baseband_mean, baseband_rms;
-    samples_mean_rms(m_buf_baseband, baseband_mean, baseband_rms);
+    samples_mean_rms(samples_baseband, baseband_mean, baseband_rms);
     m_baseband_mean  = 0.95 * m_baseband_mean + 0.05 * baseband_mean;
     m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
 
     // Extract mono audio signal.
-    m_resample_mono.process(m_buf_baseband, m_buf_mono);
+    if (m_mono_downsample > 1) {
+        // Mono only: drop to a low rate first, then filter and resample.
+        m_decimate_mono.process(samples_baseband, m_buf_mono_decim);
+        m_resample_mono.process(m_buf_mono_decim, m_buf_mono);
+    } else {
+        m_resample_mono.process(samples_baseband, m_buf_mono);
+    }
 
     // DC blocking
     m_dcblock_mono.process_inplace(m_buf_mono);
 
-    if (m_stereo_enabled)
+    if (m_stereo_enabled || m_rds)
     {
         // Lock on stereo pilot.
-        m_pilotpll.process(m_buf_baseband, m_buf_rawstereo);
+        m_pilotpll.process(samples_baseband, m_buf_rawstereo,
+                           m_rds ? &m_buf_rds57k : NULL);
+    }
+
+    if (m_rds)
+    {
+        // Decode RDS on the 57 kHz subcarrier.
+        m_rds->process(samples_baseband, m_buf_rds57k);
+    }
+
+    if (m_quality_probe)
+    {
+        measure_quality(samples_baseband);
+    }
+
+    if (m_stereo_output && m_stereo_enabled)
+    {
         m_stereo_detected = m_pilotpll.locked();
 
-        // Demodulate stereo signal.
-        demod_stereo(m_buf_baseband, m_buf_rawstereo);
+        if (m_stereo_detected || !m_stereo_bypass)
+        {
+            // Demodulate stereo signal.
+            demod_stereo(samples_baseband, m_buf_rawstereo);
 
-        // Extract audio and downsample.
-        // NOTE: This MUST be done even if no stereo signal is detected yet,
-        // because the downsamplers for mono and stereo signal must be
-        // kept in sync.
-        m_resample_stereo.process(m_buf_rawstereo, m_buf_stereo);
+            // Extract audio and downsample.
+            // NOTE: Without bypass this is done even if no stereo signal is
+            // detected yet, because the downsamplers for mono and stereo
+            // signal must be kept in sync.
+            m_resample_stereo.process(m_buf_rawstereo, m_buf_stereo);
 
-        // DC blocking
-        m_dcblock_stereo.process_inplace(m_buf_stereo);
+            // DC blocking
+            m_dcblock_stereo.process_inplace(m_buf_stereo);
+        }
+        else
+        {
+            // No pilot: keep the stereo downsampler in sync without
+            // filtering. It only needs the tail of the demodulated signal.
+            unsigned int n = samples_baseband.size();
+            unsigned int order = m_resample_stereo.filter_order();
+            demod_stereo(samples_baseband, m_buf_rawstereo, (n > order) ? n - order : 0);
+            m_resample_stereo.skip(m_buf_rawstereo);
+
+            // Restart DC blocking from rest when the pilot appears.
+            m_dcblock_stereo = HighPassFilterIir(30.0 / m_sample_rate_pcm);
+        }
 
         if (m_stereo_detected)
         {
@@ -403,6 +618,13 @@ void FmDecoder::process(const IQSampleVector& samples_in,
             mono_to_left_right(m_buf_mono, audio);
         }
     }
+    else if (m_stereo_output)
+    {
+        // Stereo decoding disabled at runtime.
+        m_stereo_detected = false;
+        m_deemph_mono.process_inplace(m_buf_mono); //  De-emphasis.
+        mono_to_left_right(m_buf_mono, audio);
+    }
     else
     {
         m_deemph_mono.process_inplace(m_buf_mono); //  De-emphasis.
@@ -412,9 +634,211 @@ void FmDecoder::process(const IQSampleVector& samples_in,
 }
 
 
+// Enable carrier squelch.
+void FmDecoder::set_squelch(double level_db, double noise_db)
+{
+    if (!m_squelch_enabled) {
+        m_squelch_enabled = true;
+        m_squelch_open    = false;
+        m_squelch_hang    = 0;
+    }
+    m_squelch_level   = level_db;
+    m_squelch_noise   = noise_db;
+}
+
+
+// Disable carrier squelch.
+void FmDecoder::disable_squelch()
+{
+    m_squelch_enabled = false;
+    m_squelch_open    = true;
+}
+
+
+// Change tuning offset.
+void FmDecoder::set_tuning_offset(double tuning_offset)
+{
+    m_tuning_shift = lrint(-m_tuning_table_size * tuning_offset / m_sample_rate_if);
+    m_finetuner = FineTuner(m_tuning_table_size, m_tuning_shift);
+}
+
+
+// Enable or disable stereo decoding.
+bool FmDecoder::set_stereo(bool stereo)
+{
+    if (stereo && !m_stereo_output)
+        return false;
+
+    if (stereo && !m_stereo_enabled) {
+        // The stereo resampler was not running; restart it in lock step
+        // with the mono resampler (same parameters with stereo output),
+        // but from silence: the mono history is not an L-R signal.
+        m_resample_stereo = m_resample_mono;
+        m_resample_stereo.clear_history();
+        m_dcblock_stereo = HighPassFilterIir(30.0 / m_sample_rate_pcm);
+    }
+
+    m_stereo_enabled = stereo;
+    return true;
+}
+
+
+// Quality measurement groups.
+enum { QUALITY_PILOT, QUALITY_GUARD, QUALITY_RDS, QUALITY_ULTRASONIC };
+
+
+// Enable signal quality measurements.
+void FmDecoder::enable_quality()
+{
+    if (m_quality_probe)
+        return;
+
+    double fs = m_sample_rate_baseband;
+    std::vector<double> freqs;
+    m_quality_group.clear();
+
+    freqs.push_back(pilot_freq / fs);
+    m_quality_group.push_back(QUALITY_PILOT);
+
+    // Guard band between mono audio and pilot.
+    for (double f = 16250; f < 18000; f += 500) {
+        freqs.push_back(f / fs);
+        m_quality_group.push_back(QUALITY_GUARD);
+    }
+
+    // RDS sidebands; the subcarrier itself is suppressed.
+    freqs.push_back(56000 / fs);
+    m_quality_group.push_back(QUALITY_RDS);
+    freqs.push_back(58000 / fs);
+    m_quality_group.push_back(QUALITY_RDS);
+
+    // Ultrasonic noise, within the pass band of the baseband filter.
+    for (double f = 66000; f < std::min(94000.0, 0.4 * fs); f += 4000) {
+        freqs.push_back(f / fs);
+        m_quality_group.push_back(QUALITY_ULTRASONIC);
+    }
+
+    m_quality_probe.reset(new GoertzelProbe(freqs));
+    m_quality_valid = false;
+}
+
+
+// Update quality averages from a block of baseband samples.
+void FmDecoder::measure_quality(const SampleVector& samples_baseband)
+{
+    unsigned int n = samples_baseband.size();
+    if (n == 0)
+        return;
+
+    m_quality_probe->process(samples_baseband, m_quality_power);
+
+    double sum[4] = { 0, 0, 0, 0 };
+    unsigned int count[4] = { 0, 0, 0, 0 };
+
+    for (unsigned int k = 0; k < m_quality_power.size(); k++) {
+        sum[m_quality_group[k]] += m_quality_power[k];
+        count[m_quality_group[k]]++;
+    }
+
+    for (unsigned int g = 0; g < 4; g++) {
+        if (count[g] == 0)
+            continue;
+
+        double p = sum[g] / count[g];
+
+        // Tone power (amplitude squared) for the pilot,
+        // one-sided density per Hz for the noise bands.
+        p = (g == QUALITY_PILOT) ? 6 * p / n : 2 * p / m_sample_rate_baseband;
+
+        m_quality_avg[g] = m_quality_valid ? 0.95 * m_quality_avg[g] + 0.05 * p : p;
+    }
+
+    m_quality_valid = true;
+}
+
+
+// Return signal quality.
+FmDecoder::Quality FmDecoder::get_quality() const
+{
+    Quality q;
+    q.pilot_db      = 10*log10(std::max(m_quality_avg[QUALITY_PILOT], 1.0e-20));
+    q.guard_db      = 10*log10(std::max(m_quality_avg[QUALITY_GUARD], 1.0e-20));
+    q.pilot_snr     = q.pilot_db - 3.01 - q.guard_db;
+    q.rds_db        = 10*log10(std::max(m_quality_avg[QUALITY_RDS], 1.0e-20));
+    q.ultrasonic_db = 10*log10(std::max(m_quality_avg[QUALITY_ULTRASONIC], 1.0e-20));
+    return q;
+}
+
+
+// Measure baseband noise above 60 kHz in dB.
+double FmDecoder::measure_squelch_noise()
+{
+    // Noise power is the total power minus the power below 60 kHz.
+    m_squelch_lowpass.process(m_buf_baseband, m_buf_squelch);
+
+    unsigned int n = m_buf_baseband.size();
+    double ptotal = 0, plow = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        ptotal += m_buf_baseband[i] * m_buf_baseband[i];
+        plow   += m_buf_squelch[i] * m_buf_squelch[i];
+    }
+
+    double pnoise = (n > 0) ? (ptotal - plow) / n : 0;
+    m_squelch_noise_level = 10*log10(std::max(pnoise, 1.0e-20));
+
+    return m_squelch_noise_level;
+}
+
+
+// Update squelch state and return true if it is open.
+bool FmDecoder::update_squelch(bool signal, unsigned int n)
+{
+    if (signal) {
+        // Re-open immediately.
+        m_squelch_open = true;
+        m_squelch_hang = 0;
+    } else if (m_squelch_open) {
+        // Close only after the hang time.
+        m_squelch_hang += n;
+        if (m_squelch_hang >= squelch_hang_time * m_sample_rate_if) {
+            m_squelch_open = false;
+        }
+    }
+
+    return m_squelch_open;
+}
+
+
+// Return silence for n IF samples while the squelch is closed.
+void FmDecoder::squelch_output(unsigned int n, SampleVector& audio)
+{
+    // Keep fractional sample counts so the output rate stays exact.
+    m_squelch_baseband_frac += double(n) / m_downsample;
+    unsigned int nbaseband = (unsigned int)m_squelch_baseband_frac;
+    m_squelch_baseband_frac -= nbaseband;
+
+    m_squelch_pcm_frac += nbaseband * m_sample_rate_pcm / m_sample_rate_baseband;
+    unsigned int npcm = (unsigned int)m_squelch_pcm_frac;
+    m_squelch_pcm_frac -= npcm;
+
+    m_buf_baseband.assign(nbaseband, 0);
+    audio.assign(m_stereo_output ? 2 * npcm : npcm, 0);
+    m_stereo_detected = false;
+
+    // Drop per-block events of the bypassed stages.
+    m_pilotpll.process(SampleVector(), m_buf_rawstereo,
+                       m_rds ? &m_buf_rds57k : NULL);
+    if (m_rds) {
+        m_rds->process(SampleVector(), IQSampleVector());
+    }
+}
+
+
 // Demodulate stereo L-R signal.
 void FmDecoder::demod_stereo(const SampleVector& samples_baseband,
-                             SampleVector& samples_rawstereo)
+                             SampleVector& samples_rawstereo,
+                             unsigned int start)
 {
     // Just multiply the baseband signal with the double-frequency pilot.
     // And multiply by 1.17 to get the full amplitude.
@@ -423,7 +847,7 @@ void FmDecoder::demod_stereo(const SampleVector& samples_baseband,
     unsigned int n = samples_baseband.size();
     assert(n == samples_rawstereo.size());
 
-    for (unsigned int i = 0; i < n; i++) {
+    for (unsigned int i = start; i < n; i++) {
         samples_rawstereo[i] *= 1.17 * samples_baseband[i];
     }
 }
@@ -461,4 +885,149 @@ void FmDecoder::stereo_to_left_right(const SampleVector& samples_mono,
     }
 }
 
+
+// Magic number and version of decoder snapshots.
+static const std::uint32_t decoder_state_magic = 0x53464d03;
+
+
+// Return a snapshot of the complete decoder state.
+std::vector<std::uint8_t> FmDecoder::save_state() const
+{
+    StateWriter state;
+
+    // Decoder parameters, checked by load_state().
+    state.put(decoder_state_magic);
+    state.put(m_sample_rate_if);
+    state.put(m_sample_rate_pcm);
+    state.put(m_freq_dev);
+    state.put(m_downsample);
+    state.put(m_stereo_output);
+    state.put(bool(m_rds));
+    state.put(m_tuning_shift);
+
+    // Runtime settings and level averages.
+    state.put(m_stereo_enabled);
+    state.put(m_stereo_detected);
+    state.put(m_if_level);
+    state.put(m_baseband_mean);
+    state.put(m_baseband_level);
+    state.put(m_squelch_enabled);
+    state.put(m_squelch_open);
+    state.put(m_squelch_level);
+    state.put(m_squelch_noise);
+    state.put(m_squelch_noise_level);
+    state.put(m_squelch_hang);
+    state.put(m_squelch_baseband_frac);
+    state.put(m_squelch_pcm_frac);
+
+    // Signal processing stages.
+    m_finetuner.save_state(state);
+    m_iffilter.save_state(state);
+    m_phasedisc.save_state(state);
+    m_resample_baseband.save_state(state);
+    m_squelch_lowpass.save_state(state);
+    m_pilotpll.save_state(state);
+    m_decimate_mono.save_state(state);
+    m_resample_mono.save_state(state);
+    m_resample_stereo.save_state(state);
+    m_dcblock_mono.save_state(state);
+    m_dcblock_stereo.save_state(state);
+    m_deemph_mono.save_state(state);
+    m_deemph_stereo.save_state(state);
+
+    if (m_rds)
+        m_rds->save_state(state);
+
+    return state.data();
+}
+
+
+// Restore decoder state from a snapshot.
+bool FmDecoder::load_state(const std::vector<std::uint8_t>& data)
+{
+    // Keep the current state to roll back a partial restore.
+    std::vector<std::uint8_t> current = save_state();
+
+    if (restore_state(data))
+        return true;
+
+    restore_state(current);
+    return false;
+}
+
+
+// Restore state without rollback.
+bool FmDecoder::restore_state(const std::vector<std::uint8_t>& data)
+{
+    StateReader state(data);
+
+    std::uint32_t magic = 0;
+    double sample_rate_if = 0, sample_rate_pcm = 0, freq_dev = 0;
+    unsigned int downsample = 0;
+    bool stereo_output = false, rds = false;
+
+    state.get(magic);
+    state.get(sample_rate_if);
+    state.get(sample_rate_pcm);
+    state.get(freq_dev);
+    state.get(downsample);
+    state.get(stereo_output);
+    state.get(rds);
+
+    if (!state ||
+        magic != decoder_state_magic ||
+        sample_rate_if != m_sample_rate_if ||
+        sample_rate_pcm != m_sample_rate_pcm ||
+        freq_dev != m_freq_dev ||
+        downsample != m_downsample ||
+        stereo_output != m_stereo_output) {
+        return false;
+    }
+
+    // The snapshot must decode the same station offset.
+    int tuning_shift = 0;
+    state.get(tuning_shift);
+    if (!state || tuning_shift != m_tuning_shift)
+        return false;
+
+    if (rds)
+        enable_rds();
+    else
+        disable_rds();
+
+    state.get(m_stereo_enabled);
+    state.get(m_stereo_detected);
+    state.get(m_if_level);
+    state.get(m_baseband_mean);
+    state.get(m_baseband_level);
+    state.get(m_squelch_enabled);
+    state.get(m_squelch_open);
+    state.get(m_squelch_level);
+    state.get(m_squelch_noise);
+    state.get(m_squelch_noise_level);
+    state.get(m_squelch_hang);
+    state.get(m_squelch_baseband_frac);
+    state.get(m_squelch_pcm_frac);
+
+    m_finetuner = FineTuner(m_tuning_table_size, m_tuning_shift);
+    m_finetuner.load_state(state);
+    m_iffilter.load_state(state);
+    m_phasedisc.load_state(state);
+    m_resample_baseband.load_state(state);
+    m_squelch_lowpass.load_state(state);
+    m_pilotpll.load_state(state);
+    m_decimate_mono.load_state(state);
+    m_resample_mono.load_state(state);
+    m_resample_stereo.load_state(state);
+    m_dcblock_mono.load_state(state);
+    m_dcblock_stereo.load_state(state);
+    m_deemph_mono.load_state(state);
+    m_deemph_stereo.load_state(state);
+
+    if (m_rds)
+        m_rds->load_state(state);
+
+    return state.at_end();
+}
+
 /* end */
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+
+#include "GainControl.h"
+
+
+/* ****************  class GainControl  **************** */
+
+// Prepare gain control.
+GainControl::GainControl(Source *source, double sample_rate, double headroom)
+    : m_source(source)
+    , m_headroom(headroom)
+    , m_interval_samples(std::max(1.0, interval * sample_rate))
+    , m_current(0)
+    , m_settling(false)
+    , m_samples(0)
+    , m_clipped(0)
+    , m_peak(0)
+    , m_sumsq(0)
+    , m_level(-INFINITY)
+    , m_clip_ratio(0)
+{
+    if (!m_source->get_gain_steps(m_steps, m_current))
+    {
+        m_error = m_source->error();
+    }
+    else if (m_steps.empty())
+    {
+        m_error = "Device has no gain settings";
+    }
+}
+
+
+// Add level statistics and adjust the gain.
+bool GainControl::update(const IQConverter::LevelStats& stats)
+{
+    if (!m_error.empty())
+        return false;
+
+    m_samples += stats.samples;
+    m_clipped += stats.clipped;
+    m_peak = std::max(m_peak, stats.peak);
+    m_sumsq += stats.rms * stats.rms * stats.samples;
+
+    if (m_samples < m_interval_samples)
+        return false;
+
+    m_level = 10 * log10(std::max(m_sumsq / m_samples, 1.0e-20));
+    m_clip_ratio = double(m_clipped) / m_samples;
+    double peak = 20 * log10(std::max(m_peak, 1.0e-10));
+
+    m_samples = 0;
+    m_clipped = 0;
+    m_peak = 0;
+    m_sumsq = 0;
+
+    // Samples of the interval after a change may predate it.
+    if (m_settling)
+    {
+        m_settling = false;
+        return false;
+    }
+
+    double change = 0;
+    bool overload = (m_clip_ratio > max_clip_ratio);
+
+    if (overload)
+    {
+        change = (m_clip_ratio > 100 * max_clip_ratio) ? -12 : -6;
+    }
+    else if (fabs(-m_headroom - m_level) > hysteresis)
+    {
+        change = -m_headroom - m_level;
+
+        // Keep peaks below full scale.
+        if (change > 0)
+            change = std::max(0.0, std::min(change, -peak - 1.0));
+    }
+
+    if (change == 0)
+        return false;
+
+    // Setting closest to the wanted gain; at least one step down on overload.
+    double target = m_steps[m_current].gain + change;
+    std::size_t next = m_current;
+
+    for (std::size_t i = 0; i < m_steps.size(); i++)
+    {
+        if (fabs(m_steps[i].gain - target) < fabs(m_steps[next].gain - target))
+            next = i;
+    }
+
+    if (overload && next == m_current && m_current > 0)
+        next = m_current - 1;
+
+    if (next == m_current)
+        return false;
+
+    if (!m_source->set_gain(m_steps[next].setting))
+    {
+        m_error = m_source->error();
+        return false;
+    }
+
+    m_current = next;
+    m_settling = true;
+    return true;
+}
+
+
+// Re-read the current gain setting from the device.
+void GainControl::sync_gain()
+{
+    if (!m_error.empty())
+        return;
+
+    if (!m_source->get_gain_steps(m_steps, m_current))
+    {
+        m_error = m_source->error();
+        return;
+    }
+
+    m_samples = 0;
+    m_clipped = 0;
+    m_peak = 0;
+    m_sumsq = 0;
+    m_settling = true;
+}
+
+/* end */
@@ -20,6 +20,7 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <mutex>
 #include <thread>
 #include <cstdlib>
 
@@ -27,11 +28,41 @@
 #include "parsekv.h"
 #include "HackRFSource.h"
 
-HackRFSource *HackRFSource::m_this = 0;
 const std::vector<int> HackRFSource::m_lgains({0, 8, 16, 24, 32, 40});
 const std::vector<int> HackRFSource::m_vgains({0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30, 32, 34, 36, 38, 40, 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 62});
 const std::vector<int> HackRFSource::m_bwfilt({1750000, 2500000, 3500000, 5000000, 5500000, 6000000, 7000000,  8000000, 9000000, 10000000, 12000000, 14000000, 15000000, 20000000, 24000000, 28000000});
 
+// Number of users of the HackRF library, shared by all devices.
+static std::mutex hackrf_lib_mutex;
+static int hackrf_lib_users = 0;
+
+// Initialize the HackRF library for one more user.
+static hackrf_error hackrf_lib_init()
+{
+    std::lock_guard<std::mutex> lock(hackrf_lib_mutex);
+
+    if (hackrf_lib_users == 0)
+    {
+        hackrf_error rc = (hackrf_error) hackrf_init();
+        if (rc != HACKRF_SUCCESS)
+            return rc;
+    }
+
+    hackrf_lib_users++;
+    return HACKRF_SUCCESS;
+}
+
+// Release the HackRF library; the last user shuts it down.
+static hackrf_error hackrf_lib_exit()
+{
+    std::lock_guard<std::mutex> lock(hackrf_lib_mutex);
+
+    if (--hackrf_lib_users > 0)
+        return HACKRF_SUCCESS;
+
+    return (hackrf_error) hackrf_exit();
+}
+
 // Open HackRF device.
 HackRFSource::HackRFSource(int dev_index) :
     m_dev(0),
@@ -43,9 +74,10 @@ HackRFSource::HackRFSource(int dev_index) :
     m_extAmp(false),
     m_biasAnt(false),
     m_running(false),
-    m_thread(0)
+    m_thread(0),
+    m_libInit(false)
 {
-    hackrf_error rc = (hackrf_error) hackrf_init();
+    hackrf_error rc = hackrf_lib_init();
 
     if (rc != HACKRF_SUCCESS)
     {
@@ -56,6 +88,7 @@ HackRFSource::HackRFSource(int dev_index) :
     }
     else
     {
+        m_libInit = true;
         hackrf_device_list_t *hackrf_devices = hackrf_device_list();
 
         rc = (hackrf_error) hackrf_device_list_open(hackrf_devices, dev_index, &m_dev);
@@ -93,8 +126,6 @@ HackRFSource::HackRFSource(int dev_index) :
     }
 
     m_bwfiltStr = bwfilt_ostr.str();
-
-    m_this = this;
 }
 
 HackRFSource::~HackRFSource()
@@ -103,10 +134,10 @@ HackRFSource::~HackRFSource()
         hackrf_close(m_dev);
     }
     
-    hackrf_error rc = (hackrf_error) hackrf_exit();
-    std::cerr << "HackRFSource::~HackRFSource: HackRF library exit: " << rc << ": " << hackrf_error_name(rc) << std::endl;
-
-    m_this = 0;
+    if (m_libInit) {
+        hackrf_error rc = hackrf_lib_exit();
+        std::cerr << "HackRFSource::~HackRFSource: HackRF library exit: " << rc << ": " << hackrf_error_name(rc) << std::endl;
+    }
 }
 
 void HackRFSource::get_device_names(std::vector<std::string>& devices)
@@ -116,7 +147,7 @@ void HackRFSource::get_device_names(std::vector<std::string>& devices)
     hackrf_error rc;
     int i;
 
-    rc = (hackrf_error) hackrf_init();
+    rc = hackrf_lib_init();
 
     if (rc != HACKRF_SUCCESS)
     {
@@ -163,7 +194,7 @@ void HackRFSource::get_device_names(std::vector<std::string>& devices)
     }
 
     hackrf_device_list_free(hackrf_devices);
-    rc = (hackrf_error) hackrf_exit();
+    rc = hackrf_lib_exit();
     std::cerr << "HackRFSource::get_device_names: HackRF library exit: " << rc << ": " << hackrf_error_name(rc) << std::endl;
 }
 
@@ -177,6 +208,93 @@ std::uint32_t HackRFSource::get_frequency()
     return m_frequency;
 }
 
+bool HackRFSource::set_frequency(std::uint32_t frequency)
+{
+    if (!m_dev || hackrf_set_freq(m_dev, static_cast<uint64_t>(frequency)) != HACKRF_SUCCESS)
+    {
+        std::ostringstream err_ostr;
+        err_ostr << "Could not set center frequency to " << frequency << " Hz";
+        m_error = err_ostr.str();
+        return false;
+    }
+
+    m_frequency = frequency;
+    return true;
+}
+
+bool HackRFSource::set_gain(const std::string& gains)
+{
+    namespace qi = boost::spirit::qi;
+    std::string config(gains);
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end)
+    {
+        m_error = "Gain parsing failed";
+        return false;
+    }
+
+    int lnaGain = m_lnaGain;
+    int vgaGain = m_vgaGain;
+
+    if (m.find("lgain") != m.end())
+    {
+        lnaGain = atoi(m["lgain"].c_str());
+
+        if (find(m_lgains.begin(), m_lgains.end(), lnaGain) == m_lgains.end())
+        {
+            m_error = "LNA gain not supported. Available gains (dB): " + m_lgainsStr;
+            return false;
+        }
+    }
+
+    if (m.find("vgain") != m.end())
+    {
+        vgaGain = atoi(m["vgain"].c_str());
+
+        if (find(m_vgains.begin(), m_vgains.end(), vgaGain) == m_vgains.end())
+        {
+            m_error = "VGA gain not supported. Available gains (dB): " + m_vgainsStr;
+            return false;
+        }
+    }
+
+    if (!m_dev || hackrf_set_lna_gain(m_dev, lnaGain) != HACKRF_SUCCESS)
+    {
+        std::ostringstream err_ostr;
+        err_ostr << "Could not set LNA gain to " << lnaGain << " dB";
+        m_error = err_ostr.str();
+        return false;
+    }
+
+    m_lnaGain = lnaGain;
+
+    if (hackrf_set_vga_gain(m_dev, vgaGain) != HACKRF_SUCCESS)
+    {
+        std::ostringstream err_ostr;
+        err_ostr << "Could not set VGA gain to " << vgaGain << " dB";
+        m_error = err_ostr.str();
+        return false;
+    }
+
+    m_vgaGain = vgaGain;
+    return true;
+}
+
+// Get gain settings for software gain control.
+bool HackRFSource::get_gain_steps(std::vector<GainStep>& steps, std::size_t& current)
+{
+    current = make_gain_steps({ "lgain", "vgain" },
+                              { m_lgains, m_vgains },
+                              { m_lnaGain, m_vgaGain },
+                              steps);
+    return true;
+}
+
 void HackRFSource::print_specific_parms()
 {
     fprintf(stderr, "LNA gain:          %d\n", m_lnaGain);
@@ -295,6 +413,9 @@ bool HackRFSource::configure(std::string configurationStr)
     uint32_t bandwidth = 2500000;
     bool extAmp = false;
     bool antBias = false;
+    bool zeroif = false;
+    bool autorate = false;
+    bool bandwidth_set = false;
 
     parsekv::key_value_sequence<std::string::iterator> p;
     parsekv::pairs_type m;
@@ -309,9 +430,10 @@ bool HackRFSource::configure(std::string configurationStr)
         if (m.find("srate") != m.end())
         {
             std::cerr << "HackRFSource::configure: srate: " << m["srate"] << std::endl;
+            autorate = (strcasecmp(m["srate"].c_str(), "auto") == 0);
             sampleRate = atoi(m["srate"].c_str());
 
-            if ((sampleRate < 1000000) || (sampleRate > 20000000))
+            if (!autorate && ((sampleRate < 1000000) || (sampleRate > 20000000)))
             {
                 m_error = "Invalid sample rate";
                 return false;
@@ -396,6 +518,7 @@ bool HackRFSource::configure(std::string configurationStr)
                 else
                 {
                     bandwidth = tmpbwi;
+                    bandwidth_set = true;
 
                     if (find(m_bwfilt.begin(), m_bwfilt.end(), bandwidth) == m_bwfilt.end())
                     {
@@ -417,10 +540,32 @@ bool HackRFSource::configure(std::string configurationStr)
             std::cerr << "HackRFSource::configure: antbias" << std::endl;
             antBias = true;
         }
+
+        if (m.find("zeroif") != m.end())
+        {
+            std::cerr << "HackRFSource::configure: zeroif" << std::endl;
+            zeroif = true;
+        }
+    }
+
+    if (autorate)
+    {
+        // Rates below 2 MS/s alias through the widest baseband filter.
+        static const std::vector<std::uint32_t> rates = {
+            2000000, 2500000, 4000000, 5000000, 8000000, 10000000,
+            12500000, 16000000, 20000000 };
+
+        sampleRate = choose_sample_rate(rates, frequency, tuner_offset_ratio(zeroif));
+
+        // Baseband filter at 3/4 of the sample rate as libhackrf does.
+        if (!bandwidth_set)
+            bandwidth = sampleRate / 4 * 3;
     }
 
     m_confFreq = frequency;
-    double tuner_freq = frequency + 0.25 * sampleRate;
+    double tuner_freq = frequency + tuner_offset_ratio(zeroif) * sampleRate;
+    m_iqconv.set_sample_rate(sampleRate);
+    m_iqconv.set_enabled(zeroif);
     return configure(sampleRate, tuner_freq, extAmp, antBias, lnaGain, vgaGain, bandwidth);
 }
 
@@ -433,7 +578,7 @@ bool HackRFSource::start(DataBuffer<IQSample> *buf, std::atomic_bool *stop_flag)
     {
         std::cerr << "HackRFSource::start: starting" << std::endl;
         m_running = true;
-        m_thread = new std::thread(run, m_dev, stop_flag);
+        m_thread = new std::thread(&HackRFSource::run, this);
         sleep(1);
         return *this;
     }
@@ -445,20 +590,21 @@ bool HackRFSource::start(DataBuffer<IQSample> *buf, std::atomic_bool *stop_flag)
     }
 }
 
-void HackRFSource::run(hackrf_device* dev, std::atomic_bool *stop_flag)
+void HackRFSource::run()
 {
     std::cerr << "HackRFSource::run" << std::endl;
 
-    hackrf_error rc = (hackrf_error) hackrf_start_rx(dev, rx_callback, 0);
+    // The callback finds its source through the transfer context.
+    hackrf_error rc = (hackrf_error) hackrf_start_rx(m_dev, rx_callback, this);
 
     if (rc == HACKRF_SUCCESS)
     {
-        while (!stop_flag->load() && (hackrf_is_streaming(dev) == HACKRF_TRUE))
+        while (!m_stop_flag->load() && (hackrf_is_streaming(m_dev) == HACKRF_TRUE))
         {
             sleep(1);
         }
         
-        rc = (hackrf_error) hackrf_stop_rx(dev);
+        rc = (hackrf_error) hackrf_stop_rx(m_dev);
         
         if (rc != HACKRF_SUCCESS)
         {
@@ -484,9 +630,11 @@ int HackRFSource::rx_callback(hackrf_transfer* transfer)
 {
     int bytes_to_write = transfer->valid_length;
 
-    if (m_this)
+    HackRFSource *source = static_cast<HackRFSource*>(transfer->rx_ctx);
+
+    if (source)
     {
-        m_this->callback((char *) transfer->buffer, bytes_to_write);
+        source->callback((char *) transfer->buffer, bytes_to_write);
     }
 
     return 0;
@@ -496,14 +644,8 @@ void HackRFSource::callback(const char* buf, int len)
 {
     IQSampleVector iqsamples;
 
-    iqsamples.resize(len/2);
-
-    for (int i = 0; i < len/2; i++) {
-        int32_t re = buf[2*i];
-        int32_t im = buf[2*i+1];
-        iqsamples[i] = IQSample( (re - 128) / IQSample::value_type(128),
-                               (im - 128) / IQSample::value_type(128) );
-    }
+    // HackRF delivers signed 8-bit samples.
+    m_iqconv.convert(reinterpret_cast<const std::int8_t*>(buf), len/2, iqsamples);
 
     m_buf->push(move(iqsamples));
 }
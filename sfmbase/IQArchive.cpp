@@ -0,0 +1,525 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <sys/types.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "IQArchive.h"
+
+
+/** Rice codes with a quotient of this size or larger are sent verbatim. */
+static const unsigned int rice_escape = 24;
+
+
+/** Write bit fields (MSB first) to a byte vector. */
+class BitWriter
+{
+public:
+    BitWriter(std::vector<std::uint8_t>& bytes)
+        : m_bytes(bytes), m_acc(0), m_nbits(0)
+    { }
+
+    void put(std::uint32_t value, unsigned int nbits)
+    {
+        if (nbits == 0)
+            return;
+        m_acc = (m_acc << nbits) | (value & ((std::uint64_t(1) << nbits) - 1));
+        m_nbits += nbits;
+        while (m_nbits >= 8) {
+            m_nbits -= 8;
+            m_bytes.push_back((m_acc >> m_nbits) & 0xff);
+        }
+    }
+
+    void put_rice(std::uint32_t u, unsigned int k)
+    {
+        std::uint32_t q = u >> k;
+        if (q >= rice_escape) {
+            put((1u << rice_escape) - 1, rice_escape);
+            put(u, 32);
+        } else {
+            put(((1u << q) - 1) << 1, q + 1);
+            put(u, k);
+        }
+    }
+
+    void flush()
+    {
+        if (m_nbits > 0) {
+            m_bytes.push_back((m_acc << (8 - m_nbits)) & 0xff);
+            m_nbits = 0;
+        }
+    }
+
+private:
+    std::vector<std::uint8_t>& m_bytes;
+    std::uint64_t   m_acc;
+    unsigned int    m_nbits;
+};
+
+
+/** Read bit fields (MSB first) from a byte array. */
+class BitReader
+{
+public:
+    BitReader(const std::uint8_t *bytes, std::size_t nbytes)
+        : m_bytes(bytes), m_nbytes(nbytes), m_pos(0), m_acc(0), m_nbits(0)
+    { }
+
+    bool get(unsigned int nbits, std::uint32_t& value)
+    {
+        while (m_nbits < nbits) {
+            if (m_pos >= m_nbytes)
+                return false;
+            m_acc = (m_acc << 8) | m_bytes[m_pos++];
+            m_nbits += 8;
+        }
+        m_nbits -= nbits;
+        value = (m_acc >> m_nbits) & ((std::uint64_t(1) << nbits) - 1);
+        return true;
+    }
+
+    bool get_rice(unsigned int k, std::uint32_t& u)
+    {
+        std::uint32_t q = 0, b;
+        while (true) {
+            if (!get(1, b))
+                return false;
+            if (b == 0)
+                break;
+            if (++q == rice_escape)
+                return get(32, u);
+        }
+        if (!get(k, b))
+            return false;
+        u = (q << k) | b;
+        return true;
+    }
+
+private:
+    const std::uint8_t *m_bytes;
+    std::size_t     m_nbytes;
+    std::size_t     m_pos;
+    std::uint64_t   m_acc;
+    unsigned int    m_nbits;
+};
+
+
+/** Return prediction residual of sample i for a fixed predictor. */
+static inline std::int32_t predict_residual(const std::int32_t *x,
+                                            unsigned int i,
+                                            unsigned int order)
+{
+    if (order == 0 || i == 0)
+        return x[i];
+    if (order == 1 || i == 1)
+        return x[i] - x[i-1];
+    return x[i] - 2 * x[i-1] + x[i-2];
+}
+
+
+/** Reconstruct sample i from its residual for a fixed predictor. */
+static inline std::int32_t predict_sample(const std::int32_t *x,
+                                          unsigned int i,
+                                          unsigned int order,
+                                          std::int32_t r)
+{
+    if (order == 0 || i == 0)
+        return r;
+    if (order == 1 || i == 1)
+        return r + x[i-1];
+    return r + 2 * x[i-1] - x[i-2];
+}
+
+
+/** Map signed residual to unsigned integer (0, -1, 1, -2, 2, ...). */
+static inline std::uint32_t zigzag(std::int32_t r)
+{
+    return (std::uint32_t(r) << 1) ^ std::uint32_t(r >> 31);
+}
+
+
+static inline std::int32_t unzigzag(std::uint32_t u)
+{
+    return std::int32_t(u >> 1) ^ -std::int32_t(u & 1);
+}
+
+
+/**
+ * Select predictor order and Rice parameter for one channel.
+ * Return the zigzag coded residuals in u.
+ */
+static void analyze_channel(const std::vector<std::int32_t>& x,
+                            unsigned int& order,
+                            unsigned int& k,
+                            std::vector<std::uint32_t>& u)
+{
+    unsigned int n = x.size();
+
+    // Pick the fixed predictor with the smallest sum of absolute residuals.
+    std::uint64_t sums[3] = { 0, 0, 0 };
+    for (unsigned int i = 0; i < n; i++) {
+        for (unsigned int p = 0; p < 3; p++) {
+            sums[p] += std::abs(predict_residual(x.data(), i, p));
+        }
+    }
+
+    order = 0;
+    for (unsigned int p = 1; p < 3; p++) {
+        if (sums[p] < sums[order])
+            order = p;
+    }
+
+    u.resize(n);
+    std::uint64_t usum = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        u[i] = zigzag(predict_residual(x.data(), i, order));
+        usum += u[i];
+    }
+
+    // Rice parameter close to log2 of the mean residual.
+    k = 0;
+    while (k < 30 && (std::uint64_t(n) << (k + 1)) <= usum)
+        k++;
+}
+
+
+/* ****************  class IQArchiveCodec  **************** */
+
+// Serialize file header.
+void IQArchiveCodec::encode_header(const Header& header,
+                                   std::vector<std::uint8_t>& bytes)
+{
+    bytes.assign(header_size, 0);
+
+    std::uint64_t rate_bits;
+    memcpy(&rate_bits, &header.sample_rate, sizeof(rate_bits));
+
+    memcpy(bytes.data(), "SFMIQARC", 8);
+    put_value<std::uint32_t>(bytes.data() +  8, version);
+    put_value<std::uint32_t>(bytes.data() + 12, header.bits);
+    put_value<std::uint32_t>(bytes.data() + 16, header.block_size);
+    put_value<std::uint32_t>(bytes.data() + 20, 0);
+    put_value<std::uint64_t>(bytes.data() + 24, rate_bits);
+    put_value<std::uint64_t>(bytes.data() + 32, header.frequency);
+    put_value<std::uint64_t>(bytes.data() + 40, header.conf_frequency);
+}
+
+
+// Parse file header.
+bool IQArchiveCodec::decode_header(const std::uint8_t *bytes, Header& header)
+{
+    if (memcmp(bytes, "SFMIQARC", 8) != 0)
+        return false;
+
+    if (get_value<std::uint32_t>(bytes + 8) != version)
+        return false;
+
+    std::uint64_t rate_bits = get_value<std::uint64_t>(bytes + 24);
+
+    header.bits           = get_value<std::uint32_t>(bytes + 12);
+    header.block_size     = get_value<std::uint32_t>(bytes + 16);
+    memcpy(&header.sample_rate, &rate_bits, sizeof(rate_bits));
+    header.frequency      = get_value<std::uint64_t>(bytes + 32);
+    header.conf_frequency = get_value<std::uint64_t>(bytes + 40);
+
+    return header.bits >= 1 && header.bits <= 16 && header.block_size > 0;
+}
+
+
+// Encode a block of IQ samples including its block header.
+void IQArchiveCodec::encode_block(const IQSampleVector& samples,
+                                  unsigned int bits,
+                                  std::vector<std::uint8_t>& bytes)
+{
+    unsigned int n = samples.size();
+    IQSample::value_type scale = IQSample::value_type(1 << (bits - 1));
+
+    // Recover integer device codes.
+    std::vector<std::int32_t> xi(n), xq(n);
+    for (unsigned int i = 0; i < n; i++) {
+        xi[i] = lrintf(samples[i].real() * scale);
+        xq[i] = lrintf(samples[i].imag() * scale);
+    }
+
+    unsigned int order_i, order_q, k_i, k_q;
+    std::vector<std::uint32_t> ui, uq;
+    analyze_channel(xi, order_i, k_i, ui);
+    analyze_channel(xq, order_q, k_q, uq);
+
+    bytes.assign(block_header_size, 0);
+
+    BitWriter writer(bytes);
+    for (unsigned int i = 0; i < n; i++)
+        writer.put_rice(ui[i], k_i);
+    for (unsigned int i = 0; i < n; i++)
+        writer.put_rice(uq[i], k_q);
+    writer.flush();
+
+    put_value<std::uint32_t>(bytes.data(), n);
+    bytes[4] = order_i | (order_q << 4);
+    bytes[5] = k_i;
+    bytes[6] = k_q;
+    bytes[7] = 0;
+    put_value<std::uint32_t>(bytes.data() + 8, bytes.size() - block_header_size);
+}
+
+
+// Parse block header.
+std::size_t IQArchiveCodec::decode_block_size(const std::uint8_t *bytes,
+                                              std::uint32_t& nsamples)
+{
+    nsamples = get_value<std::uint32_t>(bytes);
+    return block_header_size + get_value<std::uint32_t>(bytes + 8);
+}
+
+
+// Decode a complete block.
+bool IQArchiveCodec::decode_block(const std::uint8_t *bytes,
+                                  std::size_t nbytes,
+                                  unsigned int bits,
+                                  IQSampleVector& samples)
+{
+    if (nbytes < block_header_size)
+        return false;
+
+    std::uint32_t n;
+    if (decode_block_size(bytes, n) != nbytes)
+        return false;
+
+    unsigned int order[2] = { bytes[4] & 0x0fu, (bytes[4] >> 4) & 0x0fu };
+    unsigned int k[2]     = { bytes[5], bytes[6] };
+
+    if (order[0] > 2 || order[1] > 2 || k[0] > 30 || k[1] > 30)
+        return false;
+
+    BitReader reader(bytes + block_header_size, nbytes - block_header_size);
+
+    std::vector<std::int32_t> x[2];
+    for (unsigned int c = 0; c < 2; c++) {
+        x[c].resize(n);
+        for (unsigned int i = 0; i < n; i++) {
+            std::uint32_t u;
+            if (!reader.get_rice(k[c], u))
+                return false;
+            x[c][i] = predict_sample(x[c].data(), i, order[c], unzigzag(u));
+        }
+    }
+
+    IQSample::value_type scale = IQSample::value_type(1 << (bits - 1));
+
+    samples.resize(n);
+    for (unsigned int i = 0; i < n; i++) {
+        samples[i] = IQSample(x[0][i] / scale, x[1][i] / scale);
+    }
+
+    return true;
+}
+
+
+/* ****************  class IQArchiveReader  **************** */
+
+// Open archive file and load its seek index.
+IQArchiveReader::IQArchiveReader(const std::string& filename)
+    : m_zombie(false)
+    , m_file(NULL)
+    , m_data_end(0)
+    , m_nsamples(0)
+    , m_position(0)
+    , m_block(0)
+    , m_skip(0)
+{
+    m_file = fopen(filename.c_str(), "rb");
+    if (m_file == NULL) {
+        m_error  = "can not open '" + filename + "' (" +
+                   strerror(errno) + ")";
+        m_zombie = true;
+        return;
+    }
+
+    std::uint8_t hdr[IQArchiveCodec::header_size];
+    if (fread(hdr, 1, sizeof(hdr), m_file) != sizeof(hdr) ||
+        !IQArchiveCodec::decode_header(hdr, m_header)) {
+        m_error  = "'" + filename + "' is not an IQ archive";
+        m_zombie = true;
+        return;
+    }
+
+    if (fseeko(m_file, 0, SEEK_END) != 0) {
+        m_error  = "can not seek in '" + filename + "'";
+        m_zombie = true;
+        return;
+    }
+
+    std::uint64_t file_size = ftello(m_file);
+
+    // An interrupted recording has no index; recover what was written.
+    if (!load_index(file_size) && !scan_index(file_size)) {
+        m_error  = "can not read index of '" + filename + "'";
+        m_zombie = true;
+    }
+}
+
+
+IQArchiveReader::~IQArchiveReader()
+{
+    if (m_file != NULL) {
+        fclose(m_file);
+    }
+}
+
+
+// Position the reader at the specified sample index.
+bool IQArchiveReader::seek(std::uint64_t sample_index)
+{
+    if (m_zombie || sample_index > m_nsamples)
+        return false;
+
+    m_block    = sample_index / m_header.block_size;
+    m_skip     = sample_index % m_header.block_size;
+    m_position = sample_index;
+    return true;
+}
+
+
+// Read next block of samples.
+bool IQArchiveReader::read(IQSampleVector& samples)
+{
+    samples.clear();
+
+    if (m_zombie)
+        return false;
+
+    if (m_block >= m_offsets.size())
+        return true;
+
+    std::uint64_t offset = m_offsets[m_block];
+    std::uint64_t next = (m_block + 1 < m_offsets.size()) ?
+                         m_offsets[m_block + 1] : m_data_end;
+
+    m_bytebuf.resize(next - offset);
+
+    if (fseeko(m_file, offset, SEEK_SET) != 0 ||
+        fread(m_bytebuf.data(), 1, m_bytebuf.size(), m_file) != m_bytebuf.size()) {
+        m_error = "read failed";
+        return false;
+    }
+
+    if (!IQArchiveCodec::decode_block(m_bytebuf.data(), m_bytebuf.size(),
+                                      m_header.bits, samples)) {
+        m_error = "corrupt block " + std::to_string(m_block);
+        return false;
+    }
+
+    if (m_skip > 0) {
+        samples.erase(samples.begin(),
+                      samples.begin() + std::min(m_skip, samples.size()));
+        m_skip = 0;
+    }
+
+    m_block++;
+    m_position += samples.size();
+    return true;
+}
+
+
+// Load seek index from the file trailer.
+bool IQArchiveReader::load_index(std::uint64_t file_size)
+{
+    const std::size_t trailer_size = IQArchiveCodec::trailer_size;
+
+    if (file_size < IQArchiveCodec::header_size + trailer_size)
+        return false;
+
+    std::uint8_t trailer[trailer_size];
+    if (fseeko(m_file, file_size - trailer_size, SEEK_SET) != 0 ||
+        fread(trailer, 1, trailer_size, m_file) != trailer_size ||
+        memcmp(trailer + 16, "SFMIQIDX", 8) != 0) {
+        return false;
+    }
+
+    std::uint64_t nblocks  = IQArchiveCodec::get_value<std::uint64_t>(trailer);
+    std::uint64_t nsamples = IQArchiveCodec::get_value<std::uint64_t>(trailer + 8);
+
+    if (nblocks > (file_size - IQArchiveCodec::header_size - trailer_size) / 8)
+        return false;
+
+    std::uint64_t index_start = file_size - trailer_size - 8 * nblocks;
+    std::vector<std::uint8_t> bytes(8 * nblocks);
+
+    if (fseeko(m_file, index_start, SEEK_SET) != 0 ||
+        fread(bytes.data(), 1, bytes.size(), m_file) != bytes.size()) {
+        return false;
+    }
+
+    std::uint64_t prev = IQArchiveCodec::header_size;
+    m_offsets.resize(nblocks);
+    for (std::size_t i = 0; i < nblocks; i++) {
+        m_offsets[i] = IQArchiveCodec::get_value<std::uint64_t>(bytes.data() + 8 * i);
+        if (m_offsets[i] < prev || m_offsets[i] >= index_start) {
+            m_offsets.clear();
+            return false;
+        }
+        prev = m_offsets[i] + IQArchiveCodec::block_header_size;
+    }
+
+    m_data_end = index_start;
+    m_nsamples = nsamples;
+    return true;
+}
+
+
+// Rebuild seek index by scanning block headers.
+bool IQArchiveReader::scan_index(std::uint64_t file_size)
+{
+    std::uint64_t pos = IQArchiveCodec::header_size;
+    std::uint8_t hdr[IQArchiveCodec::block_header_size];
+    bool short_block = false;
+
+    m_offsets.clear();
+    m_nsamples = 0;
+
+    // Stop at the first truncated block, or after a partial block
+    // (the index trailer may follow it).
+    while (!short_block && pos + sizeof(hdr) <= file_size) {
+
+        if (fseeko(m_file, pos, SEEK_SET) != 0 ||
+            fread(hdr, 1, sizeof(hdr), m_file) != sizeof(hdr)) {
+            return false;
+        }
+
+        std::uint32_t n;
+        std::size_t nbytes = IQArchiveCodec::decode_block_size(hdr, n);
+        if (n == 0 || n > m_header.block_size || pos + nbytes > file_size)
+            break;
+
+        short_block = (n < m_header.block_size);
+        m_offsets.push_back(pos);
+        m_nsamples += n;
+        pos += nbytes;
+    }
+
+    m_data_end = pos;
+    return true;
+}
+
+/* end */
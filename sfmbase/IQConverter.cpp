@@ -0,0 +1,264 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "IQConverter.h"
+
+
+/* ****************  class IQConverter  **************** */
+
+// Construct converter.
+IQConverter::IQConverter()
+    : m_enabled(true)
+    , m_time_constant(default_time_constant * 1.0e6)
+    , m_stats{0, 0, 0, 0}
+    , m_stats_sumsq(0)
+{
+    set_sample_rate(1.0e6);
+}
+
+
+// Set sample rate and restart the estimation.
+void IQConverter::set_sample_rate(double sample_rate)
+{
+    m_time_constant = default_time_constant * sample_rate;
+    m_nsamples = 0;
+    m_dc_i     = 0;
+    m_dc_q     = 0;
+    m_pii      = 0;
+    m_pqq      = 0;
+    m_piq      = 0;
+    m_corr_qq  = 1;
+    m_corr_qi  = 0;
+}
+
+
+// Convert unsigned 8-bit offset binary samples.
+void IQConverter::convert(const std::uint8_t *buf, std::size_t n,
+                          IQSampleVector& samples_out)
+{
+    convert_block<std::uint8_t>(buf, n, 128.0f, 1.0f / 128, 0, 255, samples_out);
+}
+
+
+// Convert signed 8-bit samples.
+void IQConverter::convert(const std::int8_t *buf, std::size_t n,
+                          IQSampleVector& samples_out)
+{
+    convert_block<std::int8_t>(buf, n, 0.0f, 1.0f / 128, -128, 127, samples_out);
+}
+
+
+// Convert signed 16-bit samples.
+void IQConverter::convert(const std::int16_t *buf, std::size_t n, unsigned int bits,
+                          IQSampleVector& samples_out)
+{
+    // Devices deliver fewer significant bits than 16 (e.g. 12 on BladeRF).
+    std::int16_t full_scale = 1 << (bits - 1);
+    convert_block<std::int16_t>(buf, n, 0.0f, 1.0f / full_scale,
+                                -full_scale, full_scale - 1, samples_out);
+}
+
+
+// Correct IQ samples in place.
+void IQConverter::process(IQSampleVector& samples)
+{
+    if (m_enabled)
+    {
+        // Clipping can not be recognized after conversion.
+        const float inf = std::numeric_limits<float>::infinity();
+        convert_block<float>(reinterpret_cast<const float*>(samples.data()), samples.size(),
+                             0.0f, 1.0f, -inf, inf, samples);
+    }
+}
+
+
+// Convert and correct a block of samples.
+template <typename T>
+void IQConverter::convert_block(const T *buf, std::size_t n, float offset, float scale,
+                                T clip_lo, T clip_hi, IQSampleVector& samples_out)
+{
+    samples_out.resize(n);
+
+    T raw_min = clip_hi;
+    T raw_max = clip_lo;
+
+    // Plain conversion with level statistics only.
+    if (!m_enabled)
+    {
+        double sumsq = 0;
+
+        for (std::size_t i = 0; i < n; i++)
+        {
+            T bi = buf[2*i];
+            T bq = buf[2*i+1];
+            raw_min = std::min(raw_min, std::min(bi, bq));
+            raw_max = std::max(raw_max, std::max(bi, bq));
+            float vi = (bi - offset) * scale;
+            float vq = (bq - offset) * scale;
+            sumsq += vi * vi + vq * vq;
+            samples_out[i] = IQSample(vi, vq);
+        }
+
+        add_level_stats(n, count_clipped(buf, n, clip_lo, clip_hi, raw_min, raw_max),
+                        std::max((raw_max - offset) * scale, (offset - raw_min) * scale),
+                        sumsq);
+        return;
+    }
+
+    // Fold DC removal into the conversion offset.
+    const float dc_i = m_dc_i;
+    const float dc_q = m_dc_q;
+    const float offset_i = offset + dc_i / scale;
+    const float offset_q = offset + dc_q / scale;
+    const float corr_qq = m_corr_qq;
+    const float corr_qi = m_corr_qi;
+    double si = 0, sq = 0, sii = 0, sqq = 0, siq = 0;
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        T bi = buf[2*i];
+        T bq = buf[2*i+1];
+        raw_min = std::min(raw_min, std::min(bi, bq));
+        raw_max = std::max(raw_max, std::max(bi, bq));
+        float vi = (bi - offset_i) * scale;
+        float vq = (bq - offset_q) * scale;
+        si  += vi;
+        sq  += vq;
+        sii += vi * vi;
+        sqq += vq * vq;
+        siq += vi * vq;
+        samples_out[i] = IQSample(vi, vq * corr_qq + vi * corr_qi);
+    }
+
+    // Level of the raw samples, i.e. with the DC offset added back.
+    double sumsq = sii + 2 * dc_i * si + n * dc_i * dc_i +
+                   sqq + 2 * dc_q * sq + n * dc_q * dc_q;
+    add_level_stats(n, count_clipped(buf, n, clip_lo, clip_hi, raw_min, raw_max),
+                    std::max((raw_max - offset) * scale, (offset - raw_min) * scale),
+                    sumsq);
+
+    update(n, si, sq, sii, sqq, siq);
+}
+
+
+// Count samples at the ADC limits.
+template <typename T>
+std::size_t IQConverter::count_clipped(const T *buf, std::size_t n,
+                                       T clip_lo, T clip_hi, T raw_min, T raw_max)
+{
+    // Only blocks that reach a limit at all need a second pass.
+    if (raw_min > clip_lo && raw_max < clip_hi)
+        return 0;
+
+    std::size_t clipped = 0;
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        T bi = buf[2*i];
+        T bq = buf[2*i+1];
+        clipped += (bi <= clip_lo) | (bi >= clip_hi) | (bq <= clip_lo) | (bq >= clip_hi);
+    }
+
+    return clipped;
+}
+
+
+// Add the level statistics of one block.
+void IQConverter::add_level_stats(std::size_t n, std::size_t clipped,
+                                  double peak, double sumsq)
+{
+    if (n == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    m_stats.samples += n;
+    m_stats.clipped += clipped;
+    m_stats.peak = std::max(m_stats.peak, peak);
+    m_stats_sumsq += sumsq;
+}
+
+
+// Return level statistics since the previous call.
+void IQConverter::get_level_stats(LevelStats& stats)
+{
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    stats = m_stats;
+    stats.rms = (m_stats.samples > 0) ? sqrt(m_stats_sumsq / m_stats.samples) : 0;
+    m_stats = LevelStats{0, 0, 0, 0};
+    m_stats_sumsq = 0;
+}
+
+
+// Update estimates from the moments of one block.
+void IQConverter::update(std::size_t n, double si, double sq,
+                         double sii, double sqq, double siq)
+{
+    if (n == 0)
+        return;
+
+    // Average over everything seen so far until the time constant is
+    // reached, so that the estimates settle within the first blocks.
+    m_nsamples += n;
+    double alpha = std::max(1.0 - exp(-double(n) / m_time_constant),
+                            double(n) / m_nsamples);
+
+    // Remaining DC after subtracting the current estimate.
+    double mi = si / n;
+    double mq = sq / n;
+    m_dc_i += alpha * mi;
+    m_dc_q += alpha * mq;
+
+    m_pii += alpha * (sii / n - mi * mi - m_pii);
+    m_pqq += alpha * (sqq / n - mq * mq - m_pqq);
+    m_piq += alpha * (siq / n - mi * mq - m_piq);
+
+    // Orthogonalize Q against I, then scale it to the power of I.
+    if (m_pii > 0)
+    {
+        double k = m_piq / m_pii;
+        double porth = m_pqq - k * m_piq;
+
+        if (porth > 0)
+        {
+            m_corr_qq = sqrt(m_pii / porth);
+            m_corr_qi = -k * m_corr_qq;
+        }
+    }
+}
+
+
+// Return estimated gain of Q relative to I in dB.
+double IQConverter::get_gain_imbalance() const
+{
+    return (m_pii > 0 && m_pqq > 0) ? 10 * log10(m_pqq / m_pii) : 0;
+}
+
+
+// Return estimated phase error of Q relative to I in degrees.
+double IQConverter::get_phase_imbalance() const
+{
+    return (m_pii > 0 && m_pqq > 0) ?
+           asin(std::max(-1.0, std::min(1.0, m_piq / sqrt(m_pii * m_pqq)))) * 180 / M_PI :
+           0;
+}
+
+/* end */
@@ -0,0 +1,321 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "IQOutput.h"
+
+
+/* ****************  class IQOutput  **************** */
+
+// Parse sample format name.
+bool IQOutput::parse_format(const std::string& name, SampleFormat& format)
+{
+    if (name == "cf32") {
+        format = FORMAT_CF32;
+        return true;
+    } else if (name == "cs16") {
+        format = FORMAT_CS16;
+        return true;
+    }
+
+    return false;
+}
+
+
+// Write all bytes to file descriptor.
+bool IQOutput::write_bytes(int fd, const std::vector<std::uint8_t>& bytes)
+{
+    std::size_t p = 0;
+    std::size_t n = bytes.size();
+    while (p < n) {
+
+        ssize_t k = ::write(fd, bytes.data() + p, n - p);
+        if (k <= 0) {
+            if (k == 0 || errno != EINTR) {
+                m_error = "write failed (";
+                m_error += strerror(errno);
+                m_error += ")";
+                return false;
+            }
+        } else {
+            p += k;
+        }
+    }
+
+    return true;
+}
+
+
+/* ****************  class RawIQOutput  **************** */
+
+// Construct raw IQ writer.
+RawIQOutput::RawIQOutput(const std::string& filename,
+                         SampleFormat format,
+                         double sample_rate,
+                         double frequency)
+    : m_format(format)
+{
+    if (filename == "-") {
+
+        m_fd = STDOUT_FILENO;
+
+    } else {
+
+        m_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (m_fd < 0) {
+            m_error  = "can not open '" + filename + "' (" +
+                       strerror(errno) + ")";
+            m_zombie = true;
+            return;
+        }
+
+        if (!write_metadata(filename, sample_rate, frequency)) {
+            m_zombie = true;
+        }
+    }
+}
+
+
+// Destructor.
+RawIQOutput::~RawIQOutput()
+{
+    // Close file descriptor.
+    if (m_fd >= 0 && m_fd != STDOUT_FILENO) {
+        close(m_fd);
+    }
+}
+
+
+// Write IQ data.
+bool RawIQOutput::write(const IQSampleVector& samples)
+{
+    if (m_zombie)
+        return false;
+
+    // Convert samples to little-endian bytes.
+    if (m_format == FORMAT_CS16) {
+
+        m_bytebuf.resize(4 * samples.size());
+        std::vector<std::uint8_t>::iterator k = m_bytebuf.begin();
+
+        for (const IQSample& s : samples) {
+            IQSample::value_type v[2] = { s.real(), s.imag() };
+            for (int c = 0; c < 2; c++) {
+                IQSample::value_type x = std::max(-1.0f, std::min(1.0f, v[c]));
+                unsigned long u = lrintf(x * 32767);
+                *(k++) = u & 0xff;
+                *(k++) = (u >> 8) & 0xff;
+            }
+        }
+
+    } else {
+
+        m_bytebuf.resize(8 * samples.size());
+        std::vector<std::uint8_t>::iterator k = m_bytebuf.begin();
+
+        for (const IQSample& s : samples) {
+            IQSample::value_type v[2] = { s.real(), s.imag() };
+            for (int c = 0; c < 2; c++) {
+                std::uint32_t u;
+                memcpy(&u, &v[c], sizeof(u));
+                *(k++) = u & 0xff;
+                *(k++) = (u >> 8) & 0xff;
+                *(k++) = (u >> 16) & 0xff;
+                *(k++) = (u >> 24) & 0xff;
+            }
+        }
+    }
+
+    // Write data.
+    return write_bytes(m_fd, m_bytebuf);
+}
+
+
+// Write SigMF metadata file.
+bool RawIQOutput::write_metadata(const std::string& filename,
+                                 double sample_rate,
+                                 double frequency)
+{
+    std::string metaname = filename + ".sigmf-meta";
+    FILE *f = fopen(metaname.c_str(), "w");
+
+    if (f == NULL) {
+        m_error  = "can not open '" + metaname + "' (" +
+                   strerror(errno) + ")";
+        return false;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "    \"global\": {\n");
+    fprintf(f, "        \"core:datatype\": \"%s\",\n",
+            (m_format == FORMAT_CS16) ? "ci16_le" : "cf32_le");
+    fprintf(f, "        \"core:sample_rate\": %.3f,\n", sample_rate);
+    fprintf(f, "        \"core:version\": \"1.0.0\",\n");
+    fprintf(f, "        \"core:recorder\": \"softfm\"\n");
+    fprintf(f, "    },\n");
+    fprintf(f, "    \"captures\": [\n");
+    fprintf(f, "        {\n");
+    fprintf(f, "            \"core:sample_start\": 0,\n");
+    fprintf(f, "            \"core:frequency\": %.0f\n", frequency);
+    fprintf(f, "        }\n");
+    fprintf(f, "    ],\n");
+    fprintf(f, "    \"annotations\": []\n");
+    fprintf(f, "}\n");
+
+    if (fclose(f) != 0) {
+        m_error = "can not write '" + metaname + "' (" +
+                  strerror(errno) + ")";
+        return false;
+    }
+
+    return true;
+}
+
+
+/* ****************  class ArchiveIQOutput  **************** */
+
+// Construct archive writer.
+ArchiveIQOutput::ArchiveIQOutput(const std::string& filename,
+                                 unsigned int bits,
+                                 double sample_rate,
+                                 double frequency,
+                                 double conf_frequency,
+                                 unsigned int block_size)
+    : m_bits(bits)
+    , m_block_size(block_size)
+    , m_offset(0)
+    , m_nsamples(0)
+{
+    if (bits < 1 || bits > 16 || block_size == 0) {
+        m_error  = "invalid archive parameters";
+        m_zombie = true;
+        m_fd     = -1;
+        return;
+    }
+
+    m_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (m_fd < 0) {
+        m_error  = "can not open '" + filename + "' (" +
+                   strerror(errno) + ")";
+        m_zombie = true;
+        return;
+    }
+
+    IQArchiveCodec::Header header;
+    header.bits           = bits;
+    header.block_size     = block_size;
+    header.sample_rate    = sample_rate;
+    header.frequency      = llrint(frequency);
+    header.conf_frequency = llrint(conf_frequency);
+
+    IQArchiveCodec::encode_header(header, m_bytebuf);
+    if (!write_bytes(m_fd, m_bytebuf)) {
+        m_zombie = true;
+        return;
+    }
+
+    m_offset = m_bytebuf.size();
+    m_pending.reserve(block_size);
+}
+
+
+// Destructor.
+ArchiveIQOutput::~ArchiveIQOutput()
+{
+    if (m_fd >= 0) {
+        if (!m_zombie)
+            finish();
+        close(m_fd);
+    }
+}
+
+
+// Write IQ data.
+bool ArchiveIQOutput::write(const IQSampleVector& samples)
+{
+    if (m_zombie)
+        return false;
+
+    // Collect samples into fixed size blocks.
+    std::size_t p = 0;
+    std::size_t n = samples.size();
+    while (p < n) {
+
+        std::size_t k = std::min(n - p, m_block_size - m_pending.size());
+        m_pending.insert(m_pending.end(),
+                         samples.begin() + p, samples.begin() + p + k);
+        p += k;
+
+        if (m_pending.size() == m_block_size) {
+            if (!write_block(m_pending))
+                return false;
+            m_pending.clear();
+        }
+    }
+
+    return true;
+}
+
+
+// Encode and write one block.
+bool ArchiveIQOutput::write_block(const IQSampleVector& samples)
+{
+    IQArchiveCodec::encode_block(samples, m_bits, m_bytebuf);
+
+    if (!write_bytes(m_fd, m_bytebuf))
+        return false;
+
+    m_index.push_back(m_offset);
+    m_offset   += m_bytebuf.size();
+    m_nsamples += samples.size();
+    return true;
+}
+
+
+// Write final partial block and seek index.
+bool ArchiveIQOutput::finish()
+{
+    if (!m_pending.empty()) {
+        if (!write_block(m_pending))
+            return false;
+        m_pending.clear();
+    }
+
+    m_bytebuf.assign(8 * m_index.size() + IQArchiveCodec::trailer_size, 0);
+
+    std::uint8_t *p = m_bytebuf.data();
+    for (std::uint64_t offset : m_index) {
+        IQArchiveCodec::put_value<std::uint64_t>(p, offset);
+        p += 8;
+    }
+
+    IQArchiveCodec::put_value<std::uint64_t>(p, m_index.size());
+    IQArchiveCodec::put_value<std::uint64_t>(p + 8, m_nsamples);
+    memcpy(p + 16, "SFMIQIDX", 8);
+
+    return write_bytes(m_fd, m_bytebuf);
+}
+
+/* end */
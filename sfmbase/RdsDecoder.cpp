@@ -0,0 +1,557 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "DecoderState.h"
+#include "RdsDecoder.h"
+
+
+/** RDS checkword generator polynomial. */
+static const std::uint32_t rds_gpoly = 0x5B9;
+
+/** Offset words for blocks A, B, C, C', D. */
+static const std::uint32_t rds_offsets[5] = { 0x0FC, 0x198, 0x168, 0x350, 0x1B4 };
+
+/** Block position in group for each offset word. */
+static const int rds_offset_block[5] = { 0, 1, 2, 2, 3 };
+
+/** Consecutive bad blocks after which synchronization is dropped. */
+static const unsigned int rds_max_bad_blocks = 12;
+
+
+/** Return remainder of a 26-bit word modulo the generator polynomial. */
+static std::uint32_t rds_remainder(std::uint32_t word)
+{
+    for (int i = 25; i >= 10; i--) {
+        if (word & (1u << i))
+            word ^= rds_gpoly << (i - 10);
+    }
+    return word & 0x3ff;
+}
+
+
+/** Return decimation factor of the first stage (to ~ 60 kS/s). */
+static int rds_downsample1(double sample_rate)
+{
+    return std::max(1, int(sample_rate / 60000));
+}
+
+
+/** Return decimation factor of the second stage (to ~ 20 kS/s). */
+static int rds_downsample2(double sample_rate)
+{
+    return std::max(1, int(sample_rate / rds_downsample1(sample_rate) / 19000));
+}
+
+
+/** Escape string for use as JSON string value. */
+static std::string json_escape(const std::string& s)
+{
+    std::string ret;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            ret += buf;
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+
+/* ****************  class RdsDecoder  **************** */
+
+// Construct RDS decoder.
+RdsDecoder::RdsDecoder(double sample_rate)
+    : m_sample_rate(sample_rate)
+
+    // First stage: cheap decimation; only needs to protect
+    // the band around DC from aliasing.
+    , m_resample1(8 * rds_downsample1(sample_rate),
+                  0.4 / rds_downsample1(sample_rate),
+                  rds_downsample1(sample_rate))
+
+    // Second stage: isolate RDS (+/- 2.4 kHz) from stereo sidebands
+    // (beyond 4 kHz after mixing).
+    , m_resample2(std::max(16, int(sample_rate / rds_downsample1(sample_rate) / 500)),
+                  3000.0 * rds_downsample1(sample_rate) / sample_rate,
+                  rds_downsample2(sample_rate))
+
+    , m_pos(0)
+    , m_prev_a1(0)
+    , m_level(0)
+    , m_shift(0)
+    , m_bit_cnt(0)
+    , m_synced(false)
+    , m_last_match_bit(0)
+    , m_last_match_block(-1)
+    , m_block_bits(0)
+    , m_block_index(0)
+    , m_bad_blocks(0)
+    , m_bler(1.0)
+    , m_group_valid(false)
+    , m_pi(-1)
+    , m_ps_segments(0)
+    , m_rt_segments(0)
+    , m_rt_ab(-1)
+    , m_group_cnt(0)
+{
+    double fs = sample_rate / (rds_downsample1(sample_rate) *
+                               rds_downsample2(sample_rate));
+
+    m_bitsteps = fs / bit_rate;
+
+    // Matched filter for one biphase impulse (see pyfm.py).
+    // Root-raised-cosine with hard cutoff at 2 * bitrate and Sinc window.
+    unsigned int wlen = int(1.5 * fs / bit_rate);
+    m_matched.resize(wlen);
+    double wsum = 0;
+    for (unsigned int i = 0; i < wlen; i++) {
+        double t = (i - 0.5 * (wlen - 1)) * 4.0 * bit_rate / fs;
+        double h;
+        if (fabs(fabs(t) - 0.5) < 1.0e-4) {
+            h = 0.25 * M_PI - 0.25 * M_PI * (fabs(t) - 0.5);
+        } else {
+            h = cos(M_PI * t) / (1 - 4.0 * t * t);
+        }
+        double x = 2.0 * (i + 1) / double(wlen + 1) - 1.0;
+        double w = (x == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+        m_matched[i] = h * w;
+        wsum += m_matched[i] * m_matched[i];
+    }
+    for (unsigned int i = 0; i < wlen; i++) {
+        m_matched[i] /= wsum;
+    }
+
+    // Syndrome tables for the two information bytes.
+    for (unsigned int b = 0; b < 256; b++) {
+        m_syndrome_hi[b] = rds_remainder(b << 18);
+        m_syndrome_lo[b] = rds_remainder(b << 10);
+    }
+
+    // Error patterns for single bit errors and 2-bit bursts.
+    memset(m_error_table, 0, sizeof(m_error_table));
+    for (unsigned int len = 2; len >= 1; len--) {
+        for (unsigned int k = 0; k + len <= 26; k++) {
+            std::uint32_t e = ((1u << len) - 1) << k;
+            m_error_table[rds_remainder(e)] = e;
+        }
+    }
+
+    memset(m_ps_buf, ' ', sizeof(m_ps_buf));
+    memset(m_rt_buf, ' ', sizeof(m_rt_buf));
+}
+
+
+// Process a block of baseband samples.
+void RdsDecoder::process(const SampleVector& samples_baseband,
+                         const IQSampleVector& subcarrier)
+{
+    unsigned int n = samples_baseband.size();
+
+    m_groups.clear();
+    m_events.clear();
+
+    // Mix 57 kHz subcarrier down to DC.
+    m_buf_mixed.resize(n);
+    for (unsigned int i = 0; i < n; i++) {
+        IQSample::value_type x = samples_baseband[i];
+        m_buf_mixed[i] = IQSample(x * subcarrier[i].real(),
+                                  - x * subcarrier[i].imag());
+    }
+
+    // Decimate and append to symbol buffer.
+    m_resample1.process(m_buf_mixed, m_buf_stage1);
+    m_resample2.process(m_buf_stage1, m_buf_mixed);
+    m_buf_symbols.insert(m_buf_symbols.end(),
+                         m_buf_mixed.begin(), m_buf_mixed.end());
+
+    demodulate();
+}
+
+
+// Recover bits from the decimated subcarrier signal.
+void RdsDecoder::demodulate()
+{
+    const unsigned int wlen = m_matched.size();
+    const unsigned int half = m_bitsteps / 2;
+    const unsigned int quarter = m_bitsteps / 4;
+
+    while (m_pos + m_bitsteps + wlen < m_buf_symbols.size()) {
+
+        const IQSample *p = m_buf_symbols.data() + (unsigned int)m_pos;
+
+        // Matched filter output for first impulse, second impulse
+        // and middle of the symbol.
+        IQSample a1 = 0, a2 = 0, a3 = 0;
+        for (unsigned int k = 0; k < wlen; k++) {
+            float w = m_matched[k];
+            a1 += p[k] * w;
+            a2 += p[k + half] * w;
+            a3 += p[k + quarter] * w;
+        }
+
+        // Consecutive symbols with opposite phase encode a 1 bit.
+        double sym = a1.real() * m_prev_a1.real() + a1.imag() * m_prev_a1.imag();
+        m_prev_a1 = a1;
+        receive_bit(sym < 0 ? 1 : 0);
+
+        double a1a2 = a1.real() * a2.real() + a1.imag() * a2.imag();
+        double a1a3 = a1.real() * a3.real() + a1.imag() * a3.imag();
+
+        m_level = 0.99 * m_level + 0.01 * sqrt(std::max(0.0, -a1a2));
+
+        // Early / late bit clock tracking.
+        if (a1a2 >= 0) {
+            // First and second impulse are in phase; badly misaligned.
+            m_pos += 0.625 * m_bitsteps;
+        } else if (a1a3 > -0.02 * a1a2) {
+            // Middle phasor in phase with first impulse; sampling early.
+            m_pos += 1.02 * m_bitsteps;
+        } else if (a1a3 > -0.01 * a1a2) {
+            m_pos += 1.01 * m_bitsteps;
+        } else if (a1a3 < 0.02 * a1a2) {
+            // Middle phasor opposite to first impulse; sampling late.
+            m_pos += 0.98 * m_bitsteps;
+        } else if (a1a3 < 0.01 * a1a2) {
+            m_pos += 0.99 * m_bitsteps;
+        } else {
+            m_pos += m_bitsteps;
+        }
+    }
+
+    // Drop consumed samples.
+    unsigned int consumed = m_pos;
+    m_buf_symbols.erase(m_buf_symbols.begin(), m_buf_symbols.begin() + consumed);
+    m_pos -= consumed;
+}
+
+
+// Return syndrome of a 26-bit word.
+std::uint32_t RdsDecoder::syndrome(std::uint32_t word) const
+{
+    std::uint32_t info = word >> 10;
+    return m_syndrome_hi[info >> 8] ^ m_syndrome_lo[info & 0xff] ^ (word & 0x3ff);
+}
+
+
+// Process one received bit.
+void RdsDecoder::receive_bit(unsigned int bit)
+{
+    m_shift = ((m_shift << 1) | bit) & 0x3ffffff;
+    m_bit_cnt++;
+
+    if (!m_synced) {
+
+        // Look for two error free blocks at a consistent distance.
+        std::uint32_t syn = syndrome(m_shift);
+
+        for (int t = 0; t < 5; t++) {
+            if (syn != rds_offsets[t])
+                continue;
+
+            int blk = rds_offset_block[t];
+            std::uint64_t dist = m_bit_cnt - m_last_match_bit;
+
+            if (m_last_match_block >= 0 && dist % 26 == 0 && dist <= 26 * 8 &&
+                (m_last_match_block + int(dist / 26)) % 4 == blk) {
+                m_synced      = true;
+                m_bad_blocks  = 0;
+                m_block_bits  = 0;
+                m_block_index = blk;
+                m_group_valid = false;
+            }
+
+            m_last_match_bit   = m_bit_cnt;
+            m_last_match_block = blk;
+            break;
+        }
+
+        if (!m_synced)
+            return;
+
+    } else {
+
+        if (++m_block_bits < 26)
+            return;
+
+        m_block_bits  = 0;
+        m_block_index = (m_block_index + 1) % 4;
+    }
+
+    // Check (and if possible correct) the block at its expected position.
+    std::uint32_t syn = syndrome(m_shift);
+    bool ok = false;
+    bool corrected = false;
+    std::uint32_t word = m_shift;
+
+    for (int t = 0; t < 5 && !ok; t++) {
+        if (rds_offset_block[t] == m_block_index && syn == rds_offsets[t])
+            ok = true;
+    }
+
+    for (int t = 0; t < 5 && !ok; t++) {
+        if (rds_offset_block[t] != m_block_index)
+            continue;
+        std::uint32_t e = m_error_table[syn ^ rds_offsets[t]];
+        if (e != 0) {
+            word ^= e;
+            ok = corrected = true;
+        }
+    }
+
+    m_bler = 0.98 * m_bler + (ok ? 0.0 : 0.02);
+
+    if (ok) {
+        m_bad_blocks = 0;
+    } else if (++m_bad_blocks >= rds_max_bad_blocks) {
+        m_synced = false;
+        m_last_match_block = -1;
+        return;
+    }
+
+    // Assemble group.
+    if (m_block_index == 0) {
+        m_group_valid = ok;
+        m_group.corrected = 0;
+    } else {
+        m_group_valid = m_group_valid && ok;
+    }
+
+    m_group.blocks[m_block_index] = word >> 10;
+    m_group.corrected += corrected ? 1 : 0;
+
+    if (m_block_index == 3 && m_group_valid) {
+        decode_group(m_group);
+    }
+}
+
+
+// Process a complete group.
+void RdsDecoder::decode_group(const Group& group)
+{
+    std::uint16_t a = group.blocks[0];
+    std::uint16_t b = group.blocks[1];
+    std::uint16_t c = group.blocks[2];
+    std::uint16_t d = group.blocks[3];
+
+    m_group_cnt++;
+    m_groups.push_back(group);
+
+    // PI is present in all groups.
+    if (int(a) != m_pi) {
+        m_pi = a;
+        m_ps.clear();
+        m_rt.clear();
+        m_ps_segments = 0;
+        m_rt_segments = 0;
+        add_event("", "");
+    }
+
+    unsigned int type = b >> 12;
+    bool version_b = (b >> 11) & 1;
+
+    if (type == 0) {
+
+        // Group 0A / 0B: program service name.
+        unsigned int seg = b & 3;
+        m_ps_buf[2*seg]   = d >> 8;
+        m_ps_buf[2*seg+1] = d & 0xff;
+        m_ps_segments |= 1 << seg;
+
+        if (m_ps_segments == 0xf) {
+            std::string ps(m_ps_buf, 8);
+            if (ps != m_ps) {
+                m_ps = ps;
+                add_event("ps", ps);
+            }
+            m_ps_segments = 0;
+        }
+
+    } else if (type == 2) {
+
+        // Group 2A / 2B: radio text.
+        unsigned int ab = (b >> 4) & 1;
+        if (int(ab) != m_rt_ab) {
+            memset(m_rt_buf, ' ', sizeof(m_rt_buf));
+            m_rt_segments = 0;
+            m_rt_ab = ab;
+        }
+
+        unsigned int seg = b & 0xf;
+        unsigned int seglen = version_b ? 2 : 4;
+        char *p = m_rt_buf + seglen * seg;
+
+        if (version_b) {
+            p[0] = d >> 8;
+            p[1] = d & 0xff;
+        } else {
+            p[0] = c >> 8;
+            p[1] = c & 0xff;
+            p[2] = d >> 8;
+            p[3] = d & 0xff;
+        }
+        m_rt_segments |= 1 << seg;
+
+        // Text is complete when all segments up to the one containing
+        // the end marker (or all 16 segments) have been received.
+        unsigned int len = 0;
+        bool complete = false;
+        for (unsigned int i = 0; i < 16; i++) {
+            if (!((m_rt_segments >> i) & 1))
+                break;
+            const char *q = m_rt_buf + seglen * i;
+            const char *cr = static_cast<const char *>(memchr(q, '\r', seglen));
+            if (cr != NULL) {
+                len = cr - m_rt_buf;
+                complete = true;
+                break;
+            }
+            if (i == 15) {
+                len = 16 * seglen;
+                complete = true;
+            }
+        }
+
+        if (complete) {
+            std::string rt(m_rt_buf, len);
+            rt.erase(rt.find_last_not_of(' ') + 1);
+            if (rt != m_rt) {
+                m_rt = rt;
+                add_event("rt", rt);
+            }
+            m_rt_segments = 0;
+        }
+
+    } else if (type == 4 && !version_b) {
+
+        // Group 4A: clock time and date (UTC).
+        long mjd = ((b & 3) << 15) | (c >> 1);
+        unsigned int hour = ((c & 1) << 4) | (d >> 12);
+        unsigned int minute = (d >> 6) & 0x3f;
+
+        // Convert modified Julian day (EN 50067 Annex G).
+        long yp = long((mjd - 15078.2) / 365.25);
+        long mp = long((mjd - 14956.1 - long(yp * 365.25)) / 30.6001);
+        long day = mjd - 14956 - long(yp * 365.25) - long(mp * 30.6001);
+        long k = (mp == 14 || mp == 15) ? 1 : 0;
+        long year = yp + k + 1900;
+        long month = mp - 1 - k * 12;
+
+        if (hour < 24 && minute < 60 && month >= 1 && month <= 12) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%04ld-%02ld-%02ldT%02u:%02u:00Z",
+                     year, month, day, hour, minute);
+            add_event("ct", buf);
+        }
+    }
+}
+
+
+// Emit a JSON event line.
+void RdsDecoder::add_event(const std::string& key, const std::string& value)
+{
+    char pi[8];
+    snprintf(pi, sizeof(pi), "%04X", m_pi & 0xffff);
+
+    std::string line = "{\"pi\":\"";
+    line += pi;
+    line += "\"";
+
+    if (!key.empty()) {
+        line += ",\"" + key + "\":\"" + json_escape(value) + "\"";
+    }
+
+    line += "}";
+    m_events.push_back(line);
+}
+
+
+// Save internal state.
+void RdsDecoder::save_state(StateWriter& state) const
+{
+    m_resample1.save_state(state);
+    m_resample2.save_state(state);
+    state.put(m_buf_symbols);
+    state.put(m_pos);
+    state.put(m_prev_a1);
+    state.put(m_level);
+    state.put(m_shift);
+    state.put(m_bit_cnt);
+    state.put(m_synced);
+    state.put(m_last_match_bit);
+    state.put(m_last_match_block);
+    state.put(m_block_bits);
+    state.put(m_block_index);
+    state.put(m_bad_blocks);
+    state.put(m_bler);
+    state.put(m_group);
+    state.put(m_group_valid);
+    state.put(m_pi);
+    state.put(m_ps);
+    state.put(m_rt);
+    state.put(m_ps_buf);
+    state.put(m_ps_segments);
+    state.put(m_rt_buf);
+    state.put(m_rt_segments);
+    state.put(m_rt_ab);
+    state.put(m_group_cnt);
+}
+
+
+// Restore internal state.
+void RdsDecoder::load_state(StateReader& state)
+{
+    m_resample1.load_state(state);
+    m_resample2.load_state(state);
+    state.get(m_buf_symbols, true);
+    state.get(m_pos);
+    state.get(m_prev_a1);
+    state.get(m_level);
+    state.get(m_shift);
+    state.get(m_bit_cnt);
+    state.get(m_synced);
+    state.get(m_last_match_bit);
+    state.get(m_last_match_block);
+    state.get(m_block_bits);
+    state.get(m_block_index);
+    state.get(m_bad_blocks);
+    state.get(m_bler);
+    state.get(m_group);
+    state.get(m_group_valid);
+    state.get(m_pi);
+    state.get(m_ps);
+    state.get(m_rt);
+    state.get(m_ps_buf);
+    state.get(m_ps_segments);
+    state.get(m_rt_buf);
+    state.get(m_rt_segments);
+    state.get(m_rt_ab);
+    state.get(m_group_cnt);
+}
+
+/* end */
@@ -28,8 +28,6 @@
 #include "parsekv.h"
 #include "RtlSdrSource.h"
 
-RtlSdrSource *RtlSdrSource::m_this = 0;
-
 // Open RTL-SDR device.
 RtlSdrSource::RtlSdrSource(int dev_index) :
     m_dev(0),
@@ -64,8 +62,6 @@ RtlSdrSource::RtlSdrSource(int dev_index) :
 
         m_gainsStr = gains_ostr.str();
     }
-    
-    m_this = this;
 }
 
 
@@ -74,8 +70,6 @@ RtlSdrSource::~RtlSdrSource()
 {
     if (m_dev)
         rtlsdr_close(m_dev);
-        
-    m_this = 0;
 }
 
 bool RtlSdrSource::configure(std::string configurationStr)
@@ -89,6 +83,9 @@ bool RtlSdrSource::configure(std::string configurationStr)
     int tuner_gain = INT_MIN;
     int block_length =  default_block_length;
     bool agcmode = false;
+    bool zeroif = false;
+    bool autorate = false;
+    bool blklen_set = false;
 
     parsekv::key_value_sequence<std::string::iterator> p;
     parsekv::pairs_type m;
@@ -103,11 +100,12 @@ bool RtlSdrSource::configure(std::string configurationStr)
         if (m.find("srate") != m.end())
         {
             std::cerr << "RtlSdrSource::configure: srate: " << m["srate"] << std::endl;
+            autorate = (strcasecmp(m["srate"].c_str(), "auto") == 0);
             sample_rate = atoi(m["srate"].c_str());
 
-            if ((sample_rate < 225001)
+            if (!autorate && ((sample_rate < 225001)
                     || ((sample_rate > 300000) && (sample_rate < 900001))
-                    || (sample_rate > 3200000))
+                    || (sample_rate > 3200000)))
             {
                 m_error = "Invalid sample rate";
                 return false;
@@ -175,6 +173,7 @@ bool RtlSdrSource::configure(std::string configurationStr)
         {
             std::cerr << "RtlSdrSource::configure: blklen: " << m["blklen"] << std::endl;
             block_length = atoi(m["blklen"].c_str());
+            blklen_set = true;
         }
 
         if (m.find("agc") != m.end())
@@ -183,10 +182,31 @@ bool RtlSdrSource::configure(std::string configurationStr)
             agcmode = true;
         }
 
-        // Intentionally tune at a higher frequency to avoid DC offset.
+        if (m.find("zeroif") != m.end())
+        {
+            std::cerr << "RtlSdrSource::configure: zeroif" << std::endl;
+            zeroif = true;
+        }
+
+        if (autorate)
+        {
+            // Rates 300 - 900 kS/s are not supported by the tuner, and
+            // rates above 2.4 MS/s may lose samples on the USB bus.
+            static const std::vector<std::uint32_t> rates = {
+                240000, 250000, 288000, 300000, 960000, 1024000, 1152000,
+                1200000, 1440000, 1536000, 1800000, 1920000, 2048000, 2400000 };
+
+            sample_rate = choose_sample_rate(rates, frequency, tuner_offset_ratio(zeroif));
+
+            if (!blklen_set)
+                block_length = choose_block_length(sample_rate, 4096);
+        }
+
         m_confFreq = frequency;
         m_confAgc = agcmode;
-        double tuner_freq = frequency + 0.25 * sample_rate;
+        double tuner_freq = frequency + tuner_offset_ratio(zeroif) * sample_rate;
+        m_iqconv.set_sample_rate(sample_rate);
+        m_iqconv.set_enabled(zeroif);
 
         return configure(sample_rate, tuner_freq, tuner_gain, block_length, agcmode);
     }
@@ -271,6 +291,106 @@ uint32_t RtlSdrSource::get_frequency()
     return rtlsdr_get_center_freq(m_dev);
 }
 
+// Set device center frequency in Hz while streaming.
+bool RtlSdrSource::set_frequency(uint32_t frequency)
+{
+    if (!m_dev || rtlsdr_set_center_freq(m_dev, frequency) < 0) {
+        m_error = "rtlsdr_set_center_freq failed";
+        return false;
+    }
+
+    return true;
+}
+
+// Set device gains while streaming.
+bool RtlSdrSource::set_gain(const std::string& gains)
+{
+    namespace qi = boost::spirit::qi;
+    std::string config(gains);
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end)
+    {
+        m_error = "Gain parsing failed";
+        return false;
+    }
+
+    if (!m_dev || m.find("gain") == m.end())
+    {
+        m_error = "No gain given";
+        return false;
+    }
+
+    std::string gain_str = m["gain"];
+
+    if (strcasecmp(gain_str.c_str(), "auto") == 0)
+    {
+        if (rtlsdr_set_tuner_gain_mode(m_dev, 0) < 0)
+        {
+            m_error = "rtlsdr_set_tuner_gain_mode could not set automatic gain";
+            return false;
+        }
+
+        return true;
+    }
+
+    double tmpgain;
+
+    if (!parse_dbl(gain_str.c_str(), tmpgain))
+    {
+        m_error = "Invalid gain";
+        return false;
+    }
+
+    int tuner_gain = lrint(tmpgain * 10);
+
+    if (find(m_gains.begin(), m_gains.end(), tuner_gain) == m_gains.end())
+    {
+        m_error = "Gain not supported. Available gains (dB): " + m_gainsStr;
+        return false;
+    }
+
+    if (rtlsdr_set_tuner_gain_mode(m_dev, 1) < 0 ||
+        rtlsdr_set_tuner_gain(m_dev, tuner_gain) < 0)
+    {
+        m_error = "rtlsdr_set_tuner_gain failed";
+        return false;
+    }
+
+    return true;
+}
+
+// Get gain settings for software gain control.
+bool RtlSdrSource::get_gain_steps(std::vector<GainStep>& steps, std::size_t& current)
+{
+    if (!m_dev || m_gains.empty())
+    {
+        m_error = "No tuner gains available";
+        return false;
+    }
+
+    int tuner_gain = get_tuner_gain();
+    steps.clear();
+    current = 0;
+
+    for (int g : m_gains)
+    {
+        std::ostringstream setting;
+        setting << "gain=" << std::fixed << std::setprecision(1) << 0.1 * g;
+
+        if (abs(g - tuner_gain) < abs(m_gains[current] - tuner_gain))
+            current = steps.size();
+
+        steps.push_back(GainStep{ 0.1 * g, setting.str() });
+    }
+
+    return true;
+}
+
 void RtlSdrSource::print_specific_parms()
 {
     int lnagain = get_tuner_gain();
@@ -313,7 +433,7 @@ bool RtlSdrSource::start(DataBuffer<IQSample>* buf, std::atomic_bool *stop_flag)
     
     if (m_thread == 0)
     {
-        m_thread = new std::thread(run);
+        m_thread = new std::thread(&RtlSdrSource::run, this);
         return true;
     }
     else
@@ -339,9 +459,9 @@ void RtlSdrSource::run()
 {
     IQSampleVector iqsamples;
 
-    while (!m_this->m_stop_flag->load() && get_samples(&iqsamples))
+    while (!m_stop_flag->load() && get_samples(&iqsamples))
     {
-        m_this->m_buf->push(move(iqsamples));
+        m_buf->push(move(iqsamples));
     }
 }
 
@@ -350,7 +470,7 @@ bool RtlSdrSource::get_samples(IQSampleVector *samples)
 {
     int r, n_read;
 
-    if (!m_this->m_dev) {
+    if (!m_dev) {
         return false;
     }
 
@@ -358,31 +478,23 @@ bool RtlSdrSource::get_samples(IQSampleVector *samples)
         return false;
     }
 
-    std::vector<uint8_t> buf(2 * m_this->m_block_length);
+    std::vector<uint8_t> buf(2 * m_block_length);
 
-    r = rtlsdr_read_sync(m_this->m_dev, buf.data(), 2 * m_this->m_block_length, &n_read);
+    r = rtlsdr_read_sync(m_dev, buf.data(), 2 * m_block_length, &n_read);
 
     if (r < 0)
     {
-        m_this->m_error = "rtlsdr_read_sync failed";
+        m_error = "rtlsdr_read_sync failed";
         return false;
     }
 
-    if (n_read != 2 *m_this-> m_block_length)
+    // Account for the samples lost in a short read and deliver the rest.
+    if (n_read != 2 * m_block_length)
     {
-        m_this->m_error = "short read, samples lost";
-        return false;
+        m_dropped_samples += m_block_length - n_read / 2;
     }
 
-    samples->resize(m_this->m_block_length);
-
-    for (int i = 0; i < m_this->m_block_length; i++)
-    {
-        int32_t re = buf[2*i];
-        int32_t im = buf[2*i+1];
-        (*samples)[i] = IQSample( (re - 128) / IQSample::value_type(128),
-                               (im - 128) / IQSample::value_type(128) );
-    }
+    m_iqconv.convert(buf.data(), n_read / 2, *samples);
 
     return true;
 }
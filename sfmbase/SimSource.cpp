@@ -0,0 +1,626 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "util.h"
+#include "parsekv.h"
+#include "SimSource.h"
+
+// Number of entries in the oscillator sine table (index = top 12 phase bits).
+static const unsigned int sintab_bits = 12;
+
+// Construct simulated source.
+SimSource::SimSource() :
+    m_frequency(0),
+    m_gain(0),
+    m_srate(1000000),
+    m_block_length(default_block_length),
+    m_bits(8),
+    m_level(0.1),
+    m_noise(pow(10.0, -50.0 / 20)),
+    m_dc(0),
+    m_iq_gain(1.0),
+    m_iq_phase(0),
+    m_ppm(0),
+    m_drop(0),
+    m_jitter(0),
+    m_duration(0),
+    m_seed(1),
+    m_realtime(true),
+    m_dropped(0),
+    m_thread(0)
+{
+    m_devname = "Simulated device";
+
+    m_sintab.resize(1 << sintab_bits);
+    for (unsigned int i = 0; i < m_sintab.size(); i++)
+        m_sintab[i] = sin(2 * M_PI * i / m_sintab.size());
+}
+
+SimSource::~SimSource()
+{
+    stop();
+}
+
+bool SimSource::configure(std::string configurationStr)
+{
+    namespace qi = boost::spirit::qi;
+    std::string::iterator begin = configurationStr.begin();
+    std::string::iterator end = configurationStr.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m))
+    {
+        m_error = "Configuration parsing failed\n";
+        return false;
+    }
+
+    double frequency = 100000000;
+    double value;
+    bool autorate = false;
+    bool blklen_set = false;
+
+    if (m.find("freq") != m.end())
+    {
+        std::cerr << "SimSource::configure: freq: " << m["freq"] << std::endl;
+
+        if (!parse_dbl(m["freq"].c_str(), frequency) || frequency < 1.0e6 || frequency > 4.0e9)
+        {
+            m_error = "Invalid frequency";
+            return false;
+        }
+    }
+
+    if (m.find("srate") != m.end())
+    {
+        std::cerr << "SimSource::configure: srate: " << m["srate"] << std::endl;
+
+        if (m["srate"] == "auto")
+        {
+            autorate = true;
+        }
+        else if (!parse_dbl(m["srate"].c_str(), value) || value < 48000 || value > 40.0e6)
+        {
+            m_error = "Invalid sample rate";
+            return false;
+        }
+        else
+        {
+            m_srate = lrint(value);
+        }
+    }
+
+    if (m.find("blklen") != m.end())
+    {
+        std::cerr << "SimSource::configure: blklen: " << m["blklen"] << std::endl;
+        int block_length = atoi(m["blklen"].c_str());
+
+        if (block_length < 1)
+        {
+            m_error = "Invalid block length";
+            return false;
+        }
+
+        m_block_length = block_length;
+        blklen_set = true;
+    }
+
+    if (m.find("bits") != m.end())
+    {
+        std::cerr << "SimSource::configure: bits: " << m["bits"] << std::endl;
+        int bits = atoi(m["bits"].c_str());
+
+        if (bits < 1 || bits > 16)
+        {
+            m_error = "Invalid number of ADC bits";
+            return false;
+        }
+
+        m_bits = bits;
+    }
+
+    if (m.find("gain") != m.end())
+    {
+        std::cerr << "SimSource::configure: gain: " << m["gain"] << std::endl;
+
+        if (!set_gain("gain=" + m["gain"]))
+            return false;
+    }
+
+    if (m.find("level") != m.end())
+    {
+        std::cerr << "SimSource::configure: level: " << m["level"] << std::endl;
+
+        if (!parse_dbl(m["level"].c_str(), value) || value > 20)
+        {
+            m_error = "Invalid station level";
+            return false;
+        }
+
+        m_level = pow(10.0, value / 20);
+    }
+
+    if (m.find("noise") != m.end())
+    {
+        std::cerr << "SimSource::configure: noise: " << m["noise"] << std::endl;
+
+        if (m["noise"] == "off")
+        {
+            m_noise = 0;
+        }
+        else if (!parse_dbl(m["noise"].c_str(), value) || value > 0)
+        {
+            m_error = "Invalid noise level";
+            return false;
+        }
+        else
+        {
+            m_noise = pow(10.0, value / 20);
+        }
+    }
+
+    if (m.find("dc") != m.end())
+    {
+        std::cerr << "SimSource::configure: dc: " << m["dc"] << std::endl;
+
+        if (!parse_dbl(m["dc"].c_str(), m_dc) || fabs(m_dc) > 1)
+        {
+            m_error = "Invalid DC offset";
+            return false;
+        }
+    }
+
+    if (m.find("iqgain") != m.end())
+    {
+        std::cerr << "SimSource::configure: iqgain: " << m["iqgain"] << std::endl;
+
+        if (!parse_dbl(m["iqgain"].c_str(), value) || fabs(value) > 6)
+        {
+            m_error = "Invalid I/Q gain imbalance";
+            return false;
+        }
+
+        m_iq_gain = pow(10.0, value / 20);
+    }
+
+    if (m.find("iqphase") != m.end())
+    {
+        std::cerr << "SimSource::configure: iqphase: " << m["iqphase"] << std::endl;
+
+        if (!parse_dbl(m["iqphase"].c_str(), value) || fabs(value) > 45)
+        {
+            m_error = "Invalid I/Q phase imbalance";
+            return false;
+        }
+
+        m_iq_phase = value * M_PI / 180;
+    }
+
+    if (m.find("ppm") != m.end())
+    {
+        std::cerr << "SimSource::configure: ppm: " << m["ppm"] << std::endl;
+
+        if (!parse_dbl(m["ppm"].c_str(), m_ppm) || fabs(m_ppm) > 1000)
+        {
+            m_error = "Invalid clock error";
+            return false;
+        }
+    }
+
+    if (m.find("drop") != m.end())
+    {
+        std::cerr << "SimSource::configure: drop: " << m["drop"] << std::endl;
+
+        if (!parse_dbl(m["drop"].c_str(), m_drop) || m_drop < 0 || m_drop >= 1)
+        {
+            m_error = "Invalid drop probability";
+            return false;
+        }
+    }
+
+    if (m.find("jitter") != m.end())
+    {
+        std::cerr << "SimSource::configure: jitter: " << m["jitter"] << std::endl;
+
+        if (!parse_dbl(m["jitter"].c_str(), m_jitter) || m_jitter < 0)
+        {
+            m_error = "Invalid timing jitter";
+            return false;
+        }
+    }
+
+    if (m.find("duration") != m.end())
+    {
+        std::cerr << "SimSource::configure: duration: " << m["duration"] << std::endl;
+
+        if (!parse_dbl(m["duration"].c_str(), m_duration) || m_duration < 0)
+        {
+            m_error = "Invalid duration";
+            return false;
+        }
+    }
+
+    if (m.find("seed") != m.end())
+    {
+        std::cerr << "SimSource::configure: seed: " << m["seed"] << std::endl;
+        m_seed = strtoul(m["seed"].c_str(), 0, 10);
+    }
+
+    if (m.find("fast") != m.end())
+    {
+        std::cerr << "SimSource::configure: fast" << std::endl;
+        m_realtime = false;
+    }
+
+    bool zeroif = false;
+
+    if (m.find("zeroif") != m.end())
+    {
+        std::cerr << "SimSource::configure: zeroif" << std::endl;
+        zeroif = true;
+    }
+
+    // Stations as colon separated list of frequencies, default one station
+    // at the configured frequency.
+    std::vector<double> freqs;
+
+    if (m.find("stations") != m.end())
+    {
+        std::cerr << "SimSource::configure: stations: " << m["stations"] << std::endl;
+        std::istringstream iss(m["stations"]);
+        std::string item;
+
+        while (std::getline(iss, item, ':'))
+        {
+            if (!parse_dbl(item.c_str(), value) || value <= 0)
+            {
+                m_error = "Invalid station frequency '" + item + "'";
+                return false;
+            }
+
+            freqs.push_back(value);
+        }
+    }
+    else
+    {
+        freqs.push_back(frequency);
+    }
+
+    // Each station carries different left and right test tones.
+    m_stations.clear();
+
+    for (unsigned int i = 0; i < freqs.size(); i++)
+    {
+        Station st;
+        st.frequency     = freqs[i];
+        st.carrier_phase = 0;
+        st.pilot_phase   = 0;
+        st.left_phase    = 0;
+        st.right_phase   = 0;
+        st.left_step     = 0;
+        st.right_step    = 0;
+        m_stations.push_back(st);
+    }
+
+    if (autorate)
+    {
+        static const std::vector<std::uint32_t> rates = {
+            240000, 250000, 300000, 480000, 500000, 960000, 1000000, 1200000,
+            1920000, 2000000, 2400000, 2500000, 3000000, 4000000, 5000000,
+            8000000, 10000000, 20000000, 40000000 };
+
+        m_srate = choose_sample_rate(rates, lrint(frequency), tuner_offset_ratio(zeroif));
+
+        if (!blklen_set)
+            m_block_length = choose_block_length(m_srate, 1);
+    }
+
+    m_confFreq = frequency;
+    m_frequency = lrint(frequency + tuner_offset_ratio(zeroif) * m_srate);
+    m_iqconv.set_sample_rate(m_srate);
+    m_iqconv.set_enabled(zeroif);
+    m_rng.seed(m_seed);
+    m_dropped = 0;
+
+    return true;
+}
+
+// Return current sample frequency in Hz.
+std::uint32_t SimSource::get_sample_rate()
+{
+    return m_srate;
+}
+
+// Return simulated tuner center frequency in Hz.
+std::uint32_t SimSource::get_frequency()
+{
+    return m_frequency;
+}
+
+// Retune the simulated tuner while streaming.
+bool SimSource::set_frequency(std::uint32_t frequency)
+{
+    m_frequency = frequency;
+    return true;
+}
+
+// Set the simulated front-end gain while streaming.
+bool SimSource::set_gain(const std::string& gains)
+{
+    namespace qi = boost::spirit::qi;
+    std::string config(gains);
+    std::string::iterator begin = config.begin();
+    std::string::iterator end = config.end();
+
+    parsekv::key_value_sequence<std::string::iterator> p;
+    parsekv::pairs_type m;
+
+    if (!qi::parse(begin, end, p, m) || begin != end || m.find("gain") == m.end())
+    {
+        m_error = "No gain given";
+        return false;
+    }
+
+    double gain;
+
+    if (!parse_dbl(m["gain"].c_str(), gain) || gain < min_gain || gain > max_gain)
+    {
+        m_error = "Invalid gain";
+        return false;
+    }
+
+    m_gain = lrint(gain);
+    return true;
+}
+
+// Get gain settings for software gain control.
+bool SimSource::get_gain_steps(std::vector<GainStep>& steps, std::size_t& current)
+{
+    steps.clear();
+
+    for (int gain = min_gain; gain <= max_gain; gain++)
+    {
+        steps.push_back(GainStep{ double(gain), "gain=" + std::to_string(gain) });
+    }
+
+    current = m_gain - min_gain;
+    return true;
+}
+
+// Return number of bits of the simulated ADC.
+unsigned int SimSource::get_sample_bits()
+{
+    return m_bits;
+}
+
+void SimSource::print_specific_parms()
+{
+    fprintf(stderr, "stations:          %u\n", (unsigned int)m_stations.size());
+    fprintf(stderr, "front-end gain:    %d dB\n", m_gain.load());
+    fprintf(stderr, "station level:     %.1f dBFS\n", 20 * log10(m_level));
+    fprintf(stderr, "noise level:       %.1f dBFS\n", m_noise > 0 ? 20 * log10(m_noise) : -INFINITY);
+    fprintf(stderr, "ADC bits:          %u\n", m_bits);
+    fprintf(stderr, "DC offset:         %.4f\n", m_dc);
+    fprintf(stderr, "I/Q imbalance:     %.2f dB, %.2f deg\n", 20 * log10(m_iq_gain), m_iq_phase * 180 / M_PI);
+    fprintf(stderr, "clock error:       %.1f ppm\n", m_ppm);
+    fprintf(stderr, "dropped blocks:    %.2f %%\n", 100 * m_drop);
+    fprintf(stderr, "timing jitter:     %.1f ms\n", m_jitter);
+    fprintf(stderr, "generation:        %s\n", m_realtime ? "real time" : "as fast as possible");
+}
+
+bool SimSource::start(DataBuffer<IQSample>* buf, std::atomic_bool *stop_flag)
+{
+    m_buf = buf;
+    m_stop_flag = stop_flag;
+
+    if (m_stations.empty())
+    {
+        m_error = "Simulator not configured";
+        return false;
+    }
+
+    if (m_thread == 0)
+    {
+        m_thread = new std::thread(&SimSource::run, this);
+        return true;
+    }
+    else
+    {
+        m_error = "Source thread already started";
+        return false;
+    }
+}
+
+bool SimSource::stop()
+{
+    if (m_thread)
+    {
+        m_thread->join();
+        delete m_thread;
+        m_thread = 0;
+
+        if (m_dropped > 0)
+            std::cerr << "SimSource::stop: dropped " << m_dropped << " blocks" << std::endl;
+    }
+
+    return true;
+}
+
+// Generate one block of device samples.
+void SimSource::generate(std::size_t n, IQSampleVector& samples_out,
+                         std::vector<std::int16_t>& codes_out)
+{
+    samples_out.resize(n);
+    codes_out.resize(2 * n);
+    const unsigned int shift = 32 - sintab_bits;
+    const std::uint32_t quarter = 1u << 30;
+    const float *sintab = m_sintab.data();
+
+    // The sample clock and the tuner LO come from the same reference.
+    const double clock = 1.0 + m_ppm * 1.0e-6;
+    const double fs = m_srate * clock;
+    const double lo = m_frequency * clock;
+    const double scale = 4294967296.0 / fs;
+
+    std::fill(samples_out.begin(), samples_out.end(), IQSample(0, 0));
+
+    for (unsigned int k = 0; k < m_stations.size(); k++)
+    {
+        Station& st = m_stations[k];
+        double offset = st.frequency - lo;
+
+        // Stations outside the simulated tuner bandwidth are not generated.
+        if (fabs(offset) > 0.5 * fs)
+            continue;
+
+        const std::int32_t carrier_step = lrint(offset * scale);
+        const float dev_step = 75.0e3 * scale;
+        const std::uint32_t pilot_step = lrint(19.0e3 * scale);
+        st.left_step  = lrint((1000.0 + 100.0 * k) * scale);
+        st.right_step = lrint((1500.0 + 100.0 * k) * scale);
+
+        std::uint32_t cph = st.carrier_phase;
+        std::uint32_t pph = st.pilot_phase;
+        std::uint32_t lph = st.left_phase;
+        std::uint32_t rph = st.right_phase;
+        const float level = m_level;
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            float l = sintab[lph >> shift];
+            float r = sintab[rph >> shift];
+            float mpx = 0.45f * (l + r) +
+                        0.45f * (l - r) * sintab[(2 * pph) >> shift] +
+                        0.1f * sintab[pph >> shift];
+
+            samples_out[i] += IQSample(level * sintab[(cph + quarter) >> shift],
+                                       level * sintab[cph >> shift]);
+
+            cph += carrier_step + std::int32_t(lrintf(mpx * dev_step));
+            pph += pilot_step;
+            lph += st.left_step;
+            rph += st.right_step;
+        }
+
+        st.carrier_phase = cph;
+        st.pilot_phase   = pph;
+        st.left_phase    = lph;
+        st.right_phase   = rph;
+    }
+
+    // Receiver noise, front-end gain, I/Q imbalance, DC offset, then ADC
+    // clipping and quantization to the configured number of bits.
+    std::normal_distribution<float> noise(0, m_noise);
+    const float gain = pow(10.0, m_gain / 20.0);
+    const float cphi = gain * m_iq_gain * cos(m_iq_phase);
+    const float sphi = gain * m_iq_gain * sin(m_iq_phase);
+    const float dc = m_dc;
+    const float fullscale = 1 << (m_bits - 1);
+    const float vmin = -fullscale;
+    const float vmax = fullscale - 1;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        float si = samples_out[i].real();
+        float sq = samples_out[i].imag();
+
+        if (m_noise > 0)
+        {
+            si += noise(m_rng);
+            sq += noise(m_rng);
+        }
+
+        float vi = si * gain + dc;
+        float vq = sq * cphi + si * sphi + dc;
+
+        codes_out[2*i]   = std::min(vmax, std::max(vmin, rintf(vi * fullscale)));
+        codes_out[2*i+1] = std::min(vmax, std::max(vmin, rintf(vq * fullscale)));
+    }
+}
+
+void SimSource::run()
+{
+    typedef std::chrono::steady_clock clock;
+
+    // Blocks are delivered at the rate of the (possibly wrong) sample clock.
+    double fs = m_srate * (1.0 + m_ppm * 1.0e-6);
+    std::uint64_t nsamples = 0;
+    std::uint64_t maxsamples = m_duration > 0 ? llrint(m_duration * m_srate) : 0;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<std::int16_t> codes;
+    clock::time_point t0 = clock::now();
+
+    while (!m_stop_flag->load())
+    {
+        if (maxsamples > 0 && nsamples >= maxsamples)
+            break;
+
+        unsigned int n = m_block_length;
+        if (maxsamples > 0)
+            n = std::min<std::uint64_t>(n, maxsamples - nsamples);
+
+        IQSampleVector iqsamples;
+        generate(n, iqsamples, codes);
+        m_iqconv.convert(codes.data(), n, m_bits, iqsamples);
+        nsamples += n;
+
+        bool drop = m_drop > 0 && uniform(m_rng) < m_drop;
+        double delay = m_jitter > 0 ? m_jitter * 1.0e-3 * uniform(m_rng) : 0;
+
+        if (m_realtime)
+        {
+            // Deliver the block when its last sample has been "received",
+            // plus random scheduling delay.
+            std::this_thread::sleep_until(t0 +
+                std::chrono::microseconds(llrint((nsamples / fs + delay) * 1.0e6)));
+        }
+        else
+        {
+            // Do not run ahead of the decoder by more than a second.
+            while (!m_stop_flag->load() && m_buf->queued_samples() > m_srate)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // A dropped transfer is lost; the signal continues after the gap.
+        if (drop)
+        {
+            m_dropped++;
+            m_dropped_samples += n;
+            continue;
+        }
+
+        m_buf->push(move(iqsamples));
+    }
+
+    m_buf->push_end();
+}
+
+void SimSource::get_device_names(std::vector<std::string>& devices)
+{
+    devices.push_back("Simulated device");
+}
+
+/* end */
@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+#include "FmDecode.h"
+#include "Source.h"
+
+
+/* ****************  class Source  **************** */
+
+// Return tuner offset from the station relative to the sample rate.
+double Source::tuner_offset_ratio(bool zeroif)
+{
+    // Intentionally tune a quarter of the sample rate above the station
+    // to keep it clear of the DC spur of the receiver. In zero-IF mode
+    // the DC offset and I/Q imbalance are corrected instead, and the
+    // tuner is set only 1/64 of the sample rate off centre so that the
+    // carrier still stays clear of the remaining DC notch.
+    return zeroif ? 1 / 64.0 : 0.25;
+}
+
+
+// Return true if the station is received in zero-IF position.
+bool Source::zeroif_tuning(double tuner_freq, double conf_freq, double sample_rate)
+{
+    // Halfway between the normal and the zero-IF offset.
+    double limit = 0.5 * (tuner_offset_ratio(false) + tuner_offset_ratio(true));
+    return fabs(tuner_freq - conf_freq) < limit * sample_rate;
+}
+
+
+// Choose the cheapest sample rate that covers all stations.
+std::uint32_t Source::choose_sample_rate(const std::vector<std::uint32_t>& rates,
+                                         std::uint32_t frequency,
+                                         double tuner_offset)
+{
+    // The baseband stages (stereo, RDS, audio filters) cost about seven
+    // times as much per sample as the IF stages (measured on x86-64).
+    const double baseband_weight = 7.0;
+
+    std::uint32_t best_rate = 0;
+    double best_cost = 0;
+    unsigned int best_downsample = 1;
+
+    for (std::uint32_t rate : rates)
+    {
+        double tuner_freq = frequency + tuner_offset * rate;
+        double span = FmDecoder::max_tuning_offset(rate);
+        bool fits = (fabs(frequency - tuner_freq) <= span);
+
+        for (double f : m_reqStations)
+        {
+            fits = fits && (fabs(f - tuner_freq) <= span);
+        }
+
+        if (!fits)
+            continue;
+
+        // Same baseband downsampling as the decoder.
+        unsigned int downsample = std::max(1, int(rate / 215.0e3));
+        double cost = rate + baseband_weight * rate / downsample;
+
+        if (best_rate == 0 || cost < best_cost)
+        {
+            best_rate = rate;
+            best_cost = cost;
+            best_downsample = downsample;
+        }
+    }
+
+    if (best_rate == 0)
+    {
+        for (std::uint32_t rate : rates)
+            best_rate = std::max(best_rate, rate);
+
+        std::cerr << "Source::choose_sample_rate: stations do not fit, using "
+                  << best_rate << " Hz" << std::endl;
+    }
+    else
+    {
+        std::cerr << "Source::choose_sample_rate: " << best_rate
+                  << " Hz (baseband downsampling " << best_downsample
+                  << ", " << m_reqStations.size() + 1 << " stations)" << std::endl;
+    }
+
+    return best_rate;
+}
+
+
+// Return block length of about 65 ms.
+int Source::choose_block_length(std::uint32_t sample_rate, int granularity)
+{
+    int n = lrint(0.065 * sample_rate);
+    return std::max(1, (n + granularity - 1) / granularity) * granularity;
+}
+
+
+// Build gain steps from the gains of several amplifier stages.
+std::size_t Source::make_gain_steps(const std::vector<std::string>& keys,
+                                    const std::vector<std::vector<int> >& values,
+                                    const std::vector<int>& current,
+                                    std::vector<GainStep>& steps)
+{
+    // Best combination of stage gains per total gain.
+    std::map<int, std::pair<double, std::vector<int> > > best;
+    std::vector<std::size_t> index(values.size(), 0);
+    std::vector<int> gains(values.size());
+
+    while (true)
+    {
+        int total = 0;
+        double sum = 0, sumsq = 0;
+
+        for (std::size_t k = 0; k < values.size(); k++)
+        {
+            const std::vector<int>& v = values[k];
+            int lo = *std::min_element(v.begin(), v.end());
+            int hi = *std::max_element(v.begin(), v.end());
+            double x = (hi > lo) ? double(v[index[k]] - lo) / (hi - lo) : 0;
+            gains[k] = v[index[k]];
+            total += gains[k];
+            sum += x;
+            sumsq += x * x;
+        }
+
+        double spread = sumsq - sum * sum / values.size();
+        auto it = best.find(total);
+
+        if (it == best.end() || spread < it->second.first)
+            best[total] = std::make_pair(spread, gains);
+
+        // Next combination.
+        std::size_t k = 0;
+
+        while (k < values.size() && ++index[k] == values[k].size())
+            index[k++] = 0;
+
+        if (k == values.size())
+            break;
+    }
+
+    int current_total = 0;
+
+    for (int g : current)
+        current_total += g;
+
+    steps.clear();
+    std::size_t current_index = 0;
+    int current_dist = 0;
+
+    for (const auto& b : best)
+    {
+        GainStep step;
+        step.gain = b.first;
+
+        for (std::size_t k = 0; k < keys.size(); k++)
+        {
+            step.setting += (k > 0 ? "," : "") + keys[k] + "=" + std::to_string(b.second.second[k]);
+        }
+
+        int dist = std::abs(b.first - current_total);
+
+        if (steps.empty() || dist < current_dist)
+        {
+            current_index = steps.size();
+            current_dist = dist;
+        }
+
+        steps.push_back(step);
+    }
+
+    return current_index;
+}
+
+/* end */
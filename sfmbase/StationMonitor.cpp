@@ -0,0 +1,206 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "StationMonitor.h"
+
+
+/** Return channel decimation factor (to ~ 250 kS/s as in the decoder). */
+static unsigned int monitor_downsample(double sample_rate_if)
+{
+    return std::max(1, int(sample_rate_if / 215.0e3));
+}
+
+
+/** Return fine tuner table size for a resolution of 1 kHz. */
+static unsigned int monitor_table_size(double sample_rate_if)
+{
+    return std::max(64, int(sample_rate_if / 1000.0));
+}
+
+
+/** Return probe frequencies: the pilot, then the guard band as with -Q. */
+static std::vector<double> monitor_probe_freqs(double sample_rate)
+{
+    std::vector<double> freqs(1, FmDecoder::pilot_freq / sample_rate);
+    for (double f = 16250; f < 18000; f += 500)
+        freqs.push_back(f / sample_rate);
+    return freqs;
+}
+
+
+/* ****************  class StationMonitor  **************** */
+
+// Construct station monitor.
+StationMonitor::StationMonitor(double sample_rate_if,
+                               double tuning_offset,
+                               double frequency)
+    : m_frequency(frequency)
+    , m_sample_rate_channel(sample_rate_if / monitor_downsample(sample_rate_if))
+    , m_if_level(0)
+    , m_block_level(0)
+    , m_pilot_snr(0)
+    , m_noise_level(0)
+    , m_squelch_enabled(false)
+    , m_squelch_open(true)
+    , m_squelch_level(0)
+
+    // Shift station to zero frequency.
+    , m_finetuner(monitor_table_size(sample_rate_if),
+                  lrint(-double(monitor_table_size(sample_rate_if)) * tuning_offset / sample_rate_if))
+
+    // Isolate station and decimate in one step.
+    , m_chanfilter(16 * monitor_downsample(sample_rate_if),
+                   FmDecoder::default_bandwidth_if / sample_rate_if,
+                   monitor_downsample(sample_rate_if))
+
+    , m_phasedisc(FmDecoder::default_freq_dev / m_sample_rate_channel)
+
+    // Low-pass filter below the noise measurement band.
+    , m_noise_lowpass(std::max(16, int(m_sample_rate_channel / 10000.0)),
+                      std::min(0.45, 62000.0 / m_sample_rate_channel),
+                      1, true)
+
+    , m_pilotpll(FmDecoder::pilot_freq / m_sample_rate_channel,   // freq
+                 50 / m_sample_rate_channel,                      // bandwidth
+                 0.01)                                            // minsignal
+
+    , m_rds(m_sample_rate_channel)
+
+    , m_pilot_probe(monitor_probe_freqs(m_sample_rate_channel))
+{
+    // nothing more to do
+}
+
+
+// Process a block of IQ samples.
+void StationMonitor::process(const IQSampleVector& samples_in)
+{
+    // Fine tuning.
+    m_finetuner.process(samples_in, m_buf_iftuned);
+
+    // Channel filter and decimation.
+    m_chanfilter.process(m_buf_iftuned, m_buf_channel);
+
+    // Measure IF level.
+    double level = 0;
+    for (const IQSample& s : m_buf_channel) {
+        level += std::norm(s);
+    }
+    if (!m_buf_channel.empty()) {
+        level = sqrt(level / m_buf_channel.size());
+        m_if_level = 0.95 * m_if_level + 0.05 * level;
+    }
+    m_block_level = level;
+
+    // Skip demodulation on an empty channel.
+    if (m_squelch_enabled) {
+        double hyst = m_squelch_open ? FmDecoder::squelch_hysteresis : 0;
+        m_squelch_open = 20 * log10(std::max(level, 1.0e-10)) >= m_squelch_level - hyst;
+        if (!m_squelch_open) {
+            m_rds.process(SampleVector(), IQSampleVector());
+            return;
+        }
+    }
+
+    // Demodulate, lock on pilot and decode RDS.
+    m_phasedisc.process(m_buf_channel, m_buf_baseband);
+    m_pilotpll.process(m_buf_baseband, m_buf_pilot, &m_buf_rds57k);
+    m_rds.process(m_buf_baseband, m_buf_rds57k);
+
+    if (m_buf_baseband.empty())
+        return;
+
+    // Pilot tone power over guard band noise density, scaled as with -Q.
+    m_pilot_probe.process(m_buf_baseband, m_probe_power);
+
+    double pguard = 0;
+    for (unsigned int k = 1; k < m_probe_power.size(); k++)
+        pguard += m_probe_power[k];
+    pguard /= m_probe_power.size() - 1;
+
+    double ppilot = 6 * m_probe_power[0] / m_buf_baseband.size();
+    pguard = 2 * pguard / m_sample_rate_channel;
+    m_pilot_snr = 10 * log10(std::max(ppilot, 1.0e-20)) - 3.01
+                  - 10 * log10(std::max(pguard, 1.0e-20));
+
+    // Noise power is the total power minus the power below 60 kHz.
+    m_noise_lowpass.process(m_buf_baseband, m_buf_noise);
+
+    double ptotal = 0, plow = 0;
+    for (unsigned int i = 0, n = m_buf_baseband.size(); i < n; i++) {
+        ptotal += m_buf_baseband[i] * m_buf_baseband[i];
+        plow   += m_buf_noise[i] * m_buf_noise[i];
+    }
+
+    m_noise_level = 10 * log10(std::max((ptotal - plow) / m_buf_baseband.size(), 1.0e-20));
+}
+
+
+// Return JSON lines for decoded groups and events.
+std::vector<std::string> StationMonitor::get_group_lines() const
+{
+    std::vector<std::string> lines;
+    char buf[160];
+
+    for (const RdsDecoder::Group& g : m_rds.get_groups()) {
+        unsigned int type = g.blocks[1] >> 12;
+        char version = ((g.blocks[1] >> 11) & 1) ? 'B' : 'A';
+        snprintf(buf, sizeof(buf),
+                 "{\"freq\":%.0f,\"group\":\"%u%c\",\"blocks\":[\"%04X\",\"%04X\",\"%04X\",\"%04X\"],\"corrected\":%u}",
+                 m_frequency, type, version,
+                 g.blocks[0], g.blocks[1], g.blocks[2], g.blocks[3],
+                 g.corrected);
+        lines.push_back(buf);
+    }
+
+    // Prefix decoder events with the station frequency.
+    for (const std::string& ev : m_rds.get_events()) {
+        snprintf(buf, sizeof(buf), "{\"freq\":%.0f,", m_frequency);
+        lines.push_back(buf + ev.substr(1));
+    }
+
+    return lines;
+}
+
+
+// Return JSON line with lock and quality metrics.
+std::string StationMonitor::get_status_line() const
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"freq\":%.0f,\"if_db\":%.1f,\"squelch\":%s,\"pilot\":%s,\"pilot_level\":%.3f,"
+             "\"pilot_snr\":%.1f,\"noise_db\":%.1f,\"rds_sync\":%s,\"rds_level\":%.4f,\"bler\":%.3f,\"groups\":%llu}",
+             m_frequency,
+             20 * log10(std::max(m_if_level, 1.0e-9)),
+             m_squelch_open ? "false" : "true",
+             m_pilotpll.locked() ? "true" : "false",
+             m_pilotpll.get_pilot_level(),
+             m_pilot_snr,
+             m_noise_level,
+             m_rds.synced() ? "true" : "false",
+             m_rds.get_level(),
+             m_rds.get_block_error_rate(),
+             (unsigned long long)m_rds.get_group_count());
+    return buf;
+}
+
+/* end */
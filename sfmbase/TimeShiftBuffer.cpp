@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include "TimeShiftBuffer.h"
+#include "IQOutput.h"
+
+
+/* ****************  class TimeShiftBuffer  **************** */
+
+// Create ring file and start dump thread.
+TimeShiftBuffer::TimeShiftBuffer(const std::string& ringfile,
+                                 std::size_t capacity,
+                                 std::size_t post_samples,
+                                 double sample_rate,
+                                 double frequency,
+                                 const std::string& dump_prefix)
+    : m_zombie(false)
+    , m_fd(-1)
+    , m_ring(NULL)
+    , m_capacity(capacity)
+    , m_post_samples(post_samples)
+    , m_sample_rate(sample_rate)
+    , m_frequency(frequency)
+    , m_dump_prefix(dump_prefix)
+    , m_write_reserved(0)
+    , m_write_pos(0)
+    , m_trigger_pos(0)
+    , m_trigger(NULL)
+    , m_stop(false)
+{
+    if (capacity == 0) {
+        m_error  = "empty time-shift buffer";
+        m_zombie = true;
+        return;
+    }
+
+    m_fd = open(ringfile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (m_fd < 0) {
+        m_error  = "can not open '" + ringfile + "' (" +
+                   strerror(errno) + ")";
+        m_zombie = true;
+        return;
+    }
+
+    std::size_t nbytes = capacity * sizeof(IQSample);
+
+    if (ftruncate(m_fd, nbytes) != 0) {
+        m_error  = "can not resize '" + ringfile + "' (" +
+                   strerror(errno) + ")";
+        m_zombie = true;
+        return;
+    }
+
+    void *p = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED) {
+        m_error  = "can not map '" + ringfile + "' (" +
+                   strerror(errno) + ")";
+        m_zombie = true;
+        return;
+    }
+
+    m_ring = static_cast<IQSample *>(p);
+    m_thread = std::thread(&TimeShiftBuffer::run, this);
+}
+
+
+// Stop dump thread and unmap ring.
+TimeShiftBuffer::~TimeShiftBuffer()
+{
+    m_stop.store(true);
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    if (m_ring != NULL) {
+        munmap(m_ring, m_capacity * sizeof(IQSample));
+    }
+
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+
+// Append samples to the ring.
+void TimeShiftBuffer::write(const IQSampleVector& samples)
+{
+    if (m_zombie)
+        return;
+
+    std::size_t n = samples.size();
+    const IQSample *src = samples.data();
+
+    // Only the last m_capacity samples can be kept.
+    if (n > m_capacity) {
+        src += n - m_capacity;
+        n = m_capacity;
+    }
+
+    std::uint64_t pos = m_write_pos.load(std::memory_order_relaxed);
+
+    // Announce the region that is about to be overwritten.
+    m_write_reserved.store(pos + n, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::size_t k = pos % m_capacity;
+    std::size_t n1 = std::min(n, m_capacity - k);
+    memcpy(m_ring + k, src, n1 * sizeof(IQSample));
+    memcpy(m_ring, src + n1, (n - n1) * sizeof(IQSample));
+
+    m_write_pos.store(pos + n, std::memory_order_release);
+}
+
+
+// Request a dump of the ring contents.
+void TimeShiftBuffer::trigger(const char *reason)
+{
+    // Remember the trigger position before the dump thread wakes up.
+    if (m_trigger.load() == NULL) {
+        m_trigger_pos.store(m_write_pos.load());
+        const char *expected = NULL;
+        m_trigger.compare_exchange_strong(expected, reason);
+    }
+}
+
+
+// Wait for triggers and write dumps.
+void TimeShiftBuffer::run()
+{
+    while (!m_stop.load()) {
+
+        const char *reason = m_trigger.load();
+
+        if (reason == NULL) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+
+        std::uint64_t end   = m_trigger_pos.load();
+        std::uint64_t begin = (end > m_capacity) ? end - m_capacity : 0;
+
+        dump(begin, end + m_post_samples, reason);
+
+        // Accept new triggers only after the dump is complete.
+        m_trigger.store(NULL);
+    }
+}
+
+
+// Copy ring contents [begin, end) to a new dump file.
+void TimeShiftBuffer::dump(std::uint64_t begin,
+                           std::uint64_t end,
+                           const char *reason)
+{
+    const std::size_t chunk = 65536;
+
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+    std::string filename = m_dump_prefix + "-" + stamp + "-" + reason + ".cf32";
+    fprintf(stderr, "\ntime-shift: dumping %.1f s (%s) to '%s'\n",
+            (end - begin) / m_sample_rate, reason, filename.c_str());
+
+    RawIQOutput output(filename, IQOutput::FORMAT_CF32, m_sample_rate, m_frequency);
+    if (!output) {
+        fprintf(stderr, "ERROR: time-shift: %s\n", output.error().c_str());
+        return;
+    }
+
+    IQSampleVector buf;
+    std::uint64_t pos = begin;
+    std::uint64_t lost = 0;
+
+    while (pos < end) {
+
+        std::uint64_t avail = m_write_pos.load(std::memory_order_acquire);
+
+        if (pos >= avail) {
+            // Wait for post-trigger samples (unless shutting down).
+            if (m_stop.load())
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+
+        std::size_t n = std::min<std::uint64_t>(chunk, std::min(avail, end) - pos);
+        std::size_t k = pos % m_capacity;
+        std::size_t n1 = std::min(n, m_capacity - k);
+
+        buf.resize(n);
+        memcpy(buf.data(), m_ring + k, n1 * sizeof(IQSample));
+        memcpy(buf.data() + n1, m_ring, (n - n1) * sizeof(IQSample));
+
+        // Check whether the writer has overtaken us during the copy.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::uint64_t reserved = m_write_reserved.load(std::memory_order_relaxed);
+
+        if (reserved > pos + m_capacity) {
+            std::uint64_t skip = std::min<std::uint64_t>(reserved - m_capacity, end) - pos;
+            lost += skip;
+            pos  += skip;
+            continue;
+        }
+
+        if (!output.write(buf)) {
+            fprintf(stderr, "ERROR: time-shift: %s\n", output.error().c_str());
+            return;
+        }
+
+        pos += n;
+    }
+
+    if (lost > 0) {
+        fprintf(stderr, "\nWARNING: time-shift: %llu samples overwritten during dump\n",
+                (unsigned long long)lost);
+    }
+}
+
+/* end */
@@ -0,0 +1,562 @@
+///////////////////////////////////////////////////////////////////////////////////
+// SoftFM - Software decoder for FM broadcast radio with stereo support          //
+//                                                                               //
+// Copyright (C) 2015 Edouard Griffiths, F4EXB                                   //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "softfm_c.h"
+#include "DecoderState.h"
+#include "FmDecode.h"
+
+
+/** Decoder handle behind the C API. */
+struct sfm_decoder
+{
+    sfm_config                  config;
+    unsigned int                channels;
+    std::unique_ptr<FmDecoder>  fm;
+    bool                        primed;
+    std::size_t                 drop;
+    SampleVector                mpxbuf;
+    SampleVector                audiobuf;
+};
+
+
+/** Drop start-up samples and convert audio into the caller buffer. */
+static long copy_audio(sfm_decoder *dec, float *audio)
+{
+    std::size_t ndrop = std::min(dec->drop, dec->audiobuf.size());
+    dec->drop -= ndrop;
+
+    std::size_t n = dec->audiobuf.size() - ndrop;
+    for (std::size_t i = 0; i < n; i++)
+        audio[i] = dec->audiobuf[ndrop + i];
+
+    return n;
+}
+
+
+// Fill configuration with defaults.
+void sfm_config_init(sfm_config *config, double sample_rate_if, double sample_rate_pcm)
+{
+    if (config == NULL)
+        return;
+
+    config->sample_rate_if  = sample_rate_if;
+    config->tuning_offset   = 0;
+    config->sample_rate_pcm = sample_rate_pcm;
+    config->stereo          = 1;
+    config->deemphasis      = FmDecoder::default_deemphasis;
+    config->bandwidth_if    = FmDecoder::default_bandwidth_if;
+    config->freq_dev        = FmDecoder::default_freq_dev;
+    config->bandwidth_pcm   = std::min(FmDecoder::default_bandwidth_pcm,
+                                       0.45 * sample_rate_pcm);
+    config->downsample      = 0;
+    config->rds             = 0;
+}
+
+
+// Create decoder.
+sfm_decoder *sfm_create(const sfm_config *config)
+{
+    if (config == NULL ||
+        !(config->sample_rate_if > 0) ||
+        !(config->sample_rate_pcm > 0) ||
+        !(config->bandwidth_if > 0) ||
+        config->bandwidth_if >= 0.5 * config->sample_rate_if ||
+        !(fabs(config->tuning_offset) < 0.5 * config->sample_rate_if) ||
+        !(config->freq_dev > 0) ||
+        !(config->bandwidth_pcm > 0) ||
+        config->bandwidth_pcm >= 0.5 * config->sample_rate_pcm ||
+        config->deemphasis < 0) {
+        return NULL;
+    }
+
+    // Downsample baseband to ~ 200 kS/s as the softfm program does.
+    unsigned int downsample = config->downsample;
+    if (downsample == 0)
+        downsample = std::max(1, int(config->sample_rate_if / 215.0e3));
+
+    if (config->sample_rate_if / downsample < config->sample_rate_pcm)
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_decoder> dec(new sfm_decoder);
+        dec->config = *config;
+        dec->config.downsample = downsample;
+        dec->channels = config->stereo ? 2 : 1;
+        dec->primed = false;
+        dec->drop = 0;
+        dec->fm.reset(new FmDecoder(config->sample_rate_if,
+                                    config->tuning_offset,
+                                    config->sample_rate_pcm,
+                                    config->stereo != 0,
+                                    config->deemphasis,
+                                    config->bandwidth_if,
+                                    config->freq_dev,
+                                    config->bandwidth_pcm,
+                                    downsample));
+        if (config->rds)
+            dec->fm->enable_rds();
+        return dec.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Destroy decoder.
+void sfm_destroy(sfm_decoder *dec)
+{
+    delete dec;
+}
+
+
+// Return upper bound of the audio output size.
+size_t sfm_max_audio_samples(const sfm_decoder *dec, size_t n)
+{
+    if (dec == NULL)
+        return 0;
+
+    // Two frames margin for the fractional resampler position.
+    double frames = ceil(n * dec->config.sample_rate_pcm / dec->config.sample_rate_if);
+    return (size_t(frames) + 2) * dec->channels;
+}
+
+
+// Decode IQ samples.
+long sfm_process(sfm_decoder *dec, const float *iq, size_t n,
+                 float *audio, size_t audio_size)
+{
+    if (dec == NULL || (n > 0 && (iq == NULL || audio == NULL)))
+        return SFM_ERR_INVALID;
+
+    if (audio_size < sfm_max_audio_samples(dec, n))
+        return SFM_ERR_BUFFER;
+
+    // Interleaved float pairs have the layout of std::complex<float>,
+    // so the decoder reads the caller buffer in place.
+    const IQSample *samples = reinterpret_cast<const IQSample *>(iq);
+
+    try {
+        if (!dec->primed && n > 0) {
+            dec->drop = dec->fm->prime(samples, n) * dec->channels;
+            dec->primed = true;
+        }
+
+        dec->fm->process(samples, n, dec->audiobuf);
+        return copy_audio(dec, audio);
+    } catch (const std::bad_alloc&) {
+        return SFM_ERR_NOMEM;
+    }
+}
+
+
+// Decode composite baseband samples.
+long sfm_process_baseband(sfm_decoder *dec, const float *mpx, size_t n,
+                          float *audio, size_t audio_size)
+{
+    if (dec == NULL || (n > 0 && (mpx == NULL || audio == NULL)))
+        return SFM_ERR_INVALID;
+
+    if (audio_size < sfm_max_audio_samples(dec, n * dec->config.downsample))
+        return SFM_ERR_BUFFER;
+
+    try {
+        dec->mpxbuf.assign(mpx, mpx + n);
+        dec->fm->process_baseband(dec->mpxbuf, dec->audiobuf);
+        return copy_audio(dec, audio);
+    } catch (const std::bad_alloc&) {
+        return SFM_ERR_NOMEM;
+    }
+}
+
+
+// Return baseband sample rate.
+double sfm_baseband_rate(const sfm_decoder *dec)
+{
+    return dec ? dec->fm->get_baseband_sample_rate() : 0;
+}
+
+
+// Get signal metrics.
+int sfm_get_metrics(const sfm_decoder *dec, sfm_metrics *metrics)
+{
+    if (dec == NULL || metrics == NULL)
+        return SFM_ERR_INVALID;
+
+    const FmDecoder& fm = *dec->fm;
+    memset(metrics, 0, sizeof(*metrics));
+
+    metrics->if_level        = fm.get_if_level();
+    metrics->baseband_level  = fm.get_baseband_level();
+    metrics->pilot_level     = fm.get_pilot_level();
+    metrics->tuning_offset   = fm.get_tuning_offset();
+    metrics->stereo_detected = fm.stereo_detected() ? 1 : 0;
+    metrics->squelch_open    = fm.squelch_open() ? 1 : 0;
+    metrics->rds_pi          = -1;
+
+    const RdsDecoder *rds = fm.get_rds();
+    if (rds != NULL) {
+        metrics->rds_synced = rds->synced() ? 1 : 0;
+        metrics->rds_pi     = rds->get_pi();
+        metrics->rds_bler   = rds->get_block_error_rate();
+        metrics->rds_groups = rds->get_group_count();
+        strncpy(metrics->rds_ps, rds->get_ps().c_str(), sizeof(metrics->rds_ps) - 1);
+        strncpy(metrics->rds_rt, rds->get_rt().c_str(), sizeof(metrics->rds_rt) - 1);
+    }
+
+    return SFM_OK;
+}
+
+
+// Copy RDS events.
+long sfm_get_rds_events(const sfm_decoder *dec, char *buf, size_t size)
+{
+    if (dec == NULL || (size > 0 && buf == NULL))
+        return SFM_ERR_INVALID;
+
+    std::string text;
+    if (dec->fm->get_rds() != NULL) {
+        for (const std::string& line : dec->fm->get_rds()->get_events())
+            text += line + "\n";
+    }
+
+    if (text.size() + 1 > size)
+        return SFM_ERR_BUFFER;
+
+    memcpy(buf, text.c_str(), text.size() + 1);
+    return text.size();
+}
+
+
+// Change tuning offset.
+int sfm_set_tuning_offset(sfm_decoder *dec, double tuning_offset)
+{
+    if (dec == NULL || !(fabs(tuning_offset) < 0.5 * dec->config.sample_rate_if))
+        return SFM_ERR_INVALID;
+
+    dec->fm->set_tuning_offset(tuning_offset);
+    dec->config.tuning_offset = tuning_offset;
+    return SFM_OK;
+}
+
+
+// Enable or disable stereo decoding.
+int sfm_set_stereo(sfm_decoder *dec, int stereo)
+{
+    if (dec == NULL || !dec->fm->set_stereo(stereo != 0))
+        return SFM_ERR_INVALID;
+    return SFM_OK;
+}
+
+
+// Enable or disable carrier squelch.
+int sfm_set_squelch(sfm_decoder *dec, int enable, double level_db)
+{
+    if (dec == NULL)
+        return SFM_ERR_INVALID;
+
+    if (enable)
+        dec->fm->set_squelch(level_db);
+    else
+        dec->fm->disable_squelch();
+    return SFM_OK;
+}
+
+
+// Save decoder state.
+long sfm_save_state(const sfm_decoder *dec, void *buf, size_t size)
+{
+    if (dec == NULL || (size > 0 && buf == NULL))
+        return SFM_ERR_INVALID;
+
+    try {
+        std::vector<std::uint8_t> state = dec->fm->save_state();
+        if (state.size() <= size)
+            memcpy(buf, state.data(), state.size());
+        return state.size();
+    } catch (const std::bad_alloc&) {
+        return SFM_ERR_NOMEM;
+    }
+}
+
+
+// Restore decoder state.
+int sfm_load_state(sfm_decoder *dec, const void *buf, size_t size)
+{
+    if (dec == NULL || (size > 0 && buf == NULL))
+        return SFM_ERR_INVALID;
+
+    try {
+        const std::uint8_t *p = static_cast<const std::uint8_t*>(buf);
+        if (!dec->fm->load_state(std::vector<std::uint8_t>(p, p + size)))
+            return SFM_ERR_STATE;
+
+        // A restored decoder is already warmed up.
+        dec->primed = true;
+        dec->drop = 0;
+        return SFM_OK;
+    } catch (const std::bad_alloc&) {
+        return SFM_ERR_NOMEM;
+    }
+}
+
+
+/** Stage behind the C API; exactly one of the filters is set. */
+struct sfm_stage
+{
+    bool                                input_iq;
+    bool                                output_iq;
+    double                              downsample;
+    std::unique_ptr<FineTuner>          finetuner;
+    std::unique_ptr<DownsampleFilterIQ> lowpass_iq;
+    std::unique_ptr<PhaseDiscriminator> discriminator;
+    std::unique_ptr<DownsampleFilter>   lowpass;
+    std::unique_ptr<PilotPhaseLock>     pilot_pll;
+    std::unique_ptr<LowPassFilterRC>    deemphasis;
+    std::unique_ptr<HighPassFilterIir>  highpass;
+    IQSampleVector                      iqout;
+    SampleVector                        in, out;
+};
+
+
+/** Allocate a stage with the given input and output types. */
+static sfm_stage *new_stage(bool input_iq, bool output_iq, double downsample)
+{
+    sfm_stage *stage = new sfm_stage;
+    stage->input_iq = input_iq;
+    stage->output_iq = output_iq;
+    stage->downsample = downsample;
+    return stage;
+}
+
+
+// Create frequency shift stage.
+sfm_stage *sfm_stage_finetuner(double freq_shift)
+{
+    const unsigned int table_size = 65536;
+
+    if (!(fabs(freq_shift) <= 0.5))
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(true, true, 1));
+        stage->finetuner.reset(new FineTuner(table_size, lrint(freq_shift * table_size)));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Create IQ low-pass stage.
+sfm_stage *sfm_stage_lowpass_iq(unsigned int order, double cutoff, unsigned int downsample)
+{
+    if (order == 0 || !(cutoff > 0 && cutoff <= 0.5) || downsample == 0)
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(true, true, downsample));
+        stage->lowpass_iq.reset(new DownsampleFilterIQ(order, cutoff, downsample));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Create FM discriminator stage.
+sfm_stage *sfm_stage_discriminator(double max_freq_dev)
+{
+    if (!(max_freq_dev > 0))
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(true, false, 1));
+        stage->discriminator.reset(new PhaseDiscriminator(max_freq_dev));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Create real low-pass stage.
+sfm_stage *sfm_stage_lowpass(unsigned int order, double cutoff, double downsample)
+{
+    if (order == 0 || !(cutoff > 0 && cutoff <= 0.5) || !(downsample >= 1))
+        return NULL;
+
+    bool integer_factor = (downsample == floor(downsample));
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(false, false, downsample));
+        stage->lowpass.reset(new DownsampleFilter(order, cutoff, downsample, integer_factor));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Create pilot PLL stage.
+sfm_stage *sfm_stage_pilot_pll(double freq, double bandwidth, double minsignal)
+{
+    if (!(freq > 0 && freq < 0.5) || !(bandwidth > 0))
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(false, false, 1));
+        stage->pilot_pll.reset(new PilotPhaseLock(freq, bandwidth, minsignal));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Create de-emphasis stage.
+sfm_stage *sfm_stage_deemphasis(double timeconst)
+{
+    if (!(timeconst > 0))
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(false, false, 1));
+        stage->deemphasis.reset(new LowPassFilterRC(timeconst));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Create high-pass stage.
+sfm_stage *sfm_stage_highpass(double cutoff)
+{
+    if (!(cutoff > 0 && cutoff < 0.5))
+        return NULL;
+
+    try {
+        std::unique_ptr<sfm_stage> stage(new_stage(false, false, 1));
+        stage->highpass.reset(new HighPassFilterIir(cutoff));
+        return stage.release();
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+
+// Destroy stage.
+void sfm_stage_destroy(sfm_stage *stage)
+{
+    delete stage;
+}
+
+
+// Return input type.
+int sfm_stage_input_iq(const sfm_stage *stage)
+{
+    return (stage && stage->input_iq) ? 1 : 0;
+}
+
+
+// Return output type.
+int sfm_stage_output_iq(const sfm_stage *stage)
+{
+    return (stage && stage->output_iq) ? 1 : 0;
+}
+
+
+// Return upper bound of the output size.
+size_t sfm_stage_max_output(const sfm_stage *stage, size_t n)
+{
+    if (stage == NULL)
+        return 0;
+
+    size_t nout = size_t(ceil(n / stage->downsample)) + 1;
+    return stage->output_iq ? 2 * nout : nout;
+}
+
+
+// Process a block of samples.
+long sfm_stage_process(sfm_stage *stage, const float *in, size_t n,
+                       float *out, size_t out_size)
+{
+    if (stage == NULL || (n > 0 && (in == NULL || out == NULL)))
+        return SFM_ERR_INVALID;
+
+    if (out_size < sfm_stage_max_output(stage, n))
+        return SFM_ERR_BUFFER;
+
+    // IQ stages read the caller buffer in place (see sfm_process()).
+    // Real stages work in double precision, so their input is converted.
+    const IQSample *iqin = reinterpret_cast<const IQSample *>(in);
+
+    try {
+        if (!stage->input_iq)
+            stage->in.assign(in, in + n);
+
+        if (stage->finetuner)
+            stage->finetuner->process(iqin, n, stage->iqout);
+        else if (stage->lowpass_iq)
+            stage->lowpass_iq->process(iqin, n, stage->iqout);
+        else if (stage->discriminator)
+            stage->discriminator->process(iqin, n, stage->out);
+        else if (stage->lowpass)
+            stage->lowpass->process(stage->in, stage->out);
+        else if (stage->pilot_pll)
+            stage->pilot_pll->process(stage->in, stage->out);
+        else if (stage->deemphasis)
+            stage->deemphasis->process(stage->in, stage->out);
+        else if (stage->highpass)
+            stage->highpass->process(stage->in, stage->out);
+
+        if (stage->output_iq) {
+            std::copy(stage->iqout.begin(), stage->iqout.end(),
+                      reinterpret_cast<IQSample *>(out));
+            return stage->iqout.size();
+        } else {
+            size_t nout = stage->out.size();
+            for (size_t i = 0; i < nout; i++)
+                out[i] = stage->out[i];
+            return nout;
+        }
+    } catch (const std::bad_alloc&) {
+        return SFM_ERR_NOMEM;
+    }
+}
+
+
+// Return description of an error code.
+const char *sfm_strerror(int err)
+{
+    switch (err) {
+        case SFM_OK:            return "no error";
+        case SFM_ERR_INVALID:   return "invalid argument";
+        case SFM_ERR_BUFFER:    return "buffer too small";
+        case SFM_ERR_STATE:     return "state does not match decoder";
+        case SFM_ERR_NOMEM:     return "out of memory";
+        default:                return "unknown error";
+    }
+}
+
+/* end */
@@ -0,0 +1,360 @@
+"""
+Python bindings for the SoftFM decoder (libsoftfm, see softfm_c.h).
+
+The C++ decoder and its filter stages run on numpy arrays at native
+speed. IQ input (Decoder.process() and the FineTuner, LowPassIQ and
+Discriminator stages) is read in place if it is a contiguous complex64
+array; otherwise it is converted once. Real input (processBaseband() and
+the other stages) is converted once to double precision inside the
+library. Output is written directly into numpy arrays; pass out= to
+reuse a buffer between calls.
+
+Use as follows:
+
+    >>> import numpy, softfm
+    >>> dec = softfm.Decoder(1.0e6, 48000, tuning_offset=250.0e3, rds=True)
+    >>> iq = numpy.fromfile('capture.cf32', dtype=numpy.complex64)
+    >>> audio = dec.process(iq)                 # shape (n, 2), float32
+    >>> dec.metrics()['stereo_detected']
+
+    >>> lpf = softfm.LowPassIQ(20, 0.1, downsample=4)
+    >>> disc = softfm.Discriminator(75.0e3 / 250.0e3)
+    >>> mpx = disc.process(lpf.process(iq))
+
+The library is loaded from $SOFTFM_LIB, the directory of this module,
+a "build" subdirectory or the system library path.
+"""
+
+import ctypes
+import ctypes.util
+import os
+import numpy
+
+
+SFM_OK = 0
+SFM_ERR_BUFFER = -2
+
+
+class _Config(ctypes.Structure):
+    _fields_ = [
+        ('sample_rate_if', ctypes.c_double),
+        ('tuning_offset', ctypes.c_double),
+        ('sample_rate_pcm', ctypes.c_double),
+        ('stereo', ctypes.c_int),
+        ('deemphasis', ctypes.c_double),
+        ('bandwidth_if', ctypes.c_double),
+        ('freq_dev', ctypes.c_double),
+        ('bandwidth_pcm', ctypes.c_double),
+        ('downsample', ctypes.c_uint),
+        ('rds', ctypes.c_int) ]
+
+
+class _Metrics(ctypes.Structure):
+    _fields_ = [
+        ('if_level', ctypes.c_double),
+        ('baseband_level', ctypes.c_double),
+        ('pilot_level', ctypes.c_double),
+        ('tuning_offset', ctypes.c_double),
+        ('stereo_detected', ctypes.c_int),
+        ('squelch_open', ctypes.c_int),
+        ('rds_synced', ctypes.c_int),
+        ('rds_pi', ctypes.c_int),
+        ('rds_bler', ctypes.c_double),
+        ('rds_groups', ctypes.c_uint64),
+        ('rds_ps', ctypes.c_char * 9),
+        ('rds_rt', ctypes.c_char * 65) ]
+
+
+def _loadLibrary():
+    """Find and load libsoftfm and declare its functions."""
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    names = [ os.environ.get('SOFTFM_LIB'),
+              os.path.join(here, 'libsoftfm.so'),
+              os.path.join(here, 'build', 'libsoftfm.so'),
+              ctypes.util.find_library('softfm') ]
+
+    lib = None
+    for name in names:
+        if name and (os.path.sep not in name or os.path.exists(name)):
+            lib = ctypes.CDLL(name)
+            break
+
+    if lib is None:
+        raise ImportError('can not find libsoftfm.so (set SOFTFM_LIB)')
+
+    vp = ctypes.c_void_p
+    fp = ctypes.POINTER(ctypes.c_float)
+    sz = ctypes.c_size_t
+    lng = ctypes.c_long
+
+    decls = [
+        ('sfm_config_init', None, [ctypes.POINTER(_Config), ctypes.c_double, ctypes.c_double]),
+        ('sfm_create', vp, [ctypes.POINTER(_Config)]),
+        ('sfm_destroy', None, [vp]),
+        ('sfm_max_audio_samples', sz, [vp, sz]),
+        ('sfm_process', lng, [vp, fp, sz, fp, sz]),
+        ('sfm_process_baseband', lng, [vp, fp, sz, fp, sz]),
+        ('sfm_baseband_rate', ctypes.c_double, [vp]),
+        ('sfm_get_metrics', ctypes.c_int, [vp, ctypes.POINTER(_Metrics)]),
+        ('sfm_get_rds_events', lng, [vp, ctypes.c_char_p, sz]),
+        ('sfm_set_tuning_offset', ctypes.c_int, [vp, ctypes.c_double]),
+        ('sfm_set_stereo', ctypes.c_int, [vp, ctypes.c_int]),
+        ('sfm_set_squelch', ctypes.c_int, [vp, ctypes.c_int, ctypes.c_double]),
+        ('sfm_save_state', lng, [vp, vp, sz]),
+        ('sfm_load_state', ctypes.c_int, [vp, vp, sz]),
+        ('sfm_strerror', ctypes.c_char_p, [ctypes.c_int]),
+        ('sfm_stage_finetuner', vp, [ctypes.c_double]),
+        ('sfm_stage_lowpass_iq', vp, [ctypes.c_uint, ctypes.c_double, ctypes.c_uint]),
+        ('sfm_stage_discriminator', vp, [ctypes.c_double]),
+        ('sfm_stage_lowpass', vp, [ctypes.c_uint, ctypes.c_double, ctypes.c_double]),
+        ('sfm_stage_pilot_pll', vp, [ctypes.c_double, ctypes.c_double, ctypes.c_double]),
+        ('sfm_stage_deemphasis', vp, [ctypes.c_double]),
+        ('sfm_stage_highpass', vp, [ctypes.c_double]),
+        ('sfm_stage_destroy', None, [vp]),
+        ('sfm_stage_input_iq', ctypes.c_int, [vp]),
+        ('sfm_stage_output_iq', ctypes.c_int, [vp]),
+        ('sfm_stage_max_output', sz, [vp, sz]),
+        ('sfm_stage_process', lng, [vp, fp, sz, fp, sz]) ]
+
+    for (name, restype, argtypes) in decls:
+        f = getattr(lib, name)
+        f.restype = restype
+        f.argtypes = argtypes
+
+    return lib
+
+
+_lib = _loadLibrary()
+
+
+def _check(ret):
+    """Raise an exception for a negative error code."""
+
+    if ret < 0:
+        raise RuntimeError('softfm: ' + _lib.sfm_strerror(ret).decode())
+    return ret
+
+
+def _floatPtr(a):
+    """Return ctypes float pointer to the data of a contiguous array."""
+
+    return a.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+
+
+def _inputArray(d, iq):
+    """Return d as contiguous complex64 (iq) or float32 array, without
+    copying if it already is one."""
+
+    return numpy.ascontiguousarray(d, dtype=(numpy.complex64 if iq else numpy.float32))
+
+
+def _outputArray(out, nfloat, iq):
+    """Return a contiguous output array with room for nfloat floats."""
+
+    dtype = numpy.complex64 if iq else numpy.float32
+    nelem = (nfloat + 1) // 2 if iq else nfloat
+
+    if out is None:
+        return numpy.empty(nelem, dtype=dtype)
+
+    if (out.dtype != dtype or not out.flags['C_CONTIGUOUS'] or
+            not out.flags['WRITEABLE'] or out.size < nelem):
+        raise ValueError('out must be a contiguous %s array of at least %d elements'
+                         % (numpy.dtype(dtype).name, nelem))
+    return out.reshape(-1)
+
+
+class Decoder(object):
+    """Complete FM broadcast decoder (FmDecoder)."""
+
+    def __init__(self, sample_rate_if, sample_rate_pcm, tuning_offset=0,
+                 stereo=True, deemphasis=None, bandwidth_if=None,
+                 freq_dev=None, bandwidth_pcm=None, downsample=0, rds=False):
+        """Create decoder; None selects the broadcast FM default."""
+
+        cfg = _Config()
+        _lib.sfm_config_init(ctypes.byref(cfg), sample_rate_if, sample_rate_pcm)
+        cfg.tuning_offset = tuning_offset
+        cfg.stereo = 1 if stereo else 0
+        cfg.downsample = downsample
+        cfg.rds = 1 if rds else 0
+        if deemphasis is not None:
+            cfg.deemphasis = deemphasis
+        if bandwidth_if is not None:
+            cfg.bandwidth_if = bandwidth_if
+        if freq_dev is not None:
+            cfg.freq_dev = freq_dev
+        if bandwidth_pcm is not None:
+            cfg.bandwidth_pcm = bandwidth_pcm
+
+        self._handle = _lib.sfm_create(ctypes.byref(cfg))
+        if not self._handle:
+            raise ValueError('invalid decoder configuration')
+
+        self.channels = 2 if stereo else 1
+        self.downsample = int(round(sample_rate_if / self.basebandRate()))
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            _lib.sfm_destroy(self._handle)
+            self._handle = None
+
+    def _audio(self, out, n):
+        """Return audio view of the output buffer."""
+
+        a = out[:n]
+        return a.reshape(-1, 2) if self.channels == 2 else a
+
+    def process(self, iq, out=None):
+        """Decode IQ samples; return float32 audio (shape (n, 2) for stereo)."""
+
+        iq = _inputArray(iq, True)
+        nmax = _lib.sfm_max_audio_samples(self._handle, iq.size)
+        out = _outputArray(out, nmax, False)
+        n = _check(_lib.sfm_process(self._handle, _floatPtr(iq), iq.size,
+                                    _floatPtr(out), out.size))
+        return self._audio(out, n)
+
+    def processBaseband(self, mpx, out=None):
+        """Decode composite baseband samples at baseband_rate()."""
+
+        mpx = _inputArray(mpx, False)
+        nmax = _lib.sfm_max_audio_samples(self._handle, mpx.size * self.downsample)
+        out = _outputArray(out, nmax, False)
+        n = _check(_lib.sfm_process_baseband(self._handle, _floatPtr(mpx), mpx.size,
+                                             _floatPtr(out), out.size))
+        return self._audio(out, n)
+
+    def basebandRate(self):
+        """Return composite baseband sample rate in Hz."""
+
+        return _lib.sfm_baseband_rate(self._handle)
+
+    def metrics(self):
+        """Return signal metrics as a dict."""
+
+        m = _Metrics()
+        _check(_lib.sfm_get_metrics(self._handle, ctypes.byref(m)))
+        d = dict((name, getattr(m, name)) for (name, typ) in _Metrics._fields_)
+        d['rds_ps'] = m.rds_ps.decode('latin-1')
+        d['rds_rt'] = m.rds_rt.decode('latin-1')
+        return d
+
+    def rdsEvents(self):
+        """Return RDS events (JSON strings) of the most recent block."""
+
+        size = 4096
+        while True:
+            buf = ctypes.create_string_buffer(size)
+            n = _lib.sfm_get_rds_events(self._handle, buf, size)
+            if n != SFM_ERR_BUFFER:
+                break
+            size *= 2
+        _check(n)
+        return buf.value.decode('utf-8').splitlines()
+
+    def setTuningOffset(self, tuning_offset):
+        """Change tuning offset in Hz, keeping filter states."""
+
+        _check(_lib.sfm_set_tuning_offset(self._handle, tuning_offset))
+
+    def setStereo(self, stereo):
+        """Enable or disable stereo decoding."""
+
+        _check(_lib.sfm_set_stereo(self._handle, 1 if stereo else 0))
+
+    def setSquelch(self, level_db):
+        """Enable carrier squelch at level_db, or disable it with None."""
+
+        _check(_lib.sfm_set_squelch(self._handle, 0 if level_db is None else 1,
+                                    0 if level_db is None else level_db))
+
+    def saveState(self):
+        """Return complete decoder state as bytes."""
+
+        n = _check(_lib.sfm_save_state(self._handle, None, 0))
+        buf = ctypes.create_string_buffer(n)
+        _check(_lib.sfm_save_state(self._handle, buf, n))
+        return buf.raw
+
+    def loadState(self, state):
+        """Restore decoder state from saveState()."""
+
+        _check(_lib.sfm_load_state(self._handle, state, len(state)))
+
+
+class Stage(object):
+    """Signal processing stage; see the subclasses."""
+
+    def __init__(self, handle):
+        if not handle:
+            raise ValueError('invalid stage parameters')
+        self._handle = handle
+        self.input_iq = bool(_lib.sfm_stage_input_iq(handle))
+        self.output_iq = bool(_lib.sfm_stage_output_iq(handle))
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            _lib.sfm_stage_destroy(self._handle)
+            self._handle = None
+
+    def process(self, d, out=None):
+        """Process a block of samples and return the output samples."""
+
+        d = _inputArray(d, self.input_iq)
+        nmax = _lib.sfm_stage_max_output(self._handle, d.size)
+        out = _outputArray(out, nmax, self.output_iq)
+        nfloat = out.size * (2 if self.output_iq else 1)
+        n = _check(_lib.sfm_stage_process(self._handle, _floatPtr(d), d.size,
+                                          _floatPtr(out), nfloat))
+        return out[:n]
+
+
+class FineTuner(Stage):
+    """Shift IQ samples by freq_shift (relative to the sample rate)."""
+
+    def __init__(self, freq_shift):
+        Stage.__init__(self, _lib.sfm_stage_finetuner(freq_shift))
+
+
+class LowPassIQ(Stage):
+    """Lanczos low-pass FIR filter for IQ samples with integer decimation."""
+
+    def __init__(self, order, cutoff, downsample=1):
+        Stage.__init__(self, _lib.sfm_stage_lowpass_iq(order, cutoff, downsample))
+
+
+class Discriminator(Stage):
+    """FM discriminator; output 1.0 = max_freq_dev (relative to sample rate)."""
+
+    def __init__(self, max_freq_dev):
+        Stage.__init__(self, _lib.sfm_stage_discriminator(max_freq_dev))
+
+
+class LowPass(Stage):
+    """Lanczos low-pass FIR filter for real samples with decimation."""
+
+    def __init__(self, order, cutoff, downsample=1.0):
+        Stage.__init__(self, _lib.sfm_stage_lowpass(order, cutoff, downsample))
+
+
+class PilotPLL(Stage):
+    """Stereo pilot PLL; returns the phase-locked 38 kHz tone."""
+
+    def __init__(self, freq, bandwidth, minsignal=0.01):
+        Stage.__init__(self, _lib.sfm_stage_pilot_pll(freq, bandwidth, minsignal))
+
+
+class Deemphasis(Stage):
+    """First order low-pass with time constant in samples."""
+
+    def __init__(self, timeconst):
+        Stage.__init__(self, _lib.sfm_stage_deemphasis(timeconst))
+
+
+class HighPass(Stage):
+    """Second order Butterworth high-pass (relative cutoff)."""
+
+    def __init__(self, cutoff):
+        Stage.__init__(self, _lib.sfm_stage_highpass(cutoff))